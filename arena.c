@@ -0,0 +1,82 @@
+/**
+ * @file arena.c
+ * @brief Bump allocator for state that lives as long as a request
+ */
+
+#include "arena.h"
+#include "csapp.h"
+
+#include <string.h>
+
+/* Every allocation is aligned for any type, as strictly as this */
+typedef union {
+    long long ll;
+    long double ld;
+    void *p;
+    void (*f)(void);
+} align_t;
+#define ALIGN sizeof(align_t)
+
+struct arena_chunk {
+    arena_chunk_t *next; // Next chunk in order of use
+    size_t size;         // Bytes in data
+    align_t data[];      // The memory handed out
+};
+
+void arena_init(arena_t *a) {
+    a->first = a->current = NULL;
+    a->used = 0;
+}
+
+/*
+ * arena_grow - Make current a chunk with at least size bytes free, reusing
+ *     the next chunk if it is large enough and inserting a new one if not.
+ */
+static void arena_grow(arena_t *a, size_t size) {
+    arena_chunk_t *next = a->current != NULL ? a->current->next : a->first;
+
+    if (next == NULL || next->size < size) {
+        size_t bytes = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        arena_chunk_t *c = Malloc(sizeof(arena_chunk_t) + bytes);
+        c->size = bytes;
+        c->next = next;
+        if (a->current != NULL) {
+            a->current->next = c;
+        } else {
+            a->first = c;
+        }
+        next = c;
+    }
+    a->current = next;
+    a->used = 0;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+    if (a->current == NULL || a->current->size - a->used < size) {
+        arena_grow(a, size);
+    }
+    void *p = (char *)a->current->data + a->used;
+    a->used += size;
+    return p;
+}
+
+void *arena_calloc(arena_t *a, size_t size) {
+    return memset(arena_alloc(a, size), 0, size);
+}
+
+void arena_reset(arena_t *a) {
+    a->current = a->first;
+    a->used = 0;
+}
+
+void arena_destroy(arena_t *a) {
+    arena_chunk_t *c = a->first;
+
+    while (c != NULL) {
+        arena_chunk_t *next = c->next;
+        Free(c);
+        c = next;
+    }
+    arena_init(a);
+}
@@ -0,0 +1,85 @@
+/**
+ * @file arena.h
+ * @brief Bump allocator for state that lives as long as a request
+ *
+ * The thread serving a connection allocates its requests from its own
+ * arena and resets the arena whenever none of them is in flight. An
+ * allocation moves a pointer along the current chunk; when the chunk runs
+ * out, the next one is used, or allocated if there is none. Resetting keeps
+ * every chunk, so once a connection has seen its largest burst of requests
+ * it never calls malloc() again. Nothing is freed on its own.
+ *
+ *     arena_t a;
+ *     arena_init(&a);
+ *     req = arena_calloc(&a, sizeof(*req));
+ *     ...once nothing allocated is in use:
+ *     arena_reset(&a);
+ *     ...
+ *     arena_destroy(&a);
+ *
+ * An arena is not thread safe: only its owner allocates and resets it,
+ * though other threads may use what it allocated until the next reset.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_CHUNK (64 * 1024) // Usual size of a chunk
+
+typedef struct arena_chunk arena_chunk_t;
+
+/**
+ * @brief An arena
+ */
+typedef struct {
+    arena_chunk_t *first;   /**< the chunks, in order of use */
+    arena_chunk_t *current; /**< the chunk being allocated from */
+    size_t used;            /**< bytes of it allocated */
+} arena_t;
+
+/**
+ * @brief Prepare an empty arena; no memory is allocated until needed
+ *
+ * @param[in] a The arena
+ */
+void arena_init(arena_t *a);
+
+/**
+ * @brief Allocate memory for any type, as malloc() would
+ *
+ * Exits, like Malloc(), if no more memory can be had.
+ *
+ * @param[in] a The arena
+ * @param[in] size The number of bytes
+ *
+ * @return The memory, valid until the next reset
+ */
+void *arena_alloc(arena_t *a, size_t size);
+
+/**
+ * @brief Allocate zeroed memory, as calloc() would
+ *
+ * @param[in] a The arena
+ * @param[in] size The number of bytes
+ *
+ * @return The memory, valid until the next reset
+ */
+void *arena_calloc(arena_t *a, size_t size);
+
+/**
+ * @brief Make all of an arena's memory available again, keeping it
+ *
+ * @param[in] a The arena
+ */
+void arena_reset(arena_t *a);
+
+/**
+ * @brief Give an arena's memory back to the system
+ *
+ * @param[in] a The arena
+ */
+void arena_destroy(arena_t *a);
+
+#endif /* __ARENA_H__ */
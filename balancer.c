@@ -0,0 +1,161 @@
+/**
+ * @file balancer.c
+ * @brief Backend selection within a pool
+ */
+
+#include "balancer.h"
+#include "csapp.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+static const char *lb_names[LB_KINDS] = {"round_robin", "least_outstanding",
+                                         "p2c", "peak_ewma"};
+
+/* Per-thread xorshift state, so random choices take no lock */
+static __thread uint32_t rng_state;
+
+static uint32_t rng_next(void) {
+    uint32_t x = rng_state;
+    if (x == 0) {
+        x = (uint32_t)balancer_now_ns() ^ (uint32_t)(uintptr_t)&rng_state;
+        x |= 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+uint64_t balancer_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+int balancer_parse(const char *name, lb_kind *kind) {
+    for (int k = 0; k < LB_KINDS; k++) {
+        if (strcmp(name, lb_names[k]) == 0) {
+            *kind = k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void balancer_init(balancer_t *b, lb_kind kind, int nbackends) {
+    b->kind = kind;
+    b->nbackends = nbackends;
+    b->stats = Calloc((size_t)nbackends, sizeof(lb_stats_t));
+    b->next = 0;
+}
+
+static unsigned outstanding(const lb_stats_t *s) {
+    return __atomic_load_n(&s->outstanding, __ATOMIC_RELAXED);
+}
+
+/* decay - Weight of an average last updated elapsed_ns ago */
+static double decay(uint64_t elapsed_ns) {
+    return exp(-(double)elapsed_ns / (LB_DECAY_MS * 1e6));
+}
+
+/*
+ * ewma_cost - Expected latency of one more request. Idle time decays the
+ *     average towards zero, so a backend that was slow gets retried. A
+ *     backend busy with its first requests is charged the penalty, so it
+ *     is not flooded before its latency is known.
+ */
+static double ewma_cost(const lb_stats_t *s, uint64_t now) {
+    uint64_t ewma = __atomic_load_n(&s->ewma_ns, __ATOMIC_RELAXED);
+    uint64_t stamp = __atomic_load_n(&s->stamp_ns, __ATOMIC_RELAXED);
+    unsigned busy = outstanding(s);
+
+    if (ewma == 0 && busy > 0) {
+        return LB_PENALTY_MS * 1e6 * busy;
+    }
+    double cost = (double)ewma * decay(now > stamp ? now - stamp : 0);
+    return cost * (busy + 1);
+}
+
+/* two_random - Two distinct backends chosen at random */
+static void two_random(const balancer_t *b, int *i, int *j) {
+    *i = (int)(rng_next() % (uint32_t)b->nbackends);
+    *j = (int)(rng_next() % (uint32_t)(b->nbackends - 1));
+    if (*j >= *i) {
+        (*j)++;
+    }
+}
+
+static int pick(balancer_t *b) {
+    int n = b->nbackends, i, j;
+
+    if (n == 1) {
+        return 0;
+    }
+    switch (b->kind) {
+    case LB_LEAST_OUTSTANDING: {
+        /* Start the scan at a rotating offset so ties are spread out */
+        int start = (int)(__atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED) %
+                          (unsigned)n);
+        int best = start;
+        for (int k = 1; k < n; k++) {
+            i = (start + k) % n;
+            if (outstanding(&b->stats[i]) < outstanding(&b->stats[best])) {
+                best = i;
+            }
+        }
+        return best;
+    }
+    case LB_P2C:
+        two_random(b, &i, &j);
+        return outstanding(&b->stats[j]) < outstanding(&b->stats[i]) ? j : i;
+    case LB_PEAK_EWMA: {
+        uint64_t now = balancer_now_ns();
+        two_random(b, &i, &j);
+        return ewma_cost(&b->stats[j], now) < ewma_cost(&b->stats[i], now)
+                   ? j
+                   : i;
+    }
+    default:
+        return (int)(__atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED) %
+                     (unsigned)n);
+    }
+}
+
+int balancer_pick(balancer_t *b) {
+    int i = pick(b);
+    __atomic_fetch_add(&b->stats[i].outstanding, 1, __ATOMIC_RELAXED);
+    return i;
+}
+
+void balancer_cancel(balancer_t *b, int i) {
+    __atomic_fetch_sub(&b->stats[i].outstanding, 1, __ATOMIC_RELAXED);
+}
+
+void balancer_done(balancer_t *b, int i, uint64_t elapsed_ns, bool ok) {
+    lb_stats_t *s = &b->stats[i];
+
+    __atomic_fetch_sub(&s->outstanding, 1, __ATOMIC_RELAXED);
+    if (b->kind != LB_PEAK_EWMA) {
+        return;
+    }
+
+    uint64_t rtt = elapsed_ns;
+    if (!ok && rtt < (uint64_t)LB_PENALTY_MS * 1000000) {
+        rtt = (uint64_t)LB_PENALTY_MS * 1000000;
+    }
+
+    /* Jump to a slower observation, otherwise fold it into the average */
+    uint64_t now = balancer_now_ns();
+    uint64_t stamp = __atomic_exchange_n(&s->stamp_ns, now, __ATOMIC_RELAXED);
+    double w = decay(now > stamp ? now - stamp : 0);
+    uint64_t old = __atomic_load_n(&s->ewma_ns, __ATOMIC_RELAXED);
+    uint64_t ewma;
+    do {
+        ewma = rtt > old ? rtt : (uint64_t)(old * w + rtt * (1 - w));
+    } while (!__atomic_compare_exchange_n(&s->ewma_ns, &old, ewma, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,113 @@
+/**
+ * @file balancer.h
+ * @brief Backend selection within a pool
+ *
+ * Each pool in the routing table picks a backend for every request with one
+ * of these algorithms:
+ *
+ * - round_robin: each backend in turn.
+ * - least_outstanding: the backend with the fewest requests in flight.
+ * - p2c: the less loaded of two backends chosen at random ("power of two
+ *   choices"); nearly as good as least_outstanding without a full scan.
+ * - peak_ewma: the lowest expected latency, taken as a moving average of
+ *   response times that jumps straight to any slower observation and then
+ *   decays, multiplied by the requests in flight. Of two random backends
+ *   the cheaper one is chosen.
+ *
+ * The per-backend counters are only ever updated atomically, so selection
+ * takes no lock.
+ */
+
+#ifndef __BALANCER_H__
+#define __BALANCER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LB_DECAY_MS 10000   // Time constant of the peak-EWMA average
+#define LB_PENALTY_MS 1000  // Latency charged for a failed request
+
+/**
+ * @brief The balancing algorithms
+ */
+typedef enum {
+    LB_ROUND_ROBIN,
+    LB_LEAST_OUTSTANDING,
+    LB_P2C,
+    LB_PEAK_EWMA,
+    LB_KINDS
+} lb_kind;
+
+/**
+ * @brief Load and latency counters of one backend
+ */
+typedef struct {
+    unsigned outstanding; /**< requests in flight */
+    uint64_t ewma_ns;     /**< peak-EWMA response time */
+    uint64_t stamp_ns;    /**< when ewma_ns was last updated */
+} lb_stats_t;
+
+/**
+ * @brief A balancer over the backends of one pool
+ */
+typedef struct {
+    lb_kind kind;      /**< algorithm */
+    int nbackends;     /**< number of backends */
+    lb_stats_t *stats; /**< counters, one per backend */
+    unsigned next;     /**< round-robin position */
+} balancer_t;
+
+/**
+ * @brief Look up an algorithm by name
+ *
+ * @param[in] name e.g. "p2c"
+ * @param[out] kind The algorithm
+ *
+ * @return 0 on success, -1 if the name is unknown
+ */
+int balancer_parse(const char *name, lb_kind *kind);
+
+/**
+ * @brief Set up a balancer with zeroed counters
+ *
+ * @param[in] b The balancer
+ * @param[in] kind The algorithm
+ * @param[in] nbackends The number of backends
+ */
+void balancer_init(balancer_t *b, lb_kind kind, int nbackends);
+
+/**
+ * @brief Choose a backend and count a request in flight on it
+ *
+ * @param[in] b The balancer
+ *
+ * @return The index of the backend; pass it to balancer_done()
+ */
+int balancer_pick(balancer_t *b);
+
+/**
+ * @brief Finish a request started with balancer_pick()
+ *
+ * @param[in] b The balancer
+ * @param[in] i The backend
+ * @param[in] elapsed_ns How long the request took
+ * @param[in] ok false if the backend failed; charged as LB_PENALTY_MS
+ */
+void balancer_done(balancer_t *b, int i, uint64_t elapsed_ns, bool ok);
+
+/**
+ * @brief Take back a balancer_pick() whose request was never sent
+ *
+ * @param[in] b The balancer
+ * @param[in] i The backend
+ */
+void balancer_cancel(balancer_t *b, int i);
+
+/**
+ * @brief Monotonic clock for timing requests
+ *
+ * @return Nanoseconds since an arbitrary point
+ */
+uint64_t balancer_now_ns(void);
+
+#endif /* __BALANCER_H__ */
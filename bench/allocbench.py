@@ -0,0 +1,105 @@
+#!/usr/bin/python2
+
+# Allocation benchmark
+#
+# Sends GETs for a small page of tiny's over one keep-alive connection,
+# one at a time and then pipelined in bursts, with bench/alloccount.so
+# preloaded into the proxy, and reports the heap allocations the proxy
+# made per request once warmed up. Run from the top of the tree after
+# building proxy, tiny and the bench directory; -x runs another build,
+# e.g. one of an older revision, for comparison.
+
+import sys
+import getopt
+import os
+import signal
+import socket
+import time
+
+from benchlib import *
+
+def usage(name):
+    print "Usage: %s [-h] [-n REQUESTS] [-b BURST] [-p PORT] [-x PROXY]" % name
+    print "  -h           Print this message"
+    print "  -n REQUESTS  Requests per run (default 500)"
+    print "  -b BURST     Requests per pipelined burst (default 8)"
+    print "  -p PORT      First port to use (default 16700)"
+    print "  -x PROXY     Proxy binary (default ./proxy)"
+    sys.exit(0)
+
+# Ask the preloaded counter for the total so far
+def allocations(proxy):
+    proxy.send_signal(signal.SIGUSR2)
+    time.sleep(0.2)
+    proxy.log.seek(0)
+    count = None
+    for line in proxy.log.read().splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[0] == "allocations":
+            count = int(fields[1])
+    if count is None:
+        raise Exception("No count from the proxy; is alloccount.so built?")
+    return count
+
+# Send requests GETs in bursts of burst, reading each burst's responses
+def fetch(sock, tinyPort, requests, burst):
+    request = ("GET http://127.0.0.1:%d/home.html HTTP/1.1\r\n"
+               "Host: 127.0.0.1\r\n\r\n" % tinyPort)
+    buf = ""
+    sent = 0
+    while sent < requests:
+        n = min(burst, requests - sent)
+        sock.sendall(request * n)
+        sent += n
+        while buf.count("</html>") < n:
+            data = sock.recv(65536)
+            if not data:
+                raise Exception("Connection closed: %r" % buf[:60])
+            buf += data
+        buf = buf[buf.rfind("</html>") + len("</html>"):]
+
+def main(name, args):
+    requests = 500
+    burst = 8
+    port = 16700
+    binary = "./proxy"
+    try:
+        opts, args = getopt.getopt(args, "hn:b:p:x:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-n':
+            requests = int(val)
+        elif opt == '-b':
+            burst = int(val)
+        elif opt == '-p':
+            port = int(val)
+        elif opt == '-x':
+            binary = val
+
+    tinyPort = port + 1
+    tiny = startTiny(tinyPort)
+    env = dict(os.environ)
+    env["LD_PRELOAD"] = os.path.abspath("bench/alloccount.so")
+    proxy = startProxy(port, [], binary, env)
+    try:
+        print "%-10s %10s %12s %16s" % ("way", "requests", "allocations",
+                                        "per request")
+        for (way, size) in [("serial", 1), ("pipelined", burst)]:
+            sock = socket.create_connection(("127.0.0.1", port))
+            fetch(sock, tinyPort, 100, size)
+            before = allocations(proxy)
+            fetch(sock, tinyPort, requests, size)
+            count = allocations(proxy) - before
+            sock.close()
+            print "%-10s %10d %12d %16.2f" % (way, requests, count,
+                                              float(count) / requests)
+    finally:
+        stopProxy(proxy)
+        tiny.terminate()
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
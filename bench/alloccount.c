@@ -0,0 +1,83 @@
+/*
+ * alloccount - Count a process's heap allocations, for allocbench.py.
+ *
+ * Preloaded (LD_PRELOAD=bench/alloccount.so), it counts every call to
+ * malloc(), calloc(), realloc(), posix_memalign() and aligned_alloc(),
+ * and writes the total to stderr as "allocations N" each time SIGUSR2
+ * arrives. The calls are passed on to glibc's own allocator.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static unsigned long allocations;
+
+static void count(void) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    count();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count();
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    count();
+    return (*memptr = __libc_memalign(alignment, size)) == NULL ? 12 : 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count();
+    return __libc_memalign(alignment, size);
+}
+
+/* report - Write the count, with nothing but write(), from the handler */
+static void report(int sig) {
+    char buf[64] = "allocations ";
+    size_t len = strlen(buf);
+    unsigned long n = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    char digits[24];
+    size_t nd = 0;
+
+    (void)sig;
+    do {
+        digits[nd++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    while (nd > 0) {
+        buf[len++] = digits[--nd];
+    }
+    buf[len++] = '\n';
+    if (write(STDERR_FILENO, buf, len) < 0) {
+        return;
+    }
+}
+
+__attribute__((constructor)) static void install(void) {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = report;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &action, NULL);
+}
@@ -0,0 +1,147 @@
+# Helpers shared by the benchmarks: backends, a delaying relay, a closed
+# loop load generator and percentiles.
+
+import os
+import random
+import signal
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+
+def waitPort(port):
+    for i in range(100):
+        try:
+            socket.create_connection(("127.0.0.1", port)).close()
+            return
+        except socket.error:
+            time.sleep(0.05)
+    raise Exception("Nothing listening on port %d" % port)
+
+def readAll(sock):
+    chunks = []
+    while True:
+        data = sock.recv(65536)
+        if not data:
+            return "".join(chunks)
+        chunks.append(data)
+
+def startTiny(port):
+    devnull = open(os.devnull, "w")
+    tiny = subprocess.Popen(["./tiny", str(port)], cwd = "tiny",
+                            stdout = devnull, stderr = devnull)
+    waitPort(port)
+    return tiny
+
+def startProxy(port, args, binary = "./proxy", env = None):
+    devnull = open(os.devnull, "w")
+    log = tempfile.TemporaryFile()
+    proxy = subprocess.Popen([binary] + args + [str(port)],
+                             stdout = devnull, stderr = log, env = env)
+    proxy.log = log
+    waitPort(port)
+    return proxy
+
+# Stop the proxy and return its metrics, dumped on SIGUSR1
+def stopProxy(proxy):
+    proxy.send_signal(signal.SIGUSR1)
+    time.sleep(0.2)
+    proxy.terminate()
+    proxy.wait()
+    metrics = {}
+    proxy.log.seek(0)
+    for line in proxy.log.read().splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[1].isdigit():
+            metrics[fields[0]] = int(fields[1])
+    proxy.log.close()
+    return metrics
+
+# Relay connections from listenPort to port, sleeping delay() seconds
+# before forwarding each request. Counts the requests that were delayed.
+class SlowRelay:
+    def __init__(self, listenPort, port, delay):
+        self.port = port
+        self.delay = delay
+        self.slowed = 0
+        self.lsock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.lsock.bind(("127.0.0.1", listenPort))
+        self.lsock.listen(128)
+        t = threading.Thread(target = self.loop)
+        t.daemon = True
+        t.start()
+
+    def loop(self):
+        while True:
+            csock, addr = self.lsock.accept()
+            t = threading.Thread(target = self.serve, args = (csock,))
+            t.daemon = True
+            t.start()
+
+    def serve(self, csock):
+        request = ""
+        while "\r\n\r\n" not in request:
+            data = csock.recv(4096)
+            if not data:
+                break
+            request += data
+        seconds = self.delay()
+        if seconds > 0:
+            self.slowed += 1
+            time.sleep(seconds)
+        try:
+            ssock = socket.create_connection(("127.0.0.1", self.port))
+            ssock.sendall(request)
+            csock.sendall(readAll(ssock))
+            ssock.close()
+        except socket.error:
+            pass
+        csock.close()
+
+def constantDelay(seconds):
+    return lambda: seconds
+
+def randomDelay(fraction, seconds):
+    return lambda: seconds if random.random() < fraction else 0
+
+# Run clients closed loop clients, each sending count requests for path
+# through the proxy; returns the sorted latencies and the request rate.
+def load(port, clients, count, path = "/home.html"):
+    latencies = []
+    lock = threading.Lock()
+    def client():
+        mine = []
+        for i in range(count):
+            start = time.time()
+            sock = socket.create_connection(("127.0.0.1", port))
+            sock.sendall("GET %s HTTP/1.0\r\nHost: bench\r\n\r\n" % path)
+            response = readAll(sock)
+            sock.close()
+            if not response.startswith("HTTP/1.0 200"):
+                print "Bad response: %r" % response[:40]
+            mine.append(time.time() - start)
+        with lock:
+            latencies.extend(mine)
+    threads = [threading.Thread(target = client) for i in range(clients)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+    latencies.sort()
+    return latencies, len(latencies) / elapsed
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+def writeRoutes(backendPorts, algorithm):
+    conf = "/tmp/bench-%d.conf" % os.getpid()
+    with open(conf, "w") as f:
+        f.write("pool bench %s\n" %
+                " ".join(["127.0.0.1:%d" % p for p in backendPorts]))
+        f.write("balance bench %s\n" % algorithm)
+        f.write("route * / bench\n")
+    return conf
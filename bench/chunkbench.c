@@ -0,0 +1,101 @@
+/*
+ * chunkbench - Throughput of the chunked codec.
+ *
+ * Encodes a body with chunks of each size, then decodes it from reads of
+ * each size, so that chunk headers and CRLFs land at every kind of split.
+ * Reports MB of body per second.
+ */
+
+#include "chunked.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BODY_SIZE (16 * 1024 * 1024)
+#define ROUNDS 8
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* encode - Frame body in chunks of chunk bytes; returns the encoded size */
+static size_t encode(char *out, const char *body, size_t len, size_t chunk) {
+    size_t n = 0;
+
+    for (size_t off = 0; off < len; off += chunk) {
+        size_t c = len - off < chunk ? len - off : chunk;
+        n += chunk_header(out + n, c);
+        memcpy(out + n, body + off, c);
+        n += c;
+        memcpy(out + n, CHUNK_CRLF, 2);
+        n += 2;
+    }
+    memcpy(out + n, CHUNK_LAST, strlen(CHUNK_LAST));
+    return n + strlen(CHUNK_LAST);
+}
+
+/* decode - Decode in reads of read bytes; returns the body size */
+static size_t decode(const char *in, size_t len, size_t read) {
+    chunk_decoder_t d;
+    chunk_status st = CHUNK_MORE;
+    size_t total = 0;
+
+    chunk_decoder_init(&d);
+    for (size_t off = 0; off < len && st != CHUNK_DONE; off += read) {
+        const char *p = in + off, *data;
+        const char *end = p + (len - off < read ? len - off : read);
+        size_t n;
+        while ((st = chunk_decode(&d, &p, end, &data, &n)) == CHUNK_DATA) {
+            total += n;
+        }
+        if (st == CHUNK_ERROR) {
+            fprintf(stderr, "decode error\n");
+            exit(1);
+        }
+    }
+    return total;
+}
+
+int main(void) {
+    static const size_t chunks[] = {16, 256, 4096, 65536};
+    static const size_t reads[] = {1000, 8192, 65536};
+    char *body = malloc(BODY_SIZE);
+    char *encoded = malloc(BODY_SIZE * 2 + 64);
+
+    if (body == NULL || encoded == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < BODY_SIZE; i++) {
+        body[i] = (char)('a' + i % 26);
+    }
+
+    printf("%8s %8s %12s %12s\n", "chunk", "read", "encode MB/s",
+           "decode MB/s");
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        size_t len = 0;
+        double start = now();
+        for (int r = 0; r < ROUNDS; r++) {
+            len = encode(encoded, body, BODY_SIZE, chunks[c]);
+        }
+        double enc = ROUNDS * (BODY_SIZE / 1e6) / (now() - start);
+
+        for (size_t r = 0; r < sizeof(reads) / sizeof(reads[0]); r++) {
+            start = now();
+            for (int i = 0; i < ROUNDS; i++) {
+                if (decode(encoded, len, reads[r]) != BODY_SIZE) {
+                    fprintf(stderr, "short body\n");
+                    return 1;
+                }
+            }
+            double dec = ROUNDS * (BODY_SIZE / 1e6) / (now() - start);
+            printf("%8zu %8zu %12.0f %12.0f\n", chunks[c], reads[r], enc, dec);
+        }
+    }
+    free(body);
+    free(encoded);
+    return 0;
+}
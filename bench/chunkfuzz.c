@@ -0,0 +1,152 @@
+/*
+ * chunkfuzz - Fuzzing for the chunked decoder.
+ *
+ * Any input is decoded whole and again split at every possible point; the
+ * two must agree, and nothing may be read outside the input. Built with
+ * -DLIBFUZZER this is a libFuzzer target. Otherwise it runs random round
+ * trips: a random body is encoded with random chunk sizes, extensions,
+ * trailers and bare LFs, then decoded from random splits and compared,
+ * and every encoding is also fed to the fuzz target mutated.
+ *
+ *     chunkfuzz [iterations] [seed]
+ */
+
+#include "chunked.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BODY 4096
+#define MAX_ENCODED (MAX_BODY * 8 + 1024)
+
+/*
+ * decode - Decode in pieces ending at the given split points. Returns the
+ *     final status, with the body in out and where decoding stopped in
+ *     *stop.
+ */
+static chunk_status decode(const char *in, size_t len, const size_t *splits,
+                           int nsplits, char *out, size_t *outlen,
+                           size_t *stop) {
+    chunk_decoder_t d;
+    chunk_status st = CHUNK_MORE;
+    const char *p = in;
+
+    chunk_decoder_init(&d);
+    *outlen = 0;
+    for (int i = 0; i <= nsplits && st == CHUNK_MORE; i++) {
+        const char *end = in + (i < nsplits ? splits[i] : len);
+        const char *data;
+        size_t n;
+        if (end < p) {
+            continue;
+        }
+        while ((st = chunk_decode(&d, &p, end, &data, &n)) == CHUNK_DATA) {
+            if (data < in || data + n > end) {
+                abort();
+            }
+            memcpy(out + *outlen, data, n);
+            *outlen += n;
+        }
+    }
+    *stop = (size_t)(p - in);
+    return st;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t len) {
+    static char whole[1 << 20], split[1 << 20];
+    const char *in = (const char *)input;
+    size_t wlen, slen, wstop, sstop;
+
+    if (len > sizeof(whole)) {
+        return 0;
+    }
+    chunk_status w = decode(in, len, NULL, 0, whole, &wlen, &wstop);
+    for (size_t at = 0; at <= len; at++) {
+        chunk_status s = decode(in, len, &at, 1, split, &slen, &sstop);
+        if (s != w || slen != wlen || sstop != wstop ||
+            memcmp(whole, split, wlen) != 0) {
+            fprintf(stderr, "split at %zu changes the result\n", at);
+            abort();
+        }
+    }
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+/* encode - Randomly framed encoding of body */
+static size_t encode(char *out, const char *body, size_t len) {
+    const char *eol = rand() % 8 == 0 ? "\n" : "\r\n";
+    size_t n = 0, off = 0;
+
+    while (off < len) {
+        size_t c = 1 + (size_t)rand() % (len - off < 300 ? len - off : 300);
+        if (rand() % 4 == 0) {
+            n += (size_t)sprintf(out + n, "%zX;ext=\"v\"%s", c, eol);
+        } else {
+            n += chunk_header(out + n, c);
+        }
+        memcpy(out + n, body + off, c);
+        n += c;
+        n += (size_t)sprintf(out + n, "%s", eol);
+        off += c;
+    }
+    n += (size_t)sprintf(out + n, "0%s", eol);
+    if (rand() % 3 == 0) {
+        n += (size_t)sprintf(out + n, "X-Trailer: %d%s", rand(), eol);
+    }
+    n += (size_t)sprintf(out + n, "%s", eol);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    static char body[MAX_BODY], encoded[MAX_ENCODED + 16], out[MAX_ENCODED];
+    long iterations = argc > 1 ? atol(argv[1]) : 10000;
+    unsigned seed = argc > 2 ? (unsigned)atol(argv[2]) : 1;
+
+    srand(seed);
+    for (long it = 0; it < iterations; it++) {
+        size_t len = (size_t)rand() % MAX_BODY;
+        for (size_t i = 0; i < len; i++) {
+            body[i] = (char)rand();
+        }
+        size_t elen = encode(encoded, body, len);
+
+        /* Trailing bytes belong to the next message */
+        memcpy(encoded + elen, "GET / ", 6);
+
+        size_t splits[8];
+        int nsplits = rand() % 8;
+        for (int i = 0; i < nsplits; i++) {
+            splits[i] = (size_t)rand() % (elen + 1);
+        }
+        for (int i = 1; i < nsplits; i++) {
+            for (int j = i; j > 0 && splits[j - 1] > splits[j]; j--) {
+                size_t t = splits[j];
+                splits[j] = splits[j - 1];
+                splits[j - 1] = t;
+            }
+        }
+
+        size_t outlen, stop;
+        chunk_status st =
+            decode(encoded, elen + 6, splits, nsplits, out, &outlen, &stop);
+        if (st != CHUNK_DONE || stop != elen || outlen != len ||
+            memcmp(out, body, len) != 0) {
+            fprintf(stderr, "round trip %ld failed (seed %u)\n", it, seed);
+            return 1;
+        }
+
+        /* Mutated encodings must not crash or depend on splitting */
+        for (int i = 0; i < 4; i++) {
+            encoded[(size_t)rand() % elen] = (char)rand();
+        }
+        LLVMFuzzerTestOneInput((const uint8_t *)encoded, elen);
+    }
+    printf("%ld round trips ok\n", iterations);
+    return 0;
+}
+
+#endif /* LIBFUZZER */
@@ -0,0 +1,148 @@
+/*
+ * gzipbench - What each gzip level costs in CPU and saves in bandwidth.
+ *
+ * Compresses a text corpus at every level, through gzip.c in reads the
+ * size of the proxy's, with the proxy's bounded deflate state and with
+ * zlib's defaults. Reports the compression ratio, MB of input per second
+ * and the link speed below which compressing pays for itself: the bytes
+ * saved divided by the time spent compressing them. The corpus is the
+ * files named on the command line, by default the proxy's own sources
+ * (run from bench/).
+ */
+
+#include "gzip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define READ_SIZE 8192
+#define OUT_SIZE (100 * 1024)
+#define MIN_SECONDS 0.5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* load - Append a file to the corpus */
+static char *load(char *corpus, size_t *len, const char *path) {
+    FILE *f = fopen(path, "rb");
+    char buf[65536];
+    size_t n;
+
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if ((corpus = realloc(corpus, *len + n)) == NULL) {
+            exit(1);
+        }
+        memcpy(corpus + *len, buf, n);
+        *len += n;
+    }
+    fclose(f);
+    return corpus;
+}
+
+/* through_gzip - Compress like relay_gzip() does; returns the output size */
+static size_t through_gzip(const char *corpus, size_t len, char *out) {
+    gzip_t g;
+    size_t total = 0, off = 0;
+
+    if (gzip_init(&g) < 0) {
+        exit(1);
+    }
+    while (!gzip_done(&g)) {
+        size_t n = len - off < READ_SIZE ? len - off : READ_SIZE;
+        const char *in = corpus + off;
+        off += n;
+        do {
+            total += gzip_deflate(&g, &in, &n, out, OUT_SIZE, off == len);
+        } while (n > 0 || (off == len && !gzip_done(&g)));
+    }
+    gzip_end(&g);
+    return total;
+}
+
+/* through_zlib - Compress in one go with zlib's default window and memory */
+static size_t through_zlib(const char *corpus, size_t len, char *out,
+                           int level) {
+    z_stream z;
+    size_t total = 0;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        exit(1);
+    }
+    z.next_in = (Bytef *)corpus;
+    z.avail_in = (uInt)len;
+    do {
+        z.next_out = (Bytef *)out;
+        z.avail_out = OUT_SIZE;
+        deflate(&z, Z_FINISH);
+        total += OUT_SIZE - z.avail_out;
+    } while (z.avail_out == 0);
+    deflateEnd(&z);
+    return total;
+}
+
+/* report - Time one way of compressing and print its line */
+static void report(const char *state, int level, const char *corpus,
+                   size_t len, char *out, bool bounded) {
+    size_t size = 0;
+    int rounds = 0;
+    double start = now(), elapsed;
+
+    do {
+        size = bounded ? through_gzip(corpus, len, out)
+                       : through_zlib(corpus, len, out, level);
+        rounds++;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    elapsed /= rounds;
+
+    /* Worth it on links slower than the rate at which bytes are saved */
+    double saved_mbit = (double)(len - size) * 8 / 1e6 / elapsed;
+    printf("%-8s %5d %7.3f %10.1f %14.0f\n", state, level,
+           (double)size / len, len / 1e6 / elapsed, saved_mbit);
+}
+
+int main(int argc, char **argv) {
+    static const char *defaults[] = {"../proxy.c", "../h2.c", "../hpack.c",
+                                     "../README.md"};
+    char *corpus = NULL, *out = malloc(OUT_SIZE);
+    size_t len = 0;
+
+    if (out == NULL) {
+        return 1;
+    }
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            corpus = load(corpus, &len, argv[i]);
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+            corpus = load(corpus, &len, defaults[i]);
+        }
+    }
+
+    printf("corpus %zu bytes; deflate state %d KB bounded, %d KB default\n",
+           len,
+           ((1 << (GZIP_WINDOW_BITS + 2)) + (1 << (GZIP_MEM_LEVEL + 9))) /
+               1024,
+           ((1 << (15 + 2)) + (1 << (8 + 9))) / 1024);
+    printf("%-8s %5s %7s %10s %14s\n", "state", "level", "ratio", "MB/s",
+           "break-even Mb/s");
+    for (int level = 1; level <= 9; level++) {
+        gzip_configure(level);
+        report("bounded", level, corpus, len, out, true);
+        report("default", level, corpus, len, out, false);
+    }
+    free(corpus);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,196 @@
+#!/usr/bin/python2
+
+# HTTP/2 frontend benchmark
+#
+# Fetches many small objects from tiny through the proxy two ways: over
+# HTTP/1.0, one connection per request, with N clients at once; and over
+# a single h2c connection with up to N streams in flight. Reports request
+# rates, latency percentiles and how many connections each way took. Run
+# from the top of the tree after building proxy and tiny.
+#
+# The HTTP/2 client here only understands what the proxy sends: header
+# fields are literals or static table entries, never Huffman coded.
+
+import sys
+import getopt
+import socket
+import struct
+import time
+
+from benchlib import *
+
+PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+DATA, HEADERS, RST_STREAM, SETTINGS, PING, GOAWAY = 0, 1, 3, 4, 6, 7
+END_STREAM, END_HEADERS, ACK = 0x1, 0x4, 0x1
+MAX_WINDOW = (1 << 31) - 1
+
+# :status values of the static table, indices 8 to 14
+STATIC_STATUS = {8: 200, 9: 204, 10: 206, 11: 304, 12: 400, 13: 404,
+                 14: 500}
+
+def usage(name):
+    print "Usage: %s [-h] [-n REQUESTS] [-c N] [-p PORT]" % name
+    print "  -h           Print this message"
+    print "  -n REQUESTS  Requests per run (default 5000)"
+    print "  -c N         Largest number of clients or streams (default 16)"
+    print "  -p PORT      First port to use (default 16600)"
+    sys.exit(0)
+
+def frame(type, flags, stream, payload):
+    return struct.pack(">I", len(payload))[1:] + struct.pack(
+        ">BBI", type, flags, stream) + payload
+
+def literal(index, value):
+    # Literal without indexing, indexed name, short raw value
+    return chr(index) + chr(len(value)) + value
+
+def decodeStatus(block):
+    first = ord(block[0])
+    if first & 0x80:
+        return STATIC_STATUS.get(first & 0x7f)
+    return int(block[2:2 + ord(block[1])])
+
+class H2Client:
+    def __init__(self, port, authority):
+        self.sock = socket.create_connection(("127.0.0.1", port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.authority = authority
+        self.nextId = 1
+        self.buf = ""
+        self.consumed = 0
+        # Open both windows all the way so the proxy never waits on us
+        self.sock.sendall(PREFACE +
+                          frame(SETTINGS, 0, 0,
+                                struct.pack(">HI", 4, MAX_WINDOW)) +
+                          frame(8, 0, 0,
+                                struct.pack(">I", MAX_WINDOW - 65535)))
+
+    def request(self, path):
+        block = ("\x82\x86" + literal(4, path) +
+                 literal(1, self.authority))
+        stream = self.nextId
+        self.nextId += 2
+        self.sock.sendall(frame(HEADERS, END_STREAM | END_HEADERS, stream,
+                                block))
+        return stream
+
+    # Returns (stream, status or None, done) for the next frame of interest
+    def next(self):
+        while True:
+            while len(self.buf) < 9:
+                data = self.sock.recv(65536)
+                if not data:
+                    raise Exception("Connection closed")
+                self.buf += data
+            length = struct.unpack(">I", "\0" + self.buf[:3])[0]
+            while len(self.buf) < 9 + length:
+                data = self.sock.recv(65536)
+                if not data:
+                    raise Exception("Connection closed")
+                self.buf += data
+            type, flags, stream = struct.unpack(">BBI", self.buf[3:9])
+            payload = self.buf[9:9 + length]
+            self.buf = self.buf[9 + length:]
+            if type == DATA:
+                self.consumed += length
+                if self.consumed > MAX_WINDOW / 2:
+                    self.sock.sendall(frame(8, 0, 0, struct.pack(
+                        ">I", self.consumed)))
+                    self.consumed = 0
+                if flags & END_STREAM:
+                    return stream, None, True
+            elif type == HEADERS:
+                return stream, decodeStatus(payload), bool(flags &
+                                                           END_STREAM)
+            elif type == RST_STREAM:
+                return stream, None, True
+            elif type == SETTINGS and not flags & ACK:
+                self.sock.sendall(frame(SETTINGS, ACK, 0, ""))
+            elif type == PING and not flags & ACK:
+                self.sock.sendall(frame(PING, ACK, 0, payload))
+            elif type == GOAWAY:
+                raise Exception("GOAWAY received")
+
+    def close(self):
+        self.sock.close()
+
+# Send count requests over one connection, streams at a time; returns the
+# sorted latencies and the request rate
+def loadH2(port, tinyPort, streams, count, path = "/home.html"):
+    client = H2Client(port, "127.0.0.1:%d" % tinyPort)
+    started = {}
+    statuses = {}
+    latencies = []
+    sent = 0
+    start = time.time()
+    while sent < min(streams, count):
+        started[client.request(path)] = time.time()
+        sent += 1
+    while started:
+        stream, status, done = client.next()
+        if status is not None:
+            statuses[stream] = status
+        if not done:
+            continue
+        status = statuses.pop(stream, None)
+        if status != 200:
+            print "Bad response on stream %d: %s" % (stream, status)
+        latencies.append(time.time() - started.pop(stream))
+        if sent < count:
+            started[client.request(path)] = time.time()
+            sent += 1
+    elapsed = time.time() - start
+    client.close()
+    latencies.sort()
+    return latencies, len(latencies) / elapsed
+
+def main(name, args):
+    requests = 5000
+    clients = 16
+    port = 16600
+    try:
+        opts, args = getopt.getopt(args, "hn:c:p:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-n':
+            requests = int(val)
+        elif opt == '-c':
+            clients = int(val)
+        elif opt == '-p':
+            port = int(val)
+
+    tinyPort = port + 1
+    tiny = startTiny(tinyPort)
+    proxy = startProxy(port, ["-2"])
+    try:
+        print "%-8s %8s %8s %10s %8s %8s %12s" % (
+            "protocol", "clients", "requests", "req/s", "p50 ms", "p99 ms",
+            "connections")
+        n = 1
+        while n <= clients:
+            latencies, rate = load(port, n, max(1, requests / n),
+                                   "http://127.0.0.1:%d/home.html" % tinyPort)
+            print "%-8s %8d %8d %10.0f %8.2f %8.2f %12d" % (
+                "http/1.0", n, len(latencies), rate,
+                percentile(latencies, 50) * 1000,
+                percentile(latencies, 99) * 1000, len(latencies))
+            latencies, rate = loadH2(port, tinyPort, n, requests)
+            print "%-8s %8d %8d %10.0f %8.2f %8.2f %12d" % (
+                "h2c", n, len(latencies), rate,
+                percentile(latencies, 50) * 1000,
+                percentile(latencies, 99) * 1000, 1)
+            n *= 4
+        metrics = stopProxy(proxy)
+        print "h2 streams %d, refused %d" % (metrics.get("h2_streams", 0),
+                                             metrics.get("h2_refused", 0))
+    finally:
+        if proxy.poll() is None:
+            proxy.terminate()
+        tiny.terminate()
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,98 @@
+#!/usr/bin/python2
+
+# Hedged request benchmark
+#
+# Starts several tiny servers behind relays that delay a small random
+# fraction of requests, then measures request latencies through the proxy
+# in reverse-proxy mode with hedging disabled and with various budgets.
+# Run from the top of the tree after building proxy and tiny.
+
+import sys
+import getopt
+import os
+
+from benchlib import *
+
+def usage(name):
+    print "Usage: %s [-h] [-b N] [-c N] [-n N] [-f PCT] [-d MS] [-p PORT]" % (
+        name)
+    print "  -h       Print this message"
+    print "  -b N     Number of backends (default 2)"
+    print "  -c N     Concurrent clients (default 8)"
+    print "  -n N     Requests per client (default 500)"
+    print "  -f PCT   Percentage of requests delayed (default 2)"
+    print "  -d MS    Delay of those requests (default 200)"
+    print "  -p PORT  First port to use (default 16100)"
+    sys.exit(0)
+
+BUDGETS = [0, 2, 5, 10]
+
+def run(budget, backendPorts, port, clients, count):
+    conf = writeRoutes(backendPorts, "round_robin")
+    proxy = startProxy(port, ["-r", conf, "-H", str(budget)])
+    try:
+        # Warm up the proxy's latency estimates
+        load(port, 2, 25)
+        latencies, rate = load(port, clients, count)
+    finally:
+        metrics = stopProxy(proxy)
+        os.remove(conf)
+    print "%-8s %8.1f %8.1f %8.1f %8.1f %8.0f %8d %8d" % (
+        "%d%%" % budget, 1000 * percentile(latencies, 50),
+        1000 * percentile(latencies, 99), 1000 * percentile(latencies, 99.9),
+        1000 * latencies[-1], rate, metrics.get("hedges", 0),
+        metrics.get("hedge_wins", 0))
+
+def main(name, args):
+    backends = 2
+    clients = 8
+    count = 500
+    fraction = 2
+    delay = 200
+    port = 16100
+    try:
+        opts, args = getopt.getopt(args, "hb:c:n:f:d:p:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-b':
+            backends = int(val)
+        elif opt == '-c':
+            clients = int(val)
+        elif opt == '-n':
+            count = int(val)
+        elif opt == '-f':
+            fraction = float(val)
+        elif opt == '-d':
+            delay = int(val)
+        elif opt == '-p':
+            port = int(val)
+
+    tinys = []
+    try:
+        backendPorts = []
+        for i in range(backends):
+            tinyPort = port + 1 + i
+            tinys.append(startTiny(tinyPort))
+            relayPort = port + 1 + backends + i
+            SlowRelay(relayPort, tinyPort,
+                      randomDelay(fraction / 100.0, delay / 1000.0))
+            backendPorts.append(relayPort)
+
+        print "%d backends, %g%% of requests delayed by %d ms; " \
+              "%d clients x %d requests" % (backends, fraction, delay,
+                                            clients, count)
+        print "%-8s %8s %8s %8s %8s %8s %8s %8s" % (
+            "budget", "p50 ms", "p99 ms", "p999 ms", "max ms", "req/s",
+            "hedges", "won")
+        for budget in BUDGETS:
+            run(budget, backendPorts, port, clients, count)
+    finally:
+        for t in tinys:
+            t.terminate()
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
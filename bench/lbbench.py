@@ -0,0 +1,91 @@
+#!/usr/bin/python2
+
+# Load balancer benchmark for reverse-proxy mode (proxy -r)
+#
+# Starts several tiny servers, one of them behind a relay that delays every
+# request, then for each balancing algorithm starts the proxy with a pool of
+# all of them and measures request latencies under concurrent load.
+# Run from the top of the tree after building proxy and tiny.
+
+import sys
+import getopt
+import os
+
+from benchlib import *
+
+def usage(name):
+    print "Usage: %s [-h] [-b N] [-c N] [-n N] [-d MS] [-p PORT]" % name
+    print "  -h       Print this message"
+    print "  -b N     Number of backends (default 4)"
+    print "  -c N     Concurrent clients (default 16)"
+    print "  -n N     Requests per client (default 200)"
+    print "  -d MS    Delay added by the slow backend (default 100)"
+    print "  -p PORT  First port to use (default 16000)"
+    sys.exit(0)
+
+ALGORITHMS = ["round_robin", "least_outstanding", "p2c", "peak_ewma"]
+
+def run(algorithm, backendPorts, slow, port, clients, count):
+    conf = writeRoutes(backendPorts, algorithm)
+    proxy = startProxy(port, ["-r", conf])
+    try:
+        slow.slowed = 0
+        latencies, rate = load(port, clients, count)
+    finally:
+        stopProxy(proxy)
+        os.remove(conf)
+    print "%-18s %8.1f %8.1f %8.1f %8.1f %8.0f %8.1f" % (
+        algorithm, 1000 * percentile(latencies, 50),
+        1000 * percentile(latencies, 90), 1000 * percentile(latencies, 99),
+        1000 * latencies[-1], rate, 100.0 * slow.slowed / len(latencies))
+
+def main(name, args):
+    backends = 4
+    clients = 16
+    count = 200
+    delay = 100
+    port = 16000
+    try:
+        opts, args = getopt.getopt(args, "hb:c:n:d:p:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-b':
+            backends = int(val)
+        elif opt == '-c':
+            clients = int(val)
+        elif opt == '-n':
+            count = int(val)
+        elif opt == '-d':
+            delay = int(val)
+        elif opt == '-p':
+            port = int(val)
+
+    tinys = []
+    try:
+        backendPorts = []
+        for i in range(backends):
+            tinys.append(startTiny(port + 1 + i))
+            backendPorts.append(port + 1 + i)
+        # The last backend is slowed down
+        slowPort = port + 1 + backends
+        slow = SlowRelay(slowPort, backendPorts[-1],
+                         constantDelay(delay / 1000.0))
+        backendPorts[-1] = slowPort
+
+        print "%d backends, one delayed by %d ms; %d clients x %d requests" % (
+            backends, delay, clients, count)
+        print "%-18s %8s %8s %8s %8s %8s %8s" % (
+            "algorithm", "p50 ms", "p90 ms", "p99 ms", "max ms", "req/s",
+            "slow %")
+        for algorithm in ALGORITHMS:
+            run(algorithm, backendPorts, slow, port, clients, count)
+    finally:
+        for t in tinys:
+            t.terminate()
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,178 @@
+/*
+ * linebench - Header lines read per second by rio, a byte at a time as
+ *     rio_readlineb() used to, with memchr() as it does now, and as views
+ *     with rio_viewlineb().
+ *
+ * The input is a file of response heads, read through a rio buffer from
+ * the start once per round, so each way makes the same read() calls.
+ * Every way must see the same lines before any is timed.
+ */
+
+#include "csapp.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_SECONDS 0.5
+#define INPUT_SIZE (4 << 20)
+
+static const char head[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Tue, 21 May 2024 14:02:11 GMT\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n"
+    "Content-Length: 48213\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: private, max-age=0, must-revalidate\r\n"
+    "ETag: W/\"bc55-18f9a3c2e10\"\r\n"
+    "Vary: Accept-Encoding, Cookie\r\n"
+    "Set-Cookie: session=8f14e45fceea167a5a36dedd4bea2543; Path=/; "
+    "HttpOnly; Secure; SameSite=Lax\r\n"
+    "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+    "X-Content-Type-Options: nosniff\r\n"
+    "Server: nginx/1.25.4\r\n"
+    "\r\n";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* old_read - rio_read() before rio_fill(): refill only when empty */
+static ssize_t old_read(rio_t *rp, char *usrbuf, size_t n) {
+    size_t cnt;
+
+    while (rp->rio_cnt <= 0) {
+        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_size);
+        if (rp->rio_cnt < 0) {
+            return -1;
+        } else if (rp->rio_cnt == 0) {
+            return 0;
+        }
+        rp->rio_bufptr = rp->rio_buf;
+    }
+    cnt = (size_t)rp->rio_cnt < n ? (size_t)rp->rio_cnt : n;
+    memcpy(usrbuf, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return (ssize_t)cnt;
+}
+
+/* old_readlineb - rio_readlineb() as it was, a byte at a time */
+static ssize_t old_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
+    size_t n;
+    ssize_t rc;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+        if ((rc = old_read(rp, &c, 1)) == 1) {
+            *bufp++ = c;
+            if (c == '\n') {
+                n++;
+                break;
+            }
+        } else if (rc == 0) {
+            if (n == 1) {
+                return 0;
+            }
+            break;
+        } else {
+            return -1;
+        }
+    }
+    *bufp = 0;
+    return (ssize_t)(n - 1);
+}
+
+/*
+ * pass - Read the whole input one way; returns the number of lines and
+ *     adds up their lengths and last bytes into *sum
+ */
+static long pass(int fd, int way, unsigned long *sum) {
+    static rio_t rio;
+    char line[MAXLINE];
+    const char *view;
+    ssize_t n;
+    long lines = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    rio_readinitb(&rio, fd);
+    while (true) {
+        if (way == 0) {
+            n = old_readlineb(&rio, line, sizeof(line));
+            view = line;
+        } else if (way == 1) {
+            n = rio_readlineb(&rio, line, sizeof(line));
+            view = line;
+        } else {
+            n = rio_viewlineb(&rio, &view);
+        }
+        if (n <= 0) {
+            break;
+        }
+        *sum += (unsigned long)n + (unsigned char)view[n - 1];
+        lines++;
+    }
+    rio_freeb(&rio);
+    return lines;
+}
+
+/* rate - Lines per second one way */
+static double rate(int fd, int way) {
+    unsigned long sum = 0;
+    long lines = 0;
+    double start = now(), elapsed;
+
+    do {
+        lines += pass(fd, way, &sum);
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    return lines / elapsed;
+}
+
+int main(void) {
+    static const char *ways[] = {"bytewise", "memchr", "view"};
+    char path[] = "/tmp/linebenchXXXXXX";
+    int fd = mkstemp(path);
+    size_t size = 0, len = strlen(head);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    while (size < INPUT_SIZE) {
+        if (write(fd, head, len) != (ssize_t)len) {
+            perror("write");
+            return 1;
+        }
+        size += len;
+    }
+
+    unsigned long sums[3] = {0, 0, 0};
+    long lines[3];
+    for (int way = 0; way < 3; way++) {
+        lines[way] = pass(fd, way, &sums[way]);
+        if (lines[way] != lines[0] || sums[way] != sums[0]) {
+            fprintf(stderr, "%s reads different lines\n", ways[way]);
+            return 1;
+        }
+    }
+
+    printf("input %zu bytes, %ld lines\n", size, lines[0]);
+    printf("%-9s %14s %10s %8s\n", "reader", "lines/s", "MB/s", "speedup");
+    double base = 0;
+    for (int way = 0; way < 3; way++) {
+        double r = rate(fd, way);
+        if (way == 0) {
+            base = r;
+        }
+        printf("%-9s %14.0f %10.1f %7.1fx\n", ways[way], r,
+               r * size / lines[0] / 1e6, r / base);
+    }
+    close(fd);
+    return 0;
+}
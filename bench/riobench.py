@@ -0,0 +1,118 @@
+#!/usr/bin/python2
+
+# Receive buffer benchmark
+#
+# Uploads bodies through the proxy, with Content-Length and chunked
+# framing, and reports the read() calls the proxy made per MB, from
+# /proc/PID/io. Then holds connections open and idle after one small
+# request each and reports the proxy's resident memory per connection.
+# Run from the top of the tree after building proxy and tiny; -x runs
+# another build, e.g. one of an older revision, for comparison.
+
+import sys
+import getopt
+import multiprocessing
+import socket
+import time
+
+from benchlib import *
+from uploadbench import origin, upload
+
+def usage(name):
+    print "Usage: %s [-h] [-m MB] [-n CONNS] [-p PORT] [-x PROXY]" % name
+    print "  -h        Print this message"
+    print "  -m MB     Body size in megabytes (default 100)"
+    print "  -n CONNS  Idle connections to hold (default 500)"
+    print "  -p PORT   First port to use (default 16500)"
+    print "  -x PROXY  Proxy binary (default ./proxy)"
+    sys.exit(0)
+
+def readCalls(pid):
+    with open("/proc/%d/io" % pid) as f:
+        for line in f:
+            if line.startswith("syscr:"):
+                return int(line.split()[1])
+    return 0
+
+def rss(pid):
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+# Open conns keep-alive connections, each after one GET of path
+def holdIdle(proxyPort, tinyPort, conns, path = "/home.html"):
+    socks = []
+    for i in range(conns):
+        sock = socket.create_connection(("127.0.0.1", proxyPort))
+        sock.sendall("GET http://127.0.0.1:%d%s HTTP/1.1\r\n"
+                     "Host: 127.0.0.1\r\n\r\n" % (tinyPort, path))
+        response = ""
+        while "</html>" not in response:
+            data = sock.recv(65536)
+            if not data:
+                raise Exception("Connection closed: %r" % response[:60])
+            response += data
+        socks.append(sock)
+    return socks
+
+def main(name, args):
+    megabytes = 100
+    conns = 500
+    port = 16500
+    binary = "./proxy"
+    try:
+        opts, args = getopt.getopt(args, "hm:n:p:x:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-m':
+            megabytes = int(val)
+        elif opt == '-n':
+            conns = int(val)
+        elif opt == '-p':
+            port = int(val)
+        elif opt == '-x':
+            binary = val
+
+    originPort = port + 1
+    tinyPort = port + 2
+    server = multiprocessing.Process(target = origin, args = (originPort,))
+    server.daemon = True
+    server.start()
+    waitPort(originPort)
+    tiny = startTiny(tinyPort)
+    proxy = startProxy(port, [], binary)
+    try:
+        print "%-10s %8s %10s %14s" % ("framing", "MB", "MB/s",
+                                       "reads per MB")
+        size = megabytes * 1000 * 1000
+        for chunked in [False, True]:
+            calls = readCalls(proxy.pid)
+            start = time.time()
+            upload(port, originPort, size, chunked)
+            rate = size / (time.time() - start) / 1e6
+            calls = readCalls(proxy.pid) - calls
+            print "%-10s %8d %10.0f %14.0f" % (
+                "chunked" if chunked else "length", megabytes, rate,
+                calls / (size / 1e6))
+
+        before = rss(proxy.pid)
+        socks = holdIdle(port, tinyPort, conns)
+        time.sleep(0.5)
+        after = rss(proxy.pid)
+        print "%d idle connections: %.1f KB resident each" % (
+            conns, float(after - before) / conns)
+        for sock in socks:
+            sock.close()
+    finally:
+        stopProxy(proxy)
+        tiny.terminate()
+        server.terminate()
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,211 @@
+#!/usr/bin/python2
+
+# CONNECT tunnel benchmark
+#
+# Starts a local origin that streams bytes to (or swallows bytes from) each
+# connection, then measures transfer rates directly and through proxy
+# tunnels, with one and with several tunnels at once. Also checks that
+# half-closes are passed through, and reports the proxy's thread count
+# while the tunnels are busy. Run from the top of the tree after building
+# proxy.
+
+import sys
+import getopt
+import multiprocessing
+import os
+import socket
+import threading
+import time
+
+from benchlib import *
+
+BUFSIZE = 1 << 20
+
+def usage(name):
+    print "Usage: %s [-h] [-m MB] [-c N] [-p PORT]" % name
+    print "  -h       Print this message"
+    print "  -m MB    Megabytes per transfer (default 1024)"
+    print "  -c N     Concurrent tunnels (default 8)"
+    print "  -p PORT  First port to use (default 16200)"
+    sys.exit(0)
+
+# Origin: the first line of each connection is "send N", "recv N" or
+# "echo". Sends N bytes, swallows N bytes and answers "ok", or echoes until
+# EOF; then closes its side.
+def serveOne(sock):
+    command = ""
+    while not command.endswith("\n"):
+        command += sock.recv(1)
+    words = command.split()
+    if words[0] == "send":
+        data = "x" * BUFSIZE
+        remaining = int(words[1])
+        while remaining > 0:
+            n = sock.send(buffer(data, 0, min(remaining, BUFSIZE)))
+            remaining -= n
+    elif words[0] == "recv":
+        buf = bytearray(BUFSIZE)
+        remaining = int(words[1])
+        while remaining > 0:
+            n = sock.recv_into(buf)
+            if n == 0:
+                break
+            remaining -= n
+        sock.sendall("ok")
+    else:
+        while True:
+            data = sock.recv(65536)
+            if not data:
+                break
+            sock.sendall(data)
+    sock.shutdown(socket.SHUT_WR)
+    while sock.recv(65536):
+        pass
+    sock.close()
+
+def origin(port):
+    lsock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    lsock.bind(("127.0.0.1", port))
+    lsock.listen(128)
+    while True:
+        sock, addr = lsock.accept()
+        t = threading.Thread(target = serveOne, args = (sock,))
+        t.daemon = True
+        t.start()
+
+# Connect to the origin, through a tunnel if proxyPort is given
+def connect(originPort, proxyPort):
+    if proxyPort is None:
+        return socket.create_connection(("127.0.0.1", originPort))
+    sock = socket.create_connection(("127.0.0.1", proxyPort))
+    sock.sendall("CONNECT 127.0.0.1:%d HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" %
+                 originPort)
+    response = ""
+    while "\r\n\r\n" not in response:
+        data = sock.recv(1)
+        if not data:
+            raise Exception("Proxy closed the tunnel: %r" % response)
+        response += data
+    if not response.startswith("HTTP/1.1 200"):
+        raise Exception("Tunnel refused: %r" % response)
+    return sock
+
+def download(originPort, proxyPort, size):
+    sock = connect(originPort, proxyPort)
+    sock.sendall("send %d\n" % size)
+    buf = bytearray(BUFSIZE)
+    received = 0
+    while True:
+        n = sock.recv_into(buf)
+        if n == 0:
+            break
+        received += n
+    sock.close()
+    if received != size:
+        raise Exception("Received %d of %d bytes" % (received, size))
+
+def upload(originPort, proxyPort, size):
+    sock = connect(originPort, proxyPort)
+    sock.sendall("recv %d\n" % size)
+    data = "x" * BUFSIZE
+    remaining = size
+    while remaining > 0:
+        remaining -= sock.send(buffer(data, 0, min(remaining, BUFSIZE)))
+    if readAll(sock) != "ok":
+        raise Exception("Upload not acknowledged")
+    sock.close()
+
+# The client finishes sending first, then must still get everything back
+def halfClose(originPort, proxyPort):
+    sock = connect(originPort, proxyPort)
+    payload = os.urandom(3 * BUFSIZE)
+    sock.sendall("echo\n")
+    sender = threading.Thread(target = sock.sendall, args = (payload,))
+    sender.start()
+    echoed = []
+    def reader():
+        echoed.append(readAll(sock))
+    r = threading.Thread(target = reader)
+    r.start()
+    sender.join()
+    sock.shutdown(socket.SHUT_WR)
+    r.join()
+    sock.close()
+    return echoed[0] == payload
+
+def threadCount(pid):
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("Threads:"):
+                return int(line.split()[1])
+    return 0
+
+# Run transfer in clients threads at once; returns MB/s and the proxy's
+# peak thread count once the tunnels are up
+def run(transfer, originPort, proxy, proxyPort, clients, size):
+    threads = [threading.Thread(target = transfer,
+                                args = (originPort, proxyPort, size))
+               for i in range(clients)]
+    peak = 0
+    start = time.time()
+    for t in threads:
+        t.start()
+    while any(t.is_alive() for t in threads):
+        # Skip the connection threads that hand each tunnel over
+        if proxy is not None and time.time() - start > 0.5:
+            peak = max(peak, threadCount(proxy.pid))
+        time.sleep(0.05)
+    elapsed = time.time() - start
+    return clients * size / elapsed / 1e6, peak
+
+def main(name, args):
+    megabytes = 1024
+    clients = 8
+    port = 16200
+    try:
+        opts, args = getopt.getopt(args, "hm:c:p:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-m':
+            megabytes = int(val)
+        elif opt == '-c':
+            clients = int(val)
+        elif opt == '-p':
+            port = int(val)
+
+    originPort = port + 1
+    server = multiprocessing.Process(target = origin, args = (originPort,))
+    server.daemon = True
+    server.start()
+    waitPort(originPort)
+    proxy = startProxy(port, [])
+    size = megabytes * 1000 * 1000
+    try:
+        print "half-close passed through: %s" % (
+            "yes" if halfClose(originPort, port) else "NO")
+        print "%-10s %-8s %8s %10s %8s" % ("transfer", "path", "tunnels",
+                                           "MB/s", "threads")
+        for (label, transfer) in [("download", download),
+                                  ("upload", upload)]:
+            for n in [1, clients]:
+                rate, peak = run(transfer, originPort, None, None, n,
+                                 size / n)
+                print "%-10s %-8s %8d %10.0f %8s" % (label, "direct", n,
+                                                     rate, "-")
+                rate, peak = run(transfer, originPort, proxy, port, n,
+                                 size / n)
+                print "%-10s %-8s %8d %10.0f %8d" % (label, "tunnel", n,
+                                                     rate, peak)
+    finally:
+        metrics = stopProxy(proxy)
+        server.terminate()
+    print "tunnels %d, tunnel_bytes %d" % (metrics.get("tunnels", 0),
+                                          metrics.get("tunnel_bytes", 0))
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,148 @@
+#!/usr/bin/python2
+
+# Request body streaming benchmark
+#
+# Uploads bodies of growing size through the proxy to a local origin that
+# counts and discards them, with Content-Length and chunked framing, and
+# reports the upload rate and the proxy's peak resident memory after each.
+# Memory should stay flat however large the body. Run from the top of the
+# tree after building proxy.
+
+import sys
+import getopt
+import multiprocessing
+import socket
+import threading
+import time
+
+from benchlib import *
+
+BUFSIZE = 1 << 20
+
+def usage(name):
+    print "Usage: %s [-h] [-m MB] [-p PORT]" % name
+    print "  -h       Print this message"
+    print "  -m MB    Largest body in megabytes (default 1000)"
+    print "  -p PORT  First port to use (default 16400)"
+    sys.exit(0)
+
+# Origin: reads a request, discards its body and answers with its size
+def serveOne(sock):
+    f = sock.makefile("rb")
+    f.readline()
+    headers = {}
+    while True:
+        line = f.readline()
+        if line in ("\r\n", "\n", ""):
+            break
+        name, value = line.split(":", 1)
+        headers[name.lower()] = value.strip()
+    total = 0
+    if headers.get("transfer-encoding") == "chunked":
+        while True:
+            size = int(f.readline().split(";")[0], 16)
+            if size == 0:
+                while f.readline() not in ("\r\n", "\n", ""):
+                    pass
+                break
+            while size > 0:
+                n = len(f.read(min(size, BUFSIZE)))
+                size -= n
+                total += n
+            f.readline()
+    else:
+        remaining = int(headers.get("content-length", "0"))
+        while remaining > 0:
+            n = len(f.read(min(remaining, BUFSIZE)))
+            if n == 0:
+                break
+            remaining -= n
+            total += n
+    body = "%d" % total
+    sock.sendall("HTTP/1.0 200 OK\r\nContent-Length: %d\r\n\r\n%s" %
+                 (len(body), body))
+    sock.close()
+
+def origin(port):
+    lsock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    lsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    lsock.bind(("127.0.0.1", port))
+    lsock.listen(128)
+    while True:
+        sock, addr = lsock.accept()
+        t = threading.Thread(target = serveOne, args = (sock,))
+        t.daemon = True
+        t.start()
+
+def upload(proxyPort, originPort, size, chunked):
+    sock = socket.create_connection(("127.0.0.1", proxyPort))
+    framing = "Transfer-Encoding: chunked" if chunked else \
+              "Content-Length: %d" % size
+    sock.sendall("PUT http://127.0.0.1:%d/upload HTTP/1.1\r\n"
+                 "Host: 127.0.0.1\r\n%s\r\nConnection: close\r\n\r\n" %
+                 (originPort, framing))
+    data = "x" * BUFSIZE
+    remaining = size
+    while remaining > 0:
+        n = min(remaining, BUFSIZE)
+        if chunked:
+            sock.sendall("%x\r\n" % n)
+        sock.sendall(buffer(data, 0, n))
+        if chunked:
+            sock.sendall("\r\n")
+        remaining -= n
+    if chunked:
+        sock.sendall("0\r\n\r\n")
+    response = readAll(sock)
+    sock.close()
+    if not response.endswith("\r\n\r\n%d" % size):
+        raise Exception("Bad response: %r" % response[:60])
+
+def peakRss(pid):
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("VmHWM:"):
+                return int(line.split()[1])
+    return 0
+
+def main(name, args):
+    megabytes = 1000
+    port = 16400
+    try:
+        opts, args = getopt.getopt(args, "hm:p:")
+    except getopt.GetoptError as e:
+        print "Error: %s" % e
+        usage(name)
+    for (opt, val) in opts:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-m':
+            megabytes = int(val)
+        elif opt == '-p':
+            port = int(val)
+
+    originPort = port + 1
+    server = multiprocessing.Process(target = origin, args = (originPort,))
+    server.daemon = True
+    server.start()
+    waitPort(originPort)
+    proxy = startProxy(port, [])
+    try:
+        print "%-10s %8s %10s %12s" % ("framing", "MB", "MB/s",
+                                       "peak RSS KB")
+        sizes = [1, 10, 100, 1000, 10000]
+        for chunked in [False, True]:
+            for mb in [m for m in sizes if m <= megabytes]:
+                size = mb * 1000 * 1000
+                start = time.time()
+                upload(port, originPort, size, chunked)
+                rate = size / (time.time() - start) / 1e6
+                print "%-10s %8d %10.0f %12d" % (
+                    "chunked" if chunked else "length", mb, rate,
+                    peakRss(proxy.pid))
+    finally:
+        stopProxy(proxy)
+        server.terminate()
+
+if __name__ == "__main__":
+    main(sys.argv[0], sys.argv[1:])
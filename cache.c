@@ -0,0 +1,312 @@
+/**
+ * @file cache.c
+ * @brief Shared in-memory cache of origin responses
+ *
+ * Entries live in a chained hash table and on a list in order of use, both
+ * protected by a single lock, which is only held to find, link or unlink
+ * entries: hits are sent and fills are copied without it. Entries are
+ * reference counted, so one evicted or replaced while a hit is being sent
+ * is freed by the last release.
+ */
+
+#include "cache.h"
+#include "csapp.h"
+#include "metrics.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define CACHE_BUCKETS 1024
+#define CACHE_MAX_TTL (7 * 24 * 3600) // Longer lifetimes are cut to this
+
+static struct {
+    pthread_mutex_t lock;
+    cache_entry_t *buckets[CACHE_BUCKETS];
+    cache_entry_t *newest; // Most recently used
+    cache_entry_t *oldest; // Least recently used, evicted first
+    size_t size;           // Largest total of bodies
+    size_t used;           // Total of the bodies linked
+} cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .size = CACHE_MAX_SIZE,
+};
+
+/* now_sec - Monotonic seconds, which lifetimes are counted in */
+static time_t now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* hash_key - The bucket of a key (djb2) */
+static unsigned hash_key(const char *key) {
+    unsigned h = 5381;
+    while (*key != '\0') {
+        h = h * 33 + (unsigned char)*key++;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+void cache_configure(size_t size) {
+    cache.size = size;
+}
+
+bool cache_enabled(void) {
+    return cache.size > 0;
+}
+
+/* seconds - The delta-seconds after "name=", or -1 if malformed */
+static int seconds(const char *p) {
+    if (*p == '"') {
+        p++;
+    }
+    if (!isdigit((unsigned char)*p)) {
+        return -1;
+    }
+    long n = strtol(p, NULL, 10);
+    return n > CACHE_MAX_TTL ? CACHE_MAX_TTL : (int)n;
+}
+
+bool cache_control(const char *value, int *ttl) {
+    const char *p = value;
+    bool shared = false;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        size_t n = strcspn(p, ",");
+        if ((n >= 8 && strncasecmp(p, "no-store", 8) == 0) ||
+            (n >= 7 && strncasecmp(p, "private", 7) == 0) ||
+            (n >= 8 && strncasecmp(p, "no-cache", 8) == 0)) {
+            return false;
+        }
+        if (n > 9 && strncasecmp(p, "s-maxage=", 9) == 0) {
+            int s = seconds(p + 9);
+            if (s < 0) {
+                return false;
+            }
+            *ttl = s;
+            shared = true;
+        } else if (n > 8 && strncasecmp(p, "max-age=", 8) == 0 && !shared) {
+            int s = seconds(p + 8);
+            if (s < 0) {
+                return false;
+            }
+            *ttl = s;
+        }
+        p += n;
+    }
+    return true;
+}
+
+/* unlink_entry - Take an entry off the table; the lock must be held */
+static void unlink_entry(cache_entry_t *e) {
+    cache_entry_t **pp = &cache.buckets[hash_key(e->key)];
+
+    while (*pp != e) {
+        pp = &(*pp)->next;
+    }
+    *pp = e->next;
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        cache.newest = e->older;
+    }
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        cache.oldest = e->newer;
+    }
+    e->next = e->newer = e->older = NULL;
+    e->linked = false;
+    cache.used -= e->body_len;
+}
+
+/* free_entry - Free an entry no one refers to */
+static void free_entry(cache_entry_t *e) {
+    Free(e->key);
+    Free(e->body);
+    Free(e);
+}
+
+/*
+ * drop_entry - Take an entry off the table and free it unless a hit is
+ *     still being sent from it; the lock must be held.
+ */
+static void drop_entry(cache_entry_t *e) {
+    unlink_entry(e);
+    if (e->refs == 0) {
+        free_entry(e);
+    }
+}
+
+/* touch - Make an entry the most recently used; the lock must be held */
+static void touch(cache_entry_t *e) {
+    if (cache.newest == e) {
+        return;
+    }
+    e->newer->older = e->older;
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        cache.oldest = e->newer;
+    }
+    e->older = cache.newest;
+    e->newer = NULL;
+    cache.newest->newer = e;
+    cache.newest = e;
+}
+
+const cache_entry_t *cache_lookup(const char *key, bool gzip, bool stale_ok) {
+    cache_variant want = gzip ? CACHE_GZIP : CACHE_IDENTITY;
+    cache_entry_t *e;
+
+    pthread_mutex_lock(&cache.lock);
+    for (e = cache.buckets[hash_key(key)]; e != NULL; e = e->next) {
+        if ((e->variant == CACHE_ANY || e->variant == want) &&
+            strcmp(e->key, key) == 0) {
+            break;
+        }
+    }
+    if (e != NULL && (stale_ok || now_sec() < e->expires)) {
+        touch(e);
+        e->refs++;
+    } else {
+        e = NULL;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return e;
+}
+
+bool cache_stale(const cache_entry_t *e) {
+    return now_sec() >= e->expires;
+}
+
+void cache_release(const cache_entry_t *entry) {
+    cache_entry_t *e = (cache_entry_t *)entry;
+
+    pthread_mutex_lock(&cache.lock);
+    bool last = --e->refs == 0 && !e->linked;
+    pthread_mutex_unlock(&cache.lock);
+    if (last) {
+        free_entry(e);
+    }
+}
+
+/*
+ * keep_header - Whether a header belongs in a cached head: framing is
+ *     redone for every hit, and hop-by-hop headers were for the origin's
+ *     connection alone.
+ */
+static bool keep_header(const char *line, size_t n) {
+    static const char *drop[] = {"Content-Length:", "Transfer-Encoding:",
+                                 "Connection:", "Proxy-Connection:",
+                                 "Keep-Alive:"};
+
+    for (size_t i = 0; i < sizeof(drop) / sizeof(drop[0]); i++) {
+        size_t len = strlen(drop[i]);
+        if (n >= len && strncasecmp(line, drop[i], len) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+cache_entry_t *cache_fill_start(const char *key, cache_variant variant,
+                                int ttl, const char *head, size_t head_len) {
+    cache_entry_t *e = Calloc(1, sizeof(cache_entry_t));
+    size_t klen = strlen(key) + 1;
+
+    /* The head is kept after the key, with CRLF line ends throughout */
+    e->key = Malloc(klen + 2 * head_len + 2);
+    memcpy(e->key, key, klen);
+    char *out = e->key + klen;
+    e->head = out;
+    const char *p = head, *end = head + head_len;
+    bool status_line = true;
+    while (p < end) {
+        const char *lf = memchr(p, '\n', (size_t)(end - p));
+        const char *next = lf != NULL ? lf + 1 : end;
+        size_t n = (size_t)((lf != NULL ? lf : end) - p);
+        if (n > 0 && p[n - 1] == '\r') {
+            n--;
+        }
+        if (status_line || keep_header(p, n)) {
+            memcpy(out, p, n);
+            memcpy(out + n, "\r\n", 2);
+            out += n + 2;
+        }
+        status_line = false;
+        p = next;
+    }
+    e->head_len = (size_t)(out - e->head);
+    e->variant = variant;
+    e->expires = now_sec() + ttl;
+    return e;
+}
+
+bool cache_fill_add(cache_entry_t *e, const void *data, size_t n) {
+    if (e->too_large) {
+        return false;
+    }
+    if (e->body_len + n > CACHE_MAX_OBJECT) {
+        e->too_large = true;
+        return false;
+    }
+    if (e->body_len + n > e->body_cap) {
+        size_t cap = e->body_cap > 0 ? e->body_cap : MAXBUF;
+        while (cap < e->body_len + n) {
+            cap *= 2;
+        }
+        e->body = Realloc(e->body, cap);
+        e->body_cap = cap;
+    }
+    memcpy(e->body + e->body_len, data, n);
+    e->body_len += n;
+    return true;
+}
+
+void cache_fill_finish(cache_entry_t *e, bool complete) {
+    if (!complete || e->too_large || e->body_len > cache.size) {
+        free_entry(e);
+        return;
+    }
+
+    unsigned b = hash_key(e->key);
+    pthread_mutex_lock(&cache.lock);
+
+    /* A response replaces every entry that would have answered its clients */
+    cache_entry_t *old = cache.buckets[b];
+    while (old != NULL) {
+        cache_entry_t *next = old->next;
+        if (strcmp(old->key, e->key) == 0 &&
+            (e->variant == CACHE_ANY || old->variant == CACHE_ANY ||
+             old->variant == e->variant)) {
+            drop_entry(old);
+        }
+        old = next;
+    }
+
+    while (cache.used + e->body_len > cache.size) {
+        drop_entry(cache.oldest);
+        metrics_inc(METRIC_CACHE_EVICTIONS);
+    }
+
+    e->next = cache.buckets[b];
+    cache.buckets[b] = e;
+    e->older = cache.newest;
+    if (cache.newest != NULL) {
+        cache.newest->newer = e;
+    } else {
+        cache.oldest = e;
+    }
+    cache.newest = e;
+    e->linked = true;
+    cache.used += e->body_len;
+    pthread_mutex_unlock(&cache.lock);
+    metrics_inc(METRIC_CACHE_STORES);
+}
@@ -0,0 +1,171 @@
+/**
+ * @file cache.h
+ * @brief Shared in-memory cache of origin responses
+ *
+ * Responses to GETs with a status cacheable by default (200, 301 and 404
+ * among them) are kept whole: the status line and end-to-end headers, and
+ * the body with any chunked framing undone, so a hit can be sent to any
+ * client with a Content-Length and the connection header it needs.
+ * Entries are keyed by the origin and path, and evicted least recently
+ * used first once their bodies add up to more than the cache's size
+ * (CACHE_MAX_SIZE by default); bodies over CACHE_MAX_OBJECT are never
+ * stored.
+ *
+ * A response the origin marks "Vary: Accept-Encoding", or that the proxy
+ * would compress, is stored as one of two variants, gzip and identity,
+ * chosen by whether the client accepted gzip; any other response serves
+ * every client. Vary on anything else, Set-Cookie and Cache-Control
+ * no-store, private or no-cache keep a response out of the cache.
+ *
+ * An entry is fresh for its s-maxage or max-age, or CACHE_DEFAULT_TTL
+ * seconds without either. A stale one is still kept, to be served when
+ * the origin is not to be sent requests, its circuit breaker open or too
+ * many requests waiting for it, until it is evicted.
+ *
+ *     cache_entry_t *fill = cache_fill_start(key, variant, ttl, head, n);
+ *     ...for each span of decoded body, while it returns true:
+ *     cache_fill_add(fill, data, len);
+ *     cache_fill_finish(fill, complete);
+ *     ...
+ *     const cache_entry_t *e = cache_lookup(key, gzip, false);
+ *     ...send e->head, framing headers, then e->body
+ *     cache_release(e);
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#define CACHE_MAX_SIZE (1024 * 1024)  // Default total of the bodies kept
+#define CACHE_MAX_OBJECT (100 * 1024) // Largest body kept
+#define CACHE_MAX_KEY 2048            // Longest key, origin and path
+#define CACHE_DEFAULT_TTL 300         // Seconds fresh without a max-age
+
+/**
+ * @brief Which clients an entry may answer
+ */
+typedef enum {
+    CACHE_ANY,      /**< every client */
+    CACHE_IDENTITY, /**< clients that do not accept gzip */
+    CACHE_GZIP,     /**< clients that accept gzip */
+} cache_variant;
+
+/**
+ * @brief A cached response, or one being filled
+ */
+typedef struct cache_entry {
+    const char *head; /**< status line and headers, each ending in CRLF,
+                           without framing or hop-by-hop ones */
+    size_t head_len;  /**< bytes in head */
+    char *body;       /**< the decoded body */
+    size_t body_len;  /**< bytes in body */
+    time_t expires;   /**< monotonic second it goes stale */
+
+    /* Internal */
+    char *key;                 /**< origin and path, then head */
+    cache_variant variant;     /**< clients it answers */
+    size_t body_cap;           /**< bytes allocated for body */
+    bool too_large;            /**< body outgrew CACHE_MAX_OBJECT */
+    unsigned refs;             /**< lookups not yet released */
+    bool linked;               /**< in the table, not evicted or filling */
+    struct cache_entry *next;  /**< next in the bucket */
+    struct cache_entry *newer; /**< toward the most recently used */
+    struct cache_entry *older; /**< toward the least recently used */
+} cache_entry_t;
+
+/**
+ * @brief Set the cache's size
+ *
+ * Call before any request is served.
+ *
+ * @param[in] size Total bytes of bodies kept, or 0 to disable caching
+ */
+void cache_configure(size_t size);
+
+/**
+ * @brief Check whether caching is enabled
+ *
+ * @return true unless the size was set to 0
+ */
+bool cache_enabled(void);
+
+/**
+ * @brief Read the parts of Cache-Control a shared cache acts on
+ *
+ * @param[in] value The value of one Cache-Control header
+ * @param[in,out] ttl Set to the max-age, or the s-maxage which overrides it
+ *
+ * @return false if the directives forbid storing the response
+ */
+bool cache_control(const char *value, int *ttl);
+
+/**
+ * @brief Find a cached response
+ *
+ * @param[in] key The origin and path
+ * @param[in] gzip Whether the client accepts gzip
+ * @param[in] stale_ok Whether an entry past its lifetime will do
+ *
+ * @return The entry, which stays valid until released, or NULL
+ */
+const cache_entry_t *cache_lookup(const char *key, bool gzip, bool stale_ok);
+
+/**
+ * @brief Check whether an entry is past its lifetime
+ *
+ * @param[in] e The entry
+ *
+ * @return true if it is stale
+ */
+bool cache_stale(const cache_entry_t *e);
+
+/**
+ * @brief Release an entry cache_lookup() returned
+ *
+ * @param[in] e The entry
+ */
+void cache_release(const cache_entry_t *e);
+
+/**
+ * @brief Start storing a response
+ *
+ * Hop-by-hop headers and Content-Length and Transfer-Encoding are left out
+ * of the head kept, since every hit is framed afresh.
+ *
+ * @param[in] key The origin and path
+ * @param[in] variant The clients it answers
+ * @param[in] ttl Seconds it stays fresh
+ * @param[in] head The status line and headers, each ending in a line end,
+ *     without the blank line
+ * @param[in] head_len Bytes in head
+ *
+ * @return The entry to fill, invisible to lookups until finished
+ */
+cache_entry_t *cache_fill_start(const char *key, cache_variant variant,
+                                int ttl, const char *head, size_t head_len);
+
+/**
+ * @brief Add to the body of a response being stored
+ *
+ * @param[in] e The entry being filled
+ * @param[in] data Decoded body bytes
+ * @param[in] n How many
+ *
+ * @return false once the body is too large to keep; the entry must still
+ *     be finished
+ */
+bool cache_fill_add(cache_entry_t *e, const void *data, size_t n);
+
+/**
+ * @brief Finish storing a response, replacing any entry it supersedes
+ *
+ * @param[in] e The entry being filled
+ * @param[in] complete Whether the whole body was added; if not, or if it
+ *     was too large, the entry is dropped
+ */
+void cache_fill_finish(cache_entry_t *e, bool complete);
+
+#endif /* __CACHE_H__ */
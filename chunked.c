@@ -0,0 +1,160 @@
+/**
+ * @file chunked.c
+ * @brief Streaming codec for the chunked transfer coding
+ */
+
+#include "chunked.h"
+
+/* Sizes are limited so that they cannot overflow */
+#define CHUNK_MAX_DIGITS 15
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+void chunk_decoder_init(chunk_decoder_t *d) {
+    d->state = CS_SIZE;
+    d->remaining = 0;
+    d->digits = 0;
+}
+
+/* size_line_done - The size line ended: on to data or trailers */
+static chunk_state size_line_done(chunk_decoder_t *d) {
+    return d->remaining == 0 ? CS_TRAILER : CS_DATA;
+}
+
+chunk_status chunk_decode(chunk_decoder_t *d, const char **pos,
+                          const char *end, const char **data, size_t *len) {
+    const char *p = *pos;
+
+    while (p < end) {
+        char c = *p;
+
+        switch (d->state) {
+        case CS_SIZE: {
+            int v = hex_value(c);
+            if (v >= 0 && d->digits < CHUNK_MAX_DIGITS) {
+                d->remaining = d->remaining * 16 + (uint64_t)v;
+                d->digits++;
+            } else if (d->digits == 0 || v >= 0) {
+                d->state = CS_ERROR;
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                d->state = CS_EXT;
+            } else if (c == '\r') {
+                d->state = CS_SIZE_LF;
+            } else if (c == '\n') {
+                d->state = size_line_done(d);
+            } else {
+                d->state = CS_ERROR;
+            }
+            p++;
+            break;
+        }
+        case CS_EXT:
+            if (c == '\r') {
+                d->state = CS_SIZE_LF;
+            } else if (c == '\n') {
+                d->state = size_line_done(d);
+            }
+            p++;
+            break;
+        case CS_SIZE_LF:
+            d->state = c == '\n' ? size_line_done(d) : CS_ERROR;
+            p++;
+            break;
+        case CS_DATA: {
+            size_t n = (size_t)(end - p);
+            if ((uint64_t)n > d->remaining) {
+                n = (size_t)d->remaining;
+            }
+            d->remaining -= n;
+            if (d->remaining == 0) {
+                d->state = CS_DATA_CR;
+            }
+            *data = p;
+            *len = n;
+            *pos = p + n;
+            return CHUNK_DATA;
+        }
+        case CS_DATA_CR:
+            if (c == '\r') {
+                d->state = CS_DATA_LF;
+            } else if (c == '\n') {
+                d->state = CS_SIZE;
+                d->digits = 0;
+            } else {
+                d->state = CS_ERROR;
+            }
+            p++;
+            break;
+        case CS_DATA_LF:
+            if (c == '\n') {
+                d->state = CS_SIZE;
+                d->digits = 0;
+            } else {
+                d->state = CS_ERROR;
+            }
+            p++;
+            break;
+        case CS_TRAILER:
+            if (c == '\r') {
+                d->state = CS_END_LF;
+            } else if (c == '\n') {
+                d->state = CS_DONE;
+            } else {
+                d->state = CS_TRAILER_LINE;
+            }
+            p++;
+            break;
+        case CS_TRAILER_LINE:
+            if (c == '\n') {
+                d->state = CS_TRAILER;
+            }
+            p++;
+            break;
+        case CS_END_LF:
+            d->state = c == '\n' ? CS_DONE : CS_ERROR;
+            p++;
+            break;
+        case CS_DONE:
+        case CS_ERROR:
+            break;
+        }
+
+        if (d->state == CS_DONE || d->state == CS_ERROR) {
+            break;
+        }
+    }
+
+    *pos = p;
+    if (d->state == CS_DONE) {
+        return CHUNK_DONE;
+    } else if (d->state == CS_ERROR) {
+        return CHUNK_ERROR;
+    }
+    return CHUNK_MORE;
+}
+
+size_t chunk_header(char *buf, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    char digits[16];
+    size_t len = 0, ndigits = 0;
+
+    do {
+        digits[ndigits++] = hex[n & 0xf];
+        n >>= 4;
+    } while (n != 0);
+    while (ndigits > 0) {
+        buf[len++] = digits[--ndigits];
+    }
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return len;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file chunked.h
+ * @brief Streaming codec for the chunked transfer coding
+ *
+ * The decoder is a byte-at-a-time state machine over whatever input the
+ * caller happens to have, so chunk sizes, CRLFs and trailers may be split
+ * across reads at any point. It never copies or allocates: each call hands
+ * back the next run of body bytes as a span of the caller's buffer.
+ *
+ *     chunk_decoder_t d;
+ *     chunk_decoder_init(&d);
+ *     ...for each buffer read, p = buf, end = buf + n:
+ *     while ((status = chunk_decode(&d, &p, end, &data, &len)) == CHUNK_DATA)
+ *         consume(data, len);
+ *     ...CHUNK_MORE: read more; CHUNK_DONE: body complete, p is just past it
+ *
+ * Chunk extensions and trailer fields are skipped. Bare LFs are accepted in
+ * place of CRLFs.
+ *
+ * The encoder side is just the framing: a chunk header to put in front of
+ * each run of body bytes, CRLF after it, and the last chunk at the end.
+ */
+
+#ifndef __CHUNKED_H__
+#define __CHUNKED_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHUNK_HEADER_MAX 18 // 16 hex digits and CRLF
+#define CHUNK_CRLF "\r\n"
+#define CHUNK_LAST "0\r\n\r\n"
+
+/**
+ * @brief Results of chunk_decode()
+ */
+typedef enum {
+    CHUNK_MORE,  /**< all input consumed, more is needed */
+    CHUNK_DATA,  /**< a span of body bytes is returned */
+    CHUNK_DONE,  /**< the body and its trailers are complete */
+    CHUNK_ERROR, /**< the input is not validly chunked */
+} chunk_status;
+
+/**
+ * @brief Decoder states (internal)
+ */
+typedef enum {
+    CS_SIZE,         /**< in the chunk size */
+    CS_EXT,          /**< in chunk extensions */
+    CS_SIZE_LF,      /**< expecting the LF after the size line */
+    CS_DATA,         /**< in chunk data */
+    CS_DATA_CR,      /**< expecting the CR after chunk data */
+    CS_DATA_LF,      /**< expecting the LF after chunk data */
+    CS_TRAILER,      /**< at the start of a trailer line */
+    CS_TRAILER_LINE, /**< in a trailer field */
+    CS_END_LF,       /**< expecting the final LF */
+    CS_DONE,
+    CS_ERROR,
+} chunk_state;
+
+/**
+ * @brief Decoder for one chunked body
+ */
+typedef struct {
+    chunk_state state;  /**< where in the framing we are */
+    uint64_t remaining; /**< size of (or bytes left in) the current chunk */
+    int digits;         /**< hex digits seen in the chunk size */
+} chunk_decoder_t;
+
+/**
+ * @brief Prepare a decoder for a new body
+ *
+ * @param[in] d The decoder
+ */
+void chunk_decoder_init(chunk_decoder_t *d);
+
+/**
+ * @brief Decode input until a span of body bytes or the end of input
+ *
+ * @param[in] d The decoder
+ * @param[in,out] pos Start of the unconsumed input; advanced past what is
+ *     consumed
+ * @param[in] end End of the input
+ * @param[out] data Start of the body bytes, on CHUNK_DATA
+ * @param[out] len Number of body bytes, on CHUNK_DATA
+ *
+ * @return CHUNK_DATA, CHUNK_MORE, CHUNK_DONE or CHUNK_ERROR
+ */
+chunk_status chunk_decode(chunk_decoder_t *d, const char **pos,
+                          const char *end, const char **data, size_t *len);
+
+/**
+ * @brief Format the header of a chunk
+ *
+ * @param[out] buf At least CHUNK_HEADER_MAX bytes
+ * @param[in] n The chunk's size, which must not be 0
+ *
+ * @return The length of the header (not NUL terminated)
+ */
+size_t chunk_header(char *buf, size_t n);
+
+#endif /* __CHUNKED_H__ */
@@ -0,0 +1,158 @@
+/**
+ * @file connector.c
+ * @brief Parallel ("happy eyeballs") connection establishment
+ */
+
+#include "connector.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * order_addrs - Interleave address families, IPv6 first (RFC 8305 section
+ *     4), keeping the resolver's order within each family.
+ */
+static int order_addrs(const resolver_result_t *addrs, int *order) {
+    int first[RESOLVER_MAX_ADDRS], other[RESOLVER_MAX_ADDRS];
+    int nfirst = 0, nother = 0, n = 0;
+
+    for (int i = 0; i < addrs->naddrs; i++) {
+        if (addrs->addrs[i].ss_family == AF_INET6) {
+            first[nfirst++] = i;
+        } else {
+            other[nother++] = i;
+        }
+    }
+    for (int i = 0; i < nfirst || i < nother; i++) {
+        if (i < nfirst) {
+            order[n++] = first[i];
+        }
+        if (i < nother) {
+            order[n++] = other[i];
+        }
+    }
+    return n;
+}
+
+/*
+ * start_attempt - Begin a non-blocking connect. Returns the socket, or -1
+ *     if the attempt failed immediately. Sets *done if it already connected.
+ */
+static int start_attempt(const resolver_result_t *addrs, int i, bool *done) {
+    int fd = socket(addrs->addrs[i].ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    *done = false;
+    if (connect(fd, (const struct sockaddr *)&addrs->addrs[i],
+                addrs->addrlens[i]) == 0) {
+        *done = true;
+    } else if (errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int connect_happy(const resolver_result_t *addrs, int timeout_ms) {
+    struct pollfd pfds[RESOLVER_MAX_ADDRS];
+    int order[RESOLVER_MAX_ADDRS];
+    int norder = order_addrs(addrs, order);
+    int npfds = 0, next = 0, winner = -1;
+    int last_errno = ECONNREFUSED;
+    long long deadline = now_ms() + timeout_ms;
+    long long next_start = now_ms();
+
+    while (winner < 0) {
+        long long now = now_ms();
+        if (now >= deadline) {
+            last_errno = ETIMEDOUT;
+            break;
+        }
+
+        /* Start the next attempt when it is due */
+        if (next < norder && now >= next_start) {
+            bool done;
+            int fd = start_attempt(addrs, order[next++], &done);
+            if (fd < 0) {
+                last_errno = errno;
+                next_start = now; /* Failed at once, try the next now */
+                continue;
+            }
+            if (done) {
+                winner = fd;
+                break;
+            }
+            pfds[npfds].fd = fd;
+            pfds[npfds].events = POLLOUT;
+            npfds++;
+            next_start = now + CONNECT_ATTEMPT_DELAY_MS;
+        }
+
+        if (npfds == 0) {
+            if (next >= norder) {
+                break; /* Every attempt failed */
+            }
+            continue;
+        }
+
+        long long wait = deadline - now;
+        if (next < norder && next_start - now < wait) {
+            wait = next_start - now;
+        }
+        int rc = poll(pfds, (nfds_t)npfds, (int)(wait > 0 ? wait : 0));
+        if (rc < 0 && errno != EINTR) {
+            last_errno = errno;
+            break;
+        }
+        if (rc <= 0) {
+            continue;
+        }
+
+        for (int i = 0; i < npfds; i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0) {
+                winner = pfds[i].fd;
+                pfds[i] = pfds[--npfds];
+                break;
+            }
+
+            /* This attempt failed, so the next one may start right away */
+            last_errno = err;
+            close(pfds[i].fd);
+            pfds[i--] = pfds[--npfds];
+            next_start = now_ms();
+        }
+    }
+
+    /* Cancel the attempts that lost */
+    for (int i = 0; i < npfds; i++) {
+        close(pfds[i].fd);
+    }
+
+    if (winner < 0) {
+        errno = last_errno;
+        return -1;
+    }
+    fcntl(winner, F_SETFL, fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+    return winner;
+}
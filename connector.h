@@ -0,0 +1,37 @@
+/**
+ * @file connector.h
+ * @brief Parallel ("happy eyeballs") connection establishment
+ *
+ * open_clientfd() tries the addresses of a host one at a time with a
+ * blocking connect(), so a single unreachable address can stall a request
+ * for the kernel's whole SYN retry period. This module instead starts
+ * non-blocking connection attempts in the order recommended by RFC 8305:
+ * address families are interleaved (IPv6 first), and a new attempt is
+ * started every CONNECT_ATTEMPT_DELAY_MS, or immediately when the previous
+ * attempt fails. The first attempt to complete wins and the others are
+ * abandoned. The whole operation is bounded by a deadline.
+ */
+
+#ifndef __CONNECTOR_H__
+#define __CONNECTOR_H__
+
+#include "resolver.h"
+
+/* Delay between starting successive attempts (RFC 8305 section 5) */
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
+/* Default deadline for establishing a connection */
+#define CONNECT_TIMEOUT_MS 10000
+
+/**
+ * @brief Connect to any of a host's addresses
+ *
+ * @param[in] addrs The addresses to try, with ports filled in
+ * @param[in] timeout_ms Deadline for the whole operation
+ *
+ * @return a connected, blocking socket on success
+ * @return -1 with errno set (ETIMEDOUT if the deadline passed) on failure
+ */
+int connect_happy(const resolver_result_t *addrs, int timeout_ms);
+
+#endif /* __CONNECTOR_H__ */
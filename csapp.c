@@ -6,6 +6,7 @@
 #include "csapp.h"
 
 #include <errno.h>      /* errno */
+#include <limits.h>     /* IOV_MAX */
 #include <netdb.h>      /* freeaddrinfo() */
 #include <semaphore.h>  /* sem_t */
 #include <signal.h>     /* struct sigaction */
@@ -472,6 +473,101 @@ ssize_t rio_writen(int fd, const void *usrbuf, size_t n) {
     return (ssize_t)n;
 }
 
+/*
+ * rio_writevn - Robustly write iovcnt buffers, in order (unbuffered). A
+ *    buffer writev() leaves partly written is finished on its own, so
+ *    iov is never modified and can be written again elsewhere.
+ */
+ssize_t rio_writevn(int fd, const struct iovec *iov, int iovcnt) {
+    size_t total = 0, done = 0; /* done: bytes of iov[0] written */
+    ssize_t nwritten;
+
+    while (1) {
+        /* Skip the buffers written whole */
+        while (iovcnt > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt == 0) {
+            break;
+        }
+        if (done > 0) {
+            nwritten = rio_writen(fd, (char *)iov->iov_base + done,
+                                  iov->iov_len - done);
+            if (nwritten < 0) {
+                return -1; /* errno set by write() */
+            }
+            total += (size_t)nwritten;
+            done = iov->iov_len;
+            continue;
+        }
+        nwritten = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (nwritten <= 0) {
+            if (errno != EINTR) {
+                return -1; /* errno set by writev() */
+            }
+
+            /* Interrupted by sig handler return, call writev() again */
+            nwritten = 0;
+        }
+        total += (size_t)nwritten;
+        done = (size_t)nwritten;
+    }
+    return (ssize_t)total;
+}
+
+/*
+ * rio_resize - Move the unread bytes to the start of a new internal buffer
+ *    of the given size, in rio_small if it fits. Returns -1 if out of
+ *    memory, with the buffer as it was.
+ */
+static int rio_resize(rio_t *rp, size_t size) {
+    char *buf = rp->rio_small;
+
+    if (size > sizeof(rp->rio_small) && (buf = malloc(size)) == NULL) {
+        return -1;
+    }
+    memmove(buf, rp->rio_bufptr, (size_t)rp->rio_cnt);
+    if (rp->rio_buf != rp->rio_small) {
+        free(rp->rio_buf);
+    }
+    rp->rio_buf = rp->rio_bufptr = buf;
+    rp->rio_size = size > sizeof(rp->rio_small) ? size : sizeof(rp->rio_small);
+    return 0;
+}
+
+/*
+ * rio_fill - Read more into the internal buffer, after the unread bytes,
+ *    which are first moved to its start. A buffer the last read filled is
+ *    doubled first, up to RIO_MAXSIZE, since more is likely waiting.
+ *    Returns the number of bytes read, 0 on EOF, -1 on error. A full
+ *    buffer that cannot grow reads nothing.
+ */
+static ssize_t rio_fill(rio_t *rp) {
+    ssize_t nread;
+    size_t room;
+
+    if (!rp->rio_full || rp->rio_size >= RIO_MAXSIZE ||
+        rio_resize(rp, rp->rio_size * 2) < 0) {
+        if (rp->rio_bufptr != rp->rio_buf) {
+            memmove(rp->rio_buf, rp->rio_bufptr, (size_t)rp->rio_cnt);
+            rp->rio_bufptr = rp->rio_buf;
+        }
+    }
+    room = rp->rio_size - (size_t)rp->rio_cnt;
+    while ((nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt, room)) < 0) {
+        if (errno != EINTR) {
+            return -1; /* errno set by read() */
+        }
+
+        /* Interrupted by sig handler return, nothing to do */
+    }
+    rp->rio_cnt += nread;
+    rp->rio_full = (size_t)nread == room;
+    return nread;
+}
+
 /*
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -482,19 +578,11 @@ ssize_t rio_writen(int fd, const void *usrbuf, size_t n) {
  */
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n) {
     size_t cnt;
+    ssize_t nread;
 
-    while (rp->rio_cnt <= 0) { /* Refill if buf is empty */
-        rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
-        if (rp->rio_cnt < 0) {
-            if (errno != EINTR) {
-                return -1; /* errno set by read() */
-            }
-
-            /* Interrupted by sig handler return, nothing to do */
-        } else if (rp->rio_cnt == 0) {
-            return 0; /* EOF */
-        } else {
-            rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+    if (rp->rio_cnt == 0) { /* Refill if buf is empty */
+        if ((nread = rio_fill(rp)) <= 0) {
+            return nread; /* EOF or error */
         }
     }
 
@@ -515,7 +603,31 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n) {
 void rio_readinitb(rio_t *rp, int fd) {
     rp->rio_fd = fd;
     rp->rio_cnt = 0;
-    rp->rio_bufptr = rp->rio_buf;
+    rp->rio_buf = rp->rio_bufptr = rp->rio_small;
+    rp->rio_size = sizeof(rp->rio_small);
+    rp->rio_full = 0;
+}
+
+/*
+ * rio_idleb - Give back a grown internal buffer, keeping the unread bytes
+ *    if they fit in a small one. Call when no more data is expected soon.
+ */
+void rio_idleb(rio_t *rp) {
+    if (rp->rio_buf != rp->rio_small &&
+        (size_t)rp->rio_cnt <= sizeof(rp->rio_small)) {
+        rio_resize(rp, sizeof(rp->rio_small));
+    }
+    rp->rio_full = 0;
+}
+
+/*
+ * rio_freeb - Give back a grown internal buffer, discarding unread bytes
+ */
+void rio_freeb(rio_t *rp) {
+    if (rp->rio_buf != rp->rio_small) {
+        free(rp->rio_buf);
+    }
+    rio_readinitb(rp, rp->rio_fd);
 }
 
 /*
@@ -539,32 +651,92 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
 }
 
 /*
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readanyb - Read up to n bytes, returning as soon as any are
+ *    available (buffered). Reads of RIO_BUFSIZE or more bypass the
+ *    internal buffer once it is empty, unless it is larger still.
+ */
+ssize_t rio_readanyb(rio_t *rp, void *usrbuf, size_t n) {
+    ssize_t nread;
+
+    if (rp->rio_cnt > 0 || n < RIO_BUFSIZE || n < rp->rio_size) {
+        return rio_read(rp, usrbuf, n);
+    }
+    while ((nread = read(rp->rio_fd, usrbuf, n)) < 0) {
+        if (errno != EINTR) {
+            return -1; /* errno set by read() */
+        }
+    }
+    return nread;
+}
+
+/*
+ * rio_readlineb - Robustly read a text line (buffered). The buffer is
+ *    searched for the end of the line with memchr() and the line copied
+ *    out in one piece, rather than a byte at a time.
  */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
-    size_t n;
+    size_t n = 0, cnt;
     ssize_t rc;
-    char c, *bufp = usrbuf;
+    char *bufp = usrbuf, *lf = NULL;
 
-    for (n = 1; n < maxlen; n++) {
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-            *bufp++ = c;
-            if (c == '\n') {
-                n++;
-                break;
+    while (lf == NULL && n + 1 < maxlen) {
+        if (rp->rio_cnt == 0 && (rc = rio_fill(rp)) <= 0) {
+            if (rc < 0) {
+                return -1; /* Error */
             }
-        } else if (rc == 0) {
-            if (n == 1) {
-                return 0; /* EOF, no data read */
-            } else {
-                break; /* EOF, some data was read */
+            break; /* EOF, with or without data read */
+        }
+        cnt = maxlen - 1 - n;
+        if ((size_t)rp->rio_cnt < cnt) {
+            cnt = (size_t)rp->rio_cnt;
+        }
+        if ((lf = memchr(rp->rio_bufptr, '\n', cnt)) != NULL) {
+            cnt = (size_t)(lf - rp->rio_bufptr) + 1;
+        }
+        memcpy(bufp + n, rp->rio_bufptr, cnt);
+        rp->rio_bufptr += cnt;
+        rp->rio_cnt -= cnt;
+        n += cnt;
+    }
+    if (maxlen > 0) {
+        bufp[n] = 0;
+    }
+    return (ssize_t)n;
+}
+
+/*
+ * rio_viewlineb - Read a text line without copying it (buffered). Points
+ *    *linep at the line, LF included but not NUL terminated, inside the
+ *    internal buffer, where it stays valid until the next read from rp.
+ *    The buffer grows to hold a long line; one longer than RIO_MAXSIZE
+ *    comes back a buffer-full at a time, and the last one before EOF may
+ *    lack its LF. Returns its length, 0 on EOF, -1 on error.
+ */
+ssize_t rio_viewlineb(rio_t *rp, const char **linep) {
+    size_t scanned = 0, n;
+    ssize_t rc;
+    char *lf;
+
+    while ((lf = memchr(rp->rio_bufptr + scanned, '\n',
+                        (size_t)rp->rio_cnt - scanned)) == NULL) {
+        scanned = (size_t)rp->rio_cnt;
+        if (scanned == rp->rio_size) {
+            if (scanned >= RIO_MAXSIZE) {
+                break; /* Longer than the buffer can grow */
             }
-        } else {
+            rp->rio_full = 1; /* Have rio_fill() grow it */
+        }
+        if ((rc = rio_fill(rp)) < 0) {
             return -1; /* Error */
+        } else if (rc == 0) {
+            break; /* EOF */
         }
     }
-    *bufp = 0;
-    return (ssize_t)(n - 1);
+    n = lf != NULL ? (size_t)(lf - rp->rio_bufptr) + 1 : (size_t)rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return (ssize_t)n;
 }
 
 /********************************
@@ -41,18 +41,29 @@
 #include <stdarg.h>    /* va_list */
 #include <stddef.h>    /* size_t */
 #include <sys/types.h> /* ssize_t */
+#include <sys/uio.h>   /* struct iovec */
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 #define DEF_MODE S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH
 #define DEF_UMASK S_IWGRP | S_IWOTH
 
-/* Persistent state for the robust I/O (Rio) package */
-#define RIO_BUFSIZE 8192
+/*
+ * Persistent state for the robust I/O (Rio) package. The internal buffer
+ * starts small, inside the rio_t, and moves to the heap and doubles each
+ * time a read fills it, up to RIO_MAXSIZE. A grown buffer must be given
+ * back with rio_freeb(), or with rio_idleb() while the descriptor is idle.
+ */
+#define RIO_MINSIZE 2048          /* Size of a buffer that has not grown */
+#define RIO_BUFSIZE 8192          /* Reads below this are always buffered */
+#define RIO_MAXSIZE (64 * 1024)   /* Most a buffer grows to */
 typedef struct {
-    int rio_fd;                /* Descriptor for this internal buf */
-    ssize_t rio_cnt;           /* Unread bytes in internal buf */
-    char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    int rio_fd;                   /* Descriptor for this internal buf */
+    ssize_t rio_cnt;              /* Unread bytes in internal buf */
+    char *rio_bufptr;             /* Next unread byte in internal buf */
+    char *rio_buf;                /* Internal buffer, rio_small or heap */
+    size_t rio_size;              /* Size of rio_buf */
+    int rio_full;                 /* Whether the last read filled it */
+    char rio_small[RIO_MINSIZE];  /* Internal buffer until it grows */
 } rio_t;
 
 /* External variables */
@@ -93,9 +104,14 @@ void Free(void *ptr);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, const void *usrbuf, size_t n);
+ssize_t rio_writevn(int fd, const struct iovec *iov, int iovcnt);
 void rio_readinitb(rio_t *rp, int fd);
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t rio_readanyb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_viewlineb(rio_t *rp, const char **linep);
+void rio_idleb(rio_t *rp);
+void rio_freeb(rio_t *rp);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(const char *hostname, const char *port);
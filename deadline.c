@@ -0,0 +1,77 @@
+/**
+ * @file deadline.c
+ * @brief Socket deadlines built on the timer wheel
+ */
+
+#include "deadline.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static const char *deadline_names[DEADLINE_KINDS] = {
+    "header", "first_byte", "idle", "total", "tunnel"};
+
+static unsigned deadline_ms[DEADLINE_KINDS] = {
+    HEADER_TIMEOUT_MS, FIRST_BYTE_TIMEOUT_MS, IDLE_TIMEOUT_MS,
+    TOTAL_TIMEOUT_MS, TUNNEL_TIMEOUT_MS};
+
+static const metric_t deadline_metrics[DEADLINE_KINDS] = {
+    METRIC_TIMEOUTS_HEADER, METRIC_TIMEOUTS_FIRST_BYTE, METRIC_TIMEOUTS_IDLE,
+    METRIC_TIMEOUTS_TOTAL, METRIC_TIMEOUTS_TUNNEL};
+
+int deadline_configure(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL) {
+        return -1;
+    }
+    for (int k = 0; k < DEADLINE_KINDS; k++) {
+        size_t len = strlen(deadline_names[k]);
+        if ((size_t)(eq - spec) == len &&
+            strncmp(spec, deadline_names[k], len) == 0) {
+            deadline_ms[k] = (unsigned)strtoul(eq + 1, NULL, 10);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+unsigned deadline_duration(deadline_kind kind) {
+    return deadline_ms[kind];
+}
+
+/* deadline_expired - Timer callback: shut the socket down */
+static void deadline_expired(tw_timer_t *timer, void *arg) {
+    deadline_t *d = arg;
+    (void)timer;
+
+    __atomic_store_n(&d->fired, true, __ATOMIC_RELEASE);
+    metrics_inc(deadline_metrics[d->kind]);
+    shutdown(d->fd, d->how);
+}
+
+void deadline_start(deadline_t *d, int fd, int how, deadline_kind kind) {
+    d->fd = fd;
+    d->how = how;
+    d->kind = kind;
+    d->fired = false;
+    timer_init(&d->timer, deadline_expired, d);
+    timer_arm(&d->timer, deadline_ms[kind]);
+}
+
+void deadline_rearm(deadline_t *d, deadline_kind kind) {
+    if (kind != d->kind) {
+        timer_cancel(&d->timer);
+        d->kind = kind;
+    }
+    timer_arm(&d->timer, deadline_ms[kind]);
+}
+
+void deadline_stop(deadline_t *d) {
+    timer_cancel(&d->timer);
+}
+
+bool deadline_fired(deadline_t *d) {
+    return __atomic_load_n(&d->fired, __ATOMIC_ACQUIRE);
+}
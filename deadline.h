@@ -0,0 +1,104 @@
+/**
+ * @file deadline.h
+ * @brief Socket deadlines built on the timer wheel
+ *
+ * The proxy uses blocking I/O, one thread per request. A deadline bounds
+ * how long such a thread may wait on a silent peer: when it passes, the
+ * socket is shut down, which wakes the blocked read or write with EOF or an
+ * error. The thread then checks deadline_fired() to tell a timeout from a
+ * genuine disconnect and answers with 408 or 504 as appropriate.
+ *
+ * Each kind of deadline has its own configurable duration and its own
+ * timeout counter in the metrics.
+ */
+
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+#include "timerwheel.h"
+
+#include <stdbool.h>
+
+/* Default durations */
+#define HEADER_TIMEOUT_MS 20000      // Reading a request's headers
+#define FIRST_BYTE_TIMEOUT_MS 30000  // Origin's first response byte
+#define IDLE_TIMEOUT_MS 30000        // Silence between response reads
+#define TOTAL_TIMEOUT_MS 300000      // Whole upstream transfer
+#define TUNNEL_TIMEOUT_MS 300000     // Silence in both directions of a tunnel
+
+/**
+ * @brief The kinds of deadline
+ */
+typedef enum {
+    DEADLINE_HEADER,     /**< client must finish sending its request */
+    DEADLINE_FIRST_BYTE, /**< origin must start responding */
+    DEADLINE_IDLE,       /**< origin must not go silent mid-response */
+    DEADLINE_TOTAL,      /**< the whole transfer must finish */
+    DEADLINE_TUNNEL,     /**< a CONNECT tunnel must not go silent */
+    DEADLINE_KINDS
+} deadline_kind;
+
+/**
+ * @brief A deadline on one socket
+ */
+typedef struct {
+    tw_timer_t timer;   /**< timer wheel entry */
+    int fd;             /**< socket shut down on expiry */
+    int how;            /**< SHUT_RD, SHUT_WR or SHUT_RDWR */
+    deadline_kind kind; /**< deadline currently enforced */
+    bool fired;         /**< set (atomically) on expiry */
+} deadline_t;
+
+/**
+ * @brief Set the duration of one kind of deadline
+ *
+ * @param[in] spec "kind=ms", e.g. "idle=5000"
+ *
+ * @return 0 on success, -1 if spec is invalid
+ */
+int deadline_configure(const char *spec);
+
+/**
+ * @brief Get the duration of one kind of deadline
+ *
+ * @param[in] kind The kind of deadline
+ *
+ * @return The duration in ms
+ */
+unsigned deadline_duration(deadline_kind kind);
+
+/**
+ * @brief Start enforcing a deadline on a socket
+ *
+ * @param[in] d The deadline
+ * @param[in] fd The socket to shut down on expiry
+ * @param[in] how How to shut it down, as for shutdown()
+ * @param[in] kind The deadline to enforce from now on
+ */
+void deadline_start(deadline_t *d, int fd, int how, deadline_kind kind);
+
+/**
+ * @brief Restart a deadline, possibly switching to another kind
+ *
+ * @param[in] d The deadline
+ * @param[in] kind The deadline to enforce from now on
+ */
+void deadline_rearm(deadline_t *d, deadline_kind kind);
+
+/**
+ * @brief Stop enforcing a deadline
+ *
+ * @param[in] d The deadline
+ */
+void deadline_stop(deadline_t *d);
+
+/**
+ * @brief Check whether a deadline has expired
+ *
+ * @param[in] d The deadline
+ *
+ * @return true if the socket was shut down because the deadline passed
+ */
+bool deadline_fired(deadline_t *d);
+
+#endif /* __DEADLINE_H__ */
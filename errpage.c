@@ -0,0 +1,134 @@
+/**
+ * @file errpage.c
+ * @brief Error responses, built once at startup
+ */
+
+#include "errpage.h"
+#include "csapp.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The parts of a page on either side of its message and of any detail */
+#define PAGE_HEAD                                                              \
+    "HTTP/1.0 %s %s\r\n"                                                       \
+    "Content-Type: text/html\r\n"                                              \
+    "Content-Length: "
+#define PAGE_BODY                                                              \
+    "<!DOCTYPE html>\r\n"                                                      \
+    "<html>\r\n"                                                               \
+    "<head><title>Tiny Error</title></head>\r\n"                               \
+    "<body bgcolor=\"ffffff\">\r\n"                                            \
+    "<h1>%s: %s</h1>\r\n"                                                      \
+    "<p>%s"
+#define PAGE_TAIL                                                              \
+    "</p>\r\n"                                                                 \
+    "<hr /><em>The Tiny Web server</em>\r\n"                                   \
+    "</body></html>\r\n"
+
+typedef struct {
+    const char *status;  // Status code
+    const char *reason;  // Reason phrase
+    const char *message; // What the body says
+} error_info;
+
+#define ERRPAGE_ENTRY(id, status, reason, message) {status, reason, message},
+static const error_info errors[ERRPAGE_COUNT] = {ERRPAGE_LIST(ERRPAGE_ENTRY)};
+#undef ERRPAGE_ENTRY
+
+/* A built response, split where a detail changes it */
+typedef struct {
+    char *blob;        // The whole response, without a detail
+    size_t len;        // Bytes in blob
+    size_t length_at;  // Offset of the Content-Length value
+    size_t length_end; // Offset just past it
+    size_t detail_at;  // Offset a detail goes at, right after the message
+    size_t body_len;   // Content-Length without a detail
+} page_t;
+
+/* Set by errpage_init() before any thread sends one, read-only after */
+static page_t pages[ERRPAGE_COUNT];
+
+void errpage_init(void) {
+    for (int i = 0; i < ERRPAGE_COUNT; i++) {
+        const error_info *e = &errors[i];
+        page_t *p = &pages[i];
+        char head[MAXLINE], body[MAXBUF], length[32];
+
+        size_t head_len = (size_t)snprintf(head, sizeof(head), PAGE_HEAD,
+                                           e->status, e->reason);
+        size_t body_len = (size_t)snprintf(body, sizeof(body), PAGE_BODY,
+                                           e->status, e->reason, e->message);
+        p->body_len = body_len + strlen(PAGE_TAIL);
+        size_t length_len = (size_t)snprintf(length, sizeof(length),
+                                             "%zu\r\n\r\n", p->body_len);
+
+        p->len = head_len + length_len + p->body_len;
+        p->blob = Malloc(p->len);
+        p->length_at = head_len;
+        p->length_end = head_len + length_len - 4;
+        p->detail_at = head_len + length_len + body_len;
+        memcpy(p->blob, head, head_len);
+        memcpy(p->blob + p->length_at, length, length_len);
+        memcpy(p->blob + p->length_end + 4, body, body_len);
+        memcpy(p->blob + p->detail_at, PAGE_TAIL, strlen(PAGE_TAIL));
+    }
+}
+
+/* escape - Copy at most n bytes of text into out, HTML escaped */
+static size_t escape(char *out, const char *text, size_t n) {
+    size_t len = 0;
+
+    for (size_t i = 0; i < n && text[i] != '\0'; i++) {
+        const char *entity = NULL;
+        switch (text[i]) {
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '&':
+            entity = "&amp;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        default:
+            out[len++] = text[i];
+            continue;
+        }
+        memcpy(out + len, entity, strlen(entity));
+        len += strlen(entity);
+    }
+    return len;
+}
+
+int errpage_iov(errpage_id id, const char *detail, struct iovec *iov,
+                char *scratch) {
+    const page_t *p = &pages[id];
+
+    if (detail == NULL) {
+        iov[0].iov_base = p->blob;
+        iov[0].iov_len = p->len;
+        return 1;
+    }
+
+    /* The escaped detail goes after the length in scratch */
+    char *text = scratch + 32;
+    memcpy(text, ": ", 2);
+    size_t text_len = 2 + escape(text + 2, detail, ERRPAGE_MAX_DETAIL - 2);
+    int length_len = snprintf(scratch, 32, "%zu", p->body_len + text_len);
+
+    iov[0].iov_base = p->blob;
+    iov[0].iov_len = p->length_at;
+    iov[1].iov_base = scratch;
+    iov[1].iov_len = (size_t)length_len;
+    iov[2].iov_base = p->blob + p->length_end;
+    iov[2].iov_len = p->detail_at - p->length_end;
+    iov[3].iov_base = text;
+    iov[3].iov_len = text_len;
+    iov[4].iov_base = p->blob + p->detail_at;
+    iov[4].iov_len = p->len - p->detail_at;
+    return ERRPAGE_IOV;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file errpage.h
+ * @brief Error responses, built once at startup
+ *
+ * Every error the proxy answers a client with is listed in ERRPAGE_LIST
+ * with its status, reason phrase and message. errpage_init() formats each
+ * into one immutable blob, status line, headers and HTML body together, so
+ * sending one formats nothing and is a single write: a 503 shed under
+ * overload or a 400 for a flood of garbage costs no more than the write.
+ *
+ * A response may carry a detail for the request, such as the origin that
+ * could not be reached, after its message. It is sent as the blob's pieces
+ * around the detail, HTML escaped, and a Content-Length that counts it:
+ *
+ *     struct iovec iov[ERRPAGE_IOV];
+ *     char scratch[ERRPAGE_SCRATCH];
+ *     int n = errpage_iov(ERRPAGE_NO_CONNECT, "example.com:80", iov, scratch);
+ *     ...write iov[0..n), which refers to scratch
+ *
+ * To add an error, add a line to ERRPAGE_LIST.
+ */
+
+#ifndef __ERRPAGE_H__
+#define __ERRPAGE_H__
+
+#include <sys/uio.h>
+
+/* X(identifier, status, reason phrase, message) */
+#define ERRPAGE_LIST(X)                                                        \
+    X(BAD_REQUEST, "400", "Bad Request",                                       \
+      "Proxy received a malformed request")                                    \
+    X(NO_AUTHORITY, "400", "Bad Request",                                      \
+      "Proxy needs the origin's authority")                                    \
+    X(NO_TUNNEL_PORT, "400", "Bad Request", "Proxy needs a port to tunnel to") \
+    X(BAD_LENGTH, "400", "Bad Request",                                        \
+      "Proxy received an invalid Content-Length")                              \
+    X(NO_ROUTE, "404", "Not Found", "Proxy has no route for this request")     \
+    X(HEADER_TIMEOUT, "408", "Request Timeout",                                \
+      "Proxy timed out waiting for the request")                               \
+    X(HEADERS_TOO_LARGE, "431", "Request Header Fields Too Large",             \
+      "Proxy could not buffer request headers")                                \
+    X(NO_METHOD, "501", "Not Implemented",                                     \
+      "Proxy does not implement this method")                                  \
+    X(NO_CODING, "501", "Not Implemented",                                     \
+      "Proxy does not implement this transfer coding")                         \
+    X(NO_REVERSE_TUNNEL, "501", "Not Implemented",                             \
+      "Proxy does not tunnel as a reverse proxy")                              \
+    X(BAD_RESPONSE, "502", "Bad Gateway",                                      \
+      "Proxy received a malformed response")                                   \
+    X(NO_RESOLVE, "502", "Bad Gateway", "Proxy could not resolve the origin")  \
+    X(NO_CONNECT, "502", "Bad Gateway",                                        \
+      "Proxy could not connect to the origin")                                 \
+    X(ORIGIN_FAILING, "503", "Service Unavailable",                            \
+      "Proxy stopped sending requests to a failing origin")                    \
+    X(BACKENDS_FAILING, "503", "Service Unavailable",                          \
+      "Proxy found every backend for this request failing")                    \
+    X(ORIGIN_BUSY, "503", "Service Unavailable",                               \
+      "Proxy has too many requests waiting for the origin")                    \
+    X(ORIGIN_TIMEOUT, "504", "Gateway Timeout",                                \
+      "Proxy timed out waiting for the origin")                                \
+    X(BAD_VERSION, "505", "HTTP Version Not Supported",                        \
+      "Proxy speaks HTTP/1.0 and HTTP/1.1")
+
+#define ERRPAGE_ENUM(id, status, reason, message) ERRPAGE_##id,
+typedef enum { ERRPAGE_LIST(ERRPAGE_ENUM) ERRPAGE_COUNT } errpage_id;
+#undef ERRPAGE_ENUM
+
+#define ERRPAGE_IOV 5          // Most buffers a response is sent as
+#define ERRPAGE_MAX_DETAIL 256 // Longest detail kept, before escaping
+
+/* Room errpage_iov() builds a detail in: its length, then every byte escaped */
+#define ERRPAGE_SCRATCH (32 + 6 * ERRPAGE_MAX_DETAIL)
+
+/**
+ * @brief Build every error response
+ *
+ * Call once, before any thread sends one.
+ */
+void errpage_init(void);
+
+/**
+ * @brief Get the buffers to send an error response as
+ *
+ * @param[in] id The error
+ * @param[in] detail Text to add after its message, or NULL for none
+ * @param[out] iov Set to the buffers, at most ERRPAGE_IOV of them
+ * @param[out] scratch ERRPAGE_SCRATCH bytes the detail's buffers are built
+ *     in, which must outlive the write
+ *
+ * @return The number of buffers: 1 without a detail
+ */
+int errpage_iov(errpage_id id, const char *detail, struct iovec *iov,
+                char *scratch);
+
+#endif /* __ERRPAGE_H__ */
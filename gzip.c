@@ -0,0 +1,122 @@
+/**
+ * @file gzip.c
+ * @brief On-the-fly gzip compression of response bodies
+ */
+
+#include "gzip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* windowBits above 15 selects the gzip wrapper rather than zlib's */
+#define GZIP_WRAPPER 16
+
+static int gzip_level = GZIP_LEVEL;
+
+/* Media types compressed, besides text/ (matched on the type alone) */
+static const char *compressible[] = {
+    "application/json", "application/javascript", "application/xml",
+    "application/xhtml+xml", "image/svg+xml"};
+
+void gzip_configure(int level) {
+    gzip_level = level;
+}
+
+bool gzip_enabled(void) {
+    return gzip_level > 0;
+}
+
+/* zero_q - Whether the parameters of a list element say q=0 */
+static bool zero_q(const char *p, size_t len) {
+    const char *end = p + len;
+
+    while ((p = memchr(p, ';', (size_t)(end - p))) != NULL) {
+        p++;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            return strtod(p + 2, NULL) == 0.0;
+        }
+    }
+    return false;
+}
+
+bool gzip_accepted(const char *accept_encoding) {
+    const char *p = accept_encoding;
+
+    while (*p != '\0' && *p != '\r' && *p != '\n') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        size_t len = strcspn(p, ",\r\n");
+        size_t token = strcspn(p, ";, \t");
+        if (token > len) {
+            token = len;
+        }
+        if (((token == 4 && strncasecmp(p, "gzip", 4) == 0) ||
+             (token == 1 && *p == '*')) &&
+            !zero_q(p, len)) {
+            return true;
+        }
+        p += len;
+    }
+    return false;
+}
+
+bool gzip_compressible(const char *content_type) {
+    while (*content_type == ' ' || *content_type == '\t') {
+        content_type++;
+    }
+    size_t len = strcspn(content_type, "; \t\r\n");
+
+    /* An event stream must not wait for a compressor to fill up */
+    if (len > 5 && strncasecmp(content_type, "text/", 5) == 0) {
+        return !(len == 17 &&
+                 strncasecmp(content_type, "text/event-stream", 17) == 0);
+    }
+    for (size_t i = 0; i < sizeof(compressible) / sizeof(compressible[0]);
+         i++) {
+        if (strlen(compressible[i]) == len &&
+            strncasecmp(content_type, compressible[i], len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int gzip_init(gzip_t *g) {
+    memset(g, 0, sizeof(*g));
+    if (deflateInit2(&g->z, gzip_level, Z_DEFLATED,
+                     GZIP_WINDOW_BITS + GZIP_WRAPPER, GZIP_MEM_LEVEL,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+size_t gzip_deflate(gzip_t *g, const char **in, size_t *inlen, char *out,
+                    size_t room, bool finish) {
+    g->z.next_in = (Bytef *)*in;
+    g->z.avail_in = (uInt)*inlen;
+    g->z.next_out = (Bytef *)out;
+    g->z.avail_out = (uInt)room;
+
+    int rc = deflate(&g->z, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+        g->done = true;
+    }
+
+    *in += *inlen - g->z.avail_in;
+    *inlen = g->z.avail_in;
+    return room - g->z.avail_out;
+}
+
+bool gzip_done(const gzip_t *g) {
+    return g->done;
+}
+
+void gzip_end(gzip_t *g) {
+    deflateEnd(&g->z);
+}
@@ -0,0 +1,122 @@
+/**
+ * @file gzip.h
+ * @brief On-the-fly gzip compression of response bodies
+ *
+ * A response is compressed when the client accepts gzip, the origin did
+ * not encode it already and its Content-Type is one that compresses well
+ * (text, JSON, JavaScript, XML, SVG). The body is compressed as it is
+ * relayed, so memory stays bounded however large it is: each response
+ * being compressed holds one deflate state, sized by GZIP_WINDOW_BITS and
+ * GZIP_MEM_LEVEL to (1 << (GZIP_WINDOW_BITS + 2)) + (1 << (GZIP_MEM_LEVEL
+ * + 9)) bytes, 128 KB by default, plus the proxy's relay buffer.
+ *
+ * The compressed response carries "Vary: Accept-Encoding" and a weakened
+ * ETag, so that caches keep it apart from the identity variant and can
+ * store it, instead of it being produced again for every client.
+ *
+ *     gzip_t g;
+ *     gzip_init(&g);
+ *     ...for each span of body, and once more with finish set at its end:
+ *     do {
+ *         n = gzip_deflate(&g, &in, &inlen, out, room, finish);
+ *         send(out, n);
+ *     } while (inlen > 0 || (finish && !gzip_done(&g)));
+ *     gzip_end(&g);
+ */
+
+#ifndef __GZIP_H__
+#define __GZIP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#define GZIP_LEVEL 1        // Default compression level; see gzipbench
+#define GZIP_WINDOW_BITS 14 // 16 KB of history
+#define GZIP_MEM_LEVEL 7    // 32 KB of hash chains
+#define GZIP_MIN_LENGTH 100 // Smaller bodies gain nothing from compression
+
+/**
+ * @brief Compression state of one response body
+ */
+typedef struct {
+    z_stream z; /**< deflate state */
+    bool done;  /**< the gzip trailer has been produced */
+} gzip_t;
+
+/**
+ * @brief Set the compression level
+ *
+ * @param[in] level 1 (fastest) to 9 (smallest), or 0 to disable
+ */
+void gzip_configure(int level);
+
+/**
+ * @brief Check whether the proxy compresses responses
+ *
+ * @return true unless the level is 0
+ */
+bool gzip_enabled(void);
+
+/**
+ * @brief Check whether a client accepts gzip
+ *
+ * Whether the proxy compresses does not matter: an origin may send gzip.
+ *
+ * @param[in] accept_encoding The value of its Accept-Encoding header
+ *
+ * @return true if gzip (or "*") is listed without q=0
+ */
+bool gzip_accepted(const char *accept_encoding);
+
+/**
+ * @brief Check whether a media type is worth compressing
+ *
+ * @param[in] content_type The value of a Content-Type header, parameters
+ *     and all
+ *
+ * @return true for text and the structured text formats
+ */
+bool gzip_compressible(const char *content_type);
+
+/**
+ * @brief Start compressing a body
+ *
+ * @param[in] g The compression state
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int gzip_init(gzip_t *g);
+
+/**
+ * @brief Compress as much input as fits in the output buffer
+ *
+ * @param[in] g The compression state
+ * @param[in,out] in The input; advanced past what was consumed
+ * @param[in,out] inlen Bytes of input; decreased by what was consumed
+ * @param[out] out Where the compressed bytes go
+ * @param[in] room Size of out
+ * @param[in] finish Whether this is the end of the body
+ *
+ * @return The number of bytes written to out
+ */
+size_t gzip_deflate(gzip_t *g, const char **in, size_t *inlen, char *out,
+                    size_t room, bool finish);
+
+/**
+ * @brief Check whether the whole body, trailer included, has been produced
+ *
+ * @param[in] g The compression state
+ *
+ * @return true once gzip_deflate() with finish set has returned everything
+ */
+bool gzip_done(const gzip_t *g);
+
+/**
+ * @brief Free the compression state
+ *
+ * @param[in] g The compression state
+ */
+void gzip_end(gzip_t *g);
+
+#endif /* __GZIP_H__ */
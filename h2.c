@@ -0,0 +1,1099 @@
+/**
+ * @file h2.c
+ * @brief HTTP/2 cleartext (h2c) frontend
+ */
+
+#include "h2.h"
+#include "chunked.h"
+#include "deadline.h"
+#include "hpack.h"
+#include "metrics.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Frame types */
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_PRIORITY 0x2
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_PUSH_PROMISE 0x5
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION 0x9
+
+/* Frame flags */
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+/* Error codes */
+#define ERR_NO_ERROR 0x0
+#define ERR_PROTOCOL 0x1
+#define ERR_INTERNAL 0x2
+#define ERR_FLOW_CONTROL 0x3
+#define ERR_STREAM_CLOSED 0x5
+#define ERR_FRAME_SIZE 0x6
+#define ERR_REFUSED_STREAM 0x7
+#define ERR_COMPRESSION 0x9
+#define ERR_ENHANCE_YOUR_CALM 0xb
+
+/* Settings */
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define FRAME_HEADER 9        // Bytes before each frame's payload
+#define MAX_WINDOW 0x7fffffff // Largest flow control window
+#define HEAD_MAX MAXBUF       // Largest response head turned into HEADERS
+
+/* Result of reading a frame: go on, or stop without a GOAWAY */
+#define READ_OK 0
+#define READ_STOP (-1)
+
+typedef struct h2_conn h2_conn_t;
+
+/* One request and its response */
+typedef struct h2_stream {
+    h2_conn_t *c;              // Connection the stream is on
+    uint32_t id;               // Stream identifier
+    long window;               // Send window
+    long recv_window;          // Receive window, the reader's alone
+    bool reset;                // No more frames may be sent on it
+    bool done;                 // Handler has finished; freed by the reader
+    bool body_open;            // Client may still send DATA
+    bool chunked;              // Body is re-framed as chunked for the handler
+    int body[2];               // Body socket pair: handler reads [0]
+    pipeline_t *pl;            // Turns the response into frames
+    pl_slot_t *slot;           // The response's slot in pl
+    h2_request_t req;          // The request, pointing into the fields below
+    bool bad;                  // Header block was not a valid request
+    const char *host;          // Value of a host field
+    char fields[2 * MAXLINE];  // Pseudo-header values, NUL terminated
+    size_t fieldslen;          // Bytes used in fields
+    char headers[MAXBUF];      // Other header fields, CRLF terminated
+    size_t headerslen;         // Bytes used in headers
+    char head[HEAD_MAX];       // Response head collected so far
+    size_t headlen;            // Bytes in head
+    bool head_sent;            // HEADERS has been sent
+    struct h2_stream *next;    // Next stream of the connection
+} h2_stream_t;
+
+struct h2_conn {
+    int fd;                      // Client socket
+    rio_t *rp;                   // Client read buffer
+    h2_handler_t handler;        // Run for every request
+    pthread_mutex_t write_lock;  // Keeps frames whole on the socket
+    pthread_mutex_t lock;        // Protects everything up to the reader's
+    pthread_cond_t cond;         // Windows grew, or a stream finished
+    long window;                 // Connection send window
+    long initial_window;         // Send window of new streams
+    int active;                  // Streams whose handler is running
+    bool closed;                 // No more frames can be sent
+    bool idling;                 // Idle deadline is armed
+    deadline_t idle;             // Closes a connection with no streams
+    h2_stream_t *streams;        // All streams not yet freed
+    uint32_t last_id;            // Highest stream the client opened
+    uint32_t block_id;           // Stream of a header block in progress
+    bool block_end;              // That block's HEADERS ended the stream
+    size_t blocklen;             // Bytes of the header block so far
+    hpack_decoder_t hpack;       // Client's header compression state
+    uint8_t frame[H2_MAX_FRAME]; // Payload of the frame being read
+    uint8_t block[H2_MAX_HEADER_BLOCK];
+    char scratch[2 * H2_MAX_HEADER_BLOCK]; // Huffman decoded strings
+};
+
+static const char preface_rest[] = "\r\nSM\r\n\r\n";
+
+/* Response fields that only make sense on an HTTP/1 connection */
+static const char *hop_by_hop[] = {"connection", "keep-alive",
+                                   "proxy-connection", "transfer-encoding",
+                                   "upgrade", "te"};
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+           p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/*
+ * frame_out - Write one frame, its header and payload in one writev();
+ *     the caller holds the write lock
+ */
+static int frame_out(h2_conn_t *c, int type, int flags, uint32_t id,
+                     const void *payload, size_t len) {
+    uint8_t header[FRAME_HEADER];
+    struct iovec iov[2] = {{header, FRAME_HEADER}, {(void *)payload, len}};
+
+    header[0] = (uint8_t)(len >> 16);
+    header[1] = (uint8_t)(len >> 8);
+    header[2] = (uint8_t)len;
+    header[3] = (uint8_t)type;
+    header[4] = (uint8_t)flags;
+    put32(header + 5, id);
+    if (rio_writevn(c->fd, iov, len > 0 ? 2 : 1) < 0) {
+        pthread_mutex_lock(&c->lock);
+        c->closed = true;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_frame(h2_conn_t *c, int type, int flags, uint32_t id,
+                       const void *payload, size_t len) {
+    pthread_mutex_lock(&c->write_lock);
+    int rc = frame_out(c, type, flags, id, payload, len);
+    pthread_mutex_unlock(&c->write_lock);
+    return rc;
+}
+
+static void write_rst(h2_conn_t *c, uint32_t id, uint32_t error) {
+    uint8_t payload[4];
+    put32(payload, error);
+    write_frame(c, FRAME_RST_STREAM, 0, id, payload, sizeof(payload));
+}
+
+static void write_window_update(h2_conn_t *c, uint32_t id, size_t n) {
+    uint8_t payload[4];
+    put32(payload, (uint32_t)n);
+    write_frame(c, FRAME_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+static void write_goaway(h2_conn_t *c, uint32_t error) {
+    uint8_t payload[8];
+    put32(payload, c->last_id);
+    put32(payload + 4, error);
+    write_frame(c, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+/*
+ * send_block - Send a header block as HEADERS and as many CONTINUATION
+ *     frames as it takes, with nothing in between
+ */
+static int send_block(h2_stream_t *s, const uint8_t *block, size_t len) {
+    h2_conn_t *c = s->c;
+    int type = FRAME_HEADERS;
+    int rc = 0;
+
+    pthread_mutex_lock(&c->write_lock);
+    do {
+        size_t n = len < H2_MAX_FRAME ? len : H2_MAX_FRAME;
+        int flags = n == len ? FLAG_END_HEADERS : 0;
+        rc = frame_out(c, type, flags, s->id, block, n);
+        type = FRAME_CONTINUATION;
+        block += n;
+        len -= n;
+    } while (rc == 0 && len > 0);
+    pthread_mutex_unlock(&c->write_lock);
+    return rc;
+}
+
+/* send_data - Send DATA frames as the flow control windows allow */
+static int send_data(h2_stream_t *s, const char *p, size_t len) {
+    h2_conn_t *c = s->c;
+
+    while (len > 0) {
+        pthread_mutex_lock(&c->lock);
+        while (!c->closed && !s->reset && (s->window <= 0 || c->window <= 0)) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        if (c->closed || s->reset) {
+            pthread_mutex_unlock(&c->lock);
+            return -1;
+        }
+        size_t n = len < H2_MAX_FRAME ? len : H2_MAX_FRAME;
+        if ((long)n > s->window) {
+            n = (size_t)s->window;
+        }
+        if ((long)n > c->window) {
+            n = (size_t)c->window;
+        }
+        s->window -= (long)n;
+        c->window -= (long)n;
+        pthread_mutex_unlock(&c->lock);
+
+        if (write_frame(c, FRAME_DATA, 0, s->id, p, n) < 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static bool is_hop_by_hop(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(hop_by_hop) / sizeof(hop_by_hop[0]); i++) {
+        if (strlen(hop_by_hop[i]) == len &&
+            memcmp(hop_by_hop[i], name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t trim(const char *p, size_t len, const char **start) {
+    while (len > 0 && (*p == ' ' || *p == '\t')) {
+        p++;
+        len--;
+    }
+    while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t' ||
+                       p[len - 1] == '\r')) {
+        len--;
+    }
+    *start = p;
+    return len;
+}
+
+/*
+ * send_head - Turn the HTTP/1 response head in s->head[0..len) into a
+ *     HEADERS frame. Returns the status, or -1 if the head is unusable.
+ */
+static int send_head(h2_stream_t *s, size_t len) {
+    uint8_t block[2 * HEAD_MAX];
+    size_t blocklen;
+    char *p = s->head, *end = s->head + len;
+    char *eol = memchr(p, '\n', len);
+    int status;
+
+    if (sscanf(p, "HTTP/%*d.%*d %3d", &status) != 1 || status < 100 ||
+        status > 999) {
+        return -1;
+    }
+    if (status < 200) {
+        return status; /* Interim responses are not passed on */
+    }
+
+    blocklen = hpack_encode_status(block, status);
+    for (p = eol + 1; p < end; p = eol + 1) {
+        eol = memchr(p, '\n', (size_t)(end - p));
+        char *colon = memchr(p, ':', (size_t)(eol - p));
+        const char *name, *value;
+        if (colon == NULL) {
+            continue; /* The blank line, or junk */
+        }
+        size_t namelen = trim(p, (size_t)(colon - p), &name);
+        size_t valuelen = trim(colon + 1, (size_t)(eol - colon - 1), &value);
+        if (namelen == 0 || memchr(name, ' ', namelen) != NULL) {
+            continue;
+        }
+        for (char *q = (char *)name; q < name + namelen; q++) {
+            *q = (char)tolower((unsigned char)*q);
+        }
+        if (is_hop_by_hop(name, namelen)) {
+            continue;
+        }
+        size_t n = hpack_encode_field(block + blocklen,
+                                      sizeof(block) - blocklen, name, namelen,
+                                      value, valuelen);
+        if (n == 0) {
+            return -1;
+        }
+        blocklen += n;
+    }
+    return send_block(s, block, blocklen) < 0 ? -1 : status;
+}
+
+/* head_end - Length of a complete response head in s->head, or 0 */
+static size_t head_end(h2_stream_t *s, size_t from) {
+    for (size_t i = from; i < s->headlen; i++) {
+        if (s->head[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < s->headlen && s->head[i + 1] == '\n') {
+            return i + 2;
+        }
+        if (i + 2 < s->headlen && s->head[i + 1] == '\r' &&
+            s->head[i + 2] == '\n') {
+            return i + 3;
+        }
+    }
+    return 0;
+}
+
+/*
+ * stream_write - Pipeline writer: the head of the HTTP/1 response becomes
+ *     HEADERS and the rest becomes DATA
+ */
+static ssize_t stream_write(void *arg, const void *buf, size_t n) {
+    h2_stream_t *s = arg;
+    const char *p = buf;
+    size_t left = n;
+
+    while (!s->head_sent && left > 0) {
+        size_t old = s->headlen;
+        size_t take = HEAD_MAX - old < left ? HEAD_MAX - old : left;
+        memcpy(s->head + old, p, take);
+        s->headlen += take;
+
+        size_t len = head_end(s, old < 2 ? 0 : old - 2);
+        if (len == 0) {
+            if (s->headlen == HEAD_MAX) {
+                return -1;
+            }
+            return (ssize_t)n;
+        }
+        int status = send_head(s, len);
+        if (status < 0) {
+            return -1;
+        }
+        p += len - old;
+        left -= len - old;
+        s->headlen = 0;
+        s->head_sent = status >= 200;
+    }
+    if (left > 0 && send_data(s, p, left) < 0) {
+        return -1;
+    }
+    return (ssize_t)n;
+}
+
+/* idle_start - Arm the idle deadline; the caller holds the lock */
+static void idle_start(h2_conn_t *c) {
+    if (!c->idling && c->active == 0 && !c->closed) {
+        deadline_start(&c->idle, c->fd, SHUT_RD, DEADLINE_HEADER);
+        c->idling = true;
+    }
+}
+
+/* idle_stop - Disarm the idle deadline; the caller holds the lock */
+static void idle_stop(h2_conn_t *c) {
+    if (c->idling) {
+        deadline_stop(&c->idle);
+        c->idling = false;
+    }
+}
+
+/*
+ * stream_thread - Run the handler for one stream, then end the stream with
+ *     an empty DATA frame, or reset it if there was no usable response
+ */
+static void *stream_thread(void *vargp) {
+    h2_stream_t *s = vargp;
+    h2_conn_t *c = s->c;
+
+    pthread_detach(pthread_self());
+    c->handler(&s->req, s->slot);
+    pipeline_finish(s->slot, false);
+    pipeline_drain(s->pl);
+    bool failed = pipeline_closed(s->pl) || !s->head_sent;
+    pipeline_free(s->pl);
+
+    if (!failed) {
+        failed =
+            write_frame(c, FRAME_DATA, FLAG_END_STREAM, s->id, NULL, 0) < 0;
+    }
+    pthread_mutex_lock(&c->lock);
+    bool reset = s->reset;
+    bool body_open = s->body_open;
+    pthread_mutex_unlock(&c->lock);
+    if (!reset && failed) {
+        write_rst(c, s->id, ERR_INTERNAL);
+    } else if (!reset && body_open) {
+        /* The response is complete: the rest of the body is not wanted */
+        write_rst(c, s->id, ERR_NO_ERROR);
+    }
+    if (s->body[0] >= 0) {
+        shutdown(s->body[0], SHUT_RDWR);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    s->done = true;
+    c->active--;
+    idle_start(c);
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static h2_stream_t *stream_new(h2_conn_t *c, uint32_t id) {
+    h2_stream_t *s = Calloc(1, sizeof(h2_stream_t));
+    s->c = c;
+    s->id = id;
+    s->body[0] = s->body[1] = -1;
+    s->req.body_fd = -1;
+    s->req.body_length = -1;
+    s->recv_window = H2_DEFAULT_WINDOW;
+    return s;
+}
+
+static void stream_free(h2_stream_t *s) {
+    if (s->body[0] >= 0) {
+        close(s->body[0]);
+        close(s->body[1]);
+    }
+    Free(s);
+}
+
+/* stream_find - Look up a stream by id; the caller holds the lock */
+static h2_stream_t *stream_find(h2_conn_t *c, uint32_t id) {
+    for (h2_stream_t *s = c->streams; s != NULL; s = s->next) {
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* reap - Free the streams whose handlers have finished */
+static void reap(h2_conn_t *c) {
+    h2_stream_t *done = NULL;
+
+    pthread_mutex_lock(&c->lock);
+    for (h2_stream_t **sp = &c->streams; *sp != NULL;) {
+        h2_stream_t *s = *sp;
+        if (s->done) {
+            *sp = s->next;
+            s->next = done;
+            done = s;
+        } else {
+            sp = &s->next;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    while (done != NULL) {
+        h2_stream_t *next = done->next;
+        stream_free(done);
+        done = next;
+    }
+}
+
+/* stream_start - Hand a complete request to a thread of its own */
+static void stream_start(h2_conn_t *c, h2_stream_t *s, bool end_stream) {
+    if (!end_stream) {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s->body) < 0) {
+            s->body[0] = s->body[1] = -1;
+            write_rst(c, s->id, ERR_INTERNAL);
+            Free(s);
+            return;
+        }
+        s->body_open = true;
+        s->chunked = s->req.body_length < 0;
+        s->req.body_fd = s->body[0];
+    }
+    s->pl = pipeline_new_writer(stream_write, s, PIPELINE_BUDGET);
+    s->slot = pipeline_push(s->pl);
+
+    pthread_mutex_lock(&c->lock);
+    s->window = c->initial_window;
+    s->next = c->streams;
+    c->streams = s;
+    c->active++;
+    idle_stop(c);
+    pthread_mutex_unlock(&c->lock);
+
+    metrics_inc(METRIC_H2_STREAMS);
+    pthread_t tid;
+    pthread_create(&tid, NULL, stream_thread, s);
+}
+
+/* field_copy - Keep a NUL terminated copy of a pseudo-header value */
+static const char *field_copy(h2_stream_t *s, const char *value, size_t len) {
+    if (len >= sizeof(s->fields) - s->fieldslen) {
+        s->bad = true;
+        return NULL;
+    }
+    char *copy = s->fields + s->fieldslen;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    s->fieldslen += len + 1;
+    return copy;
+}
+
+/* set_pseudo - Record a pseudo-header, which may only appear once */
+static void set_pseudo(h2_stream_t *s, const char **field, const char *value,
+                       size_t len) {
+    if (*field != NULL) {
+        s->bad = true;
+    } else {
+        *field = field_copy(s, value, len);
+    }
+}
+
+static bool name_is(const char *name, size_t len, const char *expected) {
+    return strlen(expected) == len && memcmp(name, expected, len) == 0;
+}
+
+/*
+ * collect - HPACK callback building a request. Decoding must run to the end
+ *     of the block to keep the dynamic table in step with the client's, so
+ *     a bad field only marks the request as bad.
+ */
+static int collect(void *arg, const char *name, size_t namelen,
+                   const char *value, size_t valuelen) {
+    h2_stream_t *s = arg;
+    h2_request_t *req = &s->req;
+
+    if (memchr(value, '\r', valuelen) != NULL ||
+        memchr(value, '\n', valuelen) != NULL ||
+        memchr(value, '\0', valuelen) != NULL || namelen == 0) {
+        s->bad = true;
+        return 0;
+    }
+    if (name[0] == ':') {
+        if (s->headerslen > 0) {
+            s->bad = true; /* Pseudo-headers come first */
+        } else if (name_is(name, namelen, ":method")) {
+            set_pseudo(s, &req->method, value, valuelen);
+        } else if (name_is(name, namelen, ":scheme")) {
+            set_pseudo(s, &req->scheme, value, valuelen);
+        } else if (name_is(name, namelen, ":authority")) {
+            set_pseudo(s, &req->authority, value, valuelen);
+        } else if (name_is(name, namelen, ":path")) {
+            set_pseudo(s, &req->path, value, valuelen);
+        } else {
+            s->bad = true;
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < namelen; i++) {
+        if (isupper((unsigned char)name[i]) || name[i] == ':' ||
+            name[i] == ' ' || name[i] == '\r' || name[i] == '\n') {
+            s->bad = true;
+            return 0;
+        }
+    }
+    if (is_hop_by_hop(name, namelen)) {
+        return 0;
+    }
+    if (name_is(name, namelen, "host")) {
+        if (s->host == NULL) {
+            s->host = field_copy(s, value, valuelen);
+        }
+        return 0;
+    }
+    if (name_is(name, namelen, "content-length")) {
+        char *copy = (char *)field_copy(s, value, valuelen), *end;
+        if (copy != NULL) {
+            req->body_length = strtoll(copy, &end, 10);
+            if (end == copy || *end != '\0' || req->body_length < 0) {
+                s->bad = true;
+            }
+        }
+        return 0;
+    }
+
+    size_t need = namelen + valuelen + 4;
+    if (need >= sizeof(s->headers) - s->headerslen) {
+        s->bad = true;
+        return 0;
+    }
+    char *p = s->headers + s->headerslen;
+    memcpy(p, name, namelen);
+    p += namelen;
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, value, valuelen);
+    p += valuelen;
+    *p++ = '\r';
+    *p++ = '\n';
+    *p = '\0';
+    s->headerslen += need;
+    return 0;
+}
+
+/* discard - HPACK callback for header blocks nobody needs */
+static int discard(void *arg, const char *name, size_t namelen,
+                   const char *value, size_t valuelen) {
+    (void)arg, (void)name, (void)namelen, (void)value, (void)valuelen;
+    return 0;
+}
+
+/* body_end - The client has sent the whole body */
+static void body_end(h2_conn_t *c, h2_stream_t *s) {
+    if (s->chunked) {
+        rio_writen(s->body[1], CHUNK_LAST, strlen(CHUNK_LAST));
+    }
+    shutdown(s->body[1], SHUT_WR);
+    pthread_mutex_lock(&c->lock);
+    s->body_open = false;
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* end_headers - A header block is complete: start a stream with it */
+static int end_headers(h2_conn_t *c) {
+    uint32_t id = c->block_id;
+    c->block_id = 0;
+
+    if (id <= c->last_id) {
+        /* Trailers, which are not passed on; a closed stream's id may not
+         * be used again (RFC 7540 5.1.1) */
+        pthread_mutex_lock(&c->lock);
+        h2_stream_t *s = stream_find(c, id);
+        bool open = s != NULL && s->body_open;
+        pthread_mutex_unlock(&c->lock);
+        if (!open) {
+            return ERR_PROTOCOL;
+        }
+        if (hpack_decode(&c->hpack, c->block, c->blocklen, c->scratch,
+                         sizeof(c->scratch), discard, NULL) < 0) {
+            return ERR_COMPRESSION;
+        }
+        if (c->block_end) {
+            body_end(c, s);
+        }
+        return 0;
+    }
+
+    c->last_id = id;
+    h2_stream_t *s = stream_new(c, id);
+    if (hpack_decode(&c->hpack, c->block, c->blocklen, c->scratch,
+                     sizeof(c->scratch), collect, s) < 0) {
+        Free(s);
+        return ERR_COMPRESSION;
+    }
+    if (s->req.authority == NULL) {
+        s->req.authority = s->host;
+    }
+    s->req.headers = s->headers;
+    if (s->bad || s->req.method == NULL || s->req.path == NULL) {
+        write_rst(c, id, ERR_PROTOCOL);
+        Free(s);
+        return 0;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    bool full = c->active >= H2_MAX_STREAMS;
+    pthread_mutex_unlock(&c->lock);
+    if (full) {
+        metrics_inc(METRIC_H2_REFUSED);
+        write_rst(c, id, ERR_REFUSED_STREAM);
+        Free(s);
+        return 0;
+    }
+    stream_start(c, s, c->block_end);
+    return 0;
+}
+
+/* strip_padding - Remove a frame's padding (and priority fields) */
+static int strip_padding(const uint8_t **payload, size_t *len, int flags,
+                         size_t priority) {
+    size_t pad = 0;
+
+    if (flags & FLAG_PADDED) {
+        if (*len < 1) {
+            return -1;
+        }
+        pad = (*payload)[0];
+        (*payload)++;
+        (*len)--;
+    }
+    if (*len < pad + priority) {
+        return -1;
+    }
+    *payload += priority;
+    *len -= pad + priority;
+    return 0;
+}
+
+/* apply_settings - Take in the client's settings */
+static int apply_settings(h2_conn_t *c, const uint8_t *p, size_t len) {
+    if (len % 6 != 0) {
+        return ERR_FRAME_SIZE;
+    }
+    for (; len > 0; p += 6, len -= 6) {
+        unsigned id = (unsigned)p[0] << 8 | p[1];
+        uint32_t value = get32(p + 2);
+
+        if (id == SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (value > MAX_WINDOW) {
+                return ERR_FLOW_CONTROL;
+            }
+            pthread_mutex_lock(&c->lock);
+            long delta = (long)value - c->initial_window;
+            c->initial_window = value;
+            for (h2_stream_t *s = c->streams; s != NULL; s = s->next) {
+                s->window += delta;
+            }
+            pthread_cond_broadcast(&c->cond);
+            pthread_mutex_unlock(&c->lock);
+        } else if (id == SETTINGS_MAX_FRAME_SIZE) {
+            if (value < H2_MAX_FRAME || value > 0xffffff) {
+                return ERR_PROTOCOL;
+            }
+            /* Never more than H2_MAX_FRAME, which is the minimum */
+        }
+    }
+    return 0;
+}
+
+static int on_data(h2_conn_t *c, int flags, uint32_t id,
+                   const uint8_t *payload, size_t len) {
+    size_t consumed = len;
+
+    if (id == 0 || id > c->last_id) {
+        return ERR_PROTOCOL;
+    }
+    if (strip_padding(&payload, &len, flags, 0) < 0) {
+        return ERR_PROTOCOL;
+    }
+
+    /* The connection window is given back with every frame, and a frame is
+     * smaller than it, so only a stream's window can be overrun */
+    pthread_mutex_lock(&c->lock);
+    h2_stream_t *s = stream_find(c, id);
+    bool open = s != NULL && s->body_open;
+    pthread_mutex_unlock(&c->lock);
+    if (s != NULL) {
+        if ((long)consumed > s->recv_window) {
+            return ERR_FLOW_CONTROL;
+        }
+        s->recv_window -= (long)consumed;
+    }
+    if (consumed > 0) {
+        write_window_update(c, 0, consumed);
+    }
+    if (!open) {
+        return 0;
+    }
+
+    /* Blocks while the handler is behind; errors mean it stopped reading */
+    if (len > 0 && s->chunked) {
+        char header[CHUNK_HEADER_MAX];
+        size_t n = chunk_header(header, len);
+        if (rio_writen(s->body[1], header, n) >= 0 &&
+            rio_writen(s->body[1], payload, len) >= 0) {
+            rio_writen(s->body[1], CHUNK_CRLF, strlen(CHUNK_CRLF));
+        }
+    } else if (len > 0) {
+        rio_writen(s->body[1], payload, len);
+    }
+    if (flags & FLAG_END_STREAM) {
+        body_end(c, s);
+    } else if (consumed > 0) {
+        s->recv_window += (long)consumed;
+        write_window_update(c, id, consumed);
+    }
+    return 0;
+}
+
+static int on_headers(h2_conn_t *c, int flags, uint32_t id,
+                      const uint8_t *payload, size_t len) {
+    if (id == 0 || id % 2 == 0) {
+        return ERR_PROTOCOL;
+    }
+    if (strip_padding(&payload, &len, flags,
+                      flags & FLAG_PRIORITY ? 5 : 0) < 0) {
+        return ERR_PROTOCOL;
+    }
+    if (len > sizeof(c->block)) {
+        return ERR_ENHANCE_YOUR_CALM;
+    }
+    memcpy(c->block, payload, len);
+    c->blocklen = len;
+    c->block_id = id;
+    c->block_end = (flags & FLAG_END_STREAM) != 0;
+    return flags & FLAG_END_HEADERS ? end_headers(c) : 0;
+}
+
+static int on_continuation(h2_conn_t *c, int flags, uint32_t id,
+                           const uint8_t *payload, size_t len) {
+    if (id != c->block_id) {
+        return ERR_PROTOCOL;
+    }
+    if (len > sizeof(c->block) - c->blocklen) {
+        return ERR_ENHANCE_YOUR_CALM;
+    }
+    memcpy(c->block + c->blocklen, payload, len);
+    c->blocklen += len;
+    return flags & FLAG_END_HEADERS ? end_headers(c) : 0;
+}
+
+static int on_rst_stream(h2_conn_t *c, uint32_t id, size_t len) {
+    if (id == 0 || id > c->last_id) {
+        return ERR_PROTOCOL;
+    }
+    if (len != 4) {
+        return ERR_FRAME_SIZE;
+    }
+    pthread_mutex_lock(&c->lock);
+    h2_stream_t *s = stream_find(c, id);
+    bool open = false;
+    if (s != NULL) {
+        s->reset = true;
+        open = s->body_open;
+        s->body_open = false;
+        pthread_cond_broadcast(&c->cond);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (open) {
+        shutdown(s->body[1], SHUT_RDWR);
+    }
+    return 0;
+}
+
+static int on_settings(h2_conn_t *c, int flags, uint32_t id,
+                       const uint8_t *payload, size_t len) {
+    if (id != 0) {
+        return ERR_PROTOCOL;
+    }
+    if (flags & FLAG_ACK) {
+        return len == 0 ? 0 : ERR_FRAME_SIZE;
+    }
+    int rc = apply_settings(c, payload, len);
+    if (rc == 0) {
+        write_frame(c, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    }
+    return rc;
+}
+
+static int on_window_update(h2_conn_t *c, uint32_t id, const uint8_t *payload,
+                            size_t len) {
+    if (len != 4) {
+        return ERR_FRAME_SIZE;
+    }
+    long increment = get32(payload) & MAX_WINDOW;
+    if (id == 0 && increment == 0) {
+        return ERR_PROTOCOL;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    int rc = 0;
+    if (id == 0) {
+        c->window += increment;
+        rc = c->window > MAX_WINDOW ? ERR_FLOW_CONTROL : 0;
+    } else {
+        h2_stream_t *s = stream_find(c, id);
+        if (s != NULL && !s->reset) {
+            s->window += increment;
+            if (increment == 0 || s->window > MAX_WINDOW) {
+                s->reset = true;
+                rc = -(increment == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL);
+            }
+        }
+    }
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    if (rc < 0) {
+        write_rst(c, id, (uint32_t)-rc); /* A stream error */
+        rc = 0;
+    }
+    return rc;
+}
+
+/*
+ * read_frame - Read and act on one frame. Returns READ_OK, READ_STOP when
+ *     the client is gone or going, or an error code for a GOAWAY.
+ */
+static int read_frame(h2_conn_t *c) {
+    uint8_t header[FRAME_HEADER];
+
+    reap(c);
+    pthread_mutex_lock(&c->lock);
+    idle_start(c);
+    pthread_mutex_unlock(&c->lock);
+    if (rio_readnb(c->rp, header, FRAME_HEADER) != FRAME_HEADER) {
+        return READ_STOP;
+    }
+    size_t len = (size_t)header[0] << 16 | (size_t)header[1] << 8 | header[2];
+    int type = header[3], flags = header[4];
+    uint32_t id = get32(header + 5) & MAX_WINDOW;
+    if (len > H2_MAX_FRAME) {
+        return ERR_FRAME_SIZE;
+    }
+    if ((size_t)rio_readnb(c->rp, c->frame, len) != len) {
+        return READ_STOP;
+    }
+    pthread_mutex_lock(&c->lock);
+    idle_stop(c);
+    pthread_mutex_unlock(&c->lock);
+
+    /* A header block may not be interrupted */
+    if (c->block_id != 0 && type != FRAME_CONTINUATION) {
+        return ERR_PROTOCOL;
+    }
+
+    switch (type) {
+    case FRAME_DATA:
+        return on_data(c, flags, id, c->frame, len);
+    case FRAME_HEADERS:
+        return on_headers(c, flags, id, c->frame, len);
+    case FRAME_CONTINUATION:
+        return on_continuation(c, flags, id, c->frame, len);
+    case FRAME_RST_STREAM:
+        return on_rst_stream(c, id, len);
+    case FRAME_SETTINGS:
+        return on_settings(c, flags, id, c->frame, len);
+    case FRAME_PING:
+        if (id != 0) {
+            return ERR_PROTOCOL;
+        }
+        if (len != 8) {
+            return ERR_FRAME_SIZE;
+        }
+        if (!(flags & FLAG_ACK)) {
+            write_frame(c, FRAME_PING, FLAG_ACK, 0, c->frame, len);
+        }
+        return READ_OK;
+    case FRAME_GOAWAY:
+        return READ_STOP;
+    case FRAME_WINDOW_UPDATE:
+        return on_window_update(c, id, c->frame, len);
+    case FRAME_PUSH_PROMISE:
+        return ERR_PROTOCOL;
+    default:
+        return READ_OK; /* PRIORITY and unknown types are ignored */
+    }
+}
+
+/* base64url_decode - Decode an HTTP2-Settings value; -1 if invalid */
+static ssize_t base64url_decode(const char *in, uint8_t *out, size_t room) {
+    uint32_t bits = 0;
+    int nbits = 0;
+    size_t len = 0;
+
+    for (; *in != '\0' && *in != '='; in++) {
+        int v;
+        if (*in >= 'A' && *in <= 'Z') {
+            v = *in - 'A';
+        } else if (*in >= 'a' && *in <= 'z') {
+            v = *in - 'a' + 26;
+        } else if (*in >= '0' && *in <= '9') {
+            v = *in - '0' + 52;
+        } else if (*in == '-') {
+            v = 62;
+        } else if (*in == '_') {
+            v = 63;
+        } else {
+            return -1;
+        }
+        bits = bits << 6 | (uint32_t)v;
+        nbits += 6;
+        if (nbits >= 8) {
+            if (len == room) {
+                return -1;
+            }
+            nbits -= 8;
+            out[len++] = (uint8_t)(bits >> nbits);
+        }
+    }
+    return (ssize_t)len;
+}
+
+/* upgrade_stream - Make the upgraded request stream 1 */
+static void upgrade_stream(h2_conn_t *c, const h2_request_t *upgraded) {
+    h2_stream_t *s = stream_new(c, 1);
+    h2_request_t *req = &s->req;
+
+    req->method = field_copy(s, upgraded->method, strlen(upgraded->method));
+    req->scheme = field_copy(s, "http", 4);
+    req->path = field_copy(s, upgraded->path, strlen(upgraded->path));
+    if (upgraded->authority != NULL) {
+        req->authority = field_copy(s, upgraded->authority,
+                                    strlen(upgraded->authority));
+    }
+    snprintf(s->headers, sizeof(s->headers), "%s", upgraded->headers);
+    req->headers = s->headers;
+    c->last_id = 1;
+    stream_start(c, s, true);
+}
+
+void h2_serve(int fd, rio_t *rp, const h2_request_t *upgraded,
+              const char *settings, h2_handler_t handler) {
+    h2_conn_t *c = Calloc(1, sizeof(h2_conn_t));
+    int rc = READ_OK;
+
+    c->fd = fd;
+    c->rp = rp;
+    c->handler = handler;
+    pthread_mutex_init(&c->write_lock, NULL);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    c->window = H2_DEFAULT_WINDOW;
+    c->initial_window = H2_DEFAULT_WINDOW;
+    hpack_decoder_init(&c->hpack);
+    metrics_inc(METRIC_H2_CONNECTIONS);
+
+    /* Frames are small and written one at a time: Nagle must not hold
+     * them back waiting for acknowledgements */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (settings != NULL) {
+        ssize_t n = base64url_decode(settings, c->frame, sizeof(c->frame));
+        rc = n < 0 ? ERR_PROTOCOL : apply_settings(c, c->frame, (size_t)n);
+    }
+
+    /* The server's preface is its SETTINGS frame */
+    uint8_t ours[6];
+    ours[0] = 0;
+    ours[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(ours + 2, H2_MAX_STREAMS);
+    if (write_frame(c, FRAME_SETTINGS, 0, 0, ours, sizeof(ours)) < 0) {
+        rc = READ_STOP;
+    }
+    if (rc == READ_OK && upgraded != NULL) {
+        upgrade_stream(c, upgraded);
+    }
+
+    /* The client's preface: what is left of it after the request line */
+    const char *preface = upgraded != NULL ? H2_PREFACE_LINE : "";
+    char buf[sizeof(H2_PREFACE_LINE) + sizeof(preface_rest)];
+    size_t len = strlen(preface) + strlen(preface_rest);
+    snprintf(buf, sizeof(buf), "%s%s", preface, preface_rest);
+    if (rc == READ_OK) {
+        char got[sizeof(buf)];
+        if ((size_t)rio_readnb(rp, got, len) != len ||
+            memcmp(got, buf, len) != 0) {
+            rc = ERR_PROTOCOL;
+        }
+    }
+
+    while (rc == READ_OK) {
+        rc = read_frame(c);
+    }
+
+    if (rc > 0) {
+        write_goaway(c, (uint32_t)rc);
+    } else if (deadline_fired(&c->idle)) {
+        write_goaway(c, ERR_NO_ERROR);
+    }
+
+    /* Streams still running are abandoned */
+    shutdown(fd, SHUT_RDWR);
+    pthread_mutex_lock(&c->lock);
+    c->closed = true;
+    idle_stop(c);
+    pthread_cond_broadcast(&c->cond);
+    for (h2_stream_t *s = c->streams; s != NULL; s = s->next) {
+        if (s->body_open) {
+            s->body_open = false;
+            shutdown(s->body[1], SHUT_RDWR);
+        }
+    }
+    while (c->active > 0) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    reap(c);
+
+    hpack_decoder_free(&c->hpack);
+    pthread_mutex_destroy(&c->write_lock);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    Free(c);
+}
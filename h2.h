@@ -0,0 +1,77 @@
+/**
+ * @file h2.h
+ * @brief HTTP/2 cleartext (h2c) frontend
+ *
+ * A client may speak HTTP/2 to the proxy, either by starting with the
+ * HTTP/2 connection preface ("prior knowledge") or by asking an HTTP/1.1
+ * request to be upgraded. Each stream becomes a request of its own, run on
+ * its own thread through a handler supplied by the proxy, and the response
+ * the handler writes (in HTTP/1 form) is turned into HEADERS and DATA
+ * frames as it is written. Streams are multiplexed over the one client
+ * connection.
+ *
+ * The connection's thread reads frames: it decodes header blocks with
+ * HPACK, starts streams (up to H2_MAX_STREAMS at once; more are refused),
+ * passes request bodies on and applies flow control updates. Writers of
+ * DATA frames wait for both the stream's and the connection's send
+ * windows.
+ *
+ * Request bodies reach the handler through a socket of their own,
+ * re-framed as chunked unless the request had a content-length. The
+ * receive windows are given back as soon as the body has been passed on,
+ * so an upload whose handler stops reading stalls the whole connection.
+ */
+
+#ifndef __H2_H__
+#define __H2_H__
+
+#include "csapp.h"
+#include "pipeline.h"
+
+#include <stdint.h>
+
+#define H2_MAX_STREAMS 100        // Concurrent streams per connection
+#define H2_MAX_FRAME 16384        // Largest frame payload sent or accepted
+#define H2_MAX_HEADER_BLOCK 65536 // Largest header block accepted
+#define H2_DEFAULT_WINDOW 65535   // Initial flow control window
+#define H2_PREFACE_LINE "PRI * HTTP/2.0\r\n"
+
+/**
+ * @brief A request read from a stream
+ *
+ * The strings are NUL terminated.
+ */
+typedef struct {
+    const char *method;    /**< :method */
+    const char *scheme;    /**< :scheme */
+    const char *authority; /**< :authority, or the host field */
+    const char *path;      /**< :path */
+    const char *headers;   /**< other fields, as "name: value\r\n" lines */
+    int body_fd;           /**< socket to read the body from, or -1 */
+    long long body_length; /**< content-length; -1 if the body is chunked */
+} h2_request_t;
+
+/**
+ * @brief Processes a request, writing the response to slot in HTTP/1 form
+ *
+ * The handler must not finish the slot.
+ */
+typedef void (*h2_handler_t)(const h2_request_t *req, pl_slot_t *slot);
+
+/**
+ * @brief Serve an HTTP/2 connection until it closes
+ *
+ * For prior knowledge, the first line of the preface has already been read
+ * (as a request line). For an upgrade, the 101 response has been sent and
+ * the upgraded request becomes stream 1.
+ *
+ * @param[in] fd The client socket
+ * @param[in] rp The client's read buffer
+ * @param[in] upgraded The upgraded request, or NULL for prior knowledge
+ * @param[in] settings The HTTP2-Settings header of the upgrade, or NULL
+ * @param[in] handler Run for every request
+ */
+void h2_serve(int fd, rio_t *rp, const h2_request_t *upgraded,
+              const char *settings, h2_handler_t handler);
+
+#endif /* __H2_H__ */
@@ -0,0 +1,95 @@
+/**
+ * @file hedge.c
+ * @brief Hedged requests
+ */
+
+#include "hedge.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* Budget in hundredths of a hedge */
+static int budget_percent = HEDGE_BUDGET_PERCENT;
+static long budget;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void hedge_configure(int percent) {
+    budget_percent = percent;
+}
+
+bool hedge_earn(void) {
+    if (budget_percent <= 0) {
+        return false;
+    }
+    long old = __atomic_load_n(&budget, __ATOMIC_RELAXED);
+    long new;
+    do {
+        new = old + budget_percent;
+        if (new > HEDGE_BURST * 100) {
+            new = HEDGE_BURST * 100;
+        }
+    } while (!__atomic_compare_exchange_n(&budget, &old, new, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
+
+bool hedge_take(void) {
+    long old = __atomic_load_n(&budget, __ATOMIC_RELAXED);
+    do {
+        if (old < 100) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&budget, &old, old - 100, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
+
+bool hedge_wait(int fd, int timeout_ms) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int rc;
+
+    while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR) {
+    }
+    return rc != 0;
+}
+
+int hedge_race(const int fds[2], int timeout_ms) {
+    struct pollfd pfds[2] = {{.fd = fds[0], .events = POLLIN},
+                             {.fd = fds[1], .events = POLLIN}};
+    int64_t end = now_ms() + timeout_ms;
+    int remaining = timeout_ms;
+
+    while (pfds[0].fd >= 0 || pfds[1].fd >= 0) {
+        int rc = poll(pfds, 2, remaining);
+        if (rc < 0 && errno != EINTR) {
+            return -1;
+        }
+        for (int i = 0; rc > 0 && i < 2; i++) {
+            char c;
+            if (pfds[i].fd < 0 || pfds[i].revents == 0) {
+                continue;
+            }
+            ssize_t n = recv(pfds[i].fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n > 0) {
+                return i;
+            }
+            if (n == 0 || errno != EAGAIN) {
+                pfds[i].fd = -1; /* EOF or error: out of the race */
+            }
+        }
+        remaining = (int)(end - now_ms());
+        if (remaining <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file hedge.h
+ * @brief Hedged requests
+ *
+ * A GET whose origin has not sent a first byte within the origin's usual
+ * (95th percentile) time to first byte is sent a second time, and the
+ * proxy relays whichever copy starts answering first. This cuts the tail
+ * latency caused by the occasional slow request.
+ *
+ * Hedges are paid for from a global budget: every eligible request earns
+ * a fraction of a hedge (the budget percentage), and a hedge can only be
+ * sent with a whole one saved up, with at most HEDGE_BURST saved. Extra
+ * load from hedging therefore never exceeds the budget percentage, even
+ * when every origin slows down at once.
+ */
+
+#ifndef __HEDGE_H__
+#define __HEDGE_H__
+
+#include <stdbool.h>
+
+#define HEDGE_BUDGET_PERCENT 5 // Default hedges per 100 requests
+#define HEDGE_PERCENTILE 95    // Hedge after this percentile of latency
+#define HEDGE_BURST 10         // Hedges that may be saved up
+
+/**
+ * @brief Set the hedging budget
+ *
+ * @param[in] percent Hedges allowed per 100 requests; 0 disables hedging
+ */
+void hedge_configure(int percent);
+
+/**
+ * @brief Earn budget for one request that could be hedged
+ *
+ * @return false if hedging is disabled
+ */
+bool hedge_earn(void);
+
+/**
+ * @brief Spend budget for one hedge
+ *
+ * @return true if there was budget for it
+ */
+bool hedge_take(void);
+
+/**
+ * @brief Wait for a socket to become readable
+ *
+ * @param[in] fd The socket
+ * @param[in] timeout_ms How long to wait
+ *
+ * @return true if it is readable (with data, EOF or an error)
+ */
+bool hedge_wait(int fd, int timeout_ms);
+
+/**
+ * @brief Wait for the first of two sockets to have data
+ *
+ * A socket that reaches EOF or an error first drops out of the race.
+ *
+ * @param[in] fds The two sockets
+ * @param[in] timeout_ms How long to wait
+ *
+ * @return 0 or 1 for the winner, or -1 if both dropped out or time ran out
+ */
+int hedge_race(const int fds[2], int timeout_ms);
+
+#endif /* __HEDGE_H__ */
@@ -0,0 +1,419 @@
+/**
+ * @file hpack.c
+ * @brief HPACK header compression for HTTP/2 (RFC 7541)
+ */
+
+#include "hpack.h"
+#include "csapp.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define HUFFMAN_EOS 256
+#define HUFFMAN_MAX_BITS 30
+
+/* The static table (RFC 7541 Appendix A); index 1 is the first entry */
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[HPACK_STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/*
+ * Lengths of the Huffman codes for each symbol (RFC 7541 Appendix B). The
+ * code is canonical, so the codes themselves follow from the lengths.
+ */
+static const uint8_t huffman_bits[HUFFMAN_EOS + 1] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/* Canonical decoding tables, built from huffman_bits once */
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+static uint32_t huffman_first[HUFFMAN_MAX_BITS + 1]; // First code per length
+static uint16_t huffman_count[HUFFMAN_MAX_BITS + 1]; // Codes per length
+static uint16_t huffman_offset[HUFFMAN_MAX_BITS + 1]; // Into huffman_symbols
+static uint16_t huffman_symbols[HUFFMAN_EOS + 1]; // By length, then symbol
+
+static void huffman_init(void) {
+    uint32_t code = 0;
+    uint16_t n = 0;
+
+    for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits++) {
+        huffman_first[bits] = code;
+        huffman_offset[bits] = n;
+        for (int sym = 0; sym <= HUFFMAN_EOS; sym++) {
+            if (huffman_bits[sym] == bits) {
+                huffman_symbols[n++] = (uint16_t)sym;
+            }
+        }
+        huffman_count[bits] = (uint16_t)(n - huffman_offset[bits]);
+        code = (code + huffman_count[bits]) << 1;
+    }
+}
+
+/*
+ * huffman_decode - Decode a Huffman coded string into out, one bit at a
+ *     time. Returns the decoded length, or -1 if the input is invalid or
+ *     does not fit.
+ */
+static ssize_t huffman_decode(const uint8_t *in, size_t len, char *out,
+                              size_t room) {
+    uint32_t code = 0;
+    int bits = 0;
+    size_t n = 0;
+
+    pthread_once(&huffman_once, huffman_init);
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            code = (code << 1) | ((in[i] >> b) & 1);
+            if (++bits > HUFFMAN_MAX_BITS) {
+                return -1;
+            }
+            uint32_t k = code - huffman_first[bits];
+            if (k < huffman_count[bits]) {
+                uint16_t sym = huffman_symbols[huffman_offset[bits] + k];
+                if (sym == HUFFMAN_EOS || n == room) {
+                    return -1;
+                }
+                out[n++] = (char)sym;
+                code = 0;
+                bits = 0;
+            }
+        }
+    }
+
+    /* Padding is the most significant bits of EOS: up to 7 one bits */
+    if (bits > 7 || code != (1u << bits) - 1) {
+        return -1;
+    }
+    return (ssize_t)n;
+}
+
+/*
+ * decode_int - Decode an integer with an N-bit prefix. Values are limited
+ *     to 2^28, far beyond anything meaningful here.
+ */
+static int decode_int(const uint8_t **pos, const uint8_t *end, int prefix,
+                      uint32_t *out) {
+    const uint8_t *p = *pos;
+    uint32_t max = (1u << prefix) - 1;
+    uint32_t v = *p++ & max;
+
+    if (v == max) {
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (p == end || shift > 21) {
+                return -1;
+            }
+            b = *p++;
+            v += (uint32_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+    }
+    *pos = p;
+    *out = v;
+    return 0;
+}
+
+/*
+ * decode_string - Decode a string literal: a span of the input, or of
+ *     scratch if Huffman coded.
+ */
+static int decode_string(const uint8_t **pos, const uint8_t *end,
+                         char *scratch, size_t scratchlen, size_t *used,
+                         const char **str, size_t *len) {
+    bool huffman = (**pos & 0x80) != 0;
+    uint32_t n;
+
+    if (decode_int(pos, end, 7, &n) < 0 || n > (size_t)(end - *pos)) {
+        return -1;
+    }
+    if (huffman) {
+        ssize_t m = huffman_decode(*pos, n, scratch + *used,
+                                   scratchlen - *used);
+        if (m < 0) {
+            return -1;
+        }
+        *str = scratch + *used;
+        *len = (size_t)m;
+        *used += (size_t)m;
+    } else {
+        *str = (const char *)*pos;
+        *len = n;
+    }
+    *pos += n;
+    return 0;
+}
+
+void hpack_decoder_init(hpack_decoder_t *d) {
+    d->first = 0;
+    d->count = 0;
+    d->size = 0;
+    d->max_size = HPACK_TABLE_SIZE;
+}
+
+/* evict - Drop the oldest entries until the table fits in limit */
+static void evict(hpack_decoder_t *d, size_t limit) {
+    while (d->size > limit && d->count > 0) {
+        hpack_entry_t *e =
+            &d->entries[(d->first + d->count - 1) % HPACK_MAX_ENTRIES];
+        d->size -= e->namelen + e->valuelen + 32;
+        Free(e->name);
+        d->count--;
+    }
+}
+
+void hpack_decoder_free(hpack_decoder_t *d) {
+    evict(d, 0);
+}
+
+/* insert - Add an entry to the dynamic table, evicting as needed */
+static void insert(hpack_decoder_t *d, const char *name, size_t namelen,
+                   const char *value, size_t valuelen) {
+    size_t size = namelen + valuelen + 32;
+
+    /* Copy first: the name may belong to an entry about to be evicted */
+    char *copy = Malloc(namelen + valuelen + 1);
+    memcpy(copy, name, namelen);
+    memcpy(copy + namelen, value, valuelen);
+
+    evict(d, size > d->max_size ? 0 : d->max_size - size);
+    if (size > d->max_size) {
+        Free(copy);
+        return;
+    }
+    d->first = (d->first + HPACK_MAX_ENTRIES - 1) % HPACK_MAX_ENTRIES;
+    d->entries[d->first] = (hpack_entry_t){.name = copy,
+                                           .namelen = namelen,
+                                           .value = copy + namelen,
+                                           .valuelen = valuelen};
+    d->count++;
+    d->size += size;
+}
+
+/* lookup - Find an entry of the static or dynamic table by index */
+static int lookup(hpack_decoder_t *d, uint32_t index, const char **name,
+                  size_t *namelen, const char **value, size_t *valuelen) {
+    if (index == 0) {
+        return -1;
+    }
+    if (index <= HPACK_STATIC_ENTRIES) {
+        *name = static_table[index - 1].name;
+        *namelen = strlen(*name);
+        *value = static_table[index - 1].value;
+        *valuelen = strlen(*value);
+        return 0;
+    }
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= d->count) {
+        return -1;
+    }
+    hpack_entry_t *e = &d->entries[(d->first + index) % HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *namelen = e->namelen;
+    *value = e->value;
+    *valuelen = e->valuelen;
+    return 0;
+}
+
+int hpack_decode(hpack_decoder_t *d, const uint8_t *in, size_t len,
+                 char *scratch, size_t scratchlen, hpack_emit_t emit,
+                 void *arg) {
+    const uint8_t *p = in, *end = in + len;
+
+    while (p < end) {
+        const char *name, *value;
+        size_t namelen, valuelen, used = 0;
+        uint32_t index;
+        uint8_t b = *p;
+
+        if (b & 0x80) {
+            /* Indexed field */
+            if (decode_int(&p, end, 7, &index) < 0 ||
+                lookup(d, index, &name, &namelen, &value, &valuelen) < 0) {
+                return -1;
+            }
+        } else if ((b & 0xe0) == 0x20) {
+            /* Dynamic table size update */
+            if (decode_int(&p, end, 5, &index) < 0 ||
+                index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            d->max_size = index;
+            evict(d, d->max_size);
+            continue;
+        } else {
+            /* Literal, with incremental indexing or without */
+            bool indexing = (b & 0x40) != 0;
+            if (decode_int(&p, end, indexing ? 6 : 4, &index) < 0) {
+                return -1;
+            }
+            if (index == 0) {
+                if (p == end || decode_string(&p, end, scratch, scratchlen,
+                                              &used, &name, &namelen) < 0) {
+                    return -1;
+                }
+            } else if (lookup(d, index, &name, &namelen, &value,
+                              &valuelen) < 0) {
+                return -1;
+            }
+            if (p == end || decode_string(&p, end, scratch, scratchlen,
+                                          &used, &value, &valuelen) < 0) {
+                return -1;
+            }
+            if (indexing) {
+                insert(d, name, namelen, value, valuelen);
+            }
+        }
+
+        int rc = emit(arg, name, namelen, value, valuelen);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* encode_int - Encode an integer with an N-bit prefix after first's bits */
+static size_t encode_int(uint8_t *out, uint8_t first, int prefix,
+                         uint32_t v) {
+    uint32_t max = (1u << prefix) - 1;
+    size_t n = 0;
+
+    if (v < max) {
+        out[n++] = (uint8_t)(first | v);
+        return n;
+    }
+    out[n++] = (uint8_t)(first | max);
+    v -= max;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(0x80 | (v & 0x7f));
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+size_t hpack_encode_status(uint8_t *out, int status) {
+    static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+
+    for (size_t i = 0; i < sizeof(indexed) / sizeof(indexed[0]); i++) {
+        if (status == indexed[i]) {
+            return encode_int(out, 0x80, 7, (uint32_t)(8 + i));
+        }
+    }
+    out[0] = 0x08; /* Literal without indexing, name :status */
+    out[1] = 3;
+    out[2] = (uint8_t)('0' + status / 100);
+    out[3] = (uint8_t)('0' + status / 10 % 10);
+    out[4] = (uint8_t)('0' + status % 10);
+    return 5;
+}
+
+size_t hpack_encode_field(uint8_t *out, size_t room, const char *name,
+                          size_t namelen, const char *value,
+                          size_t valuelen) {
+    uint32_t index = 0;
+    size_t n;
+
+    for (uint32_t i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+        if (strlen(static_table[i].name) == namelen &&
+            memcmp(static_table[i].name, name, namelen) == 0) {
+            index = i + 1;
+            break;
+        }
+    }
+
+    /* Integers take at most 6 bytes each at these sizes */
+    if (namelen + valuelen + 18 > room) {
+        return 0;
+    }
+    n = encode_int(out, 0x00, 4, index);
+    if (index == 0) {
+        n += encode_int(out + n, 0x00, 7, (uint32_t)namelen);
+        memcpy(out + n, name, namelen);
+        n += namelen;
+    }
+    n += encode_int(out + n, 0x00, 7, (uint32_t)valuelen);
+    memcpy(out + n, value, valuelen);
+    return n + valuelen;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file hpack.h
+ * @brief HPACK header compression for HTTP/2 (RFC 7541)
+ *
+ * The decoder keeps the dynamic table a peer's encoder builds up over a
+ * connection, so there is one per connection. The static table and the
+ * Huffman code are shared by all of them. Header blocks are decoded
+ * without copying where possible: a field that is neither Huffman coded
+ * nor added to the dynamic table is handed out as a span of the input.
+ *
+ * The encoder side never indexes anything, so it needs no state: fields
+ * are sent as literals "without indexing", with the name taken from the
+ * static table when it is there, and without Huffman coding.
+ */
+
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HPACK_TABLE_SIZE 4096 // Dynamic table size allowed to the peer
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32) // Entries cost >= 32
+
+/**
+ * @brief An entry of the dynamic table
+ */
+typedef struct {
+    char *name;      /**< name, followed in the same allocation by value */
+    size_t namelen;  /**< length of name */
+    char *value;     /**< value */
+    size_t valuelen; /**< length of value */
+} hpack_entry_t;
+
+/**
+ * @brief Decoding state for one direction of one connection
+ */
+typedef struct {
+    hpack_entry_t entries[HPACK_MAX_ENTRIES]; /**< ring, newest at first */
+    size_t first;    /**< position of the newest entry */
+    size_t count;    /**< number of entries */
+    size_t size;     /**< table size as RFC 7541 counts it */
+    size_t max_size; /**< current limit, from the peer's size updates */
+} hpack_decoder_t;
+
+/**
+ * @brief Called with each decoded header field
+ *
+ * The strings are not NUL terminated and are only valid during the call.
+ *
+ * @return 0 to go on, or a negative value to stop decoding
+ */
+typedef int (*hpack_emit_t)(void *arg, const char *name, size_t namelen,
+                            const char *value, size_t valuelen);
+
+/**
+ * @brief Prepare a decoder with an empty dynamic table
+ *
+ * @param[in] d The decoder
+ */
+void hpack_decoder_init(hpack_decoder_t *d);
+
+/**
+ * @brief Free a decoder's dynamic table
+ *
+ * @param[in] d The decoder
+ */
+void hpack_decoder_free(hpack_decoder_t *d);
+
+/**
+ * @brief Decode a complete header block
+ *
+ * @param[in] d The decoder for the connection
+ * @param[in] in The header block
+ * @param[in] len Length of the header block
+ * @param[in] scratch Room for Huffman decoded strings
+ * @param[in] scratchlen Size of scratch
+ * @param[in] emit Called with each field, in order
+ * @param[in] arg Passed to emit
+ *
+ * @return 0 on success, -1 if the block is malformed or does not fit in
+ *     scratch (a connection error), or what emit returned if it stopped
+ */
+int hpack_decode(hpack_decoder_t *d, const uint8_t *in, size_t len,
+                 char *scratch, size_t scratchlen, hpack_emit_t emit,
+                 void *arg);
+
+/**
+ * @brief Encode a :status pseudo-header
+ *
+ * @param[out] out At least 5 bytes
+ * @param[in] status The status code, 100 to 999
+ *
+ * @return The number of bytes written
+ */
+size_t hpack_encode_status(uint8_t *out, int status);
+
+/**
+ * @brief Encode a header field as a literal without indexing
+ *
+ * @param[out] out Where to write
+ * @param[in] room Bytes available at out
+ * @param[in] name The name, which must be lowercase
+ * @param[in] namelen Length of name
+ * @param[in] value The value
+ * @param[in] valuelen Length of value
+ *
+ * @return The number of bytes written, or 0 if they do not fit
+ */
+size_t hpack_encode_field(uint8_t *out, size_t room, const char *name,
+                          size_t namelen, const char *value,
+                          size_t valuelen);
+
+#endif /* __HPACK_H__ */
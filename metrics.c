@@ -0,0 +1,83 @@
+/**
+ * @file metrics.c
+ * @brief Process-wide counters and gauges
+ */
+
+#include "metrics.h"
+#include "csapp.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define METRIC_NAME(id, name) name,
+static const char *metric_names[METRIC_COUNT] = {METRICS_LIST(METRIC_NAME)};
+#undef METRIC_NAME
+
+static long metric_values[METRIC_COUNT];
+
+static void (*reporters[METRICS_MAX_REPORTERS])(int fd);
+static int nreporters;
+static sem_t dump_requested;
+
+void metrics_add(metric_t m, long delta) {
+    __atomic_fetch_add(&metric_values[m], delta, __ATOMIC_RELAXED);
+}
+
+void metrics_inc(metric_t m) {
+    __atomic_fetch_add(&metric_values[m], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_set(metric_t m, long value) {
+    __atomic_store_n(&metric_values[m], value, __ATOMIC_RELAXED);
+}
+
+long metrics_get(metric_t m) {
+    return __atomic_load_n(&metric_values[m], __ATOMIC_RELAXED);
+}
+
+void metrics_dump(int fd) {
+    for (int m = 0; m < METRIC_COUNT; m++) {
+        sio_dprintf(fd, "%s %ld\n", metric_names[m], metrics_get(m));
+    }
+}
+
+void metrics_register(void (*report)(int fd)) {
+    if (nreporters < METRICS_MAX_REPORTERS) {
+        reporters[nreporters++] = report;
+    }
+}
+
+/* dump_thread - Print a dump each time SIGUSR1 arrives */
+static void *dump_thread(void *arg) {
+    (void)arg;
+    while (true) {
+        if (sem_wait(&dump_requested) < 0) {
+            continue;
+        }
+        metrics_dump(STDERR_FILENO);
+        for (int i = 0; i < nreporters; i++) {
+            reporters[i](STDERR_FILENO);
+        }
+    }
+    return NULL;
+}
+
+static void sigusr1_handler(int sig) {
+    (void)sig;
+    int olderrno = errno;
+    sem_post(&dump_requested);
+    errno = olderrno;
+}
+
+void metrics_init(void) {
+    pthread_t tid;
+
+    sem_init(&dump_requested, 0, 0);
+    pthread_create(&tid, NULL, dump_thread, NULL);
+    pthread_detach(tid);
+    Signal(SIGUSR1, sigusr1_handler);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file metrics.h
+ * @brief Process-wide counters and gauges
+ *
+ * Each metric is a single atomically updated long, so recording one costs
+ * an atomic add and no lock. Sending SIGUSR1 to the proxy prints every
+ * metric to stderr, one "name value" pair per line, followed by the output
+ * of any registered reporters (which describe per-origin state and the
+ * like). The signal handler only wakes a thread that does the printing, so
+ * reporters may take locks.
+ *
+ * To add a metric, add a line to METRICS_LIST.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/* X(identifier, printed name) */
+#define METRICS_LIST(X)                                                        \
+    X(REQUESTS, "requests")                                                    \
+    X(TIMEOUTS_HEADER, "timeouts_header")                                      \
+    X(TIMEOUTS_FIRST_BYTE, "timeouts_first_byte")                              \
+    X(TIMEOUTS_IDLE, "timeouts_idle")                                          \
+    X(TIMEOUTS_TOTAL, "timeouts_total")                                        \
+    X(TIMEOUTS_TUNNEL, "timeouts_tunnel")                                      \
+    X(BREAKER_OPENS, "breaker_opens")                                          \
+    X(BREAKER_REJECTS, "breaker_rejects")                                      \
+    X(HEDGES, "hedges")                                                        \
+    X(HEDGE_WINS, "hedge_wins")                                                \
+    X(LIMIT_QUEUED, "limit_queued")                                            \
+    X(LIMIT_QUEUE_MS, "limit_queue_ms")                                        \
+    X(LIMIT_REJECTS, "limit_rejects")                                          \
+    X(TUNNELS, "tunnels")                                                      \
+    X(TUNNELS_ACTIVE, "tunnels_active")                                        \
+    X(TUNNEL_BYTES, "tunnel_bytes")                                            \
+    X(UPGRADES, "upgrades")                                                    \
+    X(H2_CONNECTIONS, "h2_connections")                                        \
+    X(H2_STREAMS, "h2_streams")                                                \
+    X(H2_REFUSED, "h2_refused")                                                \
+    X(GZIP_RESPONSES, "gzip_responses")                                        \
+    X(GZIP_BYTES_IN, "gzip_bytes_in")                                          \
+    X(GZIP_BYTES_OUT, "gzip_bytes_out")                                        \
+    X(CACHE_HITS, "cache_hits")                                                \
+    X(CACHE_MISSES, "cache_misses")                                            \
+    X(CACHE_STALE_HITS, "cache_stale_hits")                                    \
+    X(CACHE_STORES, "cache_stores")                                            \
+    X(CACHE_EVICTIONS, "cache_evictions")
+
+#define METRIC_ENUM(id, name) METRIC_##id,
+typedef enum { METRICS_LIST(METRIC_ENUM) METRIC_COUNT } metric_t;
+#undef METRIC_ENUM
+
+#define METRICS_MAX_REPORTERS 4
+
+/**
+ * @brief Install the SIGUSR1 handler that dumps all metrics
+ */
+void metrics_init(void);
+
+/**
+ * @brief Add a reporter to the SIGUSR1 dump
+ *
+ * @param[in] report Called with the file descriptor to print to
+ */
+void metrics_register(void (*report)(int fd));
+
+/**
+ * @brief Add to a counter (or gauge)
+ *
+ * @param[in] m The metric
+ * @param[in] delta The amount to add, which may be negative
+ */
+void metrics_add(metric_t m, long delta);
+
+/**
+ * @brief Increment a counter by one
+ *
+ * @param[in] m The metric
+ */
+void metrics_inc(metric_t m);
+
+/**
+ * @brief Set a gauge
+ *
+ * @param[in] m The metric
+ * @param[in] value The new value
+ */
+void metrics_set(metric_t m, long value);
+
+/**
+ * @brief Read a metric
+ *
+ * @param[in] m The metric
+ *
+ * @return The current value
+ */
+long metrics_get(metric_t m);
+
+/**
+ * @brief Print every metric to a file descriptor
+ *
+ * @param[in] fd The file descriptor
+ *
+ * @remark This function is async-signal-safe.
+ */
+void metrics_dump(int fd);
+
+#endif /* __METRICS_H__ */
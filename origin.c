@@ -0,0 +1,415 @@
+/**
+ * @file origin.c
+ * @brief Per-origin health and latency tracking
+ *
+ * Entries live in a chained hash table protected by a single lock, which
+ * is only held to find, create or drop entries. Each entry has its own lock
+ * for its breaker, latency histogram and concurrency limit. Entries are
+ * reference counted so that idle ones can be dropped once the table grows
+ * past ORIGIN_MAX_ENTRIES.
+ */
+
+#include "origin.h"
+#include "csapp.h"
+#include "metrics.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ORIGIN_BUCKETS 256
+#define ORIGIN_MAX_NAME 272     // host:port
+#define ORIGIN_MAX_ENTRIES 1024 // Above this, idle entries are dropped
+#define ORIGIN_IDLE_MS 60000    // How long an entry must be idle to go
+
+/* The error rate window is made of this many buckets */
+#define WINDOW_SLOTS 10
+#define WINDOW_SLOT_MS (BREAKER_WINDOW_MS / WINDOW_SLOTS)
+
+/* Latency bucket i counts times below 2^((i + 1) / 4) - 1 ms */
+#define LATENCY_BUCKETS 64
+#define LATENCY_STEPS 4
+
+typedef struct {
+    uint64_t epoch;    // Which WINDOW_SLOT_MS period this slot counts
+    unsigned requests; // Requests finished in that period
+    unsigned failures; // Of which failed
+} window_slot_t;
+
+struct origin {
+    struct origin *next;        // Next entry in the bucket
+    char name[ORIGIN_MAX_NAME]; // Lower case host:port
+    unsigned refs;              // origin_get()s not yet put
+    uint64_t used_ms;           // When last looked up
+
+    pthread_mutex_t lock;               // Protects the breaker below
+    breaker_state state;                // Closed, open or half-open
+    unsigned consecutive;               // Failures in a row while closed
+    window_slot_t window[WINDOW_SLOTS]; // Recent outcomes
+    uint64_t open_until_ms;             // End of the cool-down
+    unsigned open_ms;                   // Length of the last cool-down
+    unsigned probes;                    // Probes in flight
+    unsigned probe_successes;           // Probe successes in a row
+
+    unsigned latency[LATENCY_BUCKETS];  // Time to first byte histogram
+    unsigned samples;                   // Samples in the histogram
+    unsigned since_decay;               // Samples since it was halved
+
+    pthread_cond_t room;                // Signalled when a request finishes
+    double limit;                       // Concurrency limit
+    unsigned inflight;                  // Requests in flight
+    unsigned queued;                    // Requests waiting for room
+    long min_rtt_us;                    // Best latency of last window, or -1
+    long window_min_us;                 // Best latency of this window, or -1
+    uint64_t window_start_ms;           // When this window began
+    uint64_t decreased_us;              // When the limit last shrank
+};
+
+static struct {
+    pthread_mutex_t lock;
+    origin_t *buckets[ORIGIN_BUCKETS];
+    unsigned count;
+} table = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t now_ms(void) {
+    return now_us() / 1000;
+}
+
+static unsigned hash_name(const char *name) {
+    unsigned h = 5381;
+    while (*name != '\0') {
+        h = h * 33 + (unsigned char)*name++;
+    }
+    return h % ORIGIN_BUCKETS;
+}
+
+/* sweep - Drop idle, healthy, unreferenced entries; lock held */
+static void sweep(uint64_t now) {
+    for (int b = 0; b < ORIGIN_BUCKETS; b++) {
+        origin_t **link = &table.buckets[b];
+        while (*link != NULL) {
+            origin_t *o = *link;
+            if (o->refs == 0 && o->state == BREAKER_CLOSED &&
+                now - o->used_ms > ORIGIN_IDLE_MS) {
+                *link = o->next;
+                pthread_mutex_destroy(&o->lock);
+                pthread_cond_destroy(&o->room);
+                Free(o);
+                table.count--;
+            } else {
+                link = &o->next;
+            }
+        }
+    }
+}
+
+origin_t *origin_get(const char *host, const char *port) {
+    char name[ORIGIN_MAX_NAME];
+    uint64_t now = now_ms();
+    origin_t *o;
+
+    snprintf(name, sizeof(name), "%s:%s", host, port);
+    for (char *p = name; *p != '\0'; p++) {
+        *p = (char)tolower((unsigned char)*p);
+    }
+    unsigned h = hash_name(name);
+
+    pthread_mutex_lock(&table.lock);
+    for (o = table.buckets[h]; o != NULL; o = o->next) {
+        if (strcmp(o->name, name) == 0) {
+            break;
+        }
+    }
+    if (o == NULL) {
+        if (table.count >= ORIGIN_MAX_ENTRIES) {
+            sweep(now);
+        }
+        o = Calloc(1, sizeof(origin_t));
+        strcpy(o->name, name);
+        pthread_mutex_init(&o->lock, NULL);
+        pthread_cond_init(&o->room, NULL);
+        o->state = BREAKER_CLOSED;
+        o->limit = LIMIT_INITIAL;
+        o->min_rtt_us = o->window_min_us = -1;
+        o->next = table.buckets[h];
+        table.buckets[h] = o;
+        table.count++;
+    }
+    o->refs++;
+    o->used_ms = now;
+    pthread_mutex_unlock(&table.lock);
+    return o;
+}
+
+void origin_put(origin_t *o) {
+    pthread_mutex_lock(&table.lock);
+    o->refs--;
+    pthread_mutex_unlock(&table.lock);
+}
+
+/* trip - Open the breaker; lock held */
+static void trip(origin_t *o, uint64_t now) {
+    if (o->state == BREAKER_HALF_OPEN) {
+        o->open_ms = o->open_ms * 2 > BREAKER_MAX_OPEN_MS ? BREAKER_MAX_OPEN_MS
+                                                          : o->open_ms * 2;
+    } else {
+        o->open_ms = BREAKER_OPEN_MS;
+    }
+    o->state = BREAKER_OPEN;
+    o->open_until_ms = now + o->open_ms;
+    o->consecutive = 0;
+    memset(o->window, 0, sizeof(o->window));
+    metrics_inc(METRIC_BREAKER_OPENS);
+    fprintf(stderr, "Origin %s failing, breaker open for %u ms\n", o->name,
+            o->open_ms);
+}
+
+/* record - Count an outcome in the error rate window; lock held */
+static void record(origin_t *o, uint64_t now, bool ok,
+                   unsigned *requests, unsigned *failures) {
+    uint64_t epoch = now / WINDOW_SLOT_MS;
+    window_slot_t *slot = &o->window[epoch % WINDOW_SLOTS];
+
+    if (slot->epoch != epoch) {
+        slot->epoch = epoch;
+        slot->requests = slot->failures = 0;
+    }
+    slot->requests++;
+    slot->failures += ok ? 0 : 1;
+
+    *requests = *failures = 0;
+    for (int i = 0; i < WINDOW_SLOTS; i++) {
+        if (o->window[i].epoch + WINDOW_SLOTS > epoch) {
+            *requests += o->window[i].requests;
+            *failures += o->window[i].failures;
+        }
+    }
+}
+
+bool origin_admit(origin_t *o) {
+    bool admit = true;
+
+    pthread_mutex_lock(&o->lock);
+    if (o->state == BREAKER_OPEN && now_ms() >= o->open_until_ms) {
+        o->state = BREAKER_HALF_OPEN;
+        o->probes = 0;
+        o->probe_successes = 0;
+    }
+    if (o->state == BREAKER_OPEN) {
+        admit = false;
+    } else if (o->state == BREAKER_HALF_OPEN) {
+        if (o->probes < BREAKER_PROBES) {
+            o->probes++;
+        } else {
+            admit = false;
+        }
+    }
+    pthread_mutex_unlock(&o->lock);
+
+    if (!admit) {
+        metrics_inc(METRIC_BREAKER_REJECTS);
+    }
+    return admit;
+}
+
+void origin_cancel(origin_t *o) {
+    pthread_mutex_lock(&o->lock);
+    if (o->state == BREAKER_HALF_OPEN && o->probes > 0) {
+        o->probes--;
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_report(origin_t *o, bool ok) {
+    uint64_t now = now_ms();
+    unsigned requests, failures;
+
+    pthread_mutex_lock(&o->lock);
+    switch (o->state) {
+    case BREAKER_CLOSED:
+        o->consecutive = ok ? 0 : o->consecutive + 1;
+        record(o, now, ok, &requests, &failures);
+        if (o->consecutive >= BREAKER_FAILURES ||
+            (requests >= BREAKER_MIN_REQUESTS &&
+             failures * 100 >= requests * BREAKER_ERROR_PERCENT)) {
+            trip(o, now);
+        }
+        break;
+    case BREAKER_HALF_OPEN:
+        if (o->probes == 0) {
+            break; /* Admitted before the breaker opened */
+        }
+        o->probes--;
+        if (!ok) {
+            trip(o, now);
+        } else if (++o->probe_successes >= BREAKER_PROBE_SUCCESSES) {
+            o->state = BREAKER_CLOSED;
+            fprintf(stderr, "Origin %s recovered, breaker closed\n", o->name);
+        }
+        break;
+    case BREAKER_OPEN:
+        /* A request admitted before the breaker opened */
+        break;
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_observe(origin_t *o, unsigned ms) {
+    int i = (int)(LATENCY_STEPS * log2(ms + 1.0));
+    if (i >= LATENCY_BUCKETS) {
+        i = LATENCY_BUCKETS - 1;
+    }
+
+    pthread_mutex_lock(&o->lock);
+    if (++o->since_decay >= LATENCY_DECAY_SAMPLES) {
+        o->samples = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            o->latency[b] /= 2;
+            o->samples += o->latency[b];
+        }
+        o->since_decay = 0;
+    }
+    o->latency[i]++;
+    o->samples++;
+    pthread_mutex_unlock(&o->lock);
+}
+
+int origin_percentile(origin_t *o, int percent) {
+    int result = -1;
+
+    pthread_mutex_lock(&o->lock);
+    if (o->samples >= LATENCY_MIN_SAMPLES) {
+        unsigned rank = (o->samples * (unsigned)percent + 99) / 100;
+        unsigned seen = 0;
+        int i = 0;
+        while (i < LATENCY_BUCKETS - 1 && (seen += o->latency[i]) < rank) {
+            i++;
+        }
+        result = (int)exp2((double)(i + 1) / LATENCY_STEPS) - 1;
+    }
+    pthread_mutex_unlock(&o->lock);
+    return result;
+}
+
+bool origin_acquire(origin_t *o, bool queue) {
+    bool ok = true;
+
+    pthread_mutex_lock(&o->lock);
+    if (o->inflight >= (unsigned)o->limit) {
+        if (!queue || o->queued >= LIMIT_QUEUE_MAX) {
+            ok = false;
+        } else {
+            struct timespec deadline;
+            uint64_t start = now_ms();
+            int rc = 0;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (LIMIT_QUEUE_MS % 1000) * 1000000L;
+            deadline.tv_sec += LIMIT_QUEUE_MS / 1000 +
+                               deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+
+            o->queued++;
+            metrics_inc(METRIC_LIMIT_QUEUED);
+            while (o->inflight >= (unsigned)o->limit && rc != ETIMEDOUT) {
+                rc = pthread_cond_timedwait(&o->room, &o->lock, &deadline);
+            }
+            o->queued--;
+            ok = o->inflight < (unsigned)o->limit;
+            metrics_add(METRIC_LIMIT_QUEUE_MS, (long)(now_ms() - start));
+        }
+    }
+    if (ok) {
+        o->inflight++;
+    }
+    pthread_mutex_unlock(&o->lock);
+
+    if (!ok) {
+        metrics_inc(METRIC_LIMIT_REJECTS);
+    }
+    return ok;
+}
+
+/* track_rtt - Update the best latency windows; lock held */
+static void track_rtt(origin_t *o, long rtt_us, uint64_t now) {
+    if (now / 1000 - o->window_start_ms >= LIMIT_BASELINE_MS) {
+        if (o->window_min_us >= 0) {
+            o->min_rtt_us = o->window_min_us;
+        }
+        o->window_min_us = -1;
+        o->window_start_ms = now / 1000;
+    }
+    if (o->window_min_us < 0 || rtt_us < o->window_min_us) {
+        o->window_min_us = rtt_us;
+    }
+    if (o->min_rtt_us < 0 || rtt_us < o->min_rtt_us) {
+        o->min_rtt_us = rtt_us;
+    }
+}
+
+void origin_release(origin_t *o, bool ok, long rtt_us) {
+    uint64_t now = now_us();
+
+    pthread_mutex_lock(&o->lock);
+    bool saturated = o->inflight * 2 >= o->limit;
+    o->inflight--;
+    if (rtt_us >= 0) {
+        track_rtt(o, rtt_us, now);
+    }
+
+    bool congested =
+        !ok || (rtt_us >= 0 &&
+                rtt_us > LIMIT_TOLERANCE * o->min_rtt_us + LIMIT_SLACK_US);
+    if (congested) {
+        /* Back off at most once per round trip */
+        long rtt = rtt_us >= 0 ? rtt_us : o->min_rtt_us;
+        if (now - o->decreased_us >= (uint64_t)(rtt > 0 ? rtt : 0)) {
+            o->limit = o->limit * LIMIT_BACKOFF;
+            if (o->limit < LIMIT_MIN) {
+                o->limit = LIMIT_MIN;
+            }
+            o->decreased_us = now;
+        }
+    } else if (rtt_us >= 0 && saturated) {
+        o->limit += 1.0 / o->limit;
+        if (o->limit > LIMIT_MAX) {
+            o->limit = LIMIT_MAX;
+        }
+    }
+    if (o->queued > 0) {
+        pthread_cond_broadcast(&o->room);
+    }
+    pthread_mutex_unlock(&o->lock);
+}
+
+void origin_dump(int fd) {
+    static const char *states[] = {"closed", "open", "half_open"};
+
+    pthread_mutex_lock(&table.lock);
+    for (int b = 0; b < ORIGIN_BUCKETS; b++) {
+        for (origin_t *o = table.buckets[b]; o != NULL; o = o->next) {
+            int p95 = origin_percentile(o, 95);
+            pthread_mutex_lock(&o->lock);
+            sio_dprintf(fd,
+                        "origin %s breaker %s limit %d inflight %u queued %u"
+                        " min_rtt_us %ld p95_ms %d\n",
+                        o->name, states[o->state], (int)o->limit,
+                        o->inflight, o->queued, o->min_rtt_us, p95);
+            pthread_mutex_unlock(&o->lock);
+        }
+    }
+    pthread_mutex_unlock(&table.lock);
+}
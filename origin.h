@@ -0,0 +1,176 @@
+/**
+ * @file origin.h
+ * @brief Per-origin health and latency tracking
+ *
+ * Every origin server (host and port) the proxy talks to has an entry
+ * recording how its recent requests went.
+ *
+ * A circuit breaker keeps the proxy from tying up threads on an origin
+ * that is refusing connections or timing out:
+ *
+ * - closed: requests flow normally. The breaker opens after
+ *   BREAKER_FAILURES consecutive failures, or when at least
+ *   BREAKER_ERROR_PERCENT of the requests in the last BREAKER_WINDOW_MS
+ *   failed (given at least BREAKER_MIN_REQUESTS of them).
+ * - open: requests are refused at once. After a cool-down, which doubles
+ *   each time the breaker reopens (from BREAKER_OPEN_MS up to
+ *   BREAKER_MAX_OPEN_MS), the breaker becomes half-open.
+ * - half-open: at most BREAKER_PROBES requests at a time are let through
+ *   as probes. BREAKER_PROBE_SUCCESSES successes in a row close the
+ *   breaker; any failure reopens it.
+ *
+ * A failure is a request that got no response from the origin at all:
+ * the connection failed, the origin timed out, or it closed or sent
+ * garbage before the response started.
+ *
+ * The entry also keeps a histogram of the origin's time to first byte,
+ * with buckets about 19% wide, halved every LATENCY_DECAY_SAMPLES samples
+ * so it follows recent behavior.
+ *
+ * Finally, the number of requests in flight to an origin is capped by an
+ * adaptive limit, much like a TCP congestion window. While the origin's
+ * time to first byte stays within LIMIT_TOLERANCE times its best recent
+ * time (the minimum over the last LIMIT_BASELINE_MS) and the limit is in
+ * use, the limit grows by one every limit-many requests. A failure or a
+ * slower response shrinks it by LIMIT_BACKOFF, at most once per round
+ * trip. Requests over the limit wait in a queue of at most LIMIT_QUEUE_MAX
+ * for up to LIMIT_QUEUE_MS, and are refused after that.
+ */
+
+#ifndef __ORIGIN_H__
+#define __ORIGIN_H__
+
+#include <stdbool.h>
+
+#define BREAKER_FAILURES 5          // Consecutive failures that open
+#define BREAKER_WINDOW_MS 10000     // Error rate window
+#define BREAKER_MIN_REQUESTS 20     // Requests needed to judge the rate
+#define BREAKER_ERROR_PERCENT 50    // Error rate that opens
+#define BREAKER_OPEN_MS 1000        // First cool-down
+#define BREAKER_MAX_OPEN_MS 30000   // Longest cool-down
+#define BREAKER_PROBES 1            // Probes in flight when half-open
+#define BREAKER_PROBE_SUCCESSES 2   // Probe successes that close
+
+#define LATENCY_MIN_SAMPLES 20      // Samples needed for a percentile
+#define LATENCY_DECAY_SAMPLES 1000  // Samples between halvings
+
+#define LIMIT_INITIAL 20            // Starting concurrency limit
+#define LIMIT_MIN 1                 // Smallest concurrency limit
+#define LIMIT_MAX 200               // Largest concurrency limit
+#define LIMIT_BACKOFF 0.9           // Factor applied on congestion
+#define LIMIT_TOLERANCE 2           // Latency multiple seen as congestion
+#define LIMIT_SLACK_US 1000         // Jitter ignored on top of that
+#define LIMIT_BASELINE_MS 10000     // Window of the best latency
+#define LIMIT_QUEUE_MAX 32          // Requests that may wait
+#define LIMIT_QUEUE_MS 200          // How long they may wait
+
+/**
+ * @brief Circuit breaker states
+ */
+typedef enum {
+    BREAKER_CLOSED,    /**< requests flow */
+    BREAKER_OPEN,      /**< requests are refused */
+    BREAKER_HALF_OPEN, /**< a few probes are let through */
+} breaker_state;
+
+typedef struct origin origin_t;
+
+/**
+ * @brief Find (or create) the entry of an origin
+ *
+ * Each origin_get() must be matched by an origin_put().
+ *
+ * @param[in] host The origin's host, compared without case
+ * @param[in] port The origin's port
+ *
+ * @return The entry
+ */
+origin_t *origin_get(const char *host, const char *port);
+
+/**
+ * @brief Release an entry obtained with origin_get()
+ *
+ * @param[in] o The entry
+ */
+void origin_put(origin_t *o);
+
+/**
+ * @brief Ask the breaker whether a request may be sent to an origin
+ *
+ * Each admitted request must be followed by an origin_report().
+ *
+ * @param[in] o The origin
+ *
+ * @return true if the request may go ahead, false to fail it fast
+ */
+bool origin_admit(origin_t *o);
+
+/**
+ * @brief Release an admitted request that was abandoned unanswered
+ *
+ * The request counts as neither a success nor a failure.
+ *
+ * @param[in] o The origin
+ */
+void origin_cancel(origin_t *o);
+
+/**
+ * @brief Record the outcome of an admitted request
+ *
+ * @param[in] o The origin
+ * @param[in] ok false if the origin failed to respond
+ */
+void origin_report(origin_t *o, bool ok);
+
+/**
+ * @brief Record an origin's time to first byte
+ *
+ * @param[in] o The origin
+ * @param[in] ms The time from sending the request to the first response
+ *     byte
+ */
+void origin_observe(origin_t *o, unsigned ms);
+
+/**
+ * @brief Estimate a percentile of an origin's time to first byte
+ *
+ * @param[in] o The origin
+ * @param[in] percent The percentile, e.g. 95
+ *
+ * @return The estimate in ms, or -1 with fewer than LATENCY_MIN_SAMPLES
+ *     recent samples
+ */
+int origin_percentile(origin_t *o, int percent);
+
+/**
+ * @brief Wait for room under an origin's concurrency limit
+ *
+ * Each successful origin_acquire() must be matched by an
+ * origin_release().
+ *
+ * @param[in] o The origin
+ * @param[in] queue Whether to wait in the queue if the limit is reached
+ *
+ * @return true if the request may be sent, false if it should be refused
+ */
+bool origin_acquire(origin_t *o, bool queue);
+
+/**
+ * @brief Give back room under the concurrency limit, and adapt the limit
+ *
+ * @param[in] o The origin
+ * @param[in] ok false if the origin failed to respond
+ * @param[in] rtt_us The request's time to first byte, or -1 if unknown
+ */
+void origin_release(origin_t *o, bool ok, long rtt_us);
+
+/**
+ * @brief Print the state of every origin, one per line
+ *
+ * Meant to be registered with metrics_register().
+ *
+ * @param[in] fd The file descriptor to print to
+ */
+void origin_dump(int fd);
+
+#endif /* __ORIGIN_H__ */
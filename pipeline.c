@@ -0,0 +1,277 @@
+/**
+ * @file pipeline.c
+ * @brief Ordered response delivery for pipelined HTTP/1.1 requests
+ *
+ * Slots form a FIFO in request order. Only the head slot may write to the
+ * client socket. When the head finishes, the next slot's buffered output is
+ * flushed by the finishing thread and that slot becomes the new head. While a
+ * flush is in progress (without the lock held), the new head's owner waits so
+ * that bytes are never interleaved on the socket. Retired slots are kept on
+ * a spare list for the next requests rather than freed, along with reorder
+ * buffers of up to KEEP_BUF bytes.
+ */
+
+#include "pipeline.h"
+#include "csapp.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/* Largest reorder buffer a slot keeps, empty, for its next request */
+#define KEEP_BUF (4 * MAXBUF)
+
+struct pl_slot {
+    pipeline_t *pl;       // Owning pipeline
+    struct pl_slot *next; // Next slot in request order
+    char *buf;            // Buffered output while not at the head
+    size_t len;           // Bytes buffered
+    size_t cap;           // Capacity of buf
+    bool done;            // Response complete
+    bool close;           // Close the connection after this response
+};
+
+struct pipeline {
+    int fd;                // Client socket
+    pl_writer_t write;     // Writes to the client
+    void *arg;             // Argument for write
+    pthread_mutex_t lock;  // Protects everything below
+    pthread_cond_t cond;   // Signalled on any state change
+    pl_slot_t *head;       // Oldest unfinished or unflushed slot
+    pl_slot_t *tail;       // Newest slot
+    pl_slot_t *spare;      // Retired slots, linked by next, for reuse
+    size_t depth;          // Number of slots in the list
+    size_t budget;         // Maximum bytes buffered out of order
+    size_t used;           // Bytes currently buffered
+    bool flushing;         // A thread is writing buffered output
+    bool closed;           // No more output will be delivered
+};
+
+/* socket_write - Writer for pipelines on a client socket */
+static ssize_t socket_write(void *arg, const void *buf, size_t n) {
+    pipeline_t *pl = arg;
+    return rio_writen(pl->fd, buf, n);
+}
+
+pipeline_t *pipeline_new_writer(pl_writer_t write, void *arg, size_t budget) {
+    pipeline_t *pl = Calloc(1, sizeof(pipeline_t));
+    pl->fd = -1;
+    pl->write = write;
+    pl->arg = arg;
+    pl->budget = budget;
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->cond, NULL);
+    return pl;
+}
+
+pipeline_t *pipeline_new(int fd, size_t budget) {
+    pipeline_t *pl = pipeline_new_writer(socket_write, NULL, budget);
+    pl->fd = fd;
+    pl->arg = pl;
+    return pl;
+}
+
+void pipeline_free(pipeline_t *pl) {
+    while (pl->spare != NULL) {
+        pl_slot_t *slot = pl->spare;
+        pl->spare = slot->next;
+        Free(slot->buf);
+        Free(slot);
+    }
+    pthread_mutex_destroy(&pl->lock);
+    pthread_cond_destroy(&pl->cond);
+    Free(pl);
+}
+
+pl_slot_t *pipeline_push(pipeline_t *pl) {
+    pl_slot_t *slot;
+
+    pthread_mutex_lock(&pl->lock);
+    while (pl->depth >= PIPELINE_MAX_DEPTH) {
+        pthread_cond_wait(&pl->cond, &pl->lock);
+    }
+    if ((slot = pl->spare) != NULL) {
+        char *buf = slot->buf;
+        size_t cap = slot->cap;
+        pl->spare = slot->next;
+        memset(slot, 0, sizeof(pl_slot_t));
+        slot->buf = buf;
+        slot->cap = cap;
+    } else {
+        slot = Calloc(1, sizeof(pl_slot_t));
+    }
+    slot->pl = pl;
+    if (pl->tail == NULL) {
+        pl->head = slot;
+    } else {
+        pl->tail->next = slot;
+    }
+    pl->tail = slot;
+    pl->depth++;
+    pthread_mutex_unlock(&pl->lock);
+    return slot;
+}
+
+/*
+ * pipeline_advance - Flush the head slot's buffered output and retire
+ *     finished slots. Must be called with the lock held; the lock is dropped
+ *     while writing to the socket.
+ */
+static void pipeline_advance(pipeline_t *pl) {
+    pl_slot_t *slot;
+
+    if (pl->flushing) {
+        return; /* The active flusher will pick up our changes */
+    }
+
+    while ((slot = pl->head) != NULL) {
+        while (slot->len > 0) {
+            char *buf = slot->buf;
+            size_t len = slot->len, cap = slot->cap;
+            slot->buf = NULL;
+            slot->len = slot->cap = 0;
+
+            if (!pl->closed) {
+                pl->flushing = true;
+                pthread_mutex_unlock(&pl->lock);
+                ssize_t rc = pl->write(pl->arg, buf, len);
+                pthread_mutex_lock(&pl->lock);
+                pl->flushing = false;
+                if (rc < 0) {
+                    pl->closed = true;
+                }
+            }
+            /* Kept empty: as the head, the slot is written directly */
+            if (slot->buf == NULL && cap <= KEEP_BUF) {
+                slot->buf = buf;
+                slot->cap = cap;
+            } else {
+                Free(buf);
+            }
+            pl->used -= len;
+            pthread_cond_broadcast(&pl->cond);
+        }
+
+        if (!slot->done) {
+            break; /* The owner now writes directly */
+        }
+
+        if (slot->close) {
+            pl->closed = true;
+        }
+        pl->head = slot->next;
+        if (pl->head == NULL) {
+            pl->tail = NULL;
+        }
+        pl->depth--;
+        slot->next = pl->spare;
+        pl->spare = slot;
+        pthread_cond_broadcast(&pl->cond);
+    }
+}
+
+/* deliver - Write buffers to the client, as the head slot */
+static ssize_t deliver(pipeline_t *pl, const struct iovec *iov, int iovcnt) {
+    if (pl->write == socket_write) {
+        return rio_writevn(pl->fd, iov, iovcnt);
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (pl->write(pl->arg, iov[i].iov_base, iov[i].iov_len) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+ssize_t pipeline_write(pl_slot_t *slot, const void *buf, size_t n) {
+    struct iovec iov = {.iov_base = (void *)buf, .iov_len = n};
+
+    return pipeline_writev(slot, &iov, 1);
+}
+
+ssize_t pipeline_writev(pl_slot_t *slot, const struct iovec *iov, int iovcnt) {
+    pipeline_t *pl = slot->pl;
+    size_t n = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        n += iov[i].iov_len;
+    }
+    pthread_mutex_lock(&pl->lock);
+    while (true) {
+        if (pl->closed) {
+            pthread_mutex_unlock(&pl->lock);
+            return -1;
+        }
+
+        if (slot == pl->head) {
+            if (pl->flushing) {
+                pthread_cond_wait(&pl->cond, &pl->lock);
+                continue;
+            }
+            pthread_mutex_unlock(&pl->lock);
+            if (deliver(pl, iov, iovcnt) < 0) {
+                pthread_mutex_lock(&pl->lock);
+                pl->closed = true;
+                pthread_cond_broadcast(&pl->cond);
+                pthread_mutex_unlock(&pl->lock);
+                return -1;
+            }
+            return (ssize_t)n;
+        }
+
+        /* Not our turn yet, buffer within the budget */
+        if (pl->used + n > pl->budget) {
+            pthread_cond_wait(&pl->cond, &pl->lock);
+            continue;
+        }
+        if (slot->len + n > slot->cap) {
+            size_t cap = slot->cap ? slot->cap : MAXBUF;
+            while (cap < slot->len + n) {
+                cap *= 2;
+            }
+            slot->buf = Realloc(slot->buf, cap);
+            slot->cap = cap;
+        }
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(slot->buf + slot->len, iov[i].iov_base, iov[i].iov_len);
+            slot->len += iov[i].iov_len;
+        }
+        pl->used += n;
+        pthread_mutex_unlock(&pl->lock);
+        return (ssize_t)n;
+    }
+}
+
+void pipeline_finish(pl_slot_t *slot, bool close) {
+    pipeline_t *pl = slot->pl;
+
+    pthread_mutex_lock(&pl->lock);
+    slot->done = true;
+    slot->close = close;
+    if (slot == pl->head) {
+        pipeline_advance(pl);
+    }
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+void pipeline_drain(pipeline_t *pl) {
+    pthread_mutex_lock(&pl->lock);
+    while (pl->head != NULL) {
+        pthread_cond_wait(&pl->cond, &pl->lock);
+    }
+    pthread_mutex_unlock(&pl->lock);
+}
+
+bool pipeline_idle(pipeline_t *pl) {
+    pthread_mutex_lock(&pl->lock);
+    bool idle = pl->head == NULL;
+    pthread_mutex_unlock(&pl->lock);
+    return idle;
+}
+
+bool pipeline_closed(pipeline_t *pl) {
+    pthread_mutex_lock(&pl->lock);
+    bool closed = pl->closed;
+    pthread_mutex_unlock(&pl->lock);
+    return closed;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file pipeline.h
+ * @brief Ordered response delivery for pipelined HTTP/1.1 requests
+ *
+ * A client that pipelines requests expects the responses back in the order
+ * the requests were sent, even though the proxy may process them
+ * concurrently. Every request read from a connection reserves a slot in the
+ * connection's pipeline. The slot at the head of the pipeline writes straight
+ * to the client socket; every other slot buffers its output in a reorder
+ * buffer until it becomes the head.
+ *
+ * The reorder buffer has a fixed memory budget shared by all slots of a
+ * connection. A slot that would exceed the budget blocks until it becomes
+ * the head (at which point it no longer buffers) or until enough buffered
+ * output has been flushed. The head never blocks on the budget, so the
+ * pipeline always makes progress.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Default reorder buffer budget per connection */
+#define PIPELINE_BUDGET (1024 * 1024)
+
+/* Maximum number of requests in flight on one connection */
+#define PIPELINE_MAX_DEPTH 16
+
+typedef struct pipeline pipeline_t;
+typedef struct pl_slot pl_slot_t;
+
+/**
+ * @brief Delivers response bytes somewhere other than a socket
+ *
+ * @return n on success, -1 on failure
+ */
+typedef ssize_t (*pl_writer_t)(void *arg, const void *buf, size_t n);
+
+/**
+ * @brief Create a pipeline that delivers responses to a client socket
+ *
+ * @param[in] fd The client socket responses are written to
+ * @param[in] budget Maximum number of bytes buffered out of order
+ *
+ * @return The pipeline
+ */
+pipeline_t *pipeline_new(int fd, size_t budget);
+
+/**
+ * @brief Create a pipeline that delivers responses through a function
+ *
+ * The HTTP/2 frontend uses this to turn each response into frames.
+ *
+ * @param[in] write Called with the bytes, in order, one call at a time
+ * @param[in] arg Passed to write
+ * @param[in] budget Maximum number of bytes buffered out of order
+ *
+ * @return The pipeline
+ */
+pipeline_t *pipeline_new_writer(pl_writer_t write, void *arg, size_t budget);
+
+/**
+ * @brief Destroy a pipeline
+ *
+ * The caller must have waited for every slot with pipeline_drain() first.
+ * The client socket is not closed.
+ *
+ * @param[in] pl The pipeline
+ */
+void pipeline_free(pipeline_t *pl);
+
+/**
+ * @brief Reserve the next response slot, in request order
+ *
+ * Blocks while PIPELINE_MAX_DEPTH requests are already in flight.
+ *
+ * @param[in] pl The pipeline
+ *
+ * @return The slot the response for the next request must be written to
+ */
+pl_slot_t *pipeline_push(pipeline_t *pl);
+
+/**
+ * @brief Write part of a response
+ *
+ * Writes directly to the client if the slot is at the head of the pipeline,
+ * otherwise buffers the data until it is.
+ *
+ * @param[in] slot The response slot
+ * @param[in] buf The bytes to write
+ * @param[in] n The number of bytes to write
+ *
+ * @return n on success
+ * @return -1 if the client connection failed or is being closed
+ */
+ssize_t pipeline_write(pl_slot_t *slot, const void *buf, size_t n);
+
+/**
+ * @brief Write part of a response from several buffers
+ *
+ * Like pipeline_write() with the buffers one after the other; a client
+ * socket gets them in one writev() when the slot is at the head.
+ *
+ * @param[in] slot The response slot
+ * @param[in] iov The buffers
+ * @param[in] iovcnt The number of buffers
+ *
+ * @return The total number of bytes on success
+ * @return -1 if the client connection failed or is being closed
+ */
+ssize_t pipeline_writev(pl_slot_t *slot, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Mark a response as complete
+ *
+ * The slot must not be used after this call.
+ *
+ * @param[in] slot The response slot
+ * @param[in] close Whether the connection must be closed after the response
+ */
+void pipeline_finish(pl_slot_t *slot, bool close);
+
+/**
+ * @brief Wait until every reserved slot has been finished and flushed
+ *
+ * @param[in] pl The pipeline
+ */
+void pipeline_drain(pipeline_t *pl);
+
+/**
+ * @brief Check whether every reserved slot has been finished and flushed
+ *
+ * Unlike pipeline_drain(), does not wait. A request whose thread stops
+ * using it once it finishes its slot is then no longer in use.
+ *
+ * @param[in] pl The pipeline
+ *
+ * @return true if no slot is in flight
+ */
+bool pipeline_idle(pipeline_t *pl);
+
+/**
+ * @brief Check whether the connection is being closed
+ *
+ * Once a response finished with close == true reaches the head, or a write
+ * to the client fails, no further responses are delivered and no further
+ * requests should be read.
+ *
+ * @param[in] pl The pipeline
+ *
+ * @return true if no further responses will be delivered
+ */
+bool pipeline_closed(pipeline_t *pl);
+
+#endif /* __PIPELINE_H__ */
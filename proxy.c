@@ -8,8 +8,23 @@ and forwards the responses to the corresponding clients.
 
 /* Some useful includes to help you get started */
 
+#include "arena.h"
+#include "cache.h"
+#include "chunked.h"
+#include "connector.h"
 #include "csapp.h"
-#include "http_parser.h"
+#include "deadline.h"
+#include "errpage.h"
+#include "gzip.h"
+#include "h2.h"
+#include "hedge.h"
+#include "metrics.h"
+#include "origin.h"
+#include "pipeline.h"
+#include "reqparse.h"
+#include "resolver.h"
+#include "routes.h"
+#include "tunnel.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -41,13 +56,18 @@ and forwards the responses to the corresponding clients.
 #define dbg_printf(...)
 #endif
 
-/*
- * Max cache and object sizes
- * You might want to move these to the file containing your cache implementation
- */
-#define MAX_CACHE_SIZE (1024 * 1024)
+/* Size of the buffer a response head and body are relayed through */
 #define MAX_OBJECT_SIZE (100 * 1024)
 
+/* Requests allocated before a busy pipeline is drained to reset the arena */
+#define ARENA_REQUESTS (4 * PIPELINE_MAX_DEPTH)
+
+/* Most iovec entries a request to an origin takes: 4 per client header */
+#define REQUEST_IOV (16 + 4 * REQ_MAX_HEADERS)
+
+/* Room for a request's Content-Length header, with any long long value */
+#define REQUEST_LENGTH_SIZE (sizeof("Content-Length: \r\n") + 20)
+
 /* Typedef for convenience */
 typedef struct sockaddr SA;
 
@@ -60,6 +80,55 @@ typedef struct {
     char serv[MAXLINE];      // Client service (port)
 } client_info;
 
+/* A request read from a client, processed inline or on its own thread. */
+typedef struct {
+    const char *method;    // Request method
+    const char *host;      // Origin host
+    const char *port;      // Origin port
+    const char *path;      // Path on the origin
+    const char *authority; // Client's Host header, if any
+    pool_t *pool;          // Backend pool, in reverse-proxy mode
+    int backend;           // Backend chosen from the pool
+    origin_t *origin;      // Health of the origin or backend
+    bool origin_failed;    // Origin did not respond
+    uint64_t start_ns;     // When the request was sent
+    uint64_t first_ns;     // When the first response byte was relayed
+    char head[MAXBUF];     // Request head as read, backing the strings
+    req_header_t fields[REQ_MAX_HEADERS]; // Client headers to forward
+    size_t nfields;        // Number of them
+    char target[1024];     // CONNECT target, owns host and port
+    bool http11;           // Client speaks HTTP/1.1
+    rio_t *client;         // Client connection, read for the body
+    long long body_length; // Content-Length of the body, -1 if none
+    bool body_chunked;     // Body is in the chunked transfer coding
+    bool expect_continue;  // Client waits for 100 Continue to send it
+    bool upgrade_h2c;      // Client asks to switch to HTTP/2
+    const char *settings;  // Its HTTP2-Settings header
+    const char *upgrade;   // Protocol to switch to, forwarded to the origin
+    int switched_fd;       // Origin socket, once it agreed to switch
+    bool keep_alive;       // Client wants the connection kept open
+    bool accept_gzip;      // Client takes gzip compressed bodies
+    bool responded;        // Part of the response has been delivered
+    pl_slot_t *slot;       // Where the response is delivered
+    char cache_key[CACHE_MAX_KEY]; // Origin and path, empty if not cached
+    const cache_entry_t *hit;      // Fresh cached response to answer with
+    bool cacheable;                // The origin's response may be stored
+    bool fill_wanted;              // It is being relayed and will be
+    cache_variant fill_variant;    // Which clients it will answer
+    int fill_ttl;                  // Seconds it will stay fresh
+    cache_entry_t *fill;           // Where it is being stored
+    bool fill_complete;            // All of its body was stored
+} request_t;
+
+/* A request body being streamed to the origin by its own thread. */
+typedef struct {
+    request_t *req; // Request the body belongs to
+    int serverfd;   // Origin connection
+    deadline_t *io; // Origin's first byte deadline, held off while sending
+    bool finished;  // Sender is done, successfully or not (atomic)
+    bool complete;  // The whole body was sent
+} upload_t;
+
 /*
  * String to use for the User-Agent header.
  * Don't forget to terminate with \r\n
@@ -69,33 +138,131 @@ static const char *header_user_agent = "User-Agent: Mozilla/5.0"
                                        " Gecko/20230411 Firefox/63.0.\r\n";
 static const char *header_conn = "Connection: close\r\n";
 static const char *header_proxy = "Proxy-Connection: close\r\n";
+static const char *header_keep_alive = "Connection: keep-alive\r\n";
+static const char *header_upgrade = "Connection: upgrade\r\n";
 static const char *default_version = "HTTP/1.0\r\n";
+static const char *chunked_version = "HTTP/1.1\r\n";
+static const char *header_continue = "HTTP/1.1 100 Continue\r\n\r\n";
+static const char *header_switching = "HTTP/1.1 101 Switching Protocols\r\n"
+                                      "Connection: Upgrade\r\n"
+                                      "Upgrade: h2c\r\n\r\n";
 static const char *default_port = "80";
 
+/* Deadline for connecting to an origin, set with -c */
+static int connect_timeout_ms = CONNECT_TIMEOUT_MS;
+
+/* Routing table, set with -r; NULL unless acting as a reverse proxy */
+static routes_t *routes = NULL;
+
+/* Whether clients may switch to HTTP/2, set with -2 */
+static bool h2c = false;
+
 /* Helper declarations */
-void clienterror(int fd, const char *errnum, const char *shortmsg,
-                 const char *longmsg);
-int doit(int client_fd);
+void clienterror(pl_slot_t *slot, errpage_id id);
+void clienterror_detail(pl_slot_t *slot, errpage_id id, const char *detail);
+int read_request(rio_t *rp, request_t *req, reqparse_t *parse,
+                 deadline_t *deadline);
+int doit(request_t *req);
+void open_tunnel(request_t *req, rio_t *rp, pipeline_t *pl);
+void switch_h2(request_t *req, rio_t *rp, pipeline_t *pl);
+bool open_upgrade(request_t *req, rio_t *rp, pipeline_t *pl);
+void serve_stream(const h2_request_t *stream, pl_slot_t *slot);
+void serve_client(int client_fd);
+void *request_thread(void *vargp);
 void *thread(void *vargp);
 
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-n nameserver[:port]] [-T dns_ttl] [-c connect_ms]"
+            " [-t kind=ms] [-r routes.conf] [-H percent] [-2] [-z level]"
+            " [-C bytes] <port>\n"
+            "  -n  resolve origins with this DNS server, honoring TTLs\n"
+            "  -T  seconds to cache system resolver results (default %d)\n"
+            "  -c  deadline for connecting to an origin (default %d ms)\n"
+            "  -t  set a deadline, kind is header, first_byte, idle, total"
+            " or tunnel\n"
+            "      (defaults %d, %d, %d, %d and %d ms)\n"
+            "  -r  act as a reverse proxy, routing requests by this table\n"
+            "  -H  hedges allowed per 100 GETs, 0 to disable (default %d)\n"
+            "  -2  accept HTTP/2 clients, by prior knowledge or Upgrade: h2c\n"
+            "  -z  gzip level for text responses, 0 to disable (default %d)\n"
+            "  -C  bytes of responses to cache, 0 to disable (default %d)\n",
+            prog, RESOLVER_DEFAULT_TTL, CONNECT_TIMEOUT_MS, HEADER_TIMEOUT_MS,
+            FIRST_BYTE_TIMEOUT_MS, IDLE_TIMEOUT_MS, TOTAL_TIMEOUT_MS,
+            TUNNEL_TIMEOUT_MS, HEDGE_BUDGET_PERCENT, GZIP_LEVEL,
+            CACHE_MAX_SIZE);
+    exit(0);
+}
+
 int main(int argc, char **argv) {
 
     signal(SIGPIPE, SIG_IGN);
 
     /* Check command line args */
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
-        exit(0);
+    resolver_config_t dns_config = {.nameserver = NULL,
+                                    .ttl = RESOLVER_DEFAULT_TTL,
+                                    .negative_ttl = RESOLVER_NEGATIVE_TTL};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:T:c:t:r:H:2z:C:")) != -1) {
+        switch (opt) {
+        case 'n':
+            dns_config.nameserver = optarg;
+            break;
+        case 'T':
+            dns_config.ttl = atoi(optarg);
+            break;
+        case 'c':
+            connect_timeout_ms = atoi(optarg);
+            break;
+        case 't':
+            if (deadline_configure(optarg) < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'r':
+            if ((routes = routes_load(optarg)) == NULL) {
+                exit(1);
+            }
+            break;
+        case 'H':
+            hedge_configure(atoi(optarg));
+            break;
+        case '2':
+            h2c = true;
+            break;
+        case 'z':
+            gzip_configure(atoi(optarg));
+            break;
+        case 'C':
+            cache_configure(strtoul(optarg, NULL, 10));
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+    }
+    const char *listen_port = argv[optind];
+
+    metrics_init();
+    metrics_register(origin_dump);
+    timerwheel_init();
+    reqparse_setup();
+    errpage_init();
+    tunnel_init();
+    if (resolver_init(&dns_config) < 0) {
+        fprintf(stderr, "Invalid nameserver: %s\n", dns_config.nameserver);
+        exit(1);
     }
 
-    int listenfd, *connfdp;
+    int listenfd;
     pthread_t tid;
 
     // Open listening file descriptor
-    // argv[1] -> Listening port
-    listenfd = open_listenfd(argv[1]);
+    listenfd = open_listenfd(listen_port);
     if (listenfd < 0) {
-        fprintf(stderr, "Failed to listen on port: %s\n", argv[1]);
+        fprintf(stderr, "Failed to listen on port: %s\n", listen_port);
         close(listenfd);
         exit(1);
     }
@@ -131,210 +298,1980 @@ int main(int argc, char **argv) {
             fprintf(stderr, "getnameinfo failed: %s\n", gai_strerror(res));
         }
 
-        connfdp = Malloc(sizeof(int));
-        *connfdp = client->connfd;
-        pthread_create(&tid, NULL, thread, connfdp);
+        /* The descriptor travels in the pointer, so nothing is allocated */
+        pthread_create(&tid, NULL, thread, (void *)(intptr_t)client->connfd);
     }
     return 0;
 }
 
 void *thread(void *vargp) {
 
-    int client_fd = *((int *)vargp);
+    int client_fd = (int)(intptr_t)vargp;
     pthread_detach(pthread_self());
-    Free(vargp);
-    doit(client_fd);
+    serve_client(client_fd);
     close(client_fd);
     return NULL;
 }
 
-int doit(int client_fd) {
+/*
+ * has_body - Whether a request is followed by a body
+ */
+static bool has_body(const request_t *req) {
+    return req->body_chunked || req->body_length > 0;
+}
+
+/*
+ * rio_unread - Give back the last n bytes read from a rio buffer. They
+ *     must have been read through the buffer (less than RIO_BUFSIZE at a
+ *     time), which still holds them.
+ */
+static void rio_unread(rio_t *rp, size_t n) {
+    rp->rio_bufptr -= n;
+    rp->rio_cnt += (ssize_t)n;
+}
+
+/*
+ * serve_client - Read requests from one client connection until it closes.
+ *
+ * A request whose successor is already sitting in the read buffer was
+ * pipelined, so it is handed to its own thread and the next request is
+ * parsed right away. The pipeline writes the responses back in request
+ * order. A request with nothing behind it is processed inline, and so is
+ * one with a body, which has to be read before the next request, and one
+ * answered from the cache, which takes no longer than a thread to start.
+ *
+ * Requests are allocated from an arena that is reset whenever none is in
+ * flight, so a keep-alive connection serves them without calling malloc().
+ * A client that never lets the pipeline empty is made to wait for it every
+ * ARENA_REQUESTS requests, which bounds the arena. The request parser is
+ * the connection's too, reset rather than cleared for each request.
+ */
+void serve_client(int client_fd) {
 
     rio_t rp;
-    char buf[MAXLINE];
     rio_readinitb(&rp, client_fd);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pipeline_t *pl = pipeline_new(client_fd, PIPELINE_BUDGET);
+    deadline_t deadline;
+    arena_t arena;
+    arena_init(&arena);
+    reqparse_t parse;
+    reqparse_init(&parse);
+    int allocated = 0;
 
-    if (rio_readlineb(&rp, buf, sizeof(buf)) <= 0) {
-        close(client_fd);
-        return -1;
+    while (!pipeline_closed(pl)) {
+        if (allocated == ARENA_REQUESTS) {
+            pipeline_drain(pl);
+        }
+        if (pipeline_idle(pl)) {
+            arena_reset(&arena);
+            allocated = 0;
+        }
+        request_t *req = arena_calloc(&arena, sizeof(request_t));
+        allocated++;
+        req->slot = pipeline_push(pl);
+
+        /* A buffer grown for the last request is not kept while idle */
+        rio_idleb(&rp);
+
+        /* Also bounds how long an idle keep-alive connection is held */
+        deadline_start(&deadline, client_fd, SHUT_RD, DEADLINE_HEADER);
+        int rc = read_request(&rp, req, &parse, &deadline);
+        deadline_stop(&deadline);
+        if (rc < 0) {
+            pipeline_finish(req->slot, true);
+            break;
+        }
+
+        /* The connection becomes a tunnel, or is done */
+        if (strcmp(req->method, "CONNECT") == 0) {
+            open_tunnel(req, &rp, pl);
+            break;
+        }
+
+        /* Or it switches to HTTP/2 */
+        if (strcmp(req->method, "PRI") == 0 || req->upgrade_h2c) {
+            switch_h2(req, &rp, pl);
+            break;
+        }
+
+        /* Or, if the origin agrees, some other protocol */
+        if (req->upgrade != NULL) {
+            if (!open_upgrade(req, &rp, pl)) {
+                break;
+            }
+            continue;
+        }
+
+        bool keep_alive = req->keep_alive;
+        if (keep_alive && rp.rio_cnt > 0 && !has_body(req) &&
+            req->hit == NULL) {
+            pthread_t tid;
+            pthread_create(&tid, &attr, request_thread, req);
+        } else {
+            request_thread(req);
+        }
+
+        if (!keep_alive) {
+            break;
+        }
     }
 
-    printf("Request: %s", buf);
+    pipeline_drain(pl);
+    pipeline_free(pl);
+    arena_destroy(&arena);
+    pthread_attr_destroy(&attr);
+    rio_freeb(&rp);
+}
 
-    /* Parse the request line and check if it's well-formed */
-    parser_t *parser = parser_new();
-    parser_state parse_state = parser_parse_line(parser, buf);
-    if (parse_state != REQUEST) {
-        parser_free(parser);
-        clienterror(client_fd, "400", "Bad Request",
-                    "Proxy received a malformed request");
-        close(client_fd);
-        return -1;
+void *request_thread(void *vargp) {
+
+    request_t *req = vargp;
+    metrics_inc(METRIC_REQUESTS);
+    bool keep_alive = (doit(req) == 0) && req->keep_alive;
+    pipeline_finish(req->slot, !keep_alive);
+    return NULL;
+}
+
+/*
+ * header_has_token - Check whether a comma separated header value contains
+ *     the given token, ignoring case.
+ */
+static bool header_has_token(const char *value, const char *token) {
+    size_t len = strlen(token);
+    const char *p = value;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r' ||
+               *p == '\n') {
+            p++;
+        }
+        size_t n = strcspn(p, ", \t\r\n");
+        if (n == len && strncasecmp(p, token, len) == 0) {
+            return true;
+        }
+        p += n;
     }
+    return false;
+}
 
-    /* Proxy only cares about HOST and PATH and
-     PORT (if provided) from the request */
-    const char *host, *path, *port, *method;
-    int err = 0;
-    if ((err = parser_retrieve(parser, METHOD, &method)) < 0) {
-        fprintf(stderr, "Error while retreiving METHOD: %d\n", err);
-        parser_free(parser);
-        close(client_fd);
-        return -1;
+/*
+ * split_target - Split req->target, host[:port], into req->host and
+ *     req->port. The host may be a bracketed IPv6 address. Without a port,
+ *     port 80 is assumed unless need_port is set.
+ */
+static int split_target(request_t *req, bool need_port) {
+    char *colon = strrchr(req->target, ':');
+    char *bracket = strrchr(req->target, ']');
+
+    if (colon != NULL && bracket != NULL && colon < bracket) {
+        colon = NULL; /* Inside the IPv6 address */
+    }
+    if (colon == NULL || colon[1] == '\0') {
+        if (need_port) {
+            return -1;
+        }
+        req->port = default_port;
+    } else {
+        req->port = colon + 1;
+    }
+    if (colon != NULL) {
+        *colon = '\0';
+    }
+    req->host = req->target;
+    size_t len = strlen(req->target);
+    if (req->target[0] == '[' && len > 1 && req->target[len - 1] == ']') {
+        req->target[len - 1] = '\0';
+        req->host++;
     }
+    return req->host[0] == '\0' ? -1 : 0;
+}
+
+/* method_allowed - Methods the proxy forwards; anything else gets a 501 */
+static bool method_allowed(const char *method) {
+    static const char *methods[] = {"GET", "POST", "PUT", "PATCH", "DELETE"};
+
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+        if (strcmp(method, methods[m]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * terminate - NUL terminate a span of the request head in place. Every
+ *     span the proxy keeps is followed by a delimiter it no longer needs.
+ */
+static const char *terminate(span_t span) {
+    char *s = (char *)span.p;
+
+    s[span.len] = '\0';
+    return s;
+}
 
-    /* Check if the method is POST */
-    if (strcmp(method, "GET") != 0) {
-        parser_free(parser);
-        clienterror(client_fd, "501", "Not Implemented",
-                    "Proxy does not implement this method");
-        close(client_fd);
+/*
+ * read_connect - Check a CONNECT request, whose target must be host:port.
+ *     Its headers are not needed.
+ */
+static int read_connect(request_t *req, const reqparse_t *parse) {
+    if (parse->authority.len == 0 || parse->scheme.len > 0 ||
+        parse->authority.len >= sizeof(req->target)) {
+        clienterror(req->slot, ERRPAGE_BAD_REQUEST);
+        return -1;
+    }
+    if (routes != NULL) {
+        clienterror(req->slot, ERRPAGE_NO_REVERSE_TUNNEL);
+        return -1;
+    }
+    memcpy(req->target, parse->authority.p, parse->authority.len);
+    req->target[parse->authority.len] = '\0';
+    if (split_target(req, true) < 0) {
+        clienterror(req->slot, ERRPAGE_NO_TUNNEL_PORT);
         return -1;
     }
+    req->method = "CONNECT";
+    req->http11 = (parse->major == 1 && parse->minor == 1);
+    return 0;
+}
+
+/*
+ * cache_key - Name a request's response for the cache by the origin it
+ *     is routed to, as the URI or else the Host header gives it, and the
+ *     path. Leaves the key empty if it would not fit.
+ */
+static void cache_key(request_t *req) {
+    int n;
+
+    if (req->host != NULL) {
+        n = snprintf(req->cache_key, sizeof(req->cache_key), "%s:%s%s",
+                     req->host, req->port, req->path);
+    } else {
+        n = snprintf(req->cache_key, sizeof(req->cache_key), "%s%s",
+                     req->authority != NULL ? req->authority : "",
+                     req->path);
+    }
+    if (n < 0 || n >= (int)sizeof(req->cache_key)) {
+        req->cache_key[0] = '\0';
+    }
+}
+
+/*
+ * lookup_early - Look a GET up in the cache as soon as its request line
+ *     is parsed. The parser has already found the Host and Accept-Encoding
+ *     headers the lookup needs, so only on a hit are the rest looked at,
+ *     and only those that decide whether the hit may answer the request
+ *     and how the connection continues; none is filtered for forwarding.
+ *     Returns true if req->hit is to be sent.
+ */
+static bool lookup_early(request_t *req, reqparse_t *parse) {
+    const req_header_t *h;
+
+    if (!cache_enabled() || strcmp(req->method, "GET") != 0) {
+        return false;
+    }
+    if ((h = reqparse_header(parse, REQ_H_HOST)) != NULL) {
+        req->authority = terminate(h->value);
+    }
+    if ((h = reqparse_header(parse, REQ_H_ACCEPT_ENCODING)) != NULL) {
+        req->accept_gzip = gzip_accepted(terminate(h->value));
+    }
+    cache_key(req);
+    if (req->cache_key[0] == '\0') {
+        return false;
+    }
+    const cache_entry_t *e = cache_lookup(req->cache_key, req->accept_gzip,
+                                          false);
+    bool usable = e != NULL;
+    for (size_t i = 0; usable && i < parse->nheaders; i++) {
+        const char *value;
+
+        switch (parse->headers[i].id) {
+        case REQ_H_CONNECTION:
+        case REQ_H_PROXY_CONNECTION:
+            value = terminate(parse->headers[i].value);
+            if (header_has_token(value, "close")) {
+                req->keep_alive = false;
+            } else if (header_has_token(value, "keep-alive")) {
+                req->keep_alive = true;
+            }
+            usable = !header_has_token(value, "upgrade");
+            break;
+        case REQ_H_CACHE_CONTROL:
+        case REQ_H_PRAGMA:
+            value = terminate(parse->headers[i].value);
+            usable = !header_has_token(value, "no-cache") &&
+                     !header_has_token(value, "no-store") &&
+                     !header_has_token(value, "max-age=0");
+            break;
+        case REQ_H_CONTENT_LENGTH:
+        case REQ_H_TRANSFER_ENCODING:
+        case REQ_H_EXPECT:
+        case REQ_H_UPGRADE:
+        case REQ_H_HTTP2_SETTINGS:
+        case REQ_H_RANGE:
+        case REQ_H_IF_MODIFIED_SINCE:
+        case REQ_H_IF_NONE_MATCH:
+        case REQ_H_IF_MATCH:
+        case REQ_H_IF_UNMODIFIED_SINCE:
+        case REQ_H_IF_RANGE:
+        case REQ_H_AUTHORIZATION:
+            usable = false; /* The origin has to see these */
+            break;
+        default:
+            break;
+        }
+    }
+    if (!usable) {
+        /* Read the headers again from scratch, as for a miss */
+        if (e != NULL) {
+            cache_release(e);
+        }
+        req->keep_alive = req->http11;
+        metrics_inc(METRIC_CACHE_MISSES);
+        return false;
+    }
+    req->hit = e;
+    metrics_inc(METRIC_CACHE_HITS);
+    return true;
+}
+
+/*
+ * read_request - Read and parse a request line and its headers.
+ *
+ * The head is read into the request's own buffer, which the parser's
+ * spans point into; bytes read past its end are given back to rp. On
+ * failure an error response (if any) has already been sent, and the
+ * connection should not be used for further requests. A client that lets
+ * the header deadline pass mid-request gets a 408. The parser is the
+ * connection's, reset here; nothing refers to it once this returns.
+ */
+int read_request(rio_t *rp, request_t *req, reqparse_t *parse,
+                 deadline_t *deadline) {
+
+    req_status status;
+    size_t len = 0;
+    ssize_t n;
 
-    if ((err = parser_retrieve(parser, HOST, &host)) < 0) {
-        fprintf(stderr, "Error while retreiving HOST: %d\n", err);
-        parser_free(parser);
-        close(client_fd);
+    reqparse_reset(parse);
+    do {
+        /* Read through the rio buffer, so that rio_unread() works */
+        size_t room = sizeof(req->head) - len;
+        if (room >= RIO_BUFSIZE) {
+            room = RIO_BUFSIZE - 1;
+        }
+        if (room == 0) {
+            clienterror(req->slot, ERRPAGE_HEADERS_TOO_LARGE);
+            return -1;
+        }
+        if ((n = rio_readanyb(rp, req->head + len, room)) > 0) {
+            len += (size_t)n;
+        }
+        if (n <= 0 || deadline_fired(deadline)) {
+            if (len > 0 && deadline_fired(deadline)) {
+                clienterror(req->slot, ERRPAGE_HEADER_TIMEOUT);
+            }
+            return -1;
+        }
+
+        /* An HTTP/2 client with prior knowledge starts with this line */
+        size_t preface = strlen(H2_PREFACE_LINE);
+        if (h2c && len >= preface &&
+            memcmp(req->head, H2_PREFACE_LINE, preface) == 0) {
+            rio_unread(rp, len - preface);
+            req->method = "PRI";
+            return 0;
+        }
+        status = reqparse_parse(parse, req->head, len);
+    } while (status == REQ_MORE);
+
+    if (status != REQ_DONE) {
+        if (status == REQ_FULL) {
+            clienterror(req->slot, ERRPAGE_HEADERS_TOO_LARGE);
+        } else {
+            clienterror(req->slot, ERRPAGE_BAD_REQUEST);
+        }
         return -1;
     }
+    rio_unread(rp, len - parse->length);
+    printf("Request: %.*s %.*s\n", (int)parse->method.len, parse->method.p,
+           (int)parse->target.len, parse->target.p);
+
+    /* CONNECT names an authority rather than a URI */
+    if (parse->method.len == 7 &&
+        strncasecmp(parse->method.p, "CONNECT", 7) == 0) {
+        return read_connect(req, parse);
+    }
 
-    if ((err = parser_retrieve(parser, PATH, &path)) < 0) {
-        fprintf(stderr, "Error while retreiving PATH: %d\n", err);
-        parser_free(parser);
-        close(client_fd);
+    req->method = terminate(parse->method);
+    if (!method_allowed(req->method)) {
+        clienterror(req->slot, ERRPAGE_NO_METHOD);
+        return -1;
+    }
+    if (parse->major != 1) {
+        clienterror(req->slot, ERRPAGE_BAD_VERSION);
         return -1;
     }
 
-    if ((err = parser_retrieve(parser, PORT, &port)) < 0) {
-        fprintf(stderr, "Error while retreiving PORT: %d\n", err);
-        port = default_port; // Default
+    /* A reverse proxy is sent bare paths and routes by the Host header */
+    if (parse->scheme.len > 0) {
+        if (parse->authority.len >= sizeof(req->target)) {
+            clienterror(req->slot, ERRPAGE_BAD_REQUEST);
+            return -1;
+        }
+        memcpy(req->target, parse->authority.p, parse->authority.len);
+        req->target[parse->authority.len] = '\0';
+        if (split_target(req, false) < 0) {
+            clienterror(req->slot, ERRPAGE_NO_AUTHORITY);
+            return -1;
+        }
+    } else if (parse->path.len == 0) {
+        clienterror(req->slot, ERRPAGE_BAD_REQUEST);
+        return -1;
+    } else if (routes == NULL) {
+        clienterror(req->slot, ERRPAGE_NO_AUTHORITY);
+        return -1;
     }
+    req->path = parse->path.len > 0 ? terminate(parse->path) : "/";
+
+    /* HTTP/1.1 connections persist unless the client asks otherwise */
+    req->http11 = (parse->minor == 1);
+    req->keep_alive = req->http11;
 
-    // Create HTTP Request
-    // Add Mandatory headers
-    char request[MAXBUF];
-    sprintf(request, "%s %s %s", method, path, default_version);
-    char *host_header = Malloc(MAXLINE);
-    sprintf(host_header, "Host: %s:%s\r\n", host, port);
-    strcat(request, host_header);
-    Free(host_header);
-    strcat(request, header_user_agent);
-    strcat(request, header_conn);
-    strcat(request, header_proxy);
-    printf("Adding other headers\n");
+    req->client = rp;
+    req->body_length = -1;
+
+    /* A fresh cached response needs none of what follows */
+    if (lookup_early(req, parse)) {
+        return 0;
+    }
 
     /* Other headers */
-    while (true) {
-        if (rio_readlineb(&rp, buf, sizeof(buf)) <= 0) {
+    const char *upgrade = NULL;
+    bool connection_upgrade = false, storable = true;
+    for (size_t i = 0; i < parse->nheaders; i++) {
+        const char *value = terminate(parse->headers[i].value);
+        bool forward = false;
+
+        switch (parse->headers[i].id) {
+        case REQ_H_CONNECTION:
+        case REQ_H_PROXY_CONNECTION:
+            if (header_has_token(value, "close")) {
+                req->keep_alive = false;
+            } else if (header_has_token(value, "keep-alive")) {
+                req->keep_alive = true;
+            }
+            connection_upgrade |= header_has_token(value, "upgrade");
+            break;
+        case REQ_H_HOST:
+            req->authority = value;
+            break;
+        case REQ_H_USER_AGENT:
+            break; /* Replaced by ours */
+        case REQ_H_CONTENT_LENGTH: {
+            char *end;
+            req->body_length = strtoll(value, &end, 10);
+            if (end == value || *end != '\0' || req->body_length < 0) {
+                clienterror(req->slot, ERRPAGE_BAD_LENGTH);
+                return -1;
+            }
             break;
         }
-        /* Check for end of request headers */
-        if (strcmp(buf, "\r\n") == 0) {
+        case REQ_H_TRANSFER_ENCODING:
+            if (!header_has_token(value, "chunked")) {
+                clienterror(req->slot, ERRPAGE_NO_CODING);
+                return -1;
+            }
+            req->body_chunked = true;
             break;
+        case REQ_H_EXPECT:
+            req->expect_continue = header_has_token(value, "100-continue");
+            break;
+        case REQ_H_UPGRADE:
+            if (h2c && header_has_token(value, "h2c")) {
+                req->upgrade_h2c = true;
+            } else {
+                upgrade = value;
+                forward = true;
+            }
+            break;
+        case REQ_H_HTTP2_SETTINGS:
+            if (h2c) {
+                req->settings = value;
+            } else {
+                forward = true;
+            }
+            break;
+        case REQ_H_ACCEPT_ENCODING:
+            /* Still forwarded: the origin may have its own gzip variant */
+            req->accept_gzip = gzip_accepted(value);
+            forward = true;
+            break;
+        case REQ_H_CACHE_CONTROL:
+            storable &= !header_has_token(value, "no-store");
+            forward = true;
+            break;
+        case REQ_H_AUTHORIZATION:
+            storable = false; /* The response is this client's alone */
+            forward = true;
+            break;
+        default:
+            forward = true;
         }
+        if (forward) {
+            req->fields[req->nfields++] = parse->headers[i];
+        }
+    }
+
+    /* Only a bodiless HTTP/1.1 request with settings can be upgraded */
+    if (!req->http11 || req->settings == NULL || has_body(req)) {
+        req->upgrade_h2c = false;
+    }
+
+    /* Any other upgrade is the origin's to accept, likewise without a body */
+    if (req->http11 && connection_upgrade && upgrade != NULL &&
+        !req->upgrade_h2c && !has_body(req)) {
+        req->upgrade = upgrade;
+    }
+
+    /* What a plain GET gets back may be stored for the next one */
+    req->cacheable = storable && req->cache_key[0] != '\0' &&
+                     !has_body(req) && req->upgrade == NULL &&
+                     !req->upgrade_h2c;
+    return 0;
+}
+
+/*
+ * respond - Deliver part of the response to the client
+ */
+static int respond(request_t *req, const void *buf, size_t n) {
+    if (!req->responded) {
+        req->first_ns = balancer_now_ns();
+    }
+    req->responded = true;
+    return pipeline_write(req->slot, buf, n) < 0 ? -1 : 0;
+}
+
+/*
+ * respond_cached - Answer a request with a cached response, framed with a
+ *     Content-Length and sent in one write, and release it. A stale one
+ *     carries a warning. Returns 0 if the client connection may be reused.
+ */
+static int respond_cached(request_t *req, const cache_entry_t *e) {
+    static const char *warning = "Warning: 110 - \"Response is Stale\"\r\n";
+    char tail[128];
+    int n = snprintf(tail, sizeof(tail), "%sContent-Length: %zu\r\n%s\r\n",
+                     cache_stale(e) ? warning : "", e->body_len,
+                     req->keep_alive ? header_keep_alive : header_conn);
+    struct iovec iov[3] = {
+        {.iov_base = (void *)e->head, .iov_len = e->head_len},
+        {.iov_base = tail, .iov_len = (size_t)n},
+        {.iov_base = e->body, .iov_len = e->body_len},
+    };
+
+    req->responded = true;
+    ssize_t rc = pipeline_writev(req->slot, iov, 3);
+    cache_release(e);
+    return rc < 0 || !req->keep_alive ? -1 : 0;
+}
+
+/*
+ * unavailable - Answer a request its origin is not to be sent: with a
+ *     cached response, however stale, if there is one, and a 503 if not.
+ */
+static int unavailable(request_t *req, errpage_id id) {
+    const cache_entry_t *e;
+
+    if (req->cacheable &&
+        (e = cache_lookup(req->cache_key, req->accept_gzip, true)) != NULL) {
+        metrics_inc(METRIC_CACHE_STALE_HITS);
+        return respond_cached(req, e);
+    }
+    clienterror(req->slot, id);
+    return -1;
+}
+
+/* fill_start - Start storing the response, if wanted, given its head */
+static void fill_start(request_t *req, const char *head, size_t len) {
+    if (req->fill_wanted) {
+        req->fill = cache_fill_start(req->cache_key, req->fill_variant,
+                                     req->fill_ttl, head, len);
+    }
+}
+
+/* fill_body - Store part of the response body, once decoded */
+static void fill_body(request_t *req, const void *data, size_t n) {
+    if (req->fill != NULL) {
+        cache_fill_add(req->fill, data, n);
+    }
+}
+
+/*
+ * relay_body - Copy remaining bytes of the response body, or everything up
+ *     to EOF if remaining is negative. Each read restarts the idle deadline.
+ *     Returns 0 once exactly remaining bytes were copied.
+ */
+static int relay_body(request_t *req, rio_t *srp, deadline_t *io,
+                      long long remaining, char *buf, size_t bufsize) {
+    ssize_t m;
 
-        // Parse the request header with parser
-        parser_state parse_state = parser_parse_line(parser, buf);
-        if (parse_state != HEADER) {
-            clienterror(client_fd, "400", "Bad Request",
-                        "Proxy could not parse request headers");
+    while (remaining != 0) {
+        size_t want = bufsize;
+        if (remaining > 0 && (long long)want > remaining) {
+            want = (size_t)remaining;
+        }
+        if ((m = rio_readanyb(srp, buf, want)) <= 0) {
             break;
         }
+        deadline_rearm(io, DEADLINE_IDLE);
+        fill_body(req, buf, (size_t)m);
+        if (respond(req, buf, (size_t)m) < 0) {
+            return -1;
+        }
+        if (remaining > 0) {
+            remaining -= m;
+        }
+    }
+    return remaining == 0 ? 0 : -1;
+}
+
+/*
+ * relay_chunked - Copy a chunked response body. An HTTP/1.1 client whose
+ *     connection is kept open gets the body as is, with the decoder only
+ *     finding where it ends. Anyone else gets it decoded, with a
+ *     Content-Length if it fits in the buffer and closing the connection
+ *     otherwise. The headers in buf (len bytes) have not been terminated.
+ *     Returns 0 if the client connection may be reused.
+ */
+static int relay_chunked(request_t *req, rio_t *srp, deadline_t *io,
+                         bool managed, char *buf, size_t len,
+                         size_t bufsize) {
+    chunk_decoder_t d;
+    chunk_status st = CHUNK_MORE;
+    const char *p, *data;
+    size_t n;
+    ssize_t m;
 
-        header_t *header = parser_retrieve_next_header(parser);
-        if (!(strcmp(header->name, "Host") == 0 ||
-              strcmp(header->name, "User-Agent") == 0 ||
-              strcmp(header->name, "Connection") == 0 ||
-              strcmp(header->name, "Proxy-Connection") == 0)) {
-            char *hdr = Malloc(MAXLINE);
-            sprintf(hdr, "%s: %s\r\n", header->name, header->value);
-            strcat(request, hdr);
-            Free(hdr);
+    chunk_decoder_init(&d);
+    fill_start(req, buf, len);
+    if (managed && req->keep_alive && req->http11) {
+        len += (size_t)sprintf(buf + len,
+                               "Transfer-Encoding: chunked\r\n%s\r\n",
+                               header_keep_alive);
+        if (respond(req, buf, len) < 0) {
+            return -1;
         }
+        while (st != CHUNK_DONE) {
+            if ((m = rio_readanyb(srp, buf, bufsize)) <= 0) {
+                return -1;
+            }
+            deadline_rearm(io, DEADLINE_IDLE);
+            p = buf;
+            while ((st = chunk_decode(&d, &p, buf + m, &data, &n)) ==
+                   CHUNK_DATA) {
+                fill_body(req, data, n);
+            }
+            if (st == CHUNK_ERROR || respond(req, buf, p - buf) < 0) {
+                return -1;
+            }
+        }
+        req->fill_complete = true;
+        return 0;
     }
-    strcat(request, "\r\n");
 
-    printf("Generated Request:\n");
-    printf("%s", request);
+    /*
+     * Decode in place, leaving room after the headers for the ones we add.
+     * Spans only move backwards, so undecoded input is never overwritten.
+     */
+    size_t body = len + 128, out = body;
+    while (st != CHUNK_DONE && out < bufsize) {
+        if ((m = rio_readanyb(srp, buf + out, bufsize - out)) <= 0) {
+            return -1;
+        }
+        deadline_rearm(io, DEADLINE_IDLE);
+        p = buf + out;
+        const char *end = p + m;
+        while ((st = chunk_decode(&d, &p, end, &data, &n)) == CHUNK_DATA) {
+            memmove(buf + out, data, n);
+            out += n;
+        }
+        if (st == CHUNK_ERROR) {
+            return -1;
+        }
+    }
 
-    /* Forward request to server  */
-    // Open client file descriptor
-    printf("Sending to Host:%s, Port:%s\n", host, port);
-    int serverfd;
-    serverfd = open_clientfd(host, port);
-    if (serverfd < 0) {
-        fprintf(stderr, "Failed to listen on port: %s\n", port);
-        clienterror(client_fd, "400", "Bad Request",
-                    "Proxy could not parse request headers");
-        close(serverfd);
-        parser_free(parser);
+    if (st == CHUNK_DONE) {
+        len += (size_t)sprintf(buf + len, "Content-Length: %zu\r\n",
+                               out - body);
+    } else {
+        req->keep_alive = false;
+    }
+    if (managed) {
+        const char *conn_hdr =
+            req->keep_alive ? header_keep_alive : header_conn;
+        len += (size_t)sprintf(buf + len, "%s", conn_hdr);
+    }
+    len += (size_t)sprintf(buf + len, "\r\n");
+    fill_body(req, buf + body, out - body);
+    if (respond(req, buf, len) < 0 ||
+        respond(req, buf + body, out - body) < 0) {
         return -1;
     }
 
-    parser_free(parser);
+    /* Too big to buffer: stream the rest, delimited by closing */
+    while (st != CHUNK_DONE) {
+        if ((m = rio_readanyb(srp, buf, bufsize)) <= 0) {
+            return -1;
+        }
+        deadline_rearm(io, DEADLINE_IDLE);
+        p = buf;
+        while ((st = chunk_decode(&d, &p, buf + m, &data, &n)) ==
+               CHUNK_DATA) {
+            fill_body(req, data, n);
+            if (respond(req, data, n) < 0) {
+                return -1;
+            }
+        }
+        if (st == CHUNK_ERROR) {
+            return -1;
+        }
+    }
+    req->fill_complete = true;
+    return req->keep_alive ? 0 : -1;
+}
 
-    /* Send request to server */
-    rio_t srp;
-    rio_readinitb(&srp, serverfd);
-    char server_buf[MAX_OBJECT_SIZE];
-    if (rio_writen(serverfd, request, strlen(request)) <= 0) {
-        fprintf(stderr, "Failed to send request! \n");
-        close(serverfd);
+/*
+ * relay_rechunked - Copy a body delimited by the origin closing the
+ *     connection as chunks, so that an HTTP/1.1 client can keep its
+ *     connection. Each chunk's header goes just in front of the data read,
+ *     so every chunk is a single write. A body cut short by a deadline is
+ *     not terminated, so the client does not mistake it for a whole one.
+ */
+static int relay_rechunked(request_t *req, rio_t *srp, deadline_t *io,
+                           deadline_t *total, char *buf, size_t bufsize) {
+    char *data = buf + CHUNK_HEADER_MAX;
+    size_t room = bufsize - CHUNK_HEADER_MAX - strlen(CHUNK_CRLF);
+    ssize_t m;
+
+    while ((m = rio_readanyb(srp, data, room)) > 0) {
+        deadline_rearm(io, DEADLINE_IDLE);
+        char header[CHUNK_HEADER_MAX];
+        size_t h = chunk_header(header, (size_t)m);
+        memcpy(data - h, header, h);
+        memcpy(data + m, CHUNK_CRLF, strlen(CHUNK_CRLF));
+        if (respond(req, data - h, h + (size_t)m + strlen(CHUNK_CRLF)) < 0) {
+            return -1;
+        }
+    }
+    if (m < 0 || deadline_fired(io) || deadline_fired(total)) {
         return -1;
     }
+    return respond(req, CHUNK_LAST, strlen(CHUNK_LAST));
+}
+
+/* Bytes left after the headers for the ones relay_gzip() adds */
+#define GZIP_HEADERS_ROOM 256
+
+/*
+ * gzip_read - Get the next span of an identity body for relay_gzip(),
+ *     decoding chunked input through d and counting down remaining for one
+ *     with a length. Sets *ended at its end. Returns -1 if the body is cut
+ *     short or malformed.
+ */
+static int gzip_read(rio_t *srp, deadline_t *io, deadline_t *total,
+                     chunk_decoder_t *d, bool chunked, long long *remaining,
+                     char *in, size_t insize, const char **pos,
+                     const char **end, const char **data, size_t *n,
+                     bool *ended) {
+    ssize_t m;
 
-    int m = 0;
-    while ((m = rio_readnb(&srp, server_buf, MAX_OBJECT_SIZE)) > 0) {
-        rio_writen(client_fd, server_buf, m);
-        memset(server_buf, 0, sizeof(server_buf));
+    if (chunked) {
+        while (true) {
+            if (*pos < *end) {
+                chunk_status st = chunk_decode(d, pos, *end, data, n);
+                if (st == CHUNK_DATA) {
+                    return 0;
+                }
+                if (st == CHUNK_DONE) {
+                    *ended = true;
+                    return 0;
+                }
+                if (st == CHUNK_ERROR) {
+                    return -1;
+                }
+            }
+            if ((m = rio_readanyb(srp, in, insize)) <= 0) {
+                return -1;
+            }
+            deadline_rearm(io, DEADLINE_IDLE);
+            *pos = in;
+            *end = in + m;
+        }
     }
 
-    close(serverfd);
+    size_t want = insize;
+    if (*remaining >= 0 && (long long)want > *remaining) {
+        want = (size_t)*remaining;
+    }
+    if (want == 0) {
+        *ended = true;
+        return 0;
+    }
+    if ((m = rio_readanyb(srp, in, want)) < 0) {
+        return -1;
+    }
+    if (m == 0) {
+        /* Only a body without a length may end with the connection */
+        if (*remaining >= 0 || deadline_fired(io) || deadline_fired(total)) {
+            return -1;
+        }
+        *ended = true;
+        return 0;
+    }
+    deadline_rearm(io, DEADLINE_IDLE);
+    if (*remaining > 0) {
+        *remaining -= m;
+    }
+    *data = in;
+    *n = (size_t)m;
     return 0;
 }
 
-void clienterror(int fd, const char *errnum, const char *shortmsg,
-                 const char *longmsg) {
-    char buf[MAXLINE];
-    char body[MAXBUF];
-    size_t buflen;
-    size_t bodylen;
-
-    /* Build the HTTP response body */
-    bodylen = snprintf(body, MAXBUF,
-                       "<!DOCTYPE html>\r\n"
-                       "<html>\r\n"
-                       "<head><title>Tiny Error</title></head>\r\n"
-                       "<body bgcolor=\"ffffff\">\r\n"
-                       "<h1>%s: %s</h1>\r\n"
-                       "<p>%s</p>\r\n"
-                       "<hr /><em>The Tiny Web server</em>\r\n"
-                       "</body></html>\r\n",
-                       errnum, shortmsg, longmsg);
-    if (bodylen >= MAXBUF) {
-        return; // Overflow!
-    }
-
-    /* Build the HTTP response headers */
-    buflen = snprintf(buf, MAXLINE,
-                      "HTTP/1.0 %s %s\r\n"
-                      "Content-Type: text/html\r\n"
-                      "Content-Length: %zu\r\n\r\n",
-                      errnum, shortmsg, bodylen);
-    if (buflen >= MAXLINE) {
-        return; // Overflow!
-    }
-
-    /* Write the headers */
-    if (rio_writen(fd, buf, buflen) < 0) {
-        fprintf(stderr, "Error writing error response headers to client\n");
-        return;
+/*
+ * gzip_send - Send the compressed bytes in buf[body, out), as a chunk if
+ *     rechunk is set. There is room for its framing on either side.
+ */
+static int gzip_send(request_t *req, char *buf, size_t body, size_t out,
+                     bool rechunk) {
+    char *chunk = buf + body;
+    size_t size = out - body;
+
+    if (size == 0) {
+        return 0; /* An empty chunk would end the body */
+    }
+    if (rechunk) {
+        char header[CHUNK_HEADER_MAX];
+        size_t h = chunk_header(header, size);
+        chunk -= h;
+        memcpy(chunk, header, h);
+        memcpy(buf + out, CHUNK_CRLF, strlen(CHUNK_CRLF));
+        size += h + strlen(CHUNK_CRLF);
     }
+    return respond(req, chunk, size);
+}
 
-    /* Write the body */
-    if (rio_writen(fd, body, bodylen) < 0) {
-        fprintf(stderr, "Error writing error response body to client\n");
-        return;
+/*
+ * relay_gzip - Copy a response body compressed. Its identity framing
+ *     (a length, chunks or the origin closing) is undone as it is read.
+ *     The compressed body is buffered while it fits, so most go out with a
+ *     Content-Length; a bigger one is sent chunked to an HTTP/1.1 client
+ *     whose connection is kept open, and delimited by closing otherwise.
+ *     The headers in buf (len bytes) have not been terminated. Returns 0
+ *     if the client connection may be reused.
+ */
+static int relay_gzip(request_t *req, rio_t *srp, deadline_t *io,
+                      deadline_t *total, bool managed, bool chunked,
+                      long long content_length, char *buf, size_t len,
+                      size_t bufsize) {
+    char in[RIO_BUFSIZE];
+    const char *pos = in, *end = in, *data = NULL;
+    size_t n = 0;
+    chunk_decoder_t d;
+    gzip_t g;
+
+    /*
+     * Compressed bytes collect in buf[body, out), a chunk header's worth
+     * behind the headers and short of the end by a CRLF, so that a chunk
+     * can be framed in place.
+     */
+    size_t body = len + GZIP_HEADERS_ROOM;
+    size_t limit = bufsize - strlen(CHUNK_CRLF), out = body;
+    bool ended = false, streaming = false, rechunk = false;
+    int rc = -1;
+
+    if (body + CHUNK_HEADER_MAX >= limit || gzip_init(&g) < 0) {
+        return -1;
+    }
+    chunk_decoder_init(&d);
+    metrics_inc(METRIC_GZIP_RESPONSES);
+    len += (size_t)sprintf(buf + len, "Content-Encoding: gzip\r\n"
+                                      "Vary: Accept-Encoding\r\n");
+    while (!gzip_done(&g)) {
+        if (n == 0 && !ended &&
+            gzip_read(srp, io, total, &d, chunked, &content_length, in,
+                      sizeof(in), &pos, &end, &data, &n, &ended) < 0) {
+            goto done;
+        }
+        if (out == limit) {
+            /* Too big to buffer: send what there is and stream the rest */
+            if (!streaming) {
+                rechunk = managed && req->keep_alive && req->http11;
+                if (rechunk) {
+                    if (strncmp(buf, "HTTP/1.0", 8) == 0) {
+                        buf[7] = '1';
+                    }
+                    len += (size_t)sprintf(buf + len,
+                                           "Transfer-Encoding: chunked\r\n");
+                } else {
+                    req->keep_alive = false;
+                }
+                if (managed) {
+                    len += (size_t)sprintf(buf + len, "%s",
+                                           rechunk ? header_keep_alive
+                                                   : header_conn);
+                }
+                len += (size_t)sprintf(buf + len, "\r\n");
+                if (respond(req, buf, len) < 0) {
+                    goto done;
+                }
+                streaming = true;
+            }
+            if (gzip_send(req, buf, body, out, rechunk) < 0) {
+                goto done;
+            }
+            out = body;
+        }
+        out += gzip_deflate(&g, &data, &n, buf + out, limit - out, ended);
+    }
+    metrics_add(METRIC_GZIP_BYTES_IN, (long)g.z.total_in);
+    metrics_add(METRIC_GZIP_BYTES_OUT, (long)g.z.total_out);
+
+    if (!streaming) {
+        /* Only a body that fit the buffer is small enough to cache */
+        fill_start(req, buf, len);
+        fill_body(req, buf + body, out - body);
+        req->fill_complete = true;
+        len += (size_t)sprintf(buf + len, "Content-Length: %zu\r\n",
+                               out - body);
+        if (managed) {
+            len += (size_t)sprintf(buf + len, "%s",
+                                   req->keep_alive ? header_keep_alive
+                                                   : header_conn);
+        }
+        len += (size_t)sprintf(buf + len, "\r\n");
+        if (respond(req, buf, len) == 0 &&
+            respond(req, buf + body, out - body) == 0) {
+            rc = managed && req->keep_alive ? 0 : -1;
+        }
+        goto done;
+    }
+    if (gzip_send(req, buf, body, out, rechunk) == 0 &&
+        (!rechunk || respond(req, CHUNK_LAST, strlen(CHUNK_LAST)) == 0)) {
+        rc = rechunk ? 0 : -1;
+    }
+done:
+    gzip_end(&g);
+    return rc;
+}
+
+/*
+ * cache_status - Whether responses with a status may be cached without the
+ *     origin saying so: the ones RFC 7231 calls cacheable by default, less
+ *     those a GET without a Range does not get.
+ */
+static bool cache_status(int status) {
+    switch (status) {
+    case 200:
+    case 203:
+    case 300:
+    case 301:
+    case 404:
+    case 405:
+    case 410:
+    case 414:
+    case 501:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * vary_only - Check whether a Vary header names nothing but
+ *     Accept-Encoding, the one request header the cache tells variants by.
+ */
+static bool vary_only(const char *value) {
+    const char *p = value;
+
+    while (*p != '\0') {
+        p += strspn(p, " \t,\r\n");
+        size_t n = strcspn(p, ", \t\r\n");
+        if (n > 0 && (n != 15 || strncasecmp(p, "Accept-Encoding", 15) != 0)) {
+            return false;
+        }
+        p += n;
+    }
+    return true;
+}
+
+/* How a stored body is encoded, as far as the cache tells variants apart */
+typedef enum { CODING_NONE, CODING_GZIP, CODING_OTHER } coding_t;
+
+/*
+ * body_coding - Classify a Content-Encoding header, given the coding
+ *     of any earlier one: gzip only if that is the one coding applied.
+ */
+static coding_t body_coding(const char *value, coding_t coding) {
+    const char *p = value;
+
+    while (*p != '\0') {
+        p += strspn(p, " \t,\r\n");
+        size_t n = strcspn(p, ", \t\r\n");
+        if (n == 0 || (n == 8 && strncasecmp(p, "identity", 8) == 0)) {
+            /* Nothing applied */
+        } else if (coding == CODING_NONE &&
+                   ((n == 4 && strncasecmp(p, "gzip", 4) == 0) ||
+                    (n == 6 && strncasecmp(p, "x-gzip", 6) == 0))) {
+            coding = CODING_GZIP;
+        } else {
+            coding = CODING_OTHER;
+        }
+        p += n;
+    }
+    return coding;
+}
+
+/*
+ * relay_response - Copy the origin's response to the client.
+ *
+ * When the client connection is closed after the response, the headers
+ * are relayed as they are. Otherwise the hop-by-hop ones are rewritten so
+ * the client can tell where the body ends: a body without a length is sent
+ * chunked to HTTP/1.1 clients and forces the connection to close for
+ * others. Chunked bodies are decoded for clients that cannot take them.
+ * Returns 0 if the client connection may be reused.
+ */
+static int relay_response(request_t *req, rio_t *srp, deadline_t *io,
+                          deadline_t *total) {
+
+    char server_buf[MAX_OBJECT_SIZE];
+    bool managed = req->keep_alive;
+
+    /* Status line */
+    char line[MAXLINE];
+    int status = 0;
+    ssize_t got;
+    if ((got = rio_readlineb(srp, line, sizeof(line))) <= 0) {
+        return -1;
+    }
+    deadline_rearm(io, DEADLINE_IDLE);
+    if (sscanf(line, "HTTP/%*d.%*d %d", &status) != 1) {
+        if (!managed) {
+            /* Not a response we understand: relay it verbatim */
+            if (respond(req, line, (size_t)got) == 0) {
+                relay_body(req, srp, io, -1, server_buf, sizeof(server_buf));
+            }
+            return -1;
+        }
+        clienterror(req->slot, ERRPAGE_BAD_RESPONSE);
+        return -1;
+    }
+    size_t len = strlen(line);
+    memcpy(server_buf, line, len);
+
+    /* Agreeing to switch protocols takes the origin's hop-by-hop headers */
+    bool switching = status == 101 && req->upgrade != NULL;
+    if (switching) {
+        managed = false;
+    }
+
+    /* Headers, minus the hop-by-hop ones we replace */
+    long long content_length = -1;
+    size_t cl_start = 0, cl_end = 0;
+    bool chunked = false, compressible = false, transformable = true;
+    bool storable = true, vary_encoding = false;
+    coding_t coding = CODING_NONE;
+    int ttl = CACHE_DEFAULT_TTL;
+    size_t etag_at = 0; // Offset of the ETag header, or 0 for none
+    while (true) {
+        /* Each header is copied once, into place, and dropped if not wanted */
+        const char *view;
+        ssize_t n = rio_viewlineb(srp, &view);
+        if (n <= 0) {
+            return -1;
+        }
+        if ((n == 1 && view[0] == '\n') ||
+            (n == 2 && view[0] == '\r' && view[1] == '\n')) {
+            break;
+        }
+        if (len + (size_t)n + 2 * MAXLINE > sizeof(server_buf)) {
+            return -1;
+        }
+        char *header = server_buf + len;
+        memcpy(header, view, (size_t)n);
+        header[n] = '\0';
+        if (managed && (strncasecmp(header, "Connection:", 11) == 0 ||
+                        strncasecmp(header, "Proxy-Connection:", 17) == 0 ||
+                        strncasecmp(header, "Keep-Alive:", 11) == 0)) {
+            continue;
+        }
+        if (strncasecmp(header, "Transfer-Encoding:", 18) == 0 &&
+            header_has_token(header + 18, "chunked")) {
+            chunked = true;
+            continue;
+        }
+        if (strncasecmp(header, "Content-Type:", 13) == 0) {
+            compressible = gzip_compressible(header + 13);
+        } else if (strncasecmp(header, "Content-Encoding:", 17) == 0) {
+            transformable = false;
+            coding = body_coding(header + 17, coding);
+        } else if (strncasecmp(header, "Cache-Control:", 14) == 0) {
+            if (header_has_token(header + 14, "no-transform")) {
+                transformable = false;
+            }
+            storable &= cache_control(header + 14, &ttl);
+        } else if (strncasecmp(header, "Set-Cookie:", 11) == 0) {
+            storable = false;
+        } else if (strncasecmp(header, "Vary:", 5) == 0) {
+            /* Variants are only kept by whether the client takes gzip */
+            storable &= vary_only(header + 5);
+            vary_encoding = true;
+        } else if (strncasecmp(header, "ETag:", 5) == 0) {
+            /* Left in place, and made weak below if the body is compressed */
+            etag_at = len;
+        } else if (strncasecmp(header, "Content-Length:", 15) == 0) {
+            content_length = strtoll(header + 15, NULL, 10);
+            cl_start = len;
+            cl_end = len + (size_t)n;
+        }
+        len += (size_t)n;
+    }
+
+    bool no_body = (status >= 100 && status < 200) || status == 204 ||
+                   status == 304;
+    bool gzippable = gzip_enabled() && status == 200 && compressible &&
+                     transformable &&
+                     (content_length < 0 || content_length >= GZIP_MIN_LENGTH);
+    bool gzipped = req->accept_gzip && gzippable;
+
+    /*
+     * Stored as relayed, once its framing is undone, under the coding of
+     * the body sent: not what the client asked for, which the origin may
+     * have answered with a coding the cache does not keep apart.
+     */
+    req->fill_wanted = req->cacheable && cache_status(status) && storable &&
+                       !switching && content_length <= CACHE_MAX_OBJECT &&
+                       (content_length >= 0 || chunked || gzipped) &&
+                       coding != CODING_OTHER;
+    req->fill_variant = CACHE_ANY;
+    if (gzipped || coding == CODING_GZIP) {
+        req->fill_variant = CACHE_GZIP;
+    } else if (vary_encoding || gzippable) {
+        req->fill_variant = CACHE_IDENTITY;
+    }
+    req->fill_ttl = ttl;
+    if (etag_at > 0 && gzipped) {
+        /* The compressed variant is not byte-for-byte the tagged entity */
+        char *value = server_buf + etag_at + 5;
+        value += strspn(value, " \t");
+        if (*value == '"') {
+            size_t at = (size_t)(value - server_buf);
+            memmove(value + 2, value, len - at);
+            memcpy(value, "W/", 2);
+            len += 2;
+            if (cl_start > at) {
+                cl_start += 2;
+                cl_end += 2;
+            }
+        }
+    }
+    if ((chunked || gzipped) && !no_body && cl_end > 0) {
+        /* Chunked framing or compression overrides any Content-Length */
+        memmove(server_buf + cl_start, server_buf + cl_end, len - cl_end);
+        len -= cl_end - cl_start;
+    }
+    if (gzipped) {
+        return relay_gzip(req, srp, io, total, managed, chunked,
+                          content_length, server_buf, len,
+                          sizeof(server_buf));
+    }
+    if (chunked && !no_body) {
+        return relay_chunked(req, srp, io, managed, server_buf, len,
+                             sizeof(server_buf));
+    }
+    if (switching) {
+        /* What the origin sent past its headers belongs to the new protocol */
+        memcpy(server_buf + len, "\r\n", 2);
+        if (respond(req, server_buf, len + 2) < 0 ||
+            (srp->rio_cnt > 0 &&
+             respond(req, srp->rio_bufptr, (size_t)srp->rio_cnt) < 0) ||
+            (req->switched_fd = dup(srp->rio_fd)) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+    if (!managed) {
+        fill_start(req, server_buf, len);
+        memcpy(server_buf + len, "\r\n", 2);
+        if (respond(req, server_buf, len + 2) == 0) {
+            relay_body(req, srp, io, -1, server_buf, sizeof(server_buf));
+        }
+        /* Read to the end, which only a length tells was the body's */
+        req->fill_complete = req->fill != NULL && content_length >= 0 &&
+                             req->fill->body_len == (size_t)content_length;
+        return -1;
+    }
+
+    bool rechunk = content_length < 0 && !no_body && req->http11;
+    if (content_length < 0 && !no_body && !rechunk) {
+        req->keep_alive = false;
+    }
+    fill_start(req, server_buf, len);
+    if (rechunk) {
+        /* Chunked is HTTP/1.1 only */
+        if (strncmp(server_buf, "HTTP/1.0", 8) == 0) {
+            server_buf[7] = '1';
+        }
+        len += (size_t)sprintf(server_buf + len,
+                               "Transfer-Encoding: chunked\r\n");
+    }
+    const char *conn_hdr = req->keep_alive ? header_keep_alive : header_conn;
+    len += (size_t)sprintf(server_buf + len, "%s\r\n", conn_hdr);
+    if (respond(req, server_buf, len) < 0) {
+        return -1;
+    }
+
+    /* Body */
+    if (no_body) {
+        return 0;
+    }
+    if (rechunk) {
+        return relay_rechunked(req, srp, io, total, server_buf,
+                               sizeof(server_buf));
+    }
+    if (relay_body(req, srp, io, content_length, server_buf,
+                   sizeof(server_buf)) < 0) {
+        return -1; /* Truncated or unframed body */
+    }
+    req->fill_complete = true;
+    return content_length < 0 ? -1 : 0;
+}
+
+/*
+ * send_body - Stream a request body from the client to the origin in
+ *     buffer-sized pieces. Chunked bodies are passed on as they are, with
+ *     the decoder finding where they end; bytes past the end belong to the
+ *     next request and are given back. A client that stops sending mid-body
+ *     has its half of the origin connection closed.
+ */
+static void *send_body(void *vargp) {
+    upload_t *up = vargp;
+    request_t *req = up->req;
+    rio_t *rp = req->client;
+    char buf[RIO_BUFSIZE - 1];
+    long long remaining = req->body_length;
+    chunk_decoder_t d;
+    chunk_status st = CHUNK_MORE;
+    bool client_failed = true;
+    deadline_t idle;
+
+    chunk_decoder_init(&d);
+    deadline_start(&idle, rp->rio_fd, SHUT_RD, DEADLINE_IDLE);
+    while (req->body_chunked ? st != CHUNK_DONE : remaining > 0) {
+        size_t want = sizeof(buf);
+        if (!req->body_chunked && (long long)want > remaining) {
+            want = (size_t)remaining;
+        }
+        ssize_t n = rio_readanyb(rp, buf, want);
+        if (n <= 0) {
+            break;
+        }
+        deadline_rearm(&idle, DEADLINE_IDLE);
+
+        size_t len = (size_t)n;
+        if (req->body_chunked) {
+            const char *p = buf, *data;
+            size_t dlen;
+            while ((st = chunk_decode(&d, &p, buf + n, &data, &dlen)) ==
+                   CHUNK_DATA) {
+            }
+            if (st == CHUNK_ERROR) {
+                break;
+            }
+            len = (size_t)(p - buf);
+            rio_unread(rp, (size_t)n - len);
+        } else {
+            remaining -= n;
+        }
+
+        if (rio_writen(up->serverfd, buf, len) < 0) {
+            client_failed = false; /* The origin stopped reading */
+            break;
+        }
+        /* The origin cannot answer before it has the body */
+        if (!__atomic_load_n(&req->responded, __ATOMIC_RELAXED)) {
+            deadline_rearm(up->io, DEADLINE_FIRST_BYTE);
+        }
+    }
+    deadline_stop(&idle);
+
+    up->complete = req->body_chunked ? st == CHUNK_DONE : remaining == 0;
+    if (!up->complete && client_failed) {
+        shutdown(up->serverfd, SHUT_WR);
+    }
+    __atomic_store_n(&up->finished, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * open_originfd - Like open_clientfd(), but with addresses from the
+ *     resolver cache, tried in parallel and bounded by the connect deadline.
+ *
+ *     On error, returns:
+ *       -2 if the host could not be resolved
+ *       -1 with errno set for other errors.
+ */
+static int open_originfd(const char *host, const char *port) {
+    resolver_result_t addrs;
+
+    if (resolver_lookup(host, port, &addrs) < 0) {
+        return -2;
+    }
+    return connect_happy(&addrs, connect_timeout_ms);
+}
+
+/*
+ * origin_error - Send an error about the origin naming it as the client
+ *     did. A reverse proxy's backends are not named.
+ */
+static void origin_error(request_t *req, errpage_id id) {
+    char name[ERRPAGE_MAX_DETAIL];
+
+    if (routes != NULL) {
+        clienterror(req->slot, id);
+        return;
+    }
+    bool ipv6 = strchr(req->host, ':') != NULL;
+    snprintf(name, sizeof(name), ipv6 ? "[%s]:%s" : "%s:%s", req->host,
+             req->port);
+    clienterror_detail(req->slot, id, name);
+}
+
+/*
+ * route_request - In reverse-proxy mode, pick the backend for a request by
+ *     its host (from the URI, else the Host header) and path. Backends whose
+ *     circuit breaker is open are passed over.
+ *
+ *     Sends a 404 and returns -1 if no route matches, and returns -2
+ *     without responding if every backend tried is failing.
+ */
+static int route_request(request_t *req) {
+    char host[ROUTES_MAXNAME] = "";
+    const char *name = req->host != NULL ? req->host : req->authority;
+
+    if (name != NULL) {
+        size_t len = strcspn(name, ":");
+        if (len < sizeof(host)) {
+            memcpy(host, name, len);
+            host[len] = '\0';
+        }
+    }
+
+    pool_t *pool = routes_match(routes, host, req->path);
+    if (pool == NULL) {
+        clienterror(req->slot, ERRPAGE_NO_ROUTE);
+        return -1;
+    }
+    for (int tries = 0; tries < 2 * pool->nbackends; tries++) {
+        int i = balancer_pick(&pool->balancer);
+        origin_t *origin =
+            origin_get(pool->backends[i].host, pool->backends[i].port);
+        if (origin_admit(origin)) {
+            req->pool = pool;
+            req->backend = i;
+            req->origin = origin;
+            req->host = pool->backends[i].host;
+            req->port = pool->backends[i].port;
+            return 0;
+        }
+        origin_put(origin);
+        balancer_cancel(&pool->balancer, i);
+    }
+    return -2;
+}
+
+/*
+ * hedge_backend - Choose another backend of the pool for a hedge, and
+ *     admit a request to it. Returns -1 to hedge to the same origin.
+ */
+static int hedge_backend(request_t *req, origin_t **origin) {
+    pool_t *pool = req->pool;
+
+    if (pool == NULL || pool->nbackends < 2) {
+        return -1;
+    }
+    for (int tries = 0; tries < 2 * pool->nbackends; tries++) {
+        int i = balancer_pick(&pool->balancer);
+        if (i != req->backend) {
+            *origin =
+                origin_get(pool->backends[i].host, pool->backends[i].port);
+            if (origin_admit(*origin)) {
+                return i;
+            }
+            origin_put(*origin);
+        }
+        balancer_cancel(&pool->balancer, i);
+    }
+    return -1;
+}
+
+/* put_iov - Append a buffer to an iovec list; returns its new length */
+static int put_iov(struct iovec *iov, int n, const void *base, size_t len) {
+    iov[n].iov_base = (void *)base;
+    iov[n].iov_len = len;
+    return n + 1;
+}
+
+#define put_str(iov, n, s) put_iov(iov, n, s, strlen(s))
+#define put_span(iov, n, span) put_iov(iov, n, (span).p, (span).len)
+
+/*
+ * request_iov - Describe the request to send to host:port as an iovec list
+ *     of REQUEST_IOV entries at most. The entries point at req's strings,
+ *     at the client's headers where they were read and at constants, so
+ *     nothing is copied; only a Content-Length value is formatted, into
+ *     length. Returns the number of entries.
+ */
+static int request_iov(const request_t *req, const char *host,
+                       const char *port, struct iovec *iov, char *length,
+                       size_t size) {
+    int n = 0;
+
+    n = put_str(iov, n, req->method);
+    n = put_str(iov, n, " ");
+    n = put_str(iov, n, req->path);
+    n = put_str(iov, n, " ");
+    n = put_str(iov, n, req->body_chunked || req->upgrade != NULL
+                            ? chunked_version
+                            : default_version);
+    n = put_str(iov, n, "Host: ");
+    n = put_str(iov, n, host);
+    n = put_str(iov, n, ":");
+    n = put_str(iov, n, port);
+    n = put_str(iov, n, "\r\n");
+    n = put_str(iov, n, header_user_agent);
+    if (req->upgrade != NULL) {
+        n = put_str(iov, n, header_upgrade);
+    } else {
+        n = put_str(iov, n, header_conn);
+        n = put_str(iov, n, header_proxy);
+    }
+    if (req->body_chunked) {
+        n = put_str(iov, n, "Transfer-Encoding: chunked\r\n");
+    } else if (req->body_length >= 0) {
+        snprintf(length, size, "Content-Length: %lld\r\n", req->body_length);
+        n = put_str(iov, n, length);
+    }
+    for (size_t i = 0; i < req->nfields; i++) {
+        n = put_span(iov, n, req->fields[i].name);
+        n = put_str(iov, n, ": ");
+        n = put_span(iov, n, req->fields[i].value);
+        n = put_str(iov, n, "\r\n");
+    }
+    return put_str(iov, n, "\r\n");
+}
+
+/*
+ * hedge - If the origin is slower than usual to start answering, send the
+ *     request a second time, to another backend if there is one, and keep
+ *     whichever connection starts answering first. On return *serverfd is
+ *     the connection to use and req describes its backend. A copy sent to
+ *     another backend is built again, to name that backend in Host.
+ *
+ *     Returns -1, after answering 504, if neither copy is answered within
+ *     the first byte deadline.
+ */
+static int hedge(request_t *req, int *serverfd) {
+    int delay = origin_percentile(req->origin, HEDGE_PERCENTILE);
+    if (delay < 0 || hedge_wait(*serverfd, delay > 0 ? delay : 1) ||
+        !hedge_take()) {
+        return 0;
+    }
+
+    origin_t *origin = req->origin;
+    int backend = hedge_backend(req, &origin);
+    const char *host = req->host, *port = req->port;
+    if (backend >= 0) {
+        host = req->pool->backends[backend].host;
+        port = req->pool->backends[backend].port;
+    }
+    if (!origin_acquire(origin, false)) {
+        if (backend >= 0) {
+            balancer_cancel(&req->pool->balancer, backend);
+            origin_cancel(origin);
+            origin_put(origin);
+        }
+        return 0;
+    }
+
+    struct iovec iov[REQUEST_IOV];
+    char length[REQUEST_LENGTH_SIZE];
+    int niov = request_iov(req, host, port, iov, length, sizeof(length));
+
+    metrics_inc(METRIC_HEDGES);
+    uint64_t start = balancer_now_ns();
+    int fds[2] = {*serverfd, open_originfd(host, port)};
+    int winner = -1;
+    bool timed_out = false;
+    if (fds[1] >= 0 && rio_writevn(fds[1], iov, niov) > 0) {
+        int timeout = (int)deadline_duration(DEADLINE_FIRST_BYTE) - delay;
+        winner = hedge_race(fds, timeout > 0 ? timeout : 0);
+        timed_out = (winner < 0 && errno == ETIMEDOUT);
+    }
+
+    /* Only one of the two copies is still in flight */
+    origin_release(winner == 1 ? req->origin : origin, true, -1);
+
+    if (winner == 1) {
+        metrics_inc(METRIC_HEDGE_WINS);
+        close(fds[0]);
+        *serverfd = fds[1];
+        if (backend >= 0) {
+            /* The first backend was slow, though it did not fail */
+            balancer_done(&req->pool->balancer, req->backend,
+                          start - req->start_ns, true);
+            origin_cancel(req->origin);
+            origin_put(req->origin);
+            req->backend = backend;
+            req->origin = origin;
+            req->host = host;
+            req->port = port;
+            req->start_ns = start;
+        }
+        return 0;
+    }
+
+    if (fds[1] >= 0) {
+        close(fds[1]);
+    }
+    if (backend >= 0) {
+        balancer_cancel(&req->pool->balancer, backend);
+        if (fds[1] < 0) {
+            origin_report(origin, false);
+        } else {
+            origin_cancel(origin);
+        }
+        origin_put(origin);
+    }
+    if (timed_out) {
+        metrics_inc(METRIC_TIMEOUTS_FIRST_BYTE);
+        req->origin_failed = true;
+        origin_error(req, ERRPAGE_ORIGIN_TIMEOUT);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * forward - Forward one request to its origin and relay the response.
+ *
+ * Returns 0 if the client connection may be used for another request.
+ */
+static int forward(request_t *req) {
+
+    const char *host = req->host, *port = req->port;
+
+    /* The request is sent in pieces, never assembled */
+    struct iovec iov[REQUEST_IOV];
+    char length[REQUEST_LENGTH_SIZE];
+    int niov = request_iov(req, host, port, iov, length, sizeof(length));
+
+    /* Forward request to server  */
+    // Open client file descriptor
+    printf("Sending to Host:%s, Port:%s\n", host, port);
+    int serverfd;
+    serverfd = open_originfd(host, port);
+    if (serverfd < 0) {
+        fprintf(stderr, "Failed to connect to %s:%s\n", host, port);
+        req->origin_failed = true;
+        origin_error(req, serverfd == -2 ? ERRPAGE_NO_RESOLVE
+                                         : ERRPAGE_NO_CONNECT);
+        return -1;
+    }
+
+    /* Send request to server */
+    if (rio_writevn(serverfd, iov, niov) <= 0) {
+        fprintf(stderr, "Failed to send request! \n");
+        close(serverfd);
+        req->origin_failed = true;
+        origin_error(req, ERRPAGE_NO_CONNECT);
+        return -1;
+    }
+
+    /* GETs are idempotent, so a slow one may be sent again */
+    if (strcmp(req->method, "GET") == 0 && !has_body(req) &&
+        req->upgrade == NULL && hedge_earn() &&
+        hedge(req, &serverfd) < 0) {
+        close(serverfd);
+        return -1;
+    }
+    rio_t srp;
+    rio_readinitb(&srp, serverfd);
+
+    /*
+     * The origin must start answering within the first byte deadline, must
+     * not go silent for longer than the idle deadline, and must finish
+     * within the total deadline.
+     */
+    deadline_t total, io;
+    deadline_start(&total, serverfd, SHUT_RDWR, DEADLINE_TOTAL);
+    deadline_start(&io, serverfd, SHUT_RDWR, DEADLINE_FIRST_BYTE);
+
+    /* The body is sent while the response is read, in case it comes early */
+    upload_t upload = {.req = req, .serverfd = serverfd, .io = &io};
+    pthread_t sender;
+    if (has_body(req)) {
+        if (req->expect_continue && req->http11) {
+            pipeline_write(req->slot, header_continue,
+                           strlen(header_continue));
+        }
+        pthread_create(&sender, NULL, send_body, &upload);
+    }
+
+    int rc = relay_response(req, &srp, &io, &total);
+    deadline_stop(&io);
+    deadline_stop(&total);
+    if (req->fill != NULL) {
+        cache_fill_finish(req->fill, req->fill_complete);
+        req->fill = NULL;
+    }
+
+    /* A body the origin answered without reading is cut off */
+    if (has_body(req)) {
+        if (!__atomic_load_n(&upload.finished, __ATOMIC_ACQUIRE)) {
+            shutdown(serverfd, SHUT_RDWR);
+            shutdown(req->client->rio_fd, SHUT_RD);
+        }
+        pthread_join(sender, NULL);
+        if (!upload.complete) {
+            req->keep_alive = false;
+        }
+    }
+    req->origin_failed = !req->responded;
+
+    if (rc < 0 && !req->responded &&
+        (deadline_fired(&io) || deadline_fired(&total))) {
+        origin_error(req, ERRPAGE_ORIGIN_TIMEOUT);
+    }
+    close(serverfd);
+    rio_freeb(&srp);
+    return rc;
+}
+
+/*
+ * open_tunnel - Answer a CONNECT by connecting to its target, then, once
+ *     every earlier response has been delivered, hand the client and origin
+ *     sockets to the tunnel pump. Bytes the client sent right after its
+ *     request are forwarded first.
+ */
+void open_tunnel(request_t *req, rio_t *rp, pipeline_t *pl) {
+    metrics_inc(METRIC_REQUESTS);
+    printf("Tunneling to Host:%s, Port:%s\n", req->host, req->port);
+
+    int serverfd = open_originfd(req->host, req->port);
+    if (serverfd < 0) {
+        origin_error(req, serverfd == -2 ? ERRPAGE_NO_RESOLVE
+                                         : ERRPAGE_NO_CONNECT);
+        pipeline_finish(req->slot, true);
+        return;
+    }
+
+    const char *established =
+        req->http11 ? "HTTP/1.1 200 Connection established\r\n\r\n"
+                    : "HTTP/1.0 200 Connection established\r\n\r\n";
+    respond(req, established, strlen(established));
+    pipeline_finish(req->slot, false);
+    pipeline_drain(pl);
+
+    int clientfd;
+    if (pipeline_closed(pl) ||
+        (rp->rio_cnt > 0 &&
+         rio_writen(serverfd, rp->rio_bufptr, (size_t)rp->rio_cnt) < 0) ||
+        (clientfd = dup(rp->rio_fd)) < 0) {
+        close(serverfd);
+        return;
+    }
+    tunnel_start(clientfd, serverfd);
+}
+
+/*
+ * open_upgrade - Forward a request to switch protocols, such as a WebSocket
+ *     handshake. If the origin answers 101, the client and origin sockets
+ *     go to the tunnel pump like a CONNECT's, once every earlier response
+ *     has been delivered, so a long-lived session holds no thread and is
+ *     closed by the tunnel deadline when idle. Otherwise the connection
+ *     carries on as HTTP. Returns whether it may be used for more requests.
+ */
+bool open_upgrade(request_t *req, rio_t *rp, pipeline_t *pl) {
+    req->switched_fd = -1;
+    metrics_inc(METRIC_REQUESTS);
+    bool keep_alive = (doit(req) == 0) && req->keep_alive;
+    int serverfd = req->switched_fd;
+    pipeline_finish(req->slot, serverfd < 0 && !keep_alive);
+    if (serverfd < 0) {
+        return keep_alive;
+    }
+
+    metrics_inc(METRIC_UPGRADES);
+    pipeline_drain(pl);
+    int clientfd;
+    if (pipeline_closed(pl) ||
+        (rp->rio_cnt > 0 &&
+         rio_writen(serverfd, rp->rio_bufptr, (size_t)rp->rio_cnt) < 0) ||
+        (clientfd = dup(rp->rio_fd)) < 0) {
+        close(serverfd);
+        return false;
+    }
+    tunnel_start(clientfd, serverfd);
+    return false;
+}
+
+/*
+ * switch_h2 - Serve the rest of a connection as HTTP/2: after the first
+ *     line of the preface, or after answering an upgrade with 101, which
+ *     makes the request stream 1. Responses to earlier requests go first.
+ */
+void switch_h2(request_t *req, rio_t *rp, pipeline_t *pl) {
+    char authority[MAXLINE];
+    char headers[2 * MAXBUF]; // Room for every field of a MAXBUF head
+    h2_request_t upgraded = {.method = req->method,
+                             .path = req->path,
+                             .authority = req->authority,
+                             .headers = headers,
+                             .body_fd = -1,
+                             .body_length = -1};
+
+    /* Stream 1 takes its fields as text, like HPACK decodes them */
+    size_t len = 0;
+    headers[0] = '\0';
+    for (size_t i = 0; i < req->nfields; i++) {
+        const req_header_t *f = &req->fields[i];
+        len += (size_t)snprintf(headers + len, sizeof(headers) - len,
+                                "%.*s: %.*s\r\n", (int)f->name.len, f->name.p,
+                                (int)f->value.len, f->value.p);
+    }
+
+    /* A forward proxy was sent the origin in the URI */
+    if (req->upgrade_h2c && req->host != NULL) {
+        snprintf(authority, sizeof(authority), "%s:%s", req->host, req->port);
+        upgraded.authority = authority;
+    }
+    if (req->upgrade_h2c) {
+        pipeline_write(req->slot, header_switching, strlen(header_switching));
+    }
+    pipeline_finish(req->slot, false);
+    pipeline_drain(pl);
+    if (!pipeline_closed(pl)) {
+        h2_serve(rp->rio_fd, rp, req->upgrade_h2c ? &upgraded : NULL,
+                 req->upgrade_h2c ? req->settings : NULL, serve_stream);
+    }
+}
+
+/*
+ * lookup_stream - Look an HTTP/2 GET up in the cache once its fields are
+ *     in req, deciding from them as lookup_early() and read_request() do
+ *     whether a hit may answer it and whether its response may be stored.
+ *     Returns true if req->hit is to be sent.
+ */
+static bool lookup_stream(request_t *req) {
+    bool usable = true, storable = true;
+
+    if (!cache_enabled() || strcmp(req->method, "GET") != 0 ||
+        req->client != NULL) {
+        return false;
+    }
+    cache_key(req);
+    if (req->cache_key[0] == '\0') {
+        return false;
+    }
+    for (size_t i = 0; i < req->nfields; i++) {
+        /* Fields are lines of the stream's block, not terminated alone */
+        char value[MAXLINE];
+        snprintf(value, sizeof(value), "%.*s", (int)req->fields[i].value.len,
+                 req->fields[i].value.p);
+
+        switch (req->fields[i].id) {
+        case REQ_H_CACHE_CONTROL:
+            storable &= !header_has_token(value, "no-store");
+            /* fall through */
+        case REQ_H_PRAGMA:
+            usable &= !header_has_token(value, "no-cache") &&
+                      !header_has_token(value, "no-store") &&
+                      !header_has_token(value, "max-age=0");
+            break;
+        case REQ_H_AUTHORIZATION:
+            storable = false; /* The response is this client's alone */
+            usable = false;
+            break;
+        case REQ_H_RANGE:
+        case REQ_H_IF_MODIFIED_SINCE:
+        case REQ_H_IF_NONE_MATCH:
+        case REQ_H_IF_MATCH:
+        case REQ_H_IF_UNMODIFIED_SINCE:
+        case REQ_H_IF_RANGE:
+            usable = false; /* The origin has to see these */
+            break;
+        default:
+            break;
+        }
+    }
+    req->cacheable = storable;
+
+    const cache_entry_t *e = NULL;
+    if (usable) {
+        e = cache_lookup(req->cache_key, req->accept_gzip, false);
+    }
+    if (e == NULL) {
+        metrics_inc(METRIC_CACHE_MISSES);
+        return false;
+    }
+    req->hit = e;
+    metrics_inc(METRIC_CACHE_HITS);
+    return true;
+}
+
+/*
+ * serve_stream - Process the request of one HTTP/2 stream like any other.
+ *     The response is written in HTTP/1 form and re-framed by h2.c, so the
+ *     origin's framing is never passed through.
+ */
+void serve_stream(const h2_request_t *stream, pl_slot_t *slot) {
+    request_t *req = Calloc(1, sizeof(request_t));
+    rio_t body;
+
+    req->slot = slot;
+    req->method = stream->method;
+    req->path = stream->path;
+    req->authority = stream->authority;
+    req->body_length = stream->body_length;
+    if (stream->body_fd >= 0) {
+        rio_readinitb(&body, stream->body_fd);
+        req->client = &body;
+        req->body_chunked = stream->body_length < 0;
+    }
+    metrics_inc(METRIC_REQUESTS);
+    printf("HTTP/2 request: %s %s\n", req->method, req->path);
+
+    /* Forwarded like read_request() does, without the client's agent */
+    bool fits = true;
+    for (const char *p = stream->headers; *p != '\0';) {
+        size_t n = strcspn(p, "\r\n"), colon = strcspn(p, ":");
+        if (colon > n) {
+            colon = n;
+        }
+        req_header_t field = {.name = {p, colon},
+                              .value = {p + n, 0},
+                              .id = reqparse_lookup(p, colon)};
+        if (colon < n) {
+            field.value.p = p + colon + 1 + strspn(p + colon + 1, " \t");
+            field.value.len = (size_t)(p + n - field.value.p);
+        }
+        if (field.id == REQ_H_ACCEPT_ENCODING) {
+            req->accept_gzip = gzip_accepted(field.value.p);
+        }
+        if (field.id != REQ_H_USER_AGENT) {
+            fits = fits && req->nfields < REQ_MAX_HEADERS;
+            if (fits) {
+                req->fields[req->nfields++] = field;
+            }
+        }
+        p += n + strspn(p + n, "\r\n");
+    }
+
+    if (!method_allowed(req->method)) {
+        clienterror(slot, ERRPAGE_NO_METHOD);
+    } else if (!fits) {
+        clienterror(slot, ERRPAGE_HEADERS_TOO_LARGE);
+    } else if (routes == NULL &&
+               (req->authority == NULL ||
+                snprintf(req->target, sizeof(req->target), "%s",
+                         req->authority) >= (int)sizeof(req->target) ||
+                split_target(req, false) < 0)) {
+        clienterror(slot, ERRPAGE_NO_AUTHORITY);
+    } else {
+        /* Hits and misses both go through doit(), as for HTTP/1.1 */
+        lookup_stream(req);
+        doit(req);
+    }
+    if (stream->body_fd >= 0) {
+        rio_freeb(&body);
+    }
+    Free(req);
+}
+
+/*
+ * doit - Answer a request from the cache if it was a hit. Otherwise route
+ *     it if acting as a reverse proxy, then forward it unless the origin's
+ *     circuit breaker is open or its concurrency limit stays reached, in
+ *     which case a stale cached response will do. The breaker, the limit
+ *     and the backend's balancer are told how the origin answered.
+ */
+int doit(request_t *req) {
+
+    if (req->hit != NULL) {
+        return respond_cached(req, req->hit);
+    }
+    if (routes != NULL) {
+        int rc = route_request(req);
+        if (rc == -2) {
+            return unavailable(req, ERRPAGE_BACKENDS_FAILING);
+        }
+        if (rc < 0) {
+            return -1;
+        }
+    } else {
+        req->origin = origin_get(req->host, req->port);
+        if (!origin_admit(req->origin)) {
+            origin_put(req->origin);
+            return unavailable(req, ERRPAGE_ORIGIN_FAILING);
+        }
+    }
+    if (!origin_acquire(req->origin, true)) {
+        origin_cancel(req->origin);
+        origin_put(req->origin);
+        if (req->pool != NULL) {
+            balancer_cancel(&req->pool->balancer, req->backend);
+        }
+        return unavailable(req, ERRPAGE_ORIGIN_BUSY);
+    }
+
+    req->start_ns = balancer_now_ns();
+    int rc = forward(req);
+    long rtt_us = -1;
+    if (req->first_ns != 0) {
+        rtt_us = (long)((req->first_ns - req->start_ns) / 1000);
+        origin_observe(req->origin, (unsigned)(rtt_us / 1000));
+    }
+    origin_release(req->origin, !req->origin_failed, rtt_us);
+    origin_report(req->origin, !req->origin_failed);
+    origin_put(req->origin);
+    if (req->pool != NULL) {
+        balancer_done(&req->pool->balancer, req->backend,
+                      balancer_now_ns() - req->start_ns, !req->origin_failed);
+    }
+    return rc;
+}
+
+/*
+ * clienterror - Send one of the error responses built at startup, in a
+ *     single write.
+ */
+void clienterror(pl_slot_t *slot, errpage_id id) {
+    clienterror_detail(slot, id, NULL);
+}
+
+/*
+ * clienterror_detail - Send an error response with a detail for this
+ *     request after its message, or none if detail is NULL.
+ */
+void clienterror_detail(pl_slot_t *slot, errpage_id id, const char *detail) {
+    struct iovec iov[ERRPAGE_IOV];
+    char scratch[ERRPAGE_SCRATCH];
+    int n = errpage_iov(id, detail, iov, scratch);
+
+    if (pipeline_writev(slot, iov, n) < 0) {
+        fprintf(stderr, "Error writing error response to client\n");
     }
 }
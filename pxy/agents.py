@@ -6,6 +6,7 @@
 import datetime
 import errno
 import random
+import re
 import socket
 import subprocess
 import threading
@@ -1023,6 +1024,256 @@ class RequestGenerator:
         self.instrumenter.statistics(self.printer)
 
 # Heartbeat event
+# Origin server that answers each path with a scripted reply, for testing
+# how the proxy handles exchanges the file server can't produce: keep-alive
+# and pipelining, deadlines, tunnels, uploads and cacheable responses
+class Origin:
+
+    host = "localhost"
+    port = None
+    sock = None
+    running = True
+    thread = None
+    printer = None
+    id = "origin"
+    echo = False
+    # Mapping from path to (delay in seconds, kind, text)
+    routes = {}
+    # Every request received, header and body
+    requests = []
+    mutex = None
+    allOK = True
+
+    def __init__(self, host, portLimit, portManager, printer, id = "origin", echo = False):
+        self.host = host
+        self.printer = printer
+        self.id = id
+        self.echo = echo
+        self.routes = {}
+        self.requests = []
+        self.mutex = threading.Lock()
+        self.running = True
+        self.allOK = True
+        self.sock = None
+        msg = ""
+        for t in range(portLimit):
+            self.port = portManager.newPort()
+            try:
+                self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+                self.sock.bind((self.host, self.port))
+                self.sock.listen(16)
+                self.sock.settimeout(1.0)
+            except socket.error as ex:
+                self.sock = None
+                msg = str(ex)
+                continue
+            break
+        if self.sock is None:
+            self.printer.errMsg("Couldn't set up origin %s (%s)" % (self.id, msg))
+            self.running = False
+            return
+        self.thread = threading.Thread(target = self.wrappedRun, name = "Origin-Thread")
+        self.thread.start()
+
+    def authority(self):
+        return "%s:%d" % (self.host, self.port)
+
+    def addRoute(self, path, delay, kind, text):
+        self.routes[path] = (delay, kind, text)
+
+    def served(self):
+        with self.mutex:
+            return len(self.requests)
+
+    def lastRequest(self):
+        with self.mutex:
+            return self.requests[-1] if len(self.requests) > 0 else None
+
+    def record(self, request):
+        with self.mutex:
+            self.requests.append(request)
+
+    # Read one request, with any Content-Length or chunked body.
+    # Return "" when the connection closes first
+    def readRequest(self, sockFile):
+        header = ""
+        while True:
+            line = sockFile.readlineb()
+            if line == "":
+                return ""
+            header += line
+            if line in ["\r\n", "\n"]:
+                break
+        body = ""
+        lower = header.lower()
+        if "transfer-encoding: chunked" in lower:
+            while True:
+                line = sockFile.readlineb()
+                body += line
+                size = int(line.split(';')[0].strip(), 16)
+                if size == 0:
+                    while line not in ["\r\n", "\n", ""]:
+                        line = sockFile.readlineb()
+                        body += line
+                    break
+                body += self.readBytes(sockFile, size + 2)
+        else:
+            for line in header.split("\r\n"):
+                if line.lower().startswith("content-length:"):
+                    body = self.readBytes(sockFile, int(line.split(':')[1]))
+        return header + body
+
+    def readBytes(self, sockFile, n):
+        data = ""
+        while len(data) < n:
+            if len(sockFile.buffer) > 0:
+                chunk = sockFile.buffer[:n - len(data)]
+                sockFile.buffer = sockFile.buffer[len(chunk):]
+            else:
+                chunk = sockFile.read()
+                if chunk == "":
+                    break
+                if len(chunk) > n - len(data):
+                    sockFile.buffer = chunk[n - len(data):]
+                    chunk = chunk[:n - len(data)]
+            data += chunk
+        return data
+
+    # Copy bytes back until the peer closes its side
+    def echoBytes(self, sockFile, received = ""):
+        while True:
+            try:
+                data = sockFile.read()
+            except files.ShutdownException:
+                return received
+            if data == "":
+                return received
+            received += data
+            sockFile.write(data)
+
+    def handleConnection(self, sockFile):
+        if self.echo:
+            self.record(self.echoBytes(sockFile))
+            sockFile.write("bye\r\n")
+            return
+        request = self.readRequest(sockFile)
+        if request == "":
+            return
+        self.record(request)
+        fields = request.split(' ')
+        path = fields[1] if len(fields) > 1 else ""
+        if path not in self.routes:
+            sockFile.write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n")
+            return
+        (delay, kind, text) = self.routes[path]
+        if delay > 0:
+            time.sleep(delay)
+        if kind == "stall":
+            # Hold the connection until the proxy gives up on it
+            self.echoBytes(sockFile)
+        elif kind == "upgrade":
+            sockFile.write(text)
+            self.record(self.echoBytes(sockFile))
+        else:
+            sockFile.write(text)
+
+    def wrappedHandleConnection(self, sockFile):
+        try:
+            self.handleConnection(sockFile)
+        except socket.error:
+            pass
+        except Exception as e:
+            self.printer.panic("Origin %s connection handler" % self.id, e)
+            self.allOK = False
+        sockFile.close()
+
+    def run(self):
+        while self.running:
+            try:
+                (conn, address) = self.sock.accept()
+            except socket.timeout:
+                continue
+            sockFile = files.SocketFile(conn)
+            t = threading.Thread(target = self.wrappedHandleConnection, args = (sockFile,))
+            t.daemon = True
+            t.start()
+        self.sock.close()
+
+    def wrappedRun(self):
+        try:
+            self.run()
+        except Exception as e:
+            self.printer.panic("Origin %s" % self.id, e)
+            self.allOK = False
+
+    def stop(self):
+        self.running = False
+
+    def waitForExit(self):
+        if self.thread is not None:
+            self.thread.join()
+        return self.allOK
+
+# Client speaking raw bytes to the proxy over one connection
+class RawClient:
+
+    sock = None
+    buffer = ""
+    closed = False
+
+    def __init__(self, proxy):
+        self.sock = socket.create_connection(proxy)
+        self.buffer = ""
+        self.closed = False
+
+    def send(self, text):
+        self.sock.sendall(text)
+
+    def shut(self):
+        self.sock.shutdown(socket.SHUT_WR)
+
+    # Read until the buffer matches regex or secs pass.  Return the match,
+    # consuming everything through it, or None
+    def expect(self, regex, secs):
+        pattern = re.compile(regex, re.DOTALL)
+        deadline = time.time() + secs
+        while True:
+            m = pattern.search(self.buffer)
+            if m is not None:
+                self.buffer = self.buffer[m.end():]
+                return m
+            if not self.fill(deadline):
+                return None
+
+    # Wait for the proxy to close the connection.  Return whether it did
+    def expectClose(self, secs):
+        deadline = time.time() + secs
+        while not self.closed:
+            if not self.fill(deadline):
+                return self.closed
+        return True
+
+    # Read more bytes.  Return False at the deadline or once closed
+    def fill(self, deadline):
+        remaining = deadline - time.time()
+        if self.closed or remaining <= 0:
+            return False
+        self.sock.settimeout(remaining)
+        try:
+            data = self.sock.recv(4096)
+        except socket.timeout:
+            return False
+        except socket.error:
+            data = ""
+        if data == "":
+            self.closed = True
+            return False
+        self.buffer += data
+        return True
+
+    def close(self):
+        self.sock.close()
+
 class Beat:
     timeStamp = None
     threadId = None
@@ -17,6 +17,7 @@ import subprocess
 import threading
 import datetime
 import signal
+import re
 
 import console
 import agents
@@ -82,7 +83,10 @@ class Driver:
     # Is there an active proxy?
     haveProxy = False
     proxyProcess = None
+    proxyPath = None
     getId = 0
+    origins = {}
+    clients = {}
 
 
     # Mapping from id to event.  Used to implement wait *
@@ -109,6 +113,8 @@ class Driver:
         self.requestManager = agents.RequestGenerator(self.eventManager, self.fileManager, self.console, strict = self.strict, verbose = self.verbose)
         self.portManager = agents.PortFinder(self.console)
         self.servers = {}
+        self.origins = {}
+        self.clients = {}
         self.monitors = []
         self.haveProxy = False
         self.proxyProcess = None
@@ -135,11 +141,22 @@ class Driver:
         self.console.addCommand("check", self.doCheck,         "ID [CODE]",     "Make sure request ID handled properly and generated expected CODE")
         self.console.addCommand("generate", self.doGenerate,   "FILE BYTES",      "Generate file (extension '.txt' or '.bin') with specified number of bytes")
         self.console.addCommand("delete", self.doDelete,       "FILE+",  "Delete specified files")
-        self.console.addCommand("proxy", self.doProxy,         "[PATH] ARG*", "(Re)start proxy server (pass arguments to proxy)")
+        self.console.addCommand("proxy", self.doProxy,         "[PATH|-] ARG*", "(Re)start proxy server (pass arguments to proxy; - reuses last PATH)")
         self.console.addCommand("external", self.doExternalProxy,    "HOST:PORT", "Use external proxy")
         self.console.addCommand("trace", self.doTrace,         "ID+",   "Trace histories of requests")
         self.console.addCommand("signal", self.doSignal,       "[SIGNO]", "Send signal number SIGNO to process.  Default = 13 (SIGPIPE)")
         self.console.addCommand("disrupt", self.doDisrupt,     "(request|response) [SID]", "Schedule disruption of request or response by client [or server SID]")
+        self.console.addCommand("origin", self.doOrigin,      "OID [echo]", "Set up scripted origin (echo: copy back tunneled bytes, then send 'bye')")
+        self.console.addCommand("route", self.doRoute,        "OID PATH [+MS] [stall|upgrade] TEXT", "Have origin OID answer PATH with TEXT after MS, or never (stall), or then echo (upgrade)")
+        self.console.addCommand("served", self.doServed,      "OID N", "Make sure origin OID has received N requests")
+        self.console.addCommand("received", self.doReceived,  "OID REGEX", "Make sure last request received by origin OID matches REGEX")
+        self.console.addCommand("stop-origin", self.doStopOrigin, "OID+", "Stop origins from accepting connections")
+        self.console.addCommand("connect", self.doConnect,    "CID", "Open raw client connection CID to proxy")
+        self.console.addCommand("send", self.doSend,          "CID TEXT", "Send TEXT over client connection CID")
+        self.console.addCommand("shut", self.doShut,          "CID", "Shut down sending side of client connection CID")
+        self.console.addCommand("expect", self.doExpect,      "CID REGEX", "Read from client connection CID until REGEX matches")
+        self.console.addCommand("expect-close", self.doExpectClose, "CID", "Make sure proxy closes client connection CID")
+        self.console.addCommand("close", self.doClose,        "CID+", "Close client connections")
         self.console.addCommand("wait", self.doWait,          "* | ID+", "Wait until all or listed pending requests, fetches, and responses have completed")
 
 
@@ -187,6 +204,12 @@ class Driver:
             s.stop()
         for s in self.servers.values():
             allOK = allOK and s.waitForExit()
+        for c in self.clients.values():
+            c.close()
+        for o in self.origins.values():
+            o.stop()
+        for o in self.origins.values():
+            allOK = o.waitForExit() and allOK
         self.eventManager.shutdown()
 #        self.requestManager.cacheStatistics()
         return allOK
@@ -505,7 +528,9 @@ class Driver:
             self.monitors = []
         if len(args) < 1:
             return True
-        path = args[0]
+        # '-' restarts the last proxy with new arguments
+        path = self.proxyPath if args[0] == '-' else args[0]
+        self.proxyPath = path
         options = args[1:]
         port = None
         for t in range(self.portLimit):
@@ -558,6 +583,187 @@ class Driver:
         self.console.outMsg("Proxy set up at %s:%d" % self.requestManager.proxy)
         return True
 
+    # Expand the text of a route or send: join arguments with spaces,
+    # decode escapes such as \r\n, replace %OID% with the authority of
+    # origin OID and %xN% with N copies of 'x'
+    def expandText(self, args):
+        text = " ".join(args).decode('string_escape')
+        for oid, origin in self.origins.items():
+            text = text.replace("%" + oid + "%", origin.authority())
+        return re.sub(r"%x(\d+)%", lambda m: "x" * int(m.group(1)), text)
+
+    def secondsLeft(self):
+        return self.timeout.getInteger() * self.stretch.getInteger() / 100000.0
+
+    def doOrigin(self, args):
+        if len(args) < 1 or len(args) > 2 or (len(args) == 2 and args[1] != "echo"):
+            self.console.errMsg("Origin command requires an ID and optionally 'echo'")
+            return False
+        oid = args[0]
+        if oid in self.origins or oid in self.servers:
+            self.console.errMsg("Duplicate origin id '%s'" % oid)
+            return False
+        o = agents.Origin(self.host, self.portLimit, self.portManager, self.console,
+                          id = oid, echo = len(args) == 2)
+        if not o.running:
+            return False
+        self.origins[oid] = o
+        self.console.outMsg("Origin %s running at %s" % (oid, o.authority()))
+        return True
+
+    def findOrigin(self, oid):
+        if oid not in self.origins:
+            self.console.errMsg("Invalid origin name %s" % oid)
+            return None
+        return self.origins[oid]
+
+    def doRoute(self, args):
+        if len(args) < 3:
+            self.console.errMsg("Route command requires an origin, a path and a reply")
+            return False
+        origin = self.findOrigin(args[0])
+        if origin is None:
+            return False
+        path = args[1]
+        rest = args[2:]
+        delay = 0.0
+        if rest[0][0] == '+':
+            try:
+                delay = float(rest[0][1:]) * self.stretch.getInteger() / 100000.0
+            except:
+                self.console.errMsg("Invalid delay '%s'" % rest[0])
+                return False
+            rest = rest[1:]
+        kind = "text"
+        if len(rest) > 0 and rest[0] in ["stall", "upgrade"]:
+            kind = rest[0]
+            rest = rest[1:]
+        origin.addRoute(path, delay, kind, self.expandText(rest))
+        return True
+
+    def doServed(self, args):
+        if len(args) != 2:
+            self.console.errMsg("Served command requires an origin and a count")
+            return False
+        origin = self.findOrigin(args[0])
+        if origin is None:
+            return False
+        count = origin.served()
+        if count != int(args[1]):
+            self.console.errMsg("Origin %s received %d requests.  Expecting %s" % (args[0], count, args[1]))
+            return False
+        self.console.outMsg("Origin %s received %d requests" % (args[0], count))
+        return True
+
+    def doReceived(self, args):
+        if len(args) < 2:
+            self.console.errMsg("Received command requires an origin and a pattern")
+            return False
+        origin = self.findOrigin(args[0])
+        if origin is None:
+            return False
+        request = origin.lastRequest()
+        pattern = self.expandText(args[1:])
+        if request is None or re.search(pattern, request, re.DOTALL) is None:
+            self.console.errMsg("Origin %s last received %s.  Expecting a match for %s" % (args[0], repr(request), repr(pattern)))
+            return False
+        self.console.outMsg("Origin %s received a match for %s" % (args[0], repr(pattern)))
+        return True
+
+    def doStopOrigin(self, args):
+        ok = True
+        for oid in args:
+            origin = self.findOrigin(oid)
+            if origin is None:
+                ok = False
+                continue
+            origin.stop()
+            ok = origin.waitForExit() and ok
+        return ok
+
+    def findClient(self, cid):
+        if cid not in self.clients:
+            self.console.errMsg("Invalid client name %s" % cid)
+            return None
+        return self.clients[cid]
+
+    def doConnect(self, args):
+        if len(args) != 1:
+            self.console.errMsg("Connect command requires a client ID")
+            return False
+        (status, msg) = self.checkProxy()
+        if not status:
+            self.console.errMsg("Cannot execute connect. %s" % msg)
+            return False
+        try:
+            self.clients[args[0]] = agents.RawClient(self.requestManager.proxy)
+        except socket.error as ex:
+            self.console.errMsg("Client %s couldn't connect to proxy (%s)" % (args[0], str(ex)))
+            return False
+        return True
+
+    def doSend(self, args):
+        if len(args) < 2:
+            self.console.errMsg("Send command requires a client and text")
+            return False
+        client = self.findClient(args[0])
+        if client is None:
+            return False
+        try:
+            client.send(self.expandText(args[1:]))
+        except socket.error as ex:
+            self.console.errMsg("Client %s couldn't send (%s)" % (args[0], str(ex)))
+            return False
+        return True
+
+    def doShut(self, args):
+        if len(args) != 1:
+            self.console.errMsg("Shut command requires a client ID")
+            return False
+        client = self.findClient(args[0])
+        if client is None:
+            return False
+        client.shut()
+        return True
+
+    def doExpect(self, args):
+        if len(args) < 2:
+            self.console.errMsg("Expect command requires a client and a pattern")
+            return False
+        client = self.findClient(args[0])
+        if client is None:
+            return False
+        pattern = self.expandText(args[1:])
+        if client.expect(pattern, self.secondsLeft()) is None:
+            self.console.errMsg("Client %s received %s.  Expecting a match for %s" % (args[0], repr(client.buffer), repr(pattern)))
+            return False
+        self.console.outMsg("Client %s received a match for %s" % (args[0], repr(pattern)))
+        return True
+
+    def doExpectClose(self, args):
+        if len(args) != 1:
+            self.console.errMsg("Expect-close command requires a client ID")
+            return False
+        client = self.findClient(args[0])
+        if client is None:
+            return False
+        if not client.expectClose(self.secondsLeft()):
+            self.console.errMsg("Proxy did not close the connection of client %s" % args[0])
+            return False
+        self.console.outMsg("Proxy closed the connection of client %s" % args[0])
+        return True
+
+    def doClose(self, args):
+        ok = True
+        for cid in args:
+            client = self.findClient(cid)
+            if client is None:
+                ok = False
+                continue
+            client.close()
+            del self.clients[cid]
+        return ok
+
     def doExternalProxy(self, args):
         # Make use of external proxy
         # Terminate any existing proxy
@@ -14,10 +14,10 @@ import threading
 import datetime
 
 def usage(name):
-    print "Usage: %s [-h] -p PROXY [-s [ABCD]+] [-a ALIMIT] [-c (0-4)] [-t SECS] [(-l|-L) FILE] [-d STRETCH]" % name
+    print "Usage: %s [-h] -p PROXY [-s [ABCDF]+] [-a ALIMIT] [-c (0-4)] [-t SECS] [(-l|-L) FILE] [-d STRETCH]" % name
     print "  -h           Print this message"
     print "  -p PROXY     Run specified proxy"
-    print "  -s [ABCDE]+  Run specified series of tests (any subset of A, B, C, and D)"
+    print "  -s [ABCDEF]+ Run specified series of tests (any subset of A, B, C, D, E and F)"
     print "  -a ALIMIT    Set limit on number of failing tests before abort"
     print "  -t SECS      Set upper time limit for any given test (Value 0 ==> run indefinitely)"
     print "  -c CHECK     Set level of checking options (0-3)"
@@ -223,7 +223,7 @@ def run(name, args):
     global abortLimit
     limit = 60
     proxy = None
-    series = "ABCD"
+    series = "ABCDF"
     generateLog = True
     superLog = False
     try:
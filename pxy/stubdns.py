@@ -0,0 +1,94 @@
+#!/usr/bin/python2
+
+# Minimal DNS server for exercising the proxy's resolver (proxy -n)
+#
+# Answers A and AAAA queries for a fixed set of names with a fixed TTL,
+# returns NXDOMAIN for anything else (or SERVFAIL for names listed so), and logs every query so that cache
+# hits, negative caching and background refreshes can be observed.
+
+import sys
+import getopt
+import socket
+import struct
+
+def usage(name):
+    print "Usage: %s [-h] [-p PORT] [-t TTL] [NAME=ADDR ...]" % name
+    print "  -h           Print this message"
+    print "  -p PORT      Listen on UDP PORT (default 5353)"
+    print "  -t TTL       TTL of every answer in seconds (default 30)"
+    print "  NAME=ADDR    Answer NAME with ADDR (default localhost=127.0.0.1)"
+    print "  NAME=servfail  Answer NAME with SERVFAIL"
+    sys.exit(0)
+
+TYPE_A = 1
+TYPE_AAAA = 28
+
+def parseName(msg, off):
+    labels = []
+    while True:
+        length = ord(msg[off])
+        off += 1
+        if length == 0:
+            break
+        labels.append(msg[off:off+length])
+        off += length
+    return ".".join(labels).lower(), off
+
+def answer(msg, records, ttl):
+    (qid, flags, qdcount) = struct.unpack("!HHH", msg[:6])
+    (name, off) = parseName(msg, 12)
+    (qtype, qclass) = struct.unpack("!HH", msg[off:off+4])
+    question = msg[12:off+4]
+    answers = []
+    rcode = 3
+    if records.get(name) == "servfail":
+        rcode = 2
+    elif name in records:
+        rcode = 0
+        for (family, addr) in records[name]:
+            if family == socket.AF_INET and qtype == TYPE_A:
+                rdata = socket.inet_pton(family, addr)
+            elif family == socket.AF_INET6 and qtype == TYPE_AAAA:
+                rdata = socket.inet_pton(family, addr)
+            else:
+                continue
+            answers.append(struct.pack("!HHHIH", 0xC00C, qtype, 1, ttl,
+                                       len(rdata)) + rdata)
+    header = struct.pack("!HHHHHH", qid, 0x8180 | rcode, 1, len(answers),
+                         0, 0)
+    print "query %s type %d -> %d answers" % (name, qtype, len(answers))
+    sys.stdout.flush()
+    return header + question + "".join(answers)
+
+def run(name, args):
+    port = 5353
+    ttl = 30
+    optlist, args = getopt.getopt(args, "hp:t:")
+    for (opt, val) in optlist:
+        if opt == '-h':
+            usage(name)
+        elif opt == '-p':
+            port = int(val)
+        elif opt == '-t':
+            ttl = int(val)
+    if len(args) == 0:
+        args = ["localhost=127.0.0.1"]
+    records = {}
+    for arg in args:
+        (host, addr) = arg.split("=", 1)
+        if addr == "servfail":
+            records[host.lower()] = addr
+            continue
+        family = socket.AF_INET6 if ':' in addr else socket.AF_INET
+        records.setdefault(host.lower(), []).append((family, addr))
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", port))
+    while True:
+        (msg, client) = sock.recvfrom(1232)
+        try:
+            sock.sendto(answer(msg, records, ttl), client)
+        except Exception as ex:
+            print "Bad query from %s (%s)" % (str(client), str(ex))
+
+run(sys.argv[0], sys.argv[1:])
@@ -0,0 +1,402 @@
+/**
+ * @file reqparse.c
+ * @brief Zero-copy incremental parser for HTTP/1.x request heads
+ */
+
+#include "reqparse.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+/* Parser states: which line comes next */
+enum { RS_REQUEST_LINE, RS_HEADER, RS_DONE, RS_ERROR, RS_FULL };
+
+/* Character classes */
+#define C_TOKEN 1  // May appear in a method or header name
+#define C_TARGET 2 // May appear in a request target
+#define C_VALUE 4  // May appear in a header value
+
+static const unsigned char char_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    4, 7, 6, 7, 7, 7, 7, 7, 6, 6, 7, 7, 6, 7, 7, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 6, 6, 6,
+    6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 6, 6, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 7, 6, 7, 0,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+};
+
+/* A scanner returns the first byte of [s, end) outside its class, or end */
+typedef const char *(*scanner_t)(const char *s, const char *end);
+
+/* scalar_span - Skip bytes of class cls a byte at a time */
+static const char *scalar_span(const char *s, const char *end, int cls) {
+    while (s < end && (char_class[(unsigned char)*s] & cls)) {
+        s++;
+    }
+    return s;
+}
+
+static const char *scalar_target(const char *s, const char *end) {
+    return scalar_span(s, end, C_TARGET);
+}
+
+static const char *scalar_value(const char *s, const char *end) {
+    return scalar_span(s, end, C_VALUE);
+}
+
+#ifdef HAVE_X86
+/*
+ * The SSE4.2 scanners look for bytes within ranges of what is not allowed:
+ * controls and DEL, plus space in a target but tab spared in a value.
+ */
+static const char target_ranges[16] = {0x00, 0x20, 0x7f, 0x7f};
+static const char value_ranges[16] = {0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f};
+
+__attribute__((target("sse4.2"))) static const char *
+sse42_target(const char *s, const char *end) {
+    const __m128i ranges = _mm_loadu_si128((const __m128i *)target_ranges);
+
+    for (; end - s >= 16; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        int i = _mm_cmpestri(ranges, 4, v, 16,
+                             _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                 _SIDD_LEAST_SIGNIFICANT);
+        if (i < 16) {
+            return s + i;
+        }
+    }
+    return scalar_target(s, end);
+}
+
+__attribute__((target("sse4.2"))) static const char *
+sse42_value(const char *s, const char *end) {
+    const __m128i ranges = _mm_loadu_si128((const __m128i *)value_ranges);
+
+    for (; end - s >= 16; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+        int i = _mm_cmpestri(ranges, 6, v, 16,
+                             _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                 _SIDD_LEAST_SIGNIFICANT);
+        if (i < 16) {
+            return s + i;
+        }
+    }
+    return scalar_value(s, end);
+}
+
+/*
+ * The AVX2 scanners compare unsigned (min(v, limit) == v means v <= limit)
+ * so that bytes from 0x80 up, which are allowed, do not look negative.
+ * Every CPU with AVX2 has SSE4.2, which finishes off their tails.
+ */
+__attribute__((target("avx2"))) static const char *
+avx2_target(const char *s, const char *end) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+
+    for (; end - s >= 32; s += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)s);
+        __m256i bad =
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v),
+                            _mm256_cmpeq_epi8(v, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+        if (mask != 0) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return sse42_target(s, end);
+}
+
+__attribute__((target("avx2"))) static const char *
+avx2_value(const char *s, const char *end) {
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+
+    for (; end - s >= 32; s += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)s);
+        __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+        low = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), low);
+        __m256i bad = _mm256_or_si256(low, _mm256_cmpeq_epi8(v, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(bad);
+        if (mask != 0) {
+            return s + __builtin_ctz(mask);
+        }
+    }
+    return sse42_value(s, end);
+}
+#endif
+
+/* Set by reqparse_setup() before any thread parses, read-only after */
+static scanner_t scan_target = scalar_target;
+static scanner_t scan_value = scalar_value;
+
+/* span_of - Advance s past bytes of class cls; returns the span skipped */
+static span_t span_of(const char **s, const char *end, int cls) {
+    span_t span = {*s, 0};
+
+    *s = scalar_span(*s, end, cls);
+    span.len = (size_t)(*s - span.p);
+    return span;
+}
+
+/* span_scan - Like span_of(), through a scanner */
+static span_t span_scan(const char **s, const char *end, scanner_t scan) {
+    span_t span = {*s, 0};
+
+    *s = scan(*s, end);
+    span.len = (size_t)(*s - span.p);
+    return span;
+}
+
+int reqparse_use(req_scanner scanner) {
+    switch (scanner) {
+    case REQ_SCAN_SCALAR:
+        scan_target = scalar_target;
+        scan_value = scalar_value;
+        return 0;
+#ifdef HAVE_X86
+    case REQ_SCAN_SSE42:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse4.2")) {
+            return -1;
+        }
+        scan_target = sse42_target;
+        scan_value = sse42_value;
+        return 0;
+    case REQ_SCAN_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) {
+            return -1;
+        }
+        scan_target = avx2_target;
+        scan_value = avx2_value;
+        return 0;
+#endif
+    default:
+        return -1;
+    }
+}
+
+req_scanner reqparse_setup(void) {
+    if (reqparse_use(REQ_SCAN_AVX2) == 0) {
+        return REQ_SCAN_AVX2;
+    }
+    if (reqparse_use(REQ_SCAN_SSE42) == 0) {
+        return REQ_SCAN_SSE42;
+    }
+    reqparse_use(REQ_SCAN_SCALAR);
+    return REQ_SCAN_SCALAR;
+}
+
+/*
+ * The known names hash perfectly into HASH_SLOTS with their first and last
+ * characters, case folded, and their length; the weights were found by
+ * searching small integers. A name that hashes to a known one's slot is
+ * still compared, so other names are never mistaken for it.
+ */
+#define HASH_SLOTS 64
+#define HASH_FIRST 3
+#define HASH_LAST 15
+
+static unsigned hash_name(const char *name, size_t len) {
+    unsigned first = (unsigned char)name[0] | 0x20;
+    unsigned last = (unsigned char)name[len - 1] | 0x20;
+
+    return (HASH_FIRST * first + HASH_LAST * last + (unsigned)len) %
+           HASH_SLOTS;
+}
+
+#define REQ_HEADER_SLOT(id, name, slot)                                       \
+    [slot] = {name, sizeof(name) - 1, REQ_H_##id},
+static const struct {
+    const char *name;
+    size_t len;
+    req_header_id id;
+} slots[HASH_SLOTS] = {REQ_KNOWN_HEADERS(REQ_HEADER_SLOT)};
+#undef REQ_HEADER_SLOT
+
+req_header_id reqparse_lookup(const char *name, size_t len) {
+    if (len == 0) {
+        return REQ_H_OTHER;
+    }
+    unsigned slot = hash_name(name, len);
+    if (slots[slot].len == len &&
+        strncasecmp(slots[slot].name, name, len) == 0) {
+        return slots[slot].id;
+    }
+    return REQ_H_OTHER;
+}
+
+const req_header_t *reqparse_header(const reqparse_t *p, req_header_id id) {
+    unsigned char i = p->known[id];
+
+    return i == 0 ? NULL : &p->headers[i - 1];
+}
+
+/* split_authority - Split host[:port], minding IPv6 brackets */
+static void split_authority(reqparse_t *p) {
+    const char *s = p->authority.p, *end = s + p->authority.len;
+    const char *colon = NULL;
+
+    if (s < end && *s == '[') {
+        const char *bracket = memchr(s, ']', (size_t)(end - s));
+        if (bracket != NULL && bracket + 1 < end && bracket[1] == ':') {
+            colon = bracket + 1;
+        }
+    } else {
+        for (const char *c = end; c > s; c--) {
+            if (c[-1] == ':') {
+                colon = c - 1;
+                break;
+            }
+        }
+    }
+    p->host.p = s;
+    p->host.len = (size_t)((colon != NULL ? colon : end) - s);
+    if (colon != NULL) {
+        p->port.p = colon + 1;
+        p->port.len = (size_t)(end - colon - 1);
+    }
+}
+
+/* split_target - Find the parts of the request target by its form */
+static void split_target(reqparse_t *p) {
+    const char *s = p->target.p, *end = s + p->target.len;
+
+    if (*s == '/') {
+        p->path = p->target;
+        return;
+    }
+    if (p->target.len == 1 && *s == '*') {
+        return;
+    }
+
+    const char *sep = NULL;
+    for (const char *c = s; c + 3 <= end && *c != '/'; c++) {
+        if (c[0] == ':' && c[1] == '/' && c[2] == '/') {
+            sep = c;
+            break;
+        }
+    }
+    if (sep != NULL) {
+        p->scheme.p = s;
+        p->scheme.len = (size_t)(sep - s);
+        s = sep + 3;
+        const char *slash = memchr(s, '/', (size_t)(end - s));
+        if (slash != NULL) {
+            p->path.p = slash;
+            p->path.len = (size_t)(end - slash);
+            end = slash;
+        }
+    }
+    p->authority.p = s;
+    p->authority.len = (size_t)(end - s);
+    split_authority(p);
+}
+
+/* parse_request_line - METHOD SP target SP HTTP/d.d */
+static int parse_request_line(reqparse_t *p, const char *s, const char *end) {
+    p->method = span_of(&s, end, C_TOKEN);
+    if (p->method.len == 0 || s == end || *s++ != ' ') {
+        return RS_ERROR;
+    }
+    p->target = span_scan(&s, end, scan_target);
+    if (p->target.len == 0 || s == end || *s++ != ' ') {
+        return RS_ERROR;
+    }
+    if (end - s != 8 || memcmp(s, "HTTP/", 5) != 0 || s[5] < '0' ||
+        s[5] > '9' || s[6] != '.' || s[7] < '0' || s[7] > '9') {
+        return RS_ERROR;
+    }
+    p->major = s[5] - '0';
+    p->minor = s[7] - '0';
+    split_target(p);
+    return RS_HEADER;
+}
+
+/* parse_header - name ":" OWS value OWS */
+static int parse_header(reqparse_t *p, const char *s, const char *end) {
+    if (p->nheaders == REQ_MAX_HEADERS) {
+        return RS_FULL;
+    }
+    req_header_t *h = &p->headers[p->nheaders];
+
+    h->name = span_of(&s, end, C_TOKEN);
+    if (h->name.len == 0 || s == end || *s++ != ':') {
+        return RS_ERROR;
+    }
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    h->value = span_scan(&s, end, scan_value);
+    if (s != end) {
+        return RS_ERROR;
+    }
+    while (h->value.len > 0 && (h->value.p[h->value.len - 1] == ' ' ||
+                                h->value.p[h->value.len - 1] == '\t')) {
+        h->value.len--;
+    }
+    h->id = reqparse_lookup(h->name.p, h->name.len);
+    if (h->id != REQ_H_OTHER && p->known[h->id] == 0) {
+        p->known[h->id] = (unsigned char)(p->nheaders + 1);
+    }
+    p->nheaders++;
+    return RS_HEADER;
+}
+
+void reqparse_init(reqparse_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->state = RS_REQUEST_LINE;
+}
+
+void reqparse_reset(reqparse_t *p) {
+    memset(p, 0, offsetof(reqparse_t, headers));
+    p->nheaders = 0;
+    memset(p->known, 0, sizeof(p->known));
+    p->length = p->line = p->scan = 0;
+    p->state = RS_REQUEST_LINE;
+}
+
+req_status reqparse_parse(reqparse_t *p, const char *buf, size_t len) {
+    while (p->state == RS_REQUEST_LINE || p->state == RS_HEADER) {
+        const char *line = buf + p->line;
+        const char *lf = memchr(buf + p->scan, '\n', len - p->scan);
+        if (lf == NULL) {
+            p->scan = len;
+            return REQ_MORE;
+        }
+        const char *end = lf > line && lf[-1] == '\r' ? lf - 1 : lf;
+        p->line = p->scan = (size_t)(lf + 1 - buf);
+
+        if (end == line) {
+            /* Blank lines before the request line are skipped */
+            if (p->state == RS_HEADER) {
+                p->length = p->line;
+                p->state = RS_DONE;
+            }
+        } else if (p->state == RS_REQUEST_LINE) {
+            p->state = parse_request_line(p, line, end);
+        } else {
+            p->state = parse_header(p, line, end);
+        }
+    }
+    return p->state == RS_DONE   ? REQ_DONE
+           : p->state == RS_FULL ? REQ_FULL
+                                 : REQ_ERROR;
+}
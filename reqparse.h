@@ -0,0 +1,219 @@
+/**
+ * @file reqparse.h
+ * @brief Zero-copy incremental parser for HTTP/1.x request heads
+ *
+ * The caller collects the bytes of a request head in one buffer as they
+ * arrive and hands the parser the whole buffer after each read. Scanning
+ * resumes where the previous call stopped, so a head split across any
+ * number of reads is still looked at only once. Nothing is copied or
+ * allocated: the method, the parts of the request target and every header
+ * come back as spans of the caller's buffer, valid for as long as it is.
+ *
+ *     reqparse_t p;
+ *     reqparse_init(&p);
+ *     while ((status = reqparse_parse(&p, buf, len)) == REQ_MORE)
+ *         ...append what the next read returns to buf, adding to len...
+ *     ...REQ_DONE: the head is buf[0, p.length); the rest is body or the
+ *     next request
+ *     reqparse_reset(&p);
+ *     ...and parse the next head with the same parser
+ *
+ * A parser is about 4 KB, nearly all of it the header array. Keeping one
+ * per connection and resetting it between heads, which leaves the array
+ * alone, costs a hundred bytes of stores rather than clearing all of it.
+ *
+ * Methods and header names must be tokens, the target must not contain
+ * spaces or control characters, and header values must not contain
+ * control characters other than tabs. Obsolete line folding is rejected.
+ * Bare LFs are accepted in place of CRLFs.
+ *
+ * The request target is split according to its form: origin-form
+ * ("/path?query") sets only the path; absolute-form
+ * ("http://host:port/path") also sets the scheme, authority, host and
+ * port; authority-form ("host:port", as in CONNECT) sets the authority,
+ * host and port; asterisk-form ("*") sets nothing beyond the target.
+ *
+ * Header names the proxy acts on are recognized as they are parsed, case
+ * insensitively, through a perfect hash: each header carries the ID of
+ * its name, and the parser keeps where the first header with each ID is,
+ * so finding one costs O(1) however many there are.
+ *
+ * Request targets and header values, the long spans, are checked 32 or 16
+ * bytes at a time with AVX2 or SSE4.2 (pcmpestri) when the CPU has them;
+ * reqparse_setup() picks the scanner once at startup, and until then the
+ * scalar one is used. Lines are found with memchr(), which the C library
+ * vectorizes itself.
+ */
+
+#ifndef __REQPARSE_H__
+#define __REQPARSE_H__
+
+#include <stddef.h>
+
+#define REQ_MAX_HEADERS 100 // Headers a request may carry
+
+/*
+ * X(identifier, name, slot): slot is the name's perfect hash, see
+ * reqparse.c. A new name needs a free slot, or new hash constants.
+ */
+#define REQ_KNOWN_HEADERS(X)                                                   \
+    X(HOST, "Host", 8)                                                         \
+    X(CONNECTION, "Connection", 37)                                            \
+    X(PROXY_CONNECTION, "Proxy-Connection", 18)                                \
+    X(USER_AGENT, "User-Agent", 53)                                            \
+    X(CONTENT_LENGTH, "Content-Length", 15)                                    \
+    X(TRANSFER_ENCODING, "Transfer-Encoding", 54)                              \
+    X(EXPECT, "Expect", 1)                                                     \
+    X(UPGRADE, "Upgrade", 17)                                                  \
+    X(HTTP2_SETTINGS, "HTTP2-Settings", 3)                                     \
+    X(ACCEPT_ENCODING, "Accept-Encoding", 59)                                  \
+    X(CACHE_CONTROL, "Cache-Control", 10)                                      \
+    X(PRAGMA, "Pragma", 5)                                                     \
+    X(RANGE, "Range", 6)                                                       \
+    X(IF_MODIFIED_SINCE, "If-Modified-Since", 55)                              \
+    X(IF_NONE_MATCH, "If-None-Match", 32)                                      \
+    X(IF_MATCH, "If-Match", 27)                                                \
+    X(IF_UNMODIFIED_SINCE, "If-Unmodified-Since", 57)                          \
+    X(IF_RANGE, "If-Range", 46)                                                \
+    X(AUTHORIZATION, "Authorization", 34)
+
+/**
+ * @brief IDs of the known header names
+ */
+#define REQ_HEADER_ENUM(id, name, slot) REQ_H_##id,
+typedef enum {
+    REQ_H_OTHER, /**< any other name */
+    REQ_KNOWN_HEADERS(REQ_HEADER_ENUM) REQ_H_COUNT
+} req_header_id;
+#undef REQ_HEADER_ENUM
+
+/**
+ * @brief Ways of scanning spans, fastest last
+ */
+typedef enum {
+    REQ_SCAN_SCALAR, /**< a byte at a time, through a table */
+    REQ_SCAN_SSE42,  /**< 16 bytes at a time with pcmpestri */
+    REQ_SCAN_AVX2,   /**< 32 bytes at a time with pcmpeqb and movemask */
+} req_scanner;
+
+/**
+ * @brief A run of bytes in the caller's buffer, not NUL terminated
+ */
+typedef struct {
+    const char *p; /**< the first byte */
+    size_t len;    /**< the number of bytes, 0 if absent */
+} span_t;
+
+/**
+ * @brief A parsed header
+ */
+typedef struct {
+    span_t name;      /**< the name, as sent */
+    span_t value;     /**< the value, without surrounding whitespace */
+    req_header_id id; /**< the name's ID, REQ_H_OTHER if not a known one */
+} req_header_t;
+
+/**
+ * @brief Results of reqparse_parse()
+ */
+typedef enum {
+    REQ_MORE,  /**< the head is incomplete, more bytes are needed */
+    REQ_DONE,  /**< the head is complete */
+    REQ_ERROR, /**< the head is malformed */
+    REQ_FULL,  /**< the head has more than REQ_MAX_HEADERS headers */
+} req_status;
+
+/**
+ * @brief A request head, as far as it has been parsed
+ */
+typedef struct {
+    span_t method;    /**< e.g. GET */
+    span_t target;    /**< the whole request target */
+    span_t scheme;    /**< e.g. http, in absolute-form only */
+    span_t authority; /**< host[:port], in absolute- and authority-form */
+    span_t host;      /**< the host, IPv6 addresses in their brackets */
+    span_t port;      /**< the port, if given */
+    span_t path;      /**< from the first '/' on (query included), if any */
+    int major;        /**< HTTP major version */
+    int minor;        /**< HTTP minor version */
+    req_header_t headers[REQ_MAX_HEADERS]; /**< in the order sent */
+    size_t nheaders;                       /**< headers parsed so far */
+    unsigned char known[REQ_H_COUNT]; /**< index + 1 of the first header
+                                           with each ID, 0 if none */
+    size_t length; /**< bytes in the head, blank line included, once done */
+
+    /* Internal */
+    size_t line; /**< offset of the line being parsed */
+    size_t scan; /**< offset up to which it has been searched for LF */
+    int state;   /**< what the next complete line is */
+} reqparse_t;
+
+/**
+ * @brief Pick the fastest scanner this CPU supports
+ *
+ * Call once, before any thread parses.
+ *
+ * @return The scanner picked
+ */
+req_scanner reqparse_setup(void);
+
+/**
+ * @brief Use a given scanner, for benchmarks and tests
+ *
+ * @param[in] scanner The scanner
+ *
+ * @return 0 on success, -1 if the CPU does not support it
+ */
+int reqparse_use(req_scanner scanner);
+
+/**
+ * @brief Find the ID of a header name
+ *
+ * @param[in] name The name, in any case
+ * @param[in] len Its length
+ *
+ * @return The ID, REQ_H_OTHER if it is not a known name
+ */
+req_header_id reqparse_lookup(const char *name, size_t len);
+
+/**
+ * @brief Find the first header with a known name
+ *
+ * @param[in] p The parser
+ * @param[in] id The name's ID
+ *
+ * @return The header, or NULL if the head has none
+ */
+const req_header_t *reqparse_header(const reqparse_t *p, req_header_id id);
+
+/**
+ * @brief Prepare a parser for a new request head
+ *
+ * @param[in] p The parser
+ */
+void reqparse_init(reqparse_t *p);
+
+/**
+ * @brief Prepare a parser that has been used for the next request head
+ *
+ * Clears only what parsing a head sets; headers past nheaders are stale
+ * and never read.
+ *
+ * @param[in] p The parser, which reqparse_init() prepared once
+ */
+void reqparse_reset(reqparse_t *p);
+
+/**
+ * @brief Parse as much of a request head as has arrived
+ *
+ * @param[in] p The parser
+ * @param[in] buf The bytes received so far, the same buffer on every call
+ *     for one head, holding at least what it held on the previous call
+ * @param[in] len The number of bytes in buf
+ *
+ * @return REQ_DONE with every field set, REQ_MORE if the head is not
+ *     complete yet, REQ_ERROR or REQ_FULL if it never will be
+ */
+req_status reqparse_parse(reqparse_t *p, const char *buf, size_t len);
+
+#endif /* __REQPARSE_H__ */
@@ -0,0 +1,602 @@
+/**
+ * @file resolver.c
+ * @brief Caching host name resolver
+ *
+ * Cache entries live in a chained hash table protected by a single lock.
+ * The lock is never held while a query is outstanding: the thread that
+ * misses marks the entry as pending, resolves without the lock, and then
+ * publishes the result and wakes any threads that were waiting on the same
+ * name.
+ *
+ * The native DNS client is deliberately small. It sends one A and one AAAA
+ * query to the configured nameserver over UDP, retries once on timeout, and
+ * takes every A/AAAA record in the answer section (so CNAME chains that the
+ * server already flattened work). The smallest record TTL becomes the
+ * entry's lifetime.
+ *
+ * Only answers that the name has no addresses, NXDOMAIN or NODATA, are
+ * cached as negative. A timeout, a SERVFAIL or a getaddrinfo() EAI_AGAIN
+ * says nothing about the name, so it fails the lookups that were waiting
+ * for it and the next lookup queries again.
+ */
+
+#include "resolver.h"
+#include "csapp.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RESOLVER_BUCKETS 256
+#define RESOLVER_MAX_NAME 256
+
+/* Bounds applied to TTLs reported by the nameserver */
+#define RESOLVER_MIN_TTL 1
+#define RESOLVER_MAX_TTL 3600
+
+/* Names with this many hits are refreshed this long before they expire */
+#define REFRESH_MIN_HITS 2
+#define REFRESH_AHEAD 5
+#define REFRESH_BATCH 16
+
+/* Expired entries are dropped this long after they expire */
+#define PURGE_AFTER 60
+
+/* Native DNS client parameters */
+#define DNS_PORT "53"
+#define DNS_TIMEOUT_MS 2000
+#define DNS_TRIES 2
+#define DNS_MAXMSG 1232
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+
+/* What resolving a name returns besides 0 */
+#define RESOLVE_NO_ADDRS -1 // The name has no addresses, cached as negative
+#define RESOLVE_FAILED -2   // No answer, tried again by the next lookup
+
+typedef enum {
+    ENTRY_PENDING,
+    ENTRY_VALID,
+    ENTRY_NEGATIVE,
+    ENTRY_FAILED
+} entry_state;
+
+/* The addresses of one name, without a port */
+typedef struct {
+    int naddrs;
+    struct sockaddr_storage addrs[RESOLVER_MAX_ADDRS];
+    socklen_t addrlens[RESOLVER_MAX_ADDRS];
+} addr_set_t;
+
+typedef struct entry {
+    struct entry *next;          // Next entry in the bucket
+    char name[RESOLVER_MAX_NAME]; // Lower case host name
+    entry_state state;           // Pending, positive, negative or failed
+    bool refreshing;             // Background refresh in progress
+    time_t expires;              // Monotonic time the result expires
+    unsigned hits;               // Lookups since the last resolution
+    addr_set_t set;              // Cached addresses (ENTRY_VALID only)
+} entry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // Signalled when a pending entry resolves
+    entry_t *buckets[RESOLVER_BUCKETS];
+    resolver_config_t config;
+    bool use_ns; // Query the nameserver below instead of getaddrinfo
+    struct sockaddr_storage ns;
+    socklen_t nslen;
+} resolver = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static time_t now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned hash_name(const char *name) {
+    unsigned h = 5381;
+    while (*name != '\0') {
+        h = h * 33 + (unsigned char)*name++;
+    }
+    return h % RESOLVER_BUCKETS;
+}
+
+/* Must be called with the lock held */
+static entry_t *find_entry(const char *name) {
+    entry_t *e;
+    for (e = resolver.buckets[hash_name(name)]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/****************************
+ * System resolver fallback
+ ****************************/
+
+static int resolve_system(const char *name, addr_set_t *set, int *ttl) {
+    struct addrinfo hints, *listp, *p;
+    int rc;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    if ((rc = getaddrinfo(name, NULL, &hints, &listp)) != 0) {
+        fprintf(stderr, "getaddrinfo failed (%s): %s\n", name,
+                gai_strerror(rc));
+#ifdef EAI_NODATA
+        if (rc == EAI_NODATA) {
+            return RESOLVE_NO_ADDRS;
+        }
+#endif
+        return rc == EAI_NONAME ? RESOLVE_NO_ADDRS : RESOLVE_FAILED;
+    }
+
+    set->naddrs = 0;
+    for (p = listp; p && set->naddrs < RESOLVER_MAX_ADDRS; p = p->ai_next) {
+        memcpy(&set->addrs[set->naddrs], p->ai_addr, p->ai_addrlen);
+        set->addrlens[set->naddrs] = p->ai_addrlen;
+        set->naddrs++;
+    }
+    freeaddrinfo(listp);
+
+    *ttl = resolver.config.ttl;
+    return set->naddrs > 0 ? 0 : RESOLVE_NO_ADDRS;
+}
+
+/****************************
+ * Native DNS client
+ ****************************/
+
+/* dns_build_query - Encode a recursive query for name/qtype into buf */
+static size_t dns_build_query(uint8_t *buf, uint16_t id, const char *name,
+                              uint16_t qtype) {
+    size_t pos = 12;
+
+    memset(buf, 0, 12);
+    buf[0] = (uint8_t)(id >> 8);
+    buf[1] = (uint8_t)id;
+    buf[2] = 0x01; /* RD */
+    buf[5] = 1;    /* QDCOUNT */
+
+    while (*name != '\0') {
+        size_t len = strcspn(name, ".");
+        if (len == 0 || len > 63) {
+            return 0;
+        }
+        buf[pos++] = (uint8_t)len;
+        memcpy(buf + pos, name, len);
+        pos += len;
+        name += len;
+        if (*name == '.') {
+            name++;
+        }
+    }
+    buf[pos++] = 0;
+    buf[pos++] = (uint8_t)(qtype >> 8);
+    buf[pos++] = (uint8_t)qtype;
+    buf[pos++] = 0;
+    buf[pos++] = DNS_CLASS_IN;
+    return pos;
+}
+
+/* dns_skip_name - Return the offset just past the (compressed) name at off */
+static size_t dns_skip_name(const uint8_t *msg, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t l = msg[off];
+        if ((l & 0xC0) == 0xC0) {
+            return off + 2;
+        }
+        if (l == 0) {
+            return off + 1;
+        }
+        off += 1 + (size_t)l;
+    }
+    return len + 1;
+}
+
+/*
+ * dns_parse_response - Append the A/AAAA records of a response to set.
+ *     Returns the response code, or -1 if the message is malformed.
+ */
+static int dns_parse_response(const uint8_t *msg, size_t len, addr_set_t *set,
+                              uint32_t *min_ttl) {
+    if (len < 12 || !(msg[2] & 0x80)) {
+        return -1;
+    }
+    int rcode = msg[3] & 0x0F;
+    unsigned qdcount = (unsigned)(msg[4] << 8 | msg[5]);
+    unsigned ancount = (unsigned)(msg[6] << 8 | msg[7]);
+    size_t off = 12;
+
+    for (unsigned i = 0; i < qdcount; i++) {
+        off = dns_skip_name(msg, len, off) + 4;
+    }
+
+    for (unsigned i = 0; i < ancount && off < len; i++) {
+        off = dns_skip_name(msg, len, off);
+        if (off + 10 > len) {
+            return -1;
+        }
+        uint16_t type = (uint16_t)(msg[off] << 8 | msg[off + 1]);
+        uint16_t class = (uint16_t)(msg[off + 2] << 8 | msg[off + 3]);
+        uint32_t ttl = (uint32_t)msg[off + 4] << 24 |
+                       (uint32_t)msg[off + 5] << 16 |
+                       (uint32_t)msg[off + 6] << 8 | (uint32_t)msg[off + 7];
+        uint16_t rdlen = (uint16_t)(msg[off + 8] << 8 | msg[off + 9]);
+        off += 10;
+        if (off + rdlen > len) {
+            return -1;
+        }
+
+        if (class == DNS_CLASS_IN && set->naddrs < RESOLVER_MAX_ADDRS &&
+            ((type == DNS_TYPE_A && rdlen == 4) ||
+             (type == DNS_TYPE_AAAA && rdlen == 16))) {
+            struct sockaddr_storage *ss = &set->addrs[set->naddrs];
+            memset(ss, 0, sizeof(*ss));
+            if (type == DNS_TYPE_A) {
+                struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+                sin->sin_family = AF_INET;
+                memcpy(&sin->sin_addr, msg + off, 4);
+                set->addrlens[set->naddrs] = sizeof(*sin);
+            } else {
+                struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+                sin6->sin6_family = AF_INET6;
+                memcpy(&sin6->sin6_addr, msg + off, 16);
+                set->addrlens[set->naddrs] = sizeof(*sin6);
+            }
+            set->naddrs++;
+            if (ttl < *min_ttl) {
+                *min_ttl = ttl;
+            }
+        }
+        off += rdlen;
+    }
+    return rcode;
+}
+
+static int resolve_native(const char *name, addr_set_t *set, int *ttl) {
+    static const uint16_t qtypes[2] = {DNS_TYPE_AAAA, DNS_TYPE_A};
+    uint8_t query[DNS_MAXMSG], msg[DNS_MAXMSG];
+    uint16_t ids[2];
+    bool answered[2] = {false, false};
+    bool nxdomain = false;
+    bool servfail = false;
+    uint32_t min_ttl = UINT32_MAX;
+    int fd;
+
+    fd = socket(resolver.ns.ss_family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return RESOLVE_FAILED;
+    }
+    if (connect(fd, (struct sockaddr *)&resolver.ns, resolver.nslen) < 0) {
+        close(fd);
+        return RESOLVE_FAILED;
+    }
+
+    set->naddrs = 0;
+    for (int try = 0; try < DNS_TRIES && !(answered[0] && answered[1]);
+         try++) {
+        for (int q = 0; q < 2; q++) {
+            if (answered[q]) {
+                continue;
+            }
+            ids[q] = (uint16_t)random();
+            size_t qlen = dns_build_query(query, ids[q], name, qtypes[q]);
+            if (qlen == 0) {
+                close(fd);
+                return RESOLVE_NO_ADDRS;
+            }
+            send(fd, query, qlen, 0);
+        }
+
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        while (!(answered[0] && answered[1]) &&
+               poll(&pfd, 1, DNS_TIMEOUT_MS) > 0) {
+            ssize_t n = recv(fd, msg, sizeof(msg), 0);
+            if (n < 12) {
+                continue;
+            }
+            uint16_t id = (uint16_t)(msg[0] << 8 | msg[1]);
+            for (int q = 0; q < 2; q++) {
+                if (answered[q] || id != ids[q]) {
+                    continue;
+                }
+                int rcode = dns_parse_response(msg, (size_t)n, set, &min_ttl);
+                if (rcode >= 0) {
+                    answered[q] = true;
+                    nxdomain |= (rcode == DNS_RCODE_NXDOMAIN);
+                    servfail |= (rcode != DNS_RCODE_NOERROR &&
+                                 rcode != DNS_RCODE_NXDOMAIN);
+                }
+            }
+        }
+    }
+    close(fd);
+
+    if (set->naddrs == 0) {
+        /* Both queries must have been answered to know there are none */
+        if (servfail || !(answered[0] && answered[1])) {
+            fprintf(stderr, "resolver: no answer for %s\n", name);
+            return RESOLVE_FAILED;
+        }
+        if (!nxdomain) {
+            fprintf(stderr, "resolver: no addresses for %s\n", name);
+        }
+        return RESOLVE_NO_ADDRS;
+    }
+
+    *ttl = (int)min_ttl;
+    if (*ttl < RESOLVER_MIN_TTL) {
+        *ttl = RESOLVER_MIN_TTL;
+    } else if (*ttl > RESOLVER_MAX_TTL) {
+        *ttl = RESOLVER_MAX_TTL;
+    }
+    return 0;
+}
+
+static int resolve_name(const char *name, addr_set_t *set, int *ttl) {
+    if (resolver.use_ns) {
+        return resolve_native(name, set, ttl);
+    }
+    return resolve_system(name, set, ttl);
+}
+
+/****************************
+ * Cache
+ ****************************/
+
+/* copy_result - Copy a cached address set out, setting the port */
+static void copy_result(const addr_set_t *set, const char *port,
+                        resolver_result_t *result) {
+    uint16_t nport = htons((uint16_t)atoi(port));
+
+    result->naddrs = set->naddrs;
+    for (int i = 0; i < set->naddrs; i++) {
+        result->addrs[i] = set->addrs[i];
+        result->addrlens[i] = set->addrlens[i];
+        if (result->addrs[i].ss_family == AF_INET6) {
+            ((struct sockaddr_in6 *)&result->addrs[i])->sin6_port = nport;
+        } else {
+            ((struct sockaddr_in *)&result->addrs[i])->sin_port = nport;
+        }
+    }
+}
+
+/* lookup_numeric - Handle hosts that are already IP addresses */
+static bool lookup_numeric(const char *host, const char *port,
+                           resolver_result_t *result) {
+    addr_set_t set;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&set.addrs[0];
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&set.addrs[0];
+
+    memset(&set.addrs[0], 0, sizeof(set.addrs[0]));
+    if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        set.addrlens[0] = sizeof(*sin);
+    } else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        set.addrlens[0] = sizeof(*sin6);
+    } else {
+        return false;
+    }
+    set.naddrs = 1;
+    copy_result(&set, port, result);
+    return true;
+}
+
+/* store_result - Publish a resolution. Must be called with the lock held */
+static void store_result(entry_t *e, int rc, const addr_set_t *set, int ttl) {
+    if (rc == 0) {
+        e->state = ENTRY_VALID;
+        e->set = *set;
+        e->expires = now_sec() + ttl;
+    } else if (rc == RESOLVE_NO_ADDRS) {
+        e->state = ENTRY_NEGATIVE;
+        e->expires = now_sec() + resolver.config.negative_ttl;
+    } else {
+        /* Expired already: only the lookups that waited for it see it */
+        e->state = ENTRY_FAILED;
+        e->expires = now_sec();
+    }
+}
+
+int resolver_lookup(const char *host, const char *port,
+                    resolver_result_t *result) {
+    char name[RESOLVER_MAX_NAME];
+    size_t len = strlen(host);
+
+    if (lookup_numeric(host, port, result)) {
+        return 0;
+    }
+
+    /* Names are case insensitive, and "host." is "host" */
+    if (len > 0 && host[len - 1] == '.') {
+        len--;
+    }
+    if (len == 0 || len >= sizeof(name)) {
+        return -2;
+    }
+    for (size_t i = 0; i < len; i++) {
+        name[i] = (char)tolower((unsigned char)host[i]);
+    }
+    name[len] = '\0';
+
+    pthread_mutex_lock(&resolver.lock);
+    entry_t *e;
+    bool waited = false;
+    while ((e = find_entry(name)) != NULL && e->state == ENTRY_PENDING) {
+        pthread_cond_wait(&resolver.cond, &resolver.lock);
+        waited = true;
+    }
+
+    if (e != NULL && e->state == ENTRY_FAILED && waited) {
+        pthread_mutex_unlock(&resolver.lock);
+        return -2;
+    }
+    if (e != NULL && now_sec() < e->expires) {
+        int rc = -2;
+        e->hits++;
+        if (e->state == ENTRY_VALID) {
+            copy_result(&e->set, port, result);
+            rc = 0;
+        }
+        pthread_mutex_unlock(&resolver.lock);
+        return rc;
+    }
+
+    /* Miss: claim the entry so concurrent lookups wait for us */
+    if (e == NULL) {
+        unsigned b = hash_name(name);
+        e = Calloc(1, sizeof(entry_t));
+        memcpy(e->name, name, len + 1);
+        e->next = resolver.buckets[b];
+        resolver.buckets[b] = e;
+    }
+    e->state = ENTRY_PENDING;
+    pthread_mutex_unlock(&resolver.lock);
+
+    addr_set_t set;
+    int ttl = 0;
+    int rc = resolve_name(name, &set, &ttl);
+
+    pthread_mutex_lock(&resolver.lock);
+    store_result(e, rc, &set, ttl);
+    e->hits = 1;
+    pthread_cond_broadcast(&resolver.cond);
+    pthread_mutex_unlock(&resolver.lock);
+
+    if (rc < 0) {
+        return -2;
+    }
+    copy_result(&set, port, result);
+    return 0;
+}
+
+/*
+ * refresh_thread - Re-resolve popular names before they expire, and drop
+ *     entries that have been expired for a while.
+ */
+static void *refresh_thread(void *vargp) {
+    (void)vargp;
+    pthread_detach(pthread_self());
+
+    while (true) {
+        char names[REFRESH_BATCH][RESOLVER_MAX_NAME];
+        int nnames = 0;
+
+        sleep(1);
+
+        pthread_mutex_lock(&resolver.lock);
+        time_t now = now_sec();
+        for (int b = 0; b < RESOLVER_BUCKETS; b++) {
+            entry_t **pp = &resolver.buckets[b];
+            while (*pp != NULL) {
+                entry_t *e = *pp;
+                if (e->state != ENTRY_PENDING && !e->refreshing &&
+                    e->expires + PURGE_AFTER < now) {
+                    *pp = e->next;
+                    Free(e);
+                    continue;
+                }
+                if (e->state == ENTRY_VALID && !e->refreshing &&
+                    e->hits >= REFRESH_MIN_HITS &&
+                    e->expires - now <= REFRESH_AHEAD && e->expires > now &&
+                    nnames < REFRESH_BATCH) {
+                    e->refreshing = true;
+                    strcpy(names[nnames++], e->name);
+                }
+                pp = &e->next;
+            }
+        }
+        pthread_mutex_unlock(&resolver.lock);
+
+        for (int i = 0; i < nnames; i++) {
+            addr_set_t set;
+            int ttl = 0;
+            int rc = resolve_name(names[i], &set, &ttl);
+
+            pthread_mutex_lock(&resolver.lock);
+            entry_t *e = find_entry(names[i]);
+            if (e != NULL) {
+                /* A failed refresh keeps serving the old addresses */
+                if (rc == 0 && e->state == ENTRY_VALID) {
+                    store_result(e, rc, &set, ttl);
+                }
+                e->hits = 0;
+                e->refreshing = false;
+            }
+            pthread_mutex_unlock(&resolver.lock);
+        }
+    }
+    return NULL;
+}
+
+int resolver_init(const resolver_config_t *config) {
+    pthread_t tid;
+
+    resolver.config.nameserver = NULL;
+    resolver.config.ttl = RESOLVER_DEFAULT_TTL;
+    resolver.config.negative_ttl = RESOLVER_NEGATIVE_TTL;
+    if (config != NULL) {
+        resolver.config = *config;
+    }
+
+    if (resolver.config.nameserver != NULL) {
+        char host[RESOLVER_MAX_NAME];
+        const char *port = DNS_PORT;
+        struct addrinfo hints, *listp;
+
+        /* host[:port], where an IPv6 host must be bracketed */
+        snprintf(host, sizeof(host), "%s", resolver.config.nameserver);
+        char *colon = strrchr(host, ':');
+        if (host[0] == '[') {
+            char *end = strchr(host, ']');
+            if (end == NULL) {
+                return -1;
+            }
+            *end = '\0';
+            if (end[1] == ':') {
+                port = end + 2;
+            }
+            memmove(host, host + 1, strlen(host));
+        } else if (colon != NULL) {
+            *colon = '\0';
+            port = colon + 1;
+        }
+
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+        if (getaddrinfo(host, port, &hints, &listp) != 0) {
+            return -1;
+        }
+        memcpy(&resolver.ns, listp->ai_addr, listp->ai_addrlen);
+        resolver.nslen = listp->ai_addrlen;
+        resolver.use_ns = true;
+        freeaddrinfo(listp);
+    }
+
+    srandom((unsigned)time(NULL) ^ (unsigned)getpid());
+    pthread_create(&tid, NULL, refresh_thread, NULL);
+    return 0;
+}
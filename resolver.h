@@ -0,0 +1,84 @@
+/**
+ * @file resolver.h
+ * @brief Caching host name resolver
+ *
+ * Replaces the per-request getaddrinfo() in open_clientfd() with a shared
+ * cache of resolved addresses. Both successful (positive) lookups and
+ * names found to have no addresses, NXDOMAIN or NODATA (negative), are
+ * cached. A lookup that got no answer, a timeout or a SERVFAIL, is not:
+ * the next lookup of the name tries again. Names are resolved in one of
+ * two ways:
+ *
+ * - When a nameserver is configured, the resolver sends its own A and AAAA
+ *   queries over UDP and honors the TTLs of the records it gets back.
+ * - Otherwise it falls back to getaddrinfo(), which does not report TTLs,
+ *   and caches the result for a configurable TTL.
+ *
+ * Concurrent lookups of the same name share one query: the first caller
+ * resolves, the others wait for its result. A background thread refreshes
+ * popular names shortly before they expire, so that busy origins are never
+ * resolved on the request path.
+ */
+
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Maximum number of addresses returned for a name */
+#define RESOLVER_MAX_ADDRS 8
+
+/* Default TTL (seconds) for results from the system resolver */
+#define RESOLVER_DEFAULT_TTL 60
+
+/* Default TTL (seconds) for names found to have no addresses */
+#define RESOLVER_NEGATIVE_TTL 5
+
+/**
+ * @brief Resolver configuration
+ */
+typedef struct {
+    const char *nameserver; /**< "host[:port]" of a DNS server, or NULL */
+    int ttl;                /**< TTL for system resolver results */
+    int negative_ttl;       /**< TTL for names without addresses */
+} resolver_config_t;
+
+/**
+ * @brief The addresses of a host, with the requested port filled in
+ */
+typedef struct {
+    int naddrs;                                        /**< addresses found */
+    struct sockaddr_storage addrs[RESOLVER_MAX_ADDRS]; /**< the addresses */
+    socklen_t addrlens[RESOLVER_MAX_ADDRS];            /**< their lengths */
+} resolver_result_t;
+
+/**
+ * @brief Initialize the resolver and start its refresh thread
+ *
+ * Must be called once before any lookups.
+ *
+ * @param[in] config The configuration, or NULL for the defaults
+ *
+ * @return 0 on success
+ * @return -1 if the nameserver address is invalid
+ */
+int resolver_init(const resolver_config_t *config);
+
+/**
+ * @brief Resolve a host name
+ *
+ * Numeric addresses are returned without a lookup. Otherwise the cache is
+ * consulted first, and a query is sent (or joined) on a miss.
+ *
+ * @param[in] host The host name or numeric address
+ * @param[in] port The numeric port to put into each address
+ * @param[out] result The addresses found
+ *
+ * @return 0 on success
+ * @return -2 if the name could not be resolved
+ */
+int resolver_lookup(const char *host, const char *port,
+                    resolver_result_t *result);
+
+#endif /* __RESOLVER_H__ */
@@ -0,0 +1,316 @@
+/**
+ * @file routes.c
+ * @brief Routing table for reverse-proxy mode
+ *
+ * Routes are first inserted into a pointer-based trie, then compiled into
+ * two flat arrays: nodes in breadth-first order, and edges grouped by
+ * parent and sorted by byte. A lookup step is a binary search over the
+ * current node's edges.
+ */
+
+#include "routes.h"
+#include "csapp.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Trie node used while loading; children are kept sorted by byte */
+typedef struct bnode {
+    unsigned char *labels; // Byte leading to each child
+    struct bnode **kids;   // The children
+    int nkids;             // Number of children
+    int pool;              // Pool of the route ending here, or -1
+} bnode_t;
+
+/* Compiled trie node */
+typedef struct {
+    int first;  // Index of the first outgoing edge
+    int nedges; // Number of outgoing edges
+    int pool;   // Pool of the route ending here, or -1
+} tnode_t;
+
+/* Compiled trie edge */
+typedef struct {
+    unsigned char c; // Byte consumed
+    int node;        // Node reached
+} tedge_t;
+
+struct routes {
+    pool_t *pools;
+    int npools;
+    tnode_t *nodes;
+    int nnodes;
+    tedge_t *edges;
+};
+
+static bnode_t *bnode_new(void) {
+    bnode_t *n = Calloc(1, sizeof(bnode_t));
+    n->pool = -1;
+    return n;
+}
+
+static void bnode_free(bnode_t *n) {
+    for (int i = 0; i < n->nkids; i++) {
+        bnode_free(n->kids[i]);
+    }
+    Free(n->labels);
+    Free(n->kids);
+    Free(n);
+}
+
+/* bnode_child - Find or create the child of n reached by c */
+static bnode_t *bnode_child(bnode_t *n, unsigned char c) {
+    int i = 0;
+    while (i < n->nkids && n->labels[i] < c) {
+        i++;
+    }
+    if (i < n->nkids && n->labels[i] == c) {
+        return n->kids[i];
+    }
+
+    n->labels = Realloc(n->labels, (size_t)(n->nkids + 1));
+    n->kids = Realloc(n->kids, (size_t)(n->nkids + 1) * sizeof(bnode_t *));
+    memmove(n->labels + i + 1, n->labels + i, (size_t)(n->nkids - i));
+    memmove(n->kids + i + 1, n->kids + i,
+            (size_t)(n->nkids - i) * sizeof(bnode_t *));
+    n->labels[i] = c;
+    n->kids[i] = bnode_new();
+    n->nkids++;
+    return n->kids[i];
+}
+
+/* bnode_insert - Insert host followed by path; returns the end node */
+static bnode_t *bnode_insert(bnode_t *root, const char *host,
+                             const char *path) {
+    bnode_t *n = root;
+    const char *parts[2] = {host, path};
+
+    for (int p = 0; p < 2; p++) {
+        for (const char *s = parts[p]; *s != '\0'; s++) {
+            unsigned char c = (unsigned char)*s;
+            if (p == 0) {
+                c = (unsigned char)tolower(c);
+            }
+            n = bnode_child(n, c);
+        }
+    }
+    return n;
+}
+
+/* count_nodes - Number of nodes in a loading trie */
+static int count_nodes(const bnode_t *n) {
+    int count = 1;
+    for (int i = 0; i < n->nkids; i++) {
+        count += count_nodes(n->kids[i]);
+    }
+    return count;
+}
+
+/* compile - Flatten the loading trie in breadth-first order */
+static void compile(routes_t *r, bnode_t *root) {
+    int total = count_nodes(root);
+    bnode_t **queue = Malloc((size_t)total * sizeof(bnode_t *));
+    int head = 0, tail = 0, nedges = 0;
+
+    r->nodes = Malloc((size_t)total * sizeof(tnode_t));
+    r->edges = Malloc((size_t)(total > 1 ? total - 1 : 1) * sizeof(tedge_t));
+    r->nnodes = total;
+
+    queue[tail++] = root;
+    while (head < tail) {
+        bnode_t *n = queue[head];
+        tnode_t *t = &r->nodes[head];
+        head++;
+
+        t->first = nedges;
+        t->nedges = n->nkids;
+        t->pool = n->pool;
+        for (int i = 0; i < n->nkids; i++) {
+            r->edges[nedges].c = n->labels[i];
+            r->edges[nedges].node = tail;
+            nedges++;
+            queue[tail++] = n->kids[i];
+        }
+    }
+    Free(queue);
+}
+
+/* trie_step - Follow the edge for c out of node, or return -1 */
+static int trie_step(const routes_t *r, int node, unsigned char c) {
+    int lo = r->nodes[node].first;
+    int hi = lo + r->nodes[node].nedges - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (r->edges[mid].c == c) {
+            return r->edges[mid].node;
+        } else if (r->edges[mid].c < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+/* match_key - Longest route for host + path, or -1 */
+static int match_key(const routes_t *r, const char *host, const char *path) {
+    int node = 0, best = -1;
+
+    for (const char *s = host; *s != '\0'; s++) {
+        node = trie_step(r, node, (unsigned char)tolower((unsigned char)*s));
+        if (node < 0) {
+            return -1;
+        }
+    }
+    for (const char *s = path; *s != '\0'; s++) {
+        node = trie_step(r, node, (unsigned char)*s);
+        if (node < 0) {
+            break;
+        }
+        if (r->nodes[node].pool >= 0) {
+            best = r->nodes[node].pool;
+        }
+    }
+    return best;
+}
+
+pool_t *routes_match(const routes_t *r, const char *host, const char *path) {
+    int pool = match_key(r, host, path);
+    if (pool < 0) {
+        pool = match_key(r, "*", path);
+    }
+    return pool < 0 ? NULL : &r->pools[pool];
+}
+
+/*
+ * parse_backend - Split "host:port" into a backend
+ */
+static bool parse_backend(const char *spec, backend_t *b) {
+    const char *colon = strrchr(spec, ':');
+    size_t hlen;
+
+    if (colon == NULL || colon == spec || colon[1] == '\0') {
+        return false;
+    }
+    hlen = (size_t)(colon - spec);
+    if (hlen >= sizeof(b->host) || strlen(colon + 1) >= sizeof(b->port) ||
+        strspn(colon + 1, "0123456789") != strlen(colon + 1)) {
+        return false;
+    }
+    memcpy(b->host, spec, hlen);
+    b->host[hlen] = '\0';
+    strcpy(b->port, colon + 1);
+    return true;
+}
+
+static int find_pool(const routes_t *r, const char *name) {
+    for (int i = 0; i < r->npools; i++) {
+        if (strcmp(r->pools[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+routes_t *routes_load(const char *path) {
+    char line[MAXLINE];
+    int lineno = 0, nroutes = 0;
+    bool ok = true;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    routes_t *r = Calloc(1, sizeof(routes_t));
+    bnode_t *root = bnode_new();
+
+    while (ok && fgets(line, sizeof(line), fp) != NULL) {
+        char *save, *argv[64];
+        int argc = 0;
+
+        lineno++;
+        line[strcspn(line, "#")] = '\0';
+        char *tok = strtok_r(line, " \t\r\n", &save);
+        while (tok != NULL && argc < 64) {
+            argv[argc++] = tok;
+            tok = strtok_r(NULL, " \t\r\n", &save);
+        }
+        if (argc == 0) {
+            continue;
+        }
+
+        if (strcmp(argv[0], "pool") == 0 && argc >= 3) {
+            if (strlen(argv[1]) >= ROUTES_MAXNAME ||
+                find_pool(r, argv[1]) >= 0) {
+                fprintf(stderr, "%s:%d: bad or duplicate pool name\n", path,
+                        lineno);
+                ok = false;
+                break;
+            }
+            r->pools = Realloc(r->pools,
+                               (size_t)(r->npools + 1) * sizeof(pool_t));
+            pool_t *pool = &r->pools[r->npools++];
+            strcpy(pool->name, argv[1]);
+            pool->nbackends = argc - 2;
+            pool->backends = Calloc((size_t)pool->nbackends, sizeof(backend_t));
+            balancer_init(&pool->balancer, LB_ROUND_ROBIN, pool->nbackends);
+            for (int i = 2; i < argc; i++) {
+                if (!parse_backend(argv[i], &pool->backends[i - 2])) {
+                    fprintf(stderr, "%s:%d: bad backend '%s'\n", path, lineno,
+                            argv[i]);
+                    ok = false;
+                }
+            }
+        } else if (strcmp(argv[0], "route") == 0 && argc == 4) {
+            int pool = find_pool(r, argv[3]);
+            if (pool < 0 || argv[2][0] != '/') {
+                fprintf(stderr, "%s:%d: unknown pool or bad path prefix\n",
+                        path, lineno);
+                ok = false;
+                break;
+            }
+            bnode_insert(root, argv[1], argv[2])->pool = pool;
+            nroutes++;
+        } else if (strcmp(argv[0], "balance") == 0 && argc == 3) {
+            int pool = find_pool(r, argv[1]);
+            lb_kind kind;
+            if (pool < 0 || balancer_parse(argv[2], &kind) < 0) {
+                fprintf(stderr, "%s:%d: unknown pool or algorithm\n", path,
+                        lineno);
+                ok = false;
+                break;
+            }
+            r->pools[pool].balancer.kind = kind;
+        } else {
+            fprintf(stderr, "%s:%d: expected 'pool', 'route' or 'balance'\n",
+                    path, lineno);
+            ok = false;
+        }
+    }
+    fclose(fp);
+
+    if (ok && nroutes == 0) {
+        fprintf(stderr, "%s: no routes\n", path);
+        ok = false;
+    }
+    if (!ok) {
+        bnode_free(root);
+        for (int i = 0; i < r->npools; i++) {
+            Free(r->pools[i].backends);
+            Free(r->pools[i].balancer.stats);
+        }
+        Free(r->pools);
+        Free(r);
+        return NULL;
+    }
+
+    compile(r, root);
+    bnode_free(root);
+    return r;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file routes.h
+ * @brief Routing table for reverse-proxy mode
+ *
+ * In reverse-proxy mode the proxy does not take the origin from the request
+ * URI. Instead a routing table, loaded from a config file, maps the request's
+ * host and path to a named pool of backend servers. The config file has one
+ * directive per line; '#' starts a comment:
+ *
+ *     pool <name> <host:port> [<host:port> ...]
+ *     route <host|*> <path-prefix> <pool>
+ *     balance <pool> <algorithm>
+ *
+ * For example:
+ *
+ *     pool tinys 127.0.0.1:8001 127.0.0.1:8002
+ *     pool images 127.0.0.1:8003
+ *     balance tinys peak_ewma
+ *     route * / tinys
+ *     route www.example.com /images/ images
+ *
+ * A request is routed by the longest path prefix among the routes for its
+ * exact host; only if none matches are the '*' routes tried. Host names are
+ * compared without case, paths with case. Within a pool a backend is chosen
+ * by the pool's balancing algorithm (see balancer.h), round_robin unless
+ * set otherwise.
+ *
+ * The routes are compiled into a single prefix trie keyed by host followed
+ * by path, so a lookup costs O(length of host + path) no matter how many
+ * routes there are.
+ */
+
+#ifndef __ROUTES_H__
+#define __ROUTES_H__
+
+#include "balancer.h"
+
+#include <stddef.h>
+
+#define ROUTES_MAXNAME 256
+#define ROUTES_MAXPORT 8
+
+/**
+ * @brief One backend server
+ */
+typedef struct {
+    char host[ROUTES_MAXNAME]; /**< host name or address */
+    char port[ROUTES_MAXPORT]; /**< numeric port */
+} backend_t;
+
+/**
+ * @brief A named group of interchangeable backends
+ */
+typedef struct {
+    char name[ROUTES_MAXNAME]; /**< pool name from the config file */
+    int nbackends;             /**< number of backends */
+    backend_t *backends;       /**< the backends */
+    balancer_t balancer;       /**< chooses among the backends */
+} pool_t;
+
+typedef struct routes routes_t;
+
+/**
+ * @brief Load and compile a routing table
+ *
+ * Errors are reported on stderr with their line number.
+ *
+ * @param[in] path The config file
+ *
+ * @return The routing table, or NULL on error
+ */
+routes_t *routes_load(const char *path);
+
+/**
+ * @brief Find the pool a request is routed to
+ *
+ * @param[in] r The routing table
+ * @param[in] host The request's host, without a port
+ * @param[in] path The request's path
+ *
+ * @return The pool, or NULL if no route matches
+ */
+pool_t *routes_match(const routes_t *r, const char *host, const char *path);
+
+#endif /* __ROUTES_H__ */
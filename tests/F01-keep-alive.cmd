@@ -0,0 +1,16 @@
+# Test keep-alive: one client connection carries several requests
+origin o1
+route o1 /a HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nalpha
+route o1 /b HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nbeta
+route o1 /c HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\ngamma
+connect c1
+send c1 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nalpha$
+send c1 GET http://%o1%/b HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nbeta$
+# Asking to close ends the connection after the response
+send c1 GET http://%o1%/c HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\ngamma$
+expect-close c1
+served o1 3
+quit
@@ -0,0 +1,12 @@
+# Test pipelining: responses come back in request order, even when an
+# earlier request takes longer at the origin than later ones
+origin o1
+route o1 /slow +300 HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nslow
+route o1 /fast HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nfast
+route o1 /last HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nlast
+connect c1
+send c1 GET http://%o1%/slow HTTP/1.1\r\nHost: %o1%\r\n\r\nGET http://%o1%/fast HTTP/1.1\r\nHost: %o1%\r\n\r\nGET http://%o1%/last HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nslowHTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nfastHTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nlast$
+expect-close c1
+served o1 3
+quit
@@ -0,0 +1,10 @@
+# Test the header deadline: a client that never finishes its request
+# gets a 408 and its connection closed
+proxy - -t header=300
+origin o1
+connect c1
+send c1 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\n
+expect c1 ^HTTP/1.[01] 408
+expect-close c1
+served o1 0
+quit
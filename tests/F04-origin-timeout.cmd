@@ -0,0 +1,16 @@
+# Test the first byte deadline: an origin that never answers gets the
+# client a 504, and the next request to it is served
+proxy - -t first_byte=300
+origin o1
+route o1 /stall stall
+route o1 /a HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nalpha
+connect c1
+send c1 GET http://%o1%/stall HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.[01] 504 [^\r]*\r\n.*</html>\r\n
+expect-close c1
+connect c2
+send c2 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c2 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nalpha$
+expect-close c2
+served o1 2
+quit
@@ -0,0 +1,15 @@
+# Test CONNECT: bytes pass through the tunnel both ways, and a client
+# that shuts down its sending side still gets the origin's last words
+origin o1 echo
+connect c1
+send c1 CONNECT %o1% HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.[01] 200 .*?\r\n\r\n
+send c1 hello\r\n
+expect c1 ^hello\r\n$
+send c1 world\r\n
+shut c1
+expect c1 ^world\r\nbye\r\n$
+expect-close c1
+served o1 1
+received o1 ^hello\r\nworld\r\n$
+quit
@@ -0,0 +1,17 @@
+# Test uploads: a body with a Content-Length reaches the origin whole,
+# including one larger than any of the proxy's buffers, and a client
+# that expects 100-continue is told to go ahead
+origin o1
+route o1 /up HTTP/1.1 201 Created\r\nContent-Length: 4\r\n\r\ndone
+connect c1
+send c1 POST http://%o1%/up HTTP/1.1\r\nHost: %o1%\r\nContent-Length: 11\r\n\r\nhello world
+expect c1 ^HTTP/1.1 201 [^\r]*\r\n.*\r\n\r\ndone$
+received o1 ^POST /up HTTP/1.[01]\r\n.*Content-Length: 11\r\n.*\r\nhello world$
+send c1 POST http://%o1%/up HTTP/1.1\r\nHost: %o1%\r\nContent-Length: 100000\r\nExpect: 100-continue\r\n\r\n
+expect c1 ^HTTP/1.1 100 [^\r]*\r\n\r\n
+send c1 %x100000%
+expect c1 ^HTTP/1.1 201 [^\r]*\r\n.*\r\n\r\ndone$
+received o1 \r\n\r\nx{100000}$
+close c1
+served o1 2
+quit
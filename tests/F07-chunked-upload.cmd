@@ -0,0 +1,16 @@
+# Test chunked uploads: the body reaches the origin chunked, however the
+# client split it, and the connection is left at the next request
+origin o1
+route o1 /up HTTP/1.1 201 Created\r\nContent-Length: 4\r\n\r\ndone
+route o1 /a HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nalpha
+connect c1
+send c1 POST http://%o1%/up HTTP/1.1\r\nHost: %o1%\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nhello \r\n
+delay 100
+send c1 5\r\nworld\r\n0\r\n\r\n
+expect c1 ^HTTP/1.1 201 [^\r]*\r\n.*\r\n\r\ndone$
+received o1 ^POST /up HTTP/1.1\r\n.*Transfer-Encoding: chunked\r\n.*\r\n(6\r\nhello \r\n5\r\nworld\r\n|b\r\nhello world\r\n)0\r\n\r\n$
+send c1 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nalpha$
+expect-close c1
+served o1 2
+quit
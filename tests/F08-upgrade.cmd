@@ -0,0 +1,17 @@
+# Test Upgrade: the origin's 101 is passed to the client, and the
+# connection then carries bytes both ways until either side closes
+origin o1
+route o1 /ws upgrade HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n\r\n
+connect c1
+send c1 GET http://%o1%/ws HTTP/1.1\r\nHost: %o1%\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n\r\n
+expect c1 ^HTTP/1.1 101 ([^\r]*\r\n)*?Upgrade: websocket\r\n([^\r]*\r\n)*?\r\n
+send c1 ping\r\n
+expect c1 ^ping\r\n$
+send c1 pong\r\n
+expect c1 ^pong\r\n$
+shut c1
+expect-close c1
+# The origin records the request, then the bytes it echoed
+served o1 2
+received o1 ^ping\r\npong\r\n$
+quit
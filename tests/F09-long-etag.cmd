@@ -0,0 +1,13 @@
+# Test a 10 KB ETag: it is relayed whole, and made weak whole when the
+# body is compressed for the client
+origin o1
+route o1 /plain HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nETag: "%x10000%"\r\nContent-Length: 5\r\n\r\nplain
+route o1 /text HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nETag: "%x10000%"\r\nContent-Length: 200\r\n\r\n%x200%
+connect c1
+send c1 GET http://%o1%/plain HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?ETag: "x{10000}"\r\n([^\r]*\r\n)*?\r\nplain$
+send c1 GET http://%o1%/text HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: gzip\r\nConnection: close\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?ETag: W/"x{10000}"\r\n
+expect-close c1
+served o1 2
+quit
@@ -0,0 +1,16 @@
+# Test the cache: a second GET for a response the origin let be stored is
+# answered without asking the origin again
+origin o1
+route o1 /a HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nCache-Control: max-age=60\r\nContent-Length: 5\r\n\r\nalpha
+connect c1
+send c1 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nalpha$
+send c1 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?Content-Length: 5\r\n([^\r]*\r\n)*?\r\nalpha$
+close c1
+connect c2
+send c2 GET http://%o1%/a HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c2 ^HTTP/1.1 200 [^\r]*\r\n.*\r\n\r\nalpha$
+expect-close c2
+served o1 1
+quit
@@ -0,0 +1,20 @@
+# Test cache variants: clients that take gzip and clients that don't each
+# get their own stored copy of a compressible response
+origin o1
+route o1 /t HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nCache-Control: max-age=60\r\nVary: Accept-Encoding\r\nContent-Length: 200\r\n\r\n%x200%
+connect c1
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: gzip\r\n\r\n
+expect c1 ^HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?Content-Encoding: gzip\r\n
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?\r\nx{200}$
+expect-close c1
+served o1 2
+# Both variants are now stored
+connect c2
+send c2 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: gzip\r\n\r\n
+expect c2 ^HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?Content-Encoding: gzip\r\n
+send c2 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c2 HTTP/1.1 200 (?:(?!Content-Encoding)[^\r]*\r\n)*?\r\nx{200}$
+expect-close c2
+served o1 2
+quit
@@ -0,0 +1,24 @@
+# Test what the cache must not store: a response marked no-store, one that
+# sets a cookie, and one to a request marked no-store
+origin o1
+route o1 /ns HTTP/1.1 200 OK\r\nCache-Control: no-store\r\nContent-Length: 2\r\n\r\nns
+route o1 /ck HTTP/1.1 200 OK\r\nSet-Cookie: id=1\r\nContent-Length: 2\r\n\r\nck
+route o1 /rq HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nrq
+connect c1
+send c1 GET http://%o1%/ns HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 \r\n\r\nns$
+send c1 GET http://%o1%/ns HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 \r\n\r\nns$
+served o1 2
+send c1 GET http://%o1%/ck HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 \r\n\r\nck$
+send c1 GET http://%o1%/ck HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 Set-Cookie: id=1\r\n.*\r\n\r\nck$
+served o1 4
+send c1 GET http://%o1%/rq HTTP/1.1\r\nHost: %o1%\r\nCache-Control: no-store\r\n\r\n
+expect c1 \r\n\r\nrq$
+send c1 GET http://%o1%/rq HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 \r\n\r\nrq$
+expect-close c1
+served o1 6
+quit
@@ -0,0 +1,35 @@
+# Test serving stale: once an origin's breaker has opened, a response that
+# is no longer fresh is served with a warning rather than a 503
+origin o1
+route o1 /s HTTP/1.1 200 OK\r\nCache-Control: max-age=1\r\nContent-Length: 5\r\n\r\nstale
+route o1 /n HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfresh
+connect c1
+send c1 GET http://%o1%/s HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 \r\n\r\nstale$
+# Enough failed connects to open the breaker
+stop-origin o1
+delay 1500
+connect f1
+send f1 GET http://%o1%/n HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect f1 ^HTTP/1.[01] 502
+connect f2
+send f2 GET http://%o1%/n HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect f2 ^HTTP/1.[01] 502
+connect f3
+send f3 GET http://%o1%/n HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect f3 ^HTTP/1.[01] 502
+connect f4
+send f4 GET http://%o1%/n HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect f4 ^HTTP/1.[01] 502
+connect f5
+send f5 GET http://%o1%/n HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect f5 ^HTTP/1.[01] 502
+connect c2
+send c2 GET http://%o1%/n HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c2 ^HTTP/1.[01] 503
+connect c3
+send c3 GET http://%o1%/s HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c3 ^HTTP/1.1 200 [^\r]*\r\n([^\r]*\r\n)*?Warning: 110 [^\r]*\r\n([^\r]*\r\n)*?\r\nstale$
+expect-close c3
+served o1 1
+quit
@@ -0,0 +1,20 @@
+# Test that conditional and Range requests go to the origin even when a
+# fresh response is stored, and that a plain GET still gets it
+origin o1
+route o1 /c HTTP/1.1 200 OK\r\nCache-Control: max-age=60\r\nETag: "v1"\r\nContent-Length: 5\r\n\r\ncache
+connect c1
+send c1 GET http://%o1%/c HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 \r\n\r\ncache$
+send c1 GET http://%o1%/c HTTP/1.1\r\nHost: %o1%\r\nIf-None-Match: "v0"\r\n\r\n
+expect c1 \r\n\r\ncache$
+served o1 2
+received o1 If-None-Match: "v0"\r\n
+send c1 GET http://%o1%/c HTTP/1.1\r\nHost: %o1%\r\nRange: bytes=0-1\r\n\r\n
+expect c1 \r\n\r\ncache$
+served o1 3
+received o1 Range: bytes=0-1\r\n
+send c1 GET http://%o1%/c HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 \r\n\r\ncache$
+expect-close c1
+served o1 3
+quit
@@ -0,0 +1,17 @@
+# Test an origin's own gzip with the proxy's compression off: the stored
+# gzip response is never served to a client that did not accept gzip
+proxy - -z 0
+origin o1
+route o1 /t HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding\r\nCache-Control: max-age=60\r\nContent-Length: 6\r\n\r\nzipped
+connect c1
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: gzip\r\n\r\n
+expect c1 Content-Encoding: gzip\r\n.*\r\n\r\nzipped$
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\n\r\n
+expect c1 \r\n\r\nzipped$
+served o1 2
+# A client that accepts gzip is still answered from the cache
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: gzip\r\nConnection: close\r\n\r\n
+expect c1 Content-Encoding: gzip\r\n.*\r\n\r\nzipped$
+expect-close c1
+served o1 2
+quit
@@ -0,0 +1,15 @@
+# Test a coding the cache does not keep apart: a br response is not stored,
+# so clients that take only gzip, or nothing, are sent to the origin
+origin o1
+route o1 /t HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Encoding: br\r\nVary: Accept-Encoding\r\nCache-Control: max-age=60\r\nContent-Length: 6\r\n\r\nbrotli
+connect c1
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: br, gzip\r\n\r\n
+expect c1 Content-Encoding: br\r\n.*\r\n\r\nbrotli$
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nAccept-Encoding: gzip\r\n\r\n
+expect c1 \r\n\r\nbrotli$
+served o1 2
+send c1 GET http://%o1%/t HTTP/1.1\r\nHost: %o1%\r\nConnection: close\r\n\r\n
+expect c1 \r\n\r\nbrotli$
+expect-close c1
+served o1 3
+quit
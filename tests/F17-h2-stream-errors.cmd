@@ -0,0 +1,26 @@
+# Test HTTP/2 connection errors: HEADERS on a stream that is no longer open
+# is a PROTOCOL_ERROR, and DATA past a stream's receive window is a
+# FLOW_CONTROL_ERROR.  Both close the connection with a GOAWAY.
+proxy - -2
+origin o1
+route o1 /stall stall
+connect c1
+send c1 GET http://%o1%/stall HTTP/1.1\r\nHost: %o1%\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: \r\n\r\n
+expect c1 ^HTTP/1.1 101 [^\r]*\r\n([^\r]*\r\n)*?\r\n
+send c1 PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n\x00\x00\x00\x04\x00\x00\x00\x00\x00
+# Stream 1 was the upgraded request, which has ended
+send c1 \x00\x00\x03\x01\x05\x00\x00\x00\x01\x82\x86\x84
+expect c1 \x00\x00\x08\x07\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x01
+expect-close c1
+connect c2
+send c2 GET http://%o1%/stall HTTP/1.1\r\nHost: %o1%\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: \r\n\r\n
+expect c2 ^HTTP/1.1 101 [^\r]*\r\n([^\r]*\r\n)*?\r\n
+send c2 PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n\x00\x00\x00\x04\x00\x00\x00\x00\x00
+# Four full frames are one byte more than the default window of 65535
+send c2 \x00\x40\x00\x00\x00\x00\x00\x00\x01%x16384%
+send c2 \x00\x40\x00\x00\x00\x00\x00\x00\x01%x16384%
+send c2 \x00\x40\x00\x00\x00\x00\x00\x00\x01%x16384%
+send c2 \x00\x40\x00\x00\x00\x00\x00\x00\x01%x16384%
+expect c2 \x00\x00\x08\x07\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x03
+expect-close c2
+quit
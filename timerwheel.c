@@ -0,0 +1,172 @@
+/**
+ * @file timerwheel.c
+ * @brief Hierarchical timer wheel for connection deadlines
+ *
+ * TW_LEVELS wheels of TW_SLOTS slots each. Level 0 covers the next
+ * TW_SLOTS ticks one tick per slot, level 1 the next TW_SLOTS^2 ticks
+ * TW_SLOTS ticks per slot, and so on. Whenever the low bits of the current
+ * tick wrap to zero, the matching slot of the next level is emptied and its
+ * timers are re-inserted, which moves them down a level. Timers further
+ * away than the top level can cover are parked in the top level and simply
+ * re-inserted until they are close enough.
+ */
+
+#include "timerwheel.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // Signalled when a callback returns
+    uint64_t now;        // Current tick
+    tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+    tw_timer_t *running; // Timer whose callback is running
+} wheel = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t now_ticks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000) /
+           TW_TICK_MS;
+}
+
+/* Must be called with the lock held */
+static void wheel_insert(tw_timer_t *t) {
+    uint64_t delta = t->expires > wheel.now ? t->expires - wheel.now : 0;
+    int level = 0;
+    tw_timer_t **slot;
+
+    while (level < TW_LEVELS - 1 &&
+           delta >= ((uint64_t)1 << (TW_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= ((uint64_t)1 << (TW_BITS * TW_LEVELS))) {
+        /* Too far out: park in the last slot the top level reaches */
+        slot = &wheel.slots[level][((wheel.now >> (TW_BITS * level)) - 1) &
+                                   TW_MASK];
+    } else {
+        slot = &wheel.slots[level][(t->expires >> (TW_BITS * level)) &
+                                   TW_MASK];
+    }
+
+    t->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->pprev = &t->next;
+    }
+    t->pprev = slot;
+    *slot = t;
+    t->pending = true;
+}
+
+/* Must be called with the lock held */
+static void wheel_remove(tw_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+    t->pending = false;
+}
+
+/* wheel_tick - Advance one tick. Must be called with the lock held */
+static void wheel_tick(void) {
+    wheel.now++;
+
+    /* Cascade higher levels whose slot boundary we just crossed */
+    for (int level = 1; level < TW_LEVELS; level++) {
+        if ((wheel.now & (((uint64_t)1 << (TW_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        int idx = (int)((wheel.now >> (TW_BITS * level)) & TW_MASK);
+        tw_timer_t *t = wheel.slots[level][idx];
+        wheel.slots[level][idx] = NULL;
+        while (t != NULL) {
+            tw_timer_t *next = t->next;
+            wheel_insert(t);
+            t = next;
+        }
+    }
+
+    /* Fire everything in the current level 0 slot */
+    int idx = (int)(wheel.now & TW_MASK);
+    tw_timer_t *t;
+    while ((t = wheel.slots[0][idx]) != NULL) {
+        wheel_remove(t);
+
+        wheel.running = t;
+        pthread_mutex_unlock(&wheel.lock);
+        t->cb(t, t->arg);
+        pthread_mutex_lock(&wheel.lock);
+        wheel.running = NULL;
+        pthread_cond_broadcast(&wheel.cond);
+    }
+}
+
+static void *wheel_thread(void *vargp) {
+    (void)vargp;
+    pthread_detach(pthread_self());
+
+    while (1) {
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = TW_TICK_MS * 1000000L};
+        nanosleep(&ts, NULL);
+
+        uint64_t target = now_ticks();
+        pthread_mutex_lock(&wheel.lock);
+        while (wheel.now < target) {
+            wheel_tick();
+        }
+        pthread_mutex_unlock(&wheel.lock);
+    }
+    return NULL;
+}
+
+void timerwheel_init(void) {
+    pthread_t tid;
+    wheel.now = now_ticks();
+    pthread_create(&tid, NULL, wheel_thread, NULL);
+}
+
+void timer_init(tw_timer_t *timer, tw_callback_t cb, void *arg) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->cb = cb;
+    timer->arg = arg;
+    timer->pending = false;
+}
+
+void timer_arm(tw_timer_t *timer, unsigned ms) {
+    pthread_mutex_lock(&wheel.lock);
+    while (wheel.running == timer) {
+        pthread_cond_wait(&wheel.cond, &wheel.lock);
+    }
+    if (timer->pending) {
+        wheel_remove(timer);
+    }
+    /* Round up so a timer never fires early */
+    timer->expires = wheel.now + 1 + (ms + TW_TICK_MS - 1) / TW_TICK_MS;
+    wheel_insert(timer);
+    pthread_mutex_unlock(&wheel.lock);
+}
+
+void timer_cancel(tw_timer_t *timer) {
+    pthread_mutex_lock(&wheel.lock);
+    if (timer->pending) {
+        wheel_remove(timer);
+    }
+    while (wheel.running == timer) {
+        pthread_cond_wait(&wheel.cond, &wheel.lock);
+    }
+    pthread_mutex_unlock(&wheel.lock);
+}
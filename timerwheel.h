@@ -0,0 +1,75 @@
+/**
+ * @file timerwheel.h
+ * @brief Hierarchical timer wheel for connection deadlines
+ *
+ * Every request arms, re-arms and cancels several deadlines, some of them
+ * once per read. A hierarchical wheel makes each of those operations O(1)
+ * regardless of how many timers are pending: a timer is placed in a slot
+ * of the lowest level whose range covers its expiry, and slots of higher
+ * levels are cascaded down one level as the wheel turns.
+ *
+ * Callbacks run on the wheel's own thread and must be short; they typically
+ * shut down a socket so that the thread blocked on it wakes up.
+ */
+
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Resolution of the wheel */
+#define TW_TICK_MS 10
+
+typedef struct tw_timer tw_timer_t;
+typedef void (*tw_callback_t)(tw_timer_t *timer, void *arg);
+
+/**
+ * @brief A timer. Embed it in the object it guards.
+ *
+ * The fields are private to the timer wheel.
+ */
+struct tw_timer {
+    struct tw_timer *next;   /**< next timer in the slot */
+    struct tw_timer **pprev; /**< link that points at this timer */
+    uint64_t expires;        /**< tick at which the timer fires */
+    tw_callback_t cb;        /**< function run on expiry */
+    void *arg;               /**< argument for cb */
+    bool pending;            /**< armed and not yet fired */
+};
+
+/**
+ * @brief Start the timer wheel thread
+ *
+ * Must be called once before any timer is armed.
+ */
+void timerwheel_init(void);
+
+/**
+ * @brief Initialize a timer
+ *
+ * @param[in] timer The timer
+ * @param[in] cb Function to run when the timer fires
+ * @param[in] arg Argument passed to cb
+ */
+void timer_init(tw_timer_t *timer, tw_callback_t cb, void *arg);
+
+/**
+ * @brief Arm (or re-arm) a timer to fire after ms milliseconds
+ *
+ * @param[in] timer The timer
+ * @param[in] ms Delay before the timer fires
+ */
+void timer_arm(tw_timer_t *timer, unsigned ms);
+
+/**
+ * @brief Disarm a timer
+ *
+ * When this returns, the timer's callback is not running and will not run
+ * until the timer is armed again.
+ *
+ * @param[in] timer The timer
+ */
+void timer_cancel(tw_timer_t *timer);
+
+#endif /* __TIMERWHEEL_H__ */
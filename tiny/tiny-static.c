@@ -265,6 +265,7 @@ void serve(client_info *client) {
     /* Read request line */
     char buf[MAXLINE];
     if (rio_readlineb(&rio, buf, MAXLINE) <= 0) {
+        rio_freeb(&rio);
         return;
     }
 
@@ -281,6 +282,7 @@ void serve(client_info *client) {
             || (version != '0' && version != '1')) {
         clienterror(client->connfd, buf, "400", "Bad Request",
                 "Tiny received a malformed request");
+        rio_freeb(&rio);
         return;
     }
 
@@ -288,11 +290,14 @@ void serve(client_info *client) {
     if (strncmp(method, "GET", sizeof("GET"))) {
         clienterror(client->connfd, method, "501", "Not Implemented",
                 "Tiny does not implement this method");
+        rio_freeb(&rio);
         return;
     }
 
     /* Check if reading request headers caused an error */
-    if (read_requesthdrs(&rio)) {
+    bool bad_headers = read_requesthdrs(&rio);
+    rio_freeb(&rio);
+    if (bad_headers) {
         return;
     }
 
@@ -339,6 +339,7 @@ void serve(client_info *client) {
     /* Read request line */
     char buf[MAXLINE];
     if (rio_readlineb(&rio, buf, sizeof(buf)) <= 0) {
+        rio_freeb(&rio);
         return;
     }
 
@@ -353,6 +354,7 @@ void serve(client_info *client) {
         parser_free(parser);
         clienterror(client->connfd, "400", "Bad Request",
                     "Tiny received a malformed request");
+        rio_freeb(&rio);
         return;
     }
 
@@ -366,11 +368,14 @@ void serve(client_info *client) {
         parser_free(parser);
         clienterror(client->connfd, "501", "Not Implemented",
                     "Tiny does not implement this method");
+        rio_freeb(&rio);
         return;
     }
 
     /* Check if reading request headers caused an error */
-    if (read_requesthdrs(client, &rio, parser)) {
+    bool bad_headers = read_requesthdrs(client, &rio, parser);
+    rio_freeb(&rio);
+    if (bad_headers) {
         parser_free(parser);
         return;
     }
@@ -0,0 +1,254 @@
+/**
+ * @file tunnel.c
+ * @brief Byte pump for CONNECT tunnels
+ */
+
+#define _GNU_SOURCE /* splice() and F_SETPIPE_SZ */
+
+#include "tunnel.h"
+#include "csapp.h"
+#include "deadline.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef struct tunnel tunnel_t;
+
+/* One direction of a tunnel */
+typedef struct {
+    tunnel_t *t;   // Tunnel this belongs to
+    int from;      // Socket read from
+    int to;        // Socket written to
+    int pipe[2];   // Bytes in flight between the two
+    size_t queued; // Bytes sitting in the pipe
+    bool eof;      // from has finished sending
+    bool shut;     // to has been shut down for writing
+} direction_t;
+
+struct tunnel {
+    direction_t dir[2]; // Client to origin, origin to client
+    deadline_t idle;    // Closes the tunnel when both sides go quiet
+    tunnel_t *next;     // Next tunnel waiting to be added
+};
+
+static int epfd;
+static int wakefd;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static tunnel_t *pending;
+
+/* direction_init - Set up one direction; returns -1 if out of pipes */
+static int direction_init(tunnel_t *t, direction_t *d, int from, int to) {
+    d->t = t;
+    d->from = from;
+    d->to = to;
+    d->queued = 0;
+    d->eof = d->shut = false;
+    if (pipe2(d->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        d->pipe[0] = d->pipe[1] = -1;
+        return -1;
+    }
+    /* A bigger pipe means fewer wakeups per megabyte; best effort */
+    fcntl(d->pipe[1], F_SETPIPE_SZ, TUNNEL_PIPE_SIZE);
+    return 0;
+}
+
+/* tunnel_free - Close everything a tunnel owns */
+static void tunnel_free(tunnel_t *t, bool registered) {
+    if (registered) {
+        deadline_stop(&t->idle);
+        metrics_add(METRIC_TUNNELS_ACTIVE, -1);
+    }
+    for (int i = 0; i < 2; i++) {
+        direction_t *d = &t->dir[i];
+        if (d->pipe[0] >= 0) {
+            close(d->pipe[0]);
+            close(d->pipe[1]);
+        }
+        /* Closing a socket also removes it from the epoll set */
+        close(d->from);
+    }
+    Free(t);
+}
+
+/*
+ * pump - Move bytes in one direction until neither socket nor pipe can
+ *     take more. Returns the bytes delivered, or -1 on a socket error.
+ */
+static ssize_t pump(direction_t *d) {
+    const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    ssize_t delivered = 0;
+    bool progress = true;
+
+    while (progress) {
+        progress = false;
+        if (!d->eof && d->queued < TUNNEL_PIPE_SIZE) {
+            ssize_t n = splice(d->from, NULL, d->pipe[1], NULL,
+                               TUNNEL_PIPE_SIZE - d->queued, flags);
+            if (n > 0) {
+                d->queued += (size_t)n;
+                progress = true;
+            } else if (n == 0) {
+                d->eof = true;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                return -1;
+            }
+        }
+        if (d->queued > 0) {
+            ssize_t n = splice(d->pipe[0], NULL, d->to, NULL, d->queued,
+                               flags);
+            if (n > 0) {
+                d->queued -= (size_t)n;
+                delivered += n;
+                progress = true;
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                return -1;
+            }
+        }
+    }
+
+    /* Pass on a half-close once everything before it is delivered */
+    if (d->eof && d->queued == 0 && !d->shut) {
+        shutdown(d->to, SHUT_WR);
+        d->shut = true;
+    }
+    return delivered;
+}
+
+/* tunnel_add - Start watching a new tunnel's sockets */
+static void tunnel_add(tunnel_t *t) {
+    deadline_start(&t->idle, t->dir[0].from, SHUT_RDWR, DEADLINE_TUNNEL);
+    metrics_add(METRIC_TUNNELS_ACTIVE, 1);
+
+    for (int i = 0; i < 2; i++) {
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = &t->dir[i]};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->dir[i].from, &ev) < 0) {
+            tunnel_free(t, true);
+            return;
+        }
+    }
+}
+
+/* tunnel_event - Something happened on one of a tunnel's sockets */
+static void tunnel_event(tunnel_t *t) {
+    if (deadline_fired(&t->idle)) {
+        tunnel_free(t, true);
+        return;
+    }
+
+    ssize_t up = pump(&t->dir[0]);
+    ssize_t down = pump(&t->dir[1]);
+    if (up < 0 || down < 0 || (t->dir[0].shut && t->dir[1].shut)) {
+        tunnel_free(t, true);
+        return;
+    }
+    if (up > 0 || down > 0) {
+        metrics_add(METRIC_TUNNEL_BYTES, up + down);
+        deadline_rearm(&t->idle, DEADLINE_TUNNEL);
+    }
+}
+
+/* add_pending - Take over the tunnels handed to us since the last time */
+static void add_pending(void) {
+    uint64_t count;
+    ssize_t rc = read(wakefd, &count, sizeof(count));
+    (void)rc;
+
+    pthread_mutex_lock(&pending_lock);
+    tunnel_t *list = pending;
+    pending = NULL;
+    pthread_mutex_unlock(&pending_lock);
+    while (list != NULL) {
+        tunnel_t *t = list;
+        list = t->next;
+        tunnel_add(t);
+    }
+}
+
+/* pump_thread - Serve every tunnel */
+static void *pump_thread(void *vargp) {
+    struct epoll_event events[TUNNEL_EVENTS];
+    (void)vargp;
+
+    while (true) {
+        int n = epoll_wait(epfd, events, TUNNEL_EVENTS, -1);
+
+        /*
+         * Both sockets of a tunnel may report events in the same batch, so
+         * each tunnel is served once, and later events for it are dropped
+         * in case serving it closed it.
+         */
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &wakefd) {
+                add_pending();
+                continue;
+            }
+            direction_t *d = events[i].data.ptr;
+            if (d == NULL) {
+                continue;
+            }
+            for (int j = i + 1; j < n; j++) {
+                direction_t *other = events[j].data.ptr;
+                if (other != (void *)&wakefd && other != NULL &&
+                    other->t == d->t) {
+                    events[j].data.ptr = NULL;
+                }
+            }
+            tunnel_event(d->t);
+        }
+    }
+    return NULL;
+}
+
+void tunnel_init(void) {
+    pthread_t tid;
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("tunnel_init");
+        exit(1);
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &wakefd};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) < 0) {
+        perror("tunnel_init");
+        exit(1);
+    }
+    pthread_create(&tid, NULL, pump_thread, NULL);
+}
+
+int tunnel_start(int clientfd, int serverfd) {
+    tunnel_t *t = Malloc(sizeof(tunnel_t));
+
+    metrics_inc(METRIC_TUNNELS);
+    t->dir[0].from = clientfd;
+    t->dir[1].from = serverfd;
+    t->dir[0].pipe[0] = t->dir[1].pipe[0] = -1;
+    if (direction_init(t, &t->dir[0], clientfd, serverfd) < 0 ||
+        direction_init(t, &t->dir[1], serverfd, clientfd) < 0 ||
+        fcntl(clientfd, F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(serverfd, F_SETFL, O_NONBLOCK) < 0) {
+        tunnel_free(t, false);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pending_lock);
+    t->next = pending;
+    pending = t;
+    pthread_mutex_unlock(&pending_lock);
+
+    uint64_t one = 1;
+    ssize_t rc = write(wakefd, &one, sizeof(one));
+    (void)rc; /* Only fails if the counter is saturated: still a wakeup */
+    return 0;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file tunnel.h
+ * @brief Byte pump for CONNECT tunnels
+ *
+ * Once a CONNECT has been answered, or an origin has agreed to an Upgrade
+ * (a WebSocket handshake, say), the proxy hands the client and origin
+ * sockets to the pump and forgets about them. A single thread serves every
+ * tunnel: it waits on all the sockets with epoll and moves bytes in both
+ * directions with splice(), through a pipe per direction, so the data never
+ * passes through user space.
+ *
+ * When one side finishes sending (half-close), the other side's write half
+ * is shut down once everything it was sent has been delivered, and bytes
+ * keep flowing the other way. The tunnel closes when both directions are
+ * finished, on an error on either socket, or when neither side has sent
+ * anything for the tunnel deadline (-t tunnel=ms).
+ */
+
+#ifndef __TUNNEL_H__
+#define __TUNNEL_H__
+
+#define TUNNEL_PIPE_SIZE (256 * 1024) // Bytes buffered per direction
+#define TUNNEL_EVENTS 64              // Events handled per wakeup
+
+/**
+ * @brief Start the pump thread
+ */
+void tunnel_init(void);
+
+/**
+ * @brief Hand a pair of connected sockets to the pump
+ *
+ * The pump owns both sockets from then on, even if this fails.
+ *
+ * @param[in] clientfd The client's socket
+ * @param[in] serverfd The origin's socket
+ *
+ * @return 0 on success, -1 if the tunnel could not be set up
+ */
+int tunnel_start(int clientfd, int serverfd);
+
+#endif /* __TUNNEL_H__ */